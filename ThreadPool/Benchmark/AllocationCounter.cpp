@@ -0,0 +1,95 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Replaces the global allocation functions to count every heap
+//                allocation the benchmark makes. Kept in its own file so the
+//                compiler can't inline them into the code that calls them.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#include "AllocationCounter.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+std::atomic<size_t> g_numAllocations{ 0 };
+
+void* operator new(size_t size)
+{
+	g_numAllocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* memory = std::malloc(size ? size : 1))
+		return memory;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	operator delete(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	operator delete(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept
+{
+	operator delete(memory);
+}
+
+#ifdef __cpp_aligned_new
+// Over-aligned allocations are counted too. The block is aligned by hand,
+// with the pointer malloc returned stored just before it.
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	size_t align = std::max(static_cast<size_t>(alignment), sizeof(void*));
+	void* memory = operator new(sizeof(void*) + align - 1 + size);
+	uintptr_t address = (reinterpret_cast<uintptr_t>(memory) + sizeof(void*) + align - 1) & ~static_cast<uintptr_t>(align - 1);
+	reinterpret_cast<void**>(address)[-1] = memory;
+	return reinterpret_cast<void*>(address);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept
+{
+	if (memory)
+		operator delete(static_cast<void**>(memory)[-1]);
+}
+
+void operator delete[](void* memory, std::align_val_t alignment) noexcept
+{
+	operator delete(memory, alignment);
+}
+
+void operator delete(void* memory, size_t, std::align_val_t alignment) noexcept
+{
+	operator delete(memory, alignment);
+}
+
+void operator delete[](void* memory, size_t, std::align_val_t alignment) noexcept
+{
+	operator delete(memory, alignment);
+}
+#endif
@@ -0,0 +1,22 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Replaces the global allocation functions to count every heap
+//                allocation the benchmark makes. Kept in its own file so the
+//                compiler can't inline them into the code that calls them.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Number of global heap allocations made by the process so far
+extern std::atomic<size_t> g_numAllocations;
@@ -0,0 +1,304 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Headless benchmarks for the thread pool.
+//                Runs the workload suite across thread counts and reports it as CSV
+//                or JSON, or counts global heap allocations made per submitted task.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#include "ThreadPool.h"
+#include "AllocationCounter.h"
+#include "BenchmarkSuite.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <sstream>
+#include <vector>
+
+// Number of regions submitted per frame by the main application
+const size_t g_kTasksPerRound = 256;
+const size_t g_kWarmupRounds = 16;
+const size_t g_kMeasuredRounds = 256;
+
+// Same signature as processRegion in the main application
+void processRegion(unsigned int texture, size_t regionStartX, size_t regionStartY, size_t width, size_t height)
+{
+	static std::atomic<size_t> s_sink{ 0 };
+	s_sink.fetch_add(texture + regionStartX + regionStartY + width + height, std::memory_order_relaxed);
+}
+
+// The submission path the thread pool used before tasks were allocation free:
+// a shared packaged_task bound into a std::function, stored in a std::queue.
+class LegacyWorkQueue
+{
+public:
+	template<typename Callable, typename... Args>
+	std::future<std::result_of_t<Callable(Args...)>> submit(Callable&& workItem, Args&&... args)
+	{
+		using ResultT = std::result_of_t<Callable(Args...)>;
+		using TaskT = std::packaged_task<ResultT(Args...)>;
+
+		auto task = std::make_shared<TaskT>(std::forward<Callable>(workItem));
+		std::future<ResultT> future = task->get_future();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_workQueue.push(std::bind([](const std::shared_ptr<TaskT>& task, InvokeTypeT<Args>... args) {
+			(*task)(args...);
+		}, std::move(task), std::forward<Args>(args)...));
+
+		return future;
+	}
+
+	// Runs every queued item on the calling thread
+	void runAll()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		while (!m_workQueue.empty()) {
+			m_workQueue.front()();
+			m_workQueue.pop();
+		}
+	}
+
+private:
+	std::queue<std::function<void()>> m_workQueue;
+	std::mutex m_mutex;
+};
+
+struct Result {
+	double allocationsPerSubmit;
+	double nanosecondsPerSubmit;
+};
+
+// Submits rounds of regions through the legacy path and runs them inline
+Result benchmarkLegacySubmit()
+{
+	LegacyWorkQueue workQueue;
+	std::vector<std::future<void>> futures;
+	futures.reserve(g_kTasksPerRound);
+
+	size_t numAllocations = 0;
+	std::chrono::nanoseconds submitTime{ 0 };
+	for (size_t round = 0; round < g_kWarmupRounds + g_kMeasuredRounds; ++round) {
+		size_t allocationsBefore = g_numAllocations.load();
+		auto start = std::chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < g_kTasksPerRound; ++i)
+			futures.push_back(workQueue.submit(processRegion, 0u, i, i, size_t{ 64 }, size_t{ 64 }));
+		auto end = std::chrono::high_resolution_clock::now();
+
+		workQueue.runAll();
+		futures.clear();
+
+		if (round >= g_kWarmupRounds) {
+			numAllocations += g_numAllocations.load() - allocationsBefore;
+			submitTime += end - start;
+		}
+	}
+
+	double numSubmits = static_cast<double>(g_kTasksPerRound * g_kMeasuredRounds);
+	return { numAllocations / numSubmits, submitTime.count() / numSubmits };
+}
+
+// Submits rounds of regions to a running thread pool and waits for them
+Result benchmarkThreadPoolSubmit(SchedulerMode schedulerMode, QueueType queueType)
+{
+	ThreadPool threadPool;
+	threadPool.setSchedulerMode(schedulerMode);
+	threadPool.setQueueType(queueType);
+	threadPool.start();
+
+	std::vector<Future<void>> futures;
+	futures.reserve(g_kTasksPerRound);
+
+	size_t numAllocations = 0;
+	std::chrono::nanoseconds submitTime{ 0 };
+	for (size_t round = 0; round < g_kWarmupRounds + g_kMeasuredRounds; ++round) {
+		size_t allocationsBefore = g_numAllocations.load();
+		auto start = std::chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < g_kTasksPerRound; ++i)
+			futures.push_back(threadPool.submit(processRegion, 0u, i, i, size_t{ 64 }, size_t{ 64 }));
+		auto end = std::chrono::high_resolution_clock::now();
+
+		for (auto& future : futures)
+			future.wait();
+		futures.clear();
+
+		if (round >= g_kWarmupRounds) {
+			numAllocations += g_numAllocations.load() - allocationsBefore;
+			submitTime += end - start;
+		}
+	}
+
+	double numSubmits = static_cast<double>(g_kTasksPerRound * g_kMeasuredRounds);
+	return { numAllocations / numSubmits, submitTime.count() / numSubmits };
+}
+
+void printResult(const char* name, const Result& result)
+{
+	std::printf("%-40s %20.2f %16.1f\n", name, result.allocationsPerSubmit, result.nanosecondsPerSubmit);
+}
+
+// Compares allocations and submit time of the old and current submission paths
+void runAllocationBenchmarks()
+{
+	std::printf("%-40s %20s %16s\n", "Submission path", "Allocations/submit", "ns/submit");
+	printResult("packaged_task + std::function (before)", benchmarkLegacySubmit());
+	printResult("ThreadPool::submit, locking queue", benchmarkThreadPoolSubmit(SchedulerMode::SharedQueue, QueueType::Locking));
+	printResult("ThreadPool::submit, lock free queue", benchmarkThreadPoolSubmit(SchedulerMode::SharedQueue, QueueType::LockFree));
+	printResult("ThreadPool::submit, work stealing", benchmarkThreadPoolSubmit(SchedulerMode::WorkStealing, QueueType::Locking));
+}
+
+void printUsage()
+{
+	std::cerr << "Usage: Benchmark [options]\n"
+	          << "  --format csv|json      Output format, csv by default\n"
+	          << "  --output FILE          Write results to FILE instead of stdout\n"
+	          << "  --threads LIST         Thread counts such as 1-4,8, powers of two up to the CPU count by default\n"
+	          << "  --workloads NAMES      Comma separated, from:";
+	for (const std::string& name : BenchmarkSuite::workloadNames())
+		std::cerr << ' ' << name;
+	std::cerr << "\n  --variants NAMES       Comma separated, from:";
+	for (const PoolVariant& variant : BenchmarkSuite::allVariants())
+		std::cerr << ' ' << variant.name;
+	std::cerr << "\n  --repeat N             Runs per measurement, the median is reported (3)\n"
+	          << "  --scale X              Multiplies the number of tasks of every workload (1)\n"
+	          << "  --producers N          Submitting threads in the multiProducer workload (4)\n"
+	          << "  --bulk N               Most tasks a thread takes from a shared queue at once (1)\n"
+	          << "  --allocations          Count heap allocations per submit instead\n";
+}
+
+std::vector<std::string> splitList(const std::string& list)
+{
+	std::vector<std::string> items;
+	std::istringstream listStream(list);
+	std::string item;
+	while (std::getline(listStream, item, ','))
+		items.push_back(item);
+	return items;
+}
+
+// Parses a number greater than zero, returns false if value isn't one
+template<typename T>
+bool parsePositive(const std::string& value, T& number)
+{
+	std::istringstream valueStream(value);
+	T parsed;
+	if (!(valueStream >> parsed) || !valueStream.eof() || !(parsed > 0))
+		return false;
+	number = parsed;
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	SuiteOptions options;
+	options.workloads = BenchmarkSuite::workloadNames();
+	options.variants = BenchmarkSuite::allVariants();
+	options.threadCounts = BenchmarkSuite::defaultThreadCounts();
+	std::string format = "csv";
+	std::string outputPath;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string option = argv[i];
+		if (option == "--allocations") {
+			runAllocationBenchmarks();
+			return EXIT_SUCCESS;
+		}
+		if (option == "--help") {
+			printUsage();
+			return EXIT_SUCCESS;
+		}
+		if (i + 1 >= argc) {
+			printUsage();
+			return EXIT_FAILURE;
+		}
+		std::string value = argv[++i];
+
+		bool valid = true;
+		if (option == "--format") {
+			format = value;
+			valid = format == "csv" || format == "json";
+		}
+		else if (option == "--output") {
+			outputPath = value;
+		}
+		else if (option == "--threads") {
+			std::vector<unsigned int> threadCounts;
+			valid = CpuTopology::parseCpuList(value, threadCounts);
+			options.threadCounts.assign(threadCounts.begin(), threadCounts.end());
+			valid = valid && std::find(threadCounts.begin(), threadCounts.end(), 0u) == threadCounts.end();
+		}
+		else if (option == "--workloads") {
+			options.workloads = splitList(value);
+		}
+		else if (option == "--variants") {
+			options.variants.clear();
+			for (const std::string& name : splitList(value)) {
+				const auto& variants = BenchmarkSuite::allVariants();
+				auto found = std::find_if(variants.begin(), variants.end(), [&name](const PoolVariant& variant) {
+					return variant.name == name;
+				});
+				valid = valid && found != variants.end();
+				if (found != variants.end())
+					options.variants.push_back(*found);
+			}
+		}
+		else if (option == "--repeat") {
+			valid = parsePositive(value, options.repetitions);
+		}
+		else if (option == "--scale") {
+			valid = parsePositive(value, options.scale);
+		}
+		else if (option == "--producers") {
+			valid = parsePositive(value, options.numProducers);
+		}
+		else if (option == "--bulk") {
+			valid = parsePositive(value, options.maxBulkPop);
+		}
+		else {
+			valid = false;
+		}
+
+		if (!valid) {
+			std::cerr << "Invalid option " << option << " " << value << "\n";
+			printUsage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::vector<SuiteResult> results = BenchmarkSuite::run(options, std::cerr);
+
+	std::ofstream outputFile;
+	if (!outputPath.empty()) {
+		outputFile.open(outputPath);
+		if (!outputFile) {
+			std::cerr << "Failed to open " << outputPath << "\n";
+			return EXIT_FAILURE;
+		}
+	}
+	std::ostream& out = outputPath.empty() ? std::cout : outputFile;
+	if (format == "json")
+		BenchmarkSuite::writeJson(out, results);
+	else
+		BenchmarkSuite::writeCsv(out, results);
+	return EXIT_SUCCESS;
+}
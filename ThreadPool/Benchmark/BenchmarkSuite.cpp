@@ -0,0 +1,378 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Microbenchmark workloads for comparing thread pool schedulers
+//                and queues across thread counts, with CSV and JSON reports.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+//Library Includes
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+//This Include
+#include "BenchmarkSuite.h"
+
+namespace {
+	// Tasks per round of the empty workload, the number of regions the fractal submits
+	const size_t g_kTasksPerRound = 256;
+	const size_t g_kEmptyRounds = 200;
+	const size_t g_kStormTasks = 100000;
+	const size_t g_kForkJoinDepth = 12;
+	const size_t g_kSkewedTasks = 20000;
+	const size_t g_kMultiProducerTasks = 100000;
+
+	// Timings of a single run of a workload
+	struct WorkloadRun {
+		uint64_t elapsedNs = 0;
+		// Submit to start latency of every task
+		std::vector<uint64_t> latencies;
+	};
+
+	// Counts down as tasks finish, and becomes ready when they all have
+	class Latch
+	{
+	public:
+		Latch(size_t count) : m_count(count) {}
+
+		void countDown()
+		{
+			if (m_count.fetch_sub(1, std::memory_order_acq_rel) != 1)
+				return;
+			// Notified under the lock, as the waiter may destroy the latch as soon as it can take it
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_done = true;
+			m_ready.notify_all();
+		}
+
+		void wait()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_ready.wait(lock, [this] { return m_done; });
+		}
+
+	private:
+		std::atomic<size_t> m_count;
+		std::mutex m_mutex;
+		std::condition_variable m_ready;
+		bool m_done = false;
+	};
+
+	size_t scaled(size_t count, double scale)
+	{
+		return std::max<size_t>(1, static_cast<size_t>(count * scale));
+	}
+
+	void spinFor(uint64_t durationNs)
+	{
+		uint64_t end = nowNs() + durationNs;
+		while (nowNs() < end) {}
+	}
+
+	WorkloadRun runEmpty(ThreadPool& threadPool, const SuiteOptions& options)
+	{
+		size_t numRounds = scaled(g_kEmptyRounds, options.scale);
+		WorkloadRun run;
+		run.latencies.resize(numRounds * g_kTasksPerRound);
+		uint64_t* latencies = run.latencies.data();
+
+		std::vector<Future<void>> futures;
+		futures.reserve(g_kTasksPerRound);
+		uint64_t start = nowNs();
+		for (size_t round = 0; round < numRounds; ++round) {
+			for (size_t i = 0; i < g_kTasksPerRound; ++i) {
+				uint64_t* latency = latencies + round * g_kTasksPerRound + i;
+				uint64_t submitted = nowNs();
+				futures.push_back(threadPool.submit([latency, submitted]() { *latency = nowNs() - submitted; }));
+			}
+			for (auto& future : futures)
+				future.wait();
+			futures.clear();
+		}
+		run.elapsedNs = nowNs() - start;
+		return run;
+	}
+
+	// Submits numTasks empty tasks from the calling thread, writing their latencies from firstLatency on
+	void submitFlood(ThreadPool& threadPool, size_t numTasks, uint64_t* firstLatency, Latch& latch)
+	{
+		for (size_t i = 0; i < numTasks; ++i) {
+			uint64_t* latency = firstLatency + i;
+			uint64_t submitted = nowNs();
+			threadPool.submit([latency, submitted, &latch]() {
+				*latency = nowNs() - submitted;
+				latch.countDown();
+			});
+		}
+	}
+
+	WorkloadRun runStorm(ThreadPool& threadPool, const SuiteOptions& options)
+	{
+		size_t numTasks = scaled(g_kStormTasks, options.scale);
+		WorkloadRun run;
+		run.latencies.resize(numTasks);
+		Latch latch(numTasks);
+
+		uint64_t start = nowNs();
+		submitFlood(threadPool, numTasks, run.latencies.data(), latch);
+		latch.wait();
+		run.elapsedNs = nowNs() - start;
+		return run;
+	}
+
+	// Runs node of a complete binary tree (numbered as a heap), submitting and waiting on its children
+	void forkJoinNode(ThreadPool& threadPool, size_t node, size_t depth, uint64_t submitted, uint64_t* latencies)
+	{
+		latencies[node] = nowNs() - submitted;
+		if (depth == 0)
+			return;
+
+		Future<void> left = threadPool.submit([&threadPool, node, depth, latencies, now = nowNs()]() {
+			forkJoinNode(threadPool, 2 * node + 1, depth - 1, now, latencies);
+		});
+		Future<void> right = threadPool.submit([&threadPool, node, depth, latencies, now = nowNs()]() {
+			forkJoinNode(threadPool, 2 * node + 2, depth - 1, now, latencies);
+		});
+		threadPool.wait(left);
+		threadPool.wait(right);
+	}
+
+	WorkloadRun runForkJoin(ThreadPool& threadPool, const SuiteOptions& options)
+	{
+		// Scaling the task count by two adds a level to the tree
+		double extraLevels = std::round(std::log2(std::max(options.scale, 1.0 / 1024)));
+		size_t depth = static_cast<size_t>(std::max(1.0, g_kForkJoinDepth + extraLevels));
+		WorkloadRun run;
+		run.latencies.resize((size_t{ 1 } << (depth + 1)) - 1);
+		uint64_t* latencies = run.latencies.data();
+
+		uint64_t start = nowNs();
+		threadPool.submit([&threadPool, depth, latencies, start]() {
+			forkJoinNode(threadPool, 0, depth, start, latencies);
+		}).wait();
+		run.elapsedNs = nowNs() - start;
+		return run;
+	}
+
+	// About 1 task in 100 runs for 100us, 1 in 10 for 5us and the rest for 500ns
+	uint64_t skewedDuration(size_t taskIdx)
+	{
+		// Scramble the index so long tasks don't arrive at regular intervals
+		uint32_t hash = static_cast<uint32_t>(taskIdx) * 2654435761u;
+		hash ^= hash >> 16;
+		uint32_t bucket = hash % 100;
+		if (bucket == 0)
+			return 100000;
+		if (bucket < 10)
+			return 5000;
+		return 500;
+	}
+
+	WorkloadRun runSkewed(ThreadPool& threadPool, const SuiteOptions& options)
+	{
+		size_t numTasks = scaled(g_kSkewedTasks, options.scale);
+		WorkloadRun run;
+		run.latencies.resize(numTasks);
+		uint64_t* latencies = run.latencies.data();
+		Latch latch(numTasks);
+
+		uint64_t start = nowNs();
+		for (size_t i = 0; i < numTasks; ++i) {
+			uint64_t submitted = nowNs();
+			threadPool.submit([latencies, i, submitted, &latch]() {
+				latencies[i] = nowNs() - submitted;
+				spinFor(skewedDuration(i));
+				latch.countDown();
+			});
+		}
+		latch.wait();
+		run.elapsedNs = nowNs() - start;
+		return run;
+	}
+
+	WorkloadRun runMultiProducer(ThreadPool& threadPool, const SuiteOptions& options)
+	{
+		size_t numProducers = std::max<size_t>(options.numProducers, 1);
+		size_t tasksPerProducer = scaled(g_kMultiProducerTasks, options.scale) / numProducers + 1;
+		WorkloadRun run;
+		run.latencies.resize(tasksPerProducer * numProducers);
+		Latch latch(run.latencies.size());
+
+		// The producers start together, so the time includes any of them being slow to start
+		std::atomic_bool go{ false };
+		std::vector<std::thread> producers;
+		for (size_t i = 0; i < numProducers; ++i) {
+			uint64_t* firstLatency = run.latencies.data() + i * tasksPerProducer;
+			producers.emplace_back([&threadPool, tasksPerProducer, firstLatency, &latch, &go]() {
+				while (!go.load(std::memory_order_acquire))
+					std::this_thread::yield();
+				submitFlood(threadPool, tasksPerProducer, firstLatency, latch);
+			});
+		}
+
+		uint64_t start = nowNs();
+		go.store(true, std::memory_order_release);
+		for (auto& producer : producers)
+			producer.join();
+		latch.wait();
+		run.elapsedNs = nowNs() - start;
+		return run;
+	}
+
+	using WorkloadFn = WorkloadRun(*)(ThreadPool&, const SuiteOptions&);
+
+	WorkloadFn findWorkload(const std::string& name)
+	{
+		static const std::map<std::string, WorkloadFn> s_workloads = {
+			{ "empty", runEmpty },
+			{ "storm", runStorm },
+			{ "forkJoin", runForkJoin },
+			{ "skewed", runSkewed },
+			{ "multiProducer", runMultiProducer },
+		};
+		auto found = s_workloads.find(name);
+		return found != s_workloads.end() ? found->second : nullptr;
+	}
+
+	// Returns the latency that a fraction p of the sorted latencies are at or below
+	uint64_t percentile(const std::vector<uint64_t>& sortedLatencies, double p)
+	{
+		if (sortedLatencies.empty())
+			return 0;
+		size_t index = static_cast<size_t>(p * sortedLatencies.size());
+		return sortedLatencies[std::min(index, sortedLatencies.size() - 1)];
+	}
+
+	// Runs a workload several times after a warm up, and reports the run with the median time
+	SuiteResult measure(ThreadPool& threadPool, const std::string& workload, const SuiteOptions& options)
+	{
+		WorkloadFn workloadFn = findWorkload(workload);
+		workloadFn(threadPool, options);
+
+		std::vector<WorkloadRun> runs;
+		for (size_t i = 0; i < std::max<size_t>(options.repetitions, 1); ++i)
+			runs.push_back(workloadFn(threadPool, options));
+		std::sort(runs.begin(), runs.end(), [](const WorkloadRun& a, const WorkloadRun& b) {
+			return a.elapsedNs < b.elapsedNs;
+		});
+		WorkloadRun& median = runs[runs.size() / 2];
+		std::sort(median.latencies.begin(), median.latencies.end());
+
+		SuiteResult result;
+		result.workload = workload;
+		result.numThreads = threadPool.getNumThreads();
+		result.numTasks = median.latencies.size();
+		result.seconds = median.elapsedNs / 1e9;
+		result.throughput = result.seconds > 0 ? result.numTasks / result.seconds : 0;
+		result.p50Ns = percentile(median.latencies, 0.5);
+		result.p99Ns = percentile(median.latencies, 0.99);
+		result.p999Ns = percentile(median.latencies, 0.999);
+		return result;
+	}
+
+	// Compares each result to the same workload and variant on the fewest threads
+	void computeEfficiency(std::vector<SuiteResult>& results)
+	{
+		for (SuiteResult& result : results) {
+			const SuiteResult* baseline = &result;
+			for (const SuiteResult& other : results) {
+				if (other.workload == result.workload && other.variant == result.variant && other.numThreads < baseline->numThreads)
+					baseline = &other;
+			}
+			if (baseline->throughput > 0) {
+				double speedup = result.throughput / baseline->throughput;
+				result.efficiency = speedup * baseline->numThreads / result.numThreads;
+			}
+		}
+	}
+}
+
+const std::vector<std::string>& BenchmarkSuite::workloadNames()
+{
+	static const std::vector<std::string> s_names = { "empty", "storm", "forkJoin", "skewed", "multiProducer" };
+	return s_names;
+}
+
+const std::vector<PoolVariant>& BenchmarkSuite::allVariants()
+{
+	static const std::vector<PoolVariant> s_variants = {
+		{ "shared-locking", SchedulerMode::SharedQueue, QueueType::Locking },
+		{ "shared-lockFree", SchedulerMode::SharedQueue, QueueType::LockFree },
+		{ "workStealing-locking", SchedulerMode::WorkStealing, QueueType::Locking },
+		{ "workStealing-lockFree", SchedulerMode::WorkStealing, QueueType::LockFree },
+	};
+	return s_variants;
+}
+
+std::vector<size_t> BenchmarkSuite::defaultThreadCounts()
+{
+	size_t numHardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	std::vector<size_t> threadCounts;
+	for (size_t numThreads = 1; numThreads < numHardwareThreads; numThreads *= 2)
+		threadCounts.push_back(numThreads);
+	threadCounts.push_back(numHardwareThreads);
+	return threadCounts;
+}
+
+std::vector<SuiteResult> BenchmarkSuite::run(const SuiteOptions& options, std::ostream& log)
+{
+	std::vector<SuiteResult> results;
+	for (size_t numThreads : options.threadCounts) {
+		for (const PoolVariant& variant : options.variants) {
+			ThreadPool threadPool(numThreads);
+			threadPool.setSchedulerMode(variant.schedulerMode);
+			threadPool.setQueueType(variant.queueType);
+			threadPool.setMaxBulkPop(options.maxBulkPop);
+			threadPool.start();
+
+			for (const std::string& workload : options.workloads) {
+				if (!findWorkload(workload)) {
+					log << "Unknown workload " << workload << std::endl;
+					continue;
+				}
+				log << workload << ", " << variant.name << ", " << numThreads << " threads" << std::endl;
+				results.push_back(measure(threadPool, workload, options));
+				results.back().variant = variant.name;
+			}
+		}
+	}
+	computeEfficiency(results);
+	return results;
+}
+
+void BenchmarkSuite::writeCsv(std::ostream& out, const std::vector<SuiteResult>& results)
+{
+	out << "workload,variant,threads,tasks,seconds,throughput,p50Ns,p99Ns,p999Ns,efficiency\n";
+	for (const SuiteResult& result : results) {
+		out << result.workload << ',' << result.variant << ',' << result.numThreads << ',' << result.numTasks << ','
+		    << result.seconds << ',' << result.throughput << ','
+		    << result.p50Ns << ',' << result.p99Ns << ',' << result.p999Ns << ',' << result.efficiency << '\n';
+	}
+}
+
+void BenchmarkSuite::writeJson(std::ostream& out, const std::vector<SuiteResult>& results)
+{
+	// Names are made of letters and dashes, so they need no escaping
+	out << "{\n  \"results\": [";
+	for (size_t i = 0; i < results.size(); ++i) {
+		const SuiteResult& result = results[i];
+		out << (i > 0 ? ",\n" : "\n")
+		    << "    { \"workload\": \"" << result.workload << "\", \"variant\": \"" << result.variant << "\""
+		    << ", \"threads\": " << result.numThreads << ", \"tasks\": " << result.numTasks
+		    << ", \"seconds\": " << result.seconds << ", \"throughput\": " << result.throughput
+		    << ", \"p50Ns\": " << result.p50Ns << ", \"p99Ns\": " << result.p99Ns << ", \"p999Ns\": " << result.p999Ns
+		    << ", \"efficiency\": " << result.efficiency << " }";
+	}
+	out << "\n  ]\n}\n";
+}
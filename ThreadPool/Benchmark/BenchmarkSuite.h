@@ -0,0 +1,85 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Microbenchmark workloads for comparing thread pool schedulers
+//                and queues across thread counts, with CSV and JSON reports.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// A scheduler and queue combination to benchmark
+struct PoolVariant {
+	std::string name;
+	SchedulerMode schedulerMode;
+	QueueType queueType;
+};
+
+// What to run, usually set from the command line
+struct SuiteOptions {
+	// Names of the workloads to run, see BenchmarkSuite::workloadNames
+	std::vector<std::string> workloads;
+	std::vector<PoolVariant> variants;
+	std::vector<size_t> threadCounts;
+	// Each measurement is repeated and the run with the median time is reported
+	size_t repetitions = 3;
+	// Multiplies the number of tasks of every workload
+	double scale = 1;
+	// Threads submitting at the same time in the multiProducer workload
+	size_t numProducers = 4;
+	// See ThreadPool::setMaxBulkPop
+	size_t maxBulkPop = 1;
+};
+
+// The measurements of one workload on one pool configuration
+struct SuiteResult {
+	std::string workload;
+	std::string variant;
+	size_t numThreads = 0;
+	size_t numTasks = 0;
+	double seconds = 0;
+	// Tasks completed per second
+	double throughput = 0;
+	// Time from a task being submitted to it starting, in nanoseconds
+	uint64_t p50Ns = 0;
+	uint64_t p99Ns = 0;
+	uint64_t p999Ns = 0;
+	// Speedup over the fewest threads measured, divided by the increase in threads.
+	// 1 is perfect scaling.
+	double efficiency = 0;
+};
+
+namespace BenchmarkSuite {
+	// Returns every workload, in the order they are run:
+	//   empty         rounds of empty tasks, each round is waited on (pure overhead)
+	//   storm         one thread submits a flood of empty tasks without waiting
+	//   forkJoin      a binary tree of tasks where every task submits and waits on two children
+	//   skewed        tasks where a few take far longer than the rest
+	//   multiProducer several threads outside the pool submit floods at the same time
+	const std::vector<std::string>& workloadNames();
+
+	// Returns every scheduler and queue combination
+	const std::vector<PoolVariant>& allVariants();
+
+	// Returns powers of two up to the number of hardware threads, and that number itself
+	std::vector<size_t> defaultThreadCounts();
+
+	// Runs every workload on every variant and thread count. Progress is written to log.
+	std::vector<SuiteResult> run(const SuiteOptions& options, std::ostream& log);
+
+	void writeCsv(std::ostream& out, const std::vector<SuiteResult>& results);
+	void writeJson(std::ostream& out, const std::vector<SuiteResult>& results);
+}
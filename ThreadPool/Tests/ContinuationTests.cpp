@@ -0,0 +1,336 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Checks continuations run in order once their antecedents are
+//                ready, that exceptions reach the futures waiting on them
+//                through then, whenAll, whenAny and task graphs, and that
+//                graphs with a cycle are rejected.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#include "Tests.h"
+#include "FutureUtils.h"
+#include "TaskGraph.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace
+{
+	const SchedulerMode g_kModes[] = { SchedulerMode::SharedQueue, SchedulerMode::WorkStealing };
+
+	const char* modeName(SchedulerMode mode)
+	{
+		return mode == SchedulerMode::WorkStealing ? "work stealing" : "shared queue";
+	}
+
+	// Waits for the future and returns the message of the exception it holds, or
+	// an empty string if it holds a value
+	template<typename FutureT>
+	std::string errorOf(ThreadPool& pool, FutureT& future)
+	{
+		pool.wait(future);
+		try {
+			future.get();
+		}
+		catch (const std::exception& exception) {
+			return exception.what();
+		}
+		return std::string();
+	}
+
+	// Each continuation in a chain must run after the one before it, and be handed
+	// its antecedent ready with the value it returned
+	void checkThenChain(ThreadPool& pool, SchedulerMode mode)
+	{
+		const int kChainLength = 20;
+
+		std::mutex orderMutex;
+		std::vector<int> order;
+		Future<int> future = pool.submit([&orderMutex, &order] {
+			std::lock_guard<std::mutex> lock(orderMutex);
+			order.push_back(0);
+			return 1;
+		});
+		std::atomic<int> numUnready{ 0 };
+		for (int step = 1; step <= kChainLength; ++step) {
+			future = pool.then(std::move(future), [step, &orderMutex, &order, &numUnready](Future<int> antecedent) {
+				if (!antecedent.isReady())
+					++numUnready;
+				std::lock_guard<std::mutex> lock(orderMutex);
+				order.push_back(step);
+				return antecedent.get() * 2;
+			});
+		}
+
+		pool.wait(future);
+		int result = future.get();
+		bool inOrder = order.size() == kChainLength + 1;
+		for (size_t i = 0; inOrder && i < order.size(); ++i)
+			inOrder = order[i] == static_cast<int>(i);
+		TEST_CHECK(result == 1 << kChainLength && inOrder && numUnready == 0,
+		           modeName(mode) << ": a chain of " << kChainLength << " continuations gave " << result << ", ran "
+		           << (inOrder ? "in order" : "out of order") << " and was handed " << numUnready << " unready antecedents");
+
+		// A continuation of a future that is already ready still runs
+		Future<int> ready = pool.submit([] { return 5; });
+		pool.wait(ready);
+		Future<int> afterReady = pool.then(std::move(ready), [](Future<int> antecedent) { return antecedent.get() + 1; });
+		pool.wait(afterReady);
+		TEST_CHECK(afterReady.get() == 6, modeName(mode) << ": a continuation of a ready future didn't run");
+	}
+
+	// An exception passes down a chain of continuations that call get, and one
+	// thrown by a continuation ends up in its own future
+	void checkThenExceptions(ThreadPool& pool, SchedulerMode mode)
+	{
+		Future<int> failed = pool.submit([]() -> int { throw std::runtime_error("antecedent failed"); });
+		Future<int> first = pool.then(std::move(failed), [](Future<int> antecedent) { return antecedent.get() + 1; });
+		Future<int> second = pool.then(std::move(first), [](Future<int> antecedent) { return antecedent.get() + 1; });
+		std::string error = errorOf(pool, second);
+		TEST_CHECK(error == "antecedent failed", modeName(mode) << ": a chain ended in \"" << error << "\", not the antecedent's exception");
+
+		// A continuation can handle the exception instead
+		Future<int> handled = pool.then(pool.submit([]() -> int { throw std::runtime_error("handled"); }), [](Future<int> antecedent) {
+			try {
+				return antecedent.get();
+			}
+			catch (const std::runtime_error&) {
+				return -1;
+			}
+		});
+		pool.wait(handled);
+		TEST_CHECK(handled.get() == -1, modeName(mode) << ": a continuation couldn't catch its antecedent's exception");
+
+		Future<void> throwing = pool.then(pool.submit([] { return 1; }), [](Future<int>) { throw std::logic_error("continuation failed"); });
+		error = errorOf(pool, throwing);
+		TEST_CHECK(error == "continuation failed", modeName(mode) << ": a throwing continuation's future held \"" << error << "\"");
+	}
+
+	// A continuation of a batch runs once every task in it has, and sees the first
+	// exception any of them threw
+	void checkThenBatch(ThreadPool& pool, SchedulerMode mode)
+	{
+		const size_t kBatchSize = 200;
+
+		std::atomic<size_t> numRun{ 0 };
+		Future<size_t> counted = pool.then(pool.submitBatch(kBatchSize, [&numRun](size_t) { ++numRun; }), [&numRun](BatchFuture batch) {
+			batch.get();
+			return numRun.load();
+		});
+		pool.wait(counted);
+		size_t numSeen = counted.get();
+		TEST_CHECK(numSeen == kBatchSize, modeName(mode) << ": a batch's continuation ran after " << numSeen << " of its " << kBatchSize << " tasks");
+
+		Future<void> failed = pool.then(pool.submitBatch(kBatchSize, [](size_t i) {
+			if (i == kBatchSize / 2)
+				throw std::runtime_error("task failed");
+		}), [](BatchFuture batch) { batch.get(); });
+		std::string error = errorOf(pool, failed);
+		TEST_CHECK(error == "task failed", modeName(mode) << ": a failed batch's continuation saw \"" << error << "\"");
+	}
+
+	// whenAll is ready once every future is, with the futures in the order given,
+	// whichever finished first and whether or not they failed
+	void checkWhenAll(ThreadPool& pool, SchedulerMode mode)
+	{
+		const int kNumFutures = 16;
+		const int kFailing = 5;
+
+		std::vector<Future<int>> futures;
+		for (int i = 0; i < kNumFutures; ++i) {
+			futures.push_back(pool.submit([i] {
+				// Later futures finish first
+				std::this_thread::sleep_for(std::chrono::microseconds(100 * (kNumFutures - i)));
+				if (i == kFailing)
+					throw std::runtime_error("future failed");
+				return i;
+			}));
+		}
+		Future<std::vector<Future<int>>> all = whenAll(std::move(futures));
+		pool.wait(all);
+		std::vector<Future<int>> results = all.get();
+
+		size_t numWrong = 0;
+		for (int i = 0; i < kNumFutures && i < static_cast<int>(results.size()); ++i) {
+			if (!results[i].isReady())
+				++numWrong;
+			else if (i == kFailing)
+				numWrong += errorOf(pool, results[i]) == "future failed" ? 0 : 1;
+			else
+				numWrong += results[i].get() == i ? 0 : 1;
+		}
+		TEST_CHECK(results.size() == kNumFutures && numWrong == 0,
+		           modeName(mode) << ": whenAll gave " << results.size() << " futures, " << numWrong << " of them not ready or wrong");
+
+		Future<std::vector<BatchFuture>> noBatches = whenAll(std::vector<BatchFuture>());
+		TEST_CHECK(noBatches.isReady() && noBatches.get().empty(), modeName(mode) << ": whenAll of nothing wasn't ready straight away");
+	}
+
+	// whenAny is ready with the first future to finish, while the rest are held up
+	void checkWhenAny(ThreadPool& pool, SchedulerMode mode)
+	{
+		const size_t kNumFutures = 8;
+		const size_t kFirst = 6;
+
+		for (bool fail : { false, true }) {
+			// Only the first future comes from the pool, the others wait on promises
+			std::vector<Promise<size_t>> heldUp(kNumFutures);
+			std::vector<Future<size_t>> futures;
+			for (size_t i = 0; i < kNumFutures; ++i) {
+				if (i != kFirst) {
+					futures.push_back(heldUp[i].getFuture());
+					continue;
+				}
+				futures.push_back(pool.submit([fail] {
+					if (fail)
+						throw std::runtime_error("first failed");
+					return kFirst;
+				}));
+			}
+			Future<WhenAnyResult<Future<size_t>>> any = whenAny(std::move(futures));
+			pool.wait(any);
+			WhenAnyResult<Future<size_t>> first = any.get();
+			for (size_t i = 0; i < kNumFutures; ++i) {
+				if (i != kFirst)
+					heldUp[i].setValue(i);
+			}
+
+			bool right = first.index == kFirst && first.future.isReady();
+			if (right && fail)
+				right = errorOf(pool, first.future) == "first failed";
+			else if (right)
+				right = first.future.get() == kFirst;
+			TEST_CHECK(right, modeName(mode) << ": whenAny gave future " << first.index << ", not the " << (fail ? "failed " : "")
+			           << "future " << kFirst << " that finished first");
+		}
+
+		Future<WhenAnyResult<Future<int>>> none = whenAny(std::vector<Future<int>>());
+		TEST_CHECK(none.isReady() && !none.get().future.valid(), modeName(mode) << ": whenAny of nothing wasn't ready straight away");
+	}
+
+	// Builds a random graph whose edges all go from lower to higher IDs, so it has
+	// no cycles. Every node must run once, after all of its predecessors.
+	void checkGraphOrder(ThreadPool& pool, SchedulerMode mode)
+	{
+		const size_t kNumNodes = 200;
+		const size_t kMaxPredecessors = 4;
+
+		std::mt19937 rng(2468);
+		std::atomic<size_t> sequence{ 0 };
+		std::vector<size_t> ranAt(kNumNodes);
+		std::vector<std::vector<size_t>> predecessors(kNumNodes);
+		TaskGraph graph;
+		for (size_t i = 0; i < kNumNodes; ++i) {
+			graph.addNode([i, &sequence, &ranAt] { ranAt[i] = ++sequence; });
+			size_t numPredecessors = i == 0 ? 0 : rng() % (kMaxPredecessors + 1);
+			for (size_t j = 0; j < numPredecessors; ++j) {
+				size_t predecessor = rng() % i;
+				graph.addDependency(predecessor, i);
+				predecessors[i].push_back(predecessor);
+			}
+		}
+
+		// A graph can be run again once it has finished
+		for (int run = 0; run < 2; ++run) {
+			sequence = 0;
+			ranAt.assign(kNumNodes, 0);
+			Future<void> done = pool.run(graph);
+			std::string error = errorOf(pool, done);
+
+			size_t numWrong = 0;
+			for (size_t i = 0; i < kNumNodes; ++i) {
+				bool right = ranAt[i] != 0;
+				for (size_t predecessor : predecessors[i])
+					right = right && ranAt[predecessor] < ranAt[i];
+				numWrong += right ? 0 : 1;
+			}
+			TEST_CHECK(error.empty() && sequence == kNumNodes && numWrong == 0,
+			           modeName(mode) << ": run " << run << " of a graph of " << kNumNodes << " nodes ran " << sequence
+			           << ", " << numWrong << " before a predecessor or not at all" << (error.empty() ? "" : ", and threw ") << error);
+		}
+	}
+
+	// The first exception a node throws is rethrown by the graph's future, and
+	// the nodes after it never run
+	void checkGraphException(ThreadPool& pool, SchedulerMode mode)
+	{
+		std::atomic<int> numAfter{ 0 };
+		TaskGraph graph;
+		TaskGraph::NodeId root = graph.addNode([] {});
+		TaskGraph::NodeId failing = graph.addNode([] { throw std::runtime_error("node failed"); }, { root });
+		TaskGraph::NodeId after = graph.addNode([&numAfter] { ++numAfter; }, { failing });
+		graph.addNode([&numAfter] { ++numAfter; }, { after });
+
+		Future<void> done = pool.run(graph);
+		std::string error = errorOf(pool, done);
+		TEST_CHECK(error == "node failed" && numAfter == 0,
+		           modeName(mode) << ": a graph with a failing node threw \"" << error << "\" and ran " << numAfter << " nodes after it");
+	}
+
+	// A cycle would leave its nodes waiting on each other forever, so run must
+	// refuse the graph, whether or not the cycle can be reached from a root
+	void checkGraphCycles(ThreadPool& pool, SchedulerMode mode)
+	{
+		for (bool reachable : { true, false }) {
+			std::atomic<int> numRun{ 0 };
+			TaskGraph graph;
+			TaskGraph::NodeId root = graph.addNode([&numRun] { ++numRun; });
+			TaskGraph::NodeId a = graph.addNode([&numRun] { ++numRun; });
+			TaskGraph::NodeId b = graph.addNode([&numRun] { ++numRun; }, { a });
+			graph.addDependency(b, a);
+			if (reachable)
+				graph.addDependency(root, a);
+
+			bool rejected = false;
+			try {
+				pool.run(graph);
+			}
+			catch (const std::logic_error&) {
+				rejected = true;
+			}
+			TEST_CHECK(rejected && numRun == 0, modeName(mode) << ": a graph with a cycle " << (reachable ? "after" : "apart from")
+			           << " its root was " << (rejected ? "rejected" : "run") << " and " << numRun << " nodes ran");
+		}
+
+		// The pool and a fixed graph still work afterwards
+		std::atomic<int> numRun{ 0 };
+		TaskGraph graph;
+		graph.addNode([&numRun] { ++numRun; }, { graph.addNode([&numRun] { ++numRun; }) });
+		Future<void> done = pool.run(graph);
+		std::string error = errorOf(pool, done);
+		TEST_CHECK(error.empty() && numRun == 2, modeName(mode) << ": a graph run after a rejected one ran " << numRun << " of 2 nodes");
+	}
+}
+
+void runContinuationTests()
+{
+	for (SchedulerMode mode : g_kModes) {
+		ThreadPool pool(4);
+		pool.setSchedulerMode(mode);
+		pool.start();
+		checkThenChain(pool, mode);
+		checkThenExceptions(pool, mode);
+		checkThenBatch(pool, mode);
+		checkWhenAll(pool, mode);
+		checkWhenAny(pool, mode);
+		checkGraphOrder(pool, mode);
+		checkGraphException(pool, mode);
+		checkGraphCycles(pool, mode);
+		pool.stop();
+	}
+}
@@ -0,0 +1,239 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Checks coroutines resume on their own pool when a future is
+//                made ready from outside it, that AsyncTasks, futures and
+//                batches can be awaited many deep without blocking a thread,
+//                and that exceptions reach the coroutines awaiting them.
+//                Only built from C++20, see Coroutine.h.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#include "Tests.h"
+#include "ThreadPool.h"
+
+#if THREADPOOL_HAS_COROUTINES
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace
+{
+	const SchedulerMode g_kModes[] = { SchedulerMode::SharedQueue, SchedulerMode::WorkStealing };
+
+	const char* modeName(SchedulerMode mode)
+	{
+		return mode == SchedulerMode::WorkStealing ? "work stealing" : "shared queue";
+	}
+
+	// Waits for the future and returns the message of the exception it holds, or
+	// an empty string if it holds a value
+	template<typename T>
+	std::string errorOf(ThreadPool& pool, Future<T>& future)
+	{
+		pool.wait(future);
+		try {
+			future.get();
+		}
+		catch (const std::exception& exception) {
+			return exception.what();
+		}
+		return std::string();
+	}
+
+	// Records the thread it runs on before and after awaiting value
+	AsyncTask<int> awaitExternal(Future<int> value, std::atomic<bool>& suspending, std::thread::id& before, std::thread::id& after)
+	{
+		before = std::this_thread::get_id();
+		suspending = true;
+		int result = co_await std::move(value);
+		after = std::this_thread::get_id();
+		co_return result;
+	}
+
+	// A coroutine on a pool awaiting a promise kept by the main thread, or by another
+	// pool's thread, must go back to its own pool rather than run on the keeper's thread
+	void checkResumeOnPool(SchedulerMode mode)
+	{
+		// One thread, so the coroutine must resume on the thread it started on
+		ThreadPool pool(1);
+		pool.setSchedulerMode(mode);
+		pool.start();
+		ThreadPool other(1);
+		other.start();
+
+		for (bool fromOtherPool : { false, true }) {
+			const char* keeper = fromOtherPool ? "another pool" : "the main thread";
+
+			Promise<int> promise;
+			std::atomic<bool> suspending{ false };
+			std::thread::id before;
+			std::thread::id after;
+			Future<int> result = pool.spawn(awaitExternal(promise.getFuture(), suspending, before, after));
+
+			// Give the coroutine time to suspend, so it is resumed by whoever keeps the promise
+			while (!suspending)
+				std::this_thread::yield();
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			if (fromOtherPool)
+				other.wait(other.submit([&promise] { promise.setValue(7); }));
+			else
+				promise.setValue(7);
+
+			pool.wait(result);
+			std::thread::id keeperId = fromOtherPool ? other.submit([] { return std::this_thread::get_id(); }).get() : std::this_thread::get_id();
+			TEST_CHECK(result.get() == 7 && after == before && after != keeperId,
+			           modeName(mode) << ": a coroutine awaiting a promise kept by " << keeper << " resumed "
+			           << (after == keeperId ? "on the keeper's thread" : after == before ? "on its own pool" : "on an unknown thread"));
+		}
+
+		other.stop();
+		pool.stop();
+	}
+
+	// Awaits a batch that counts its tasks
+	AsyncTask<void> countBatch(ThreadPool& pool, size_t numTasks, std::atomic<size_t>& numRun)
+	{
+		co_await pool.submitBatch(numTasks, [&numRun](size_t) { ++numRun; });
+	}
+
+	// Returns the number of leaves in a binary tree depth deep. Each node awaits one
+	// half as an AsyncTask and the other as a spawned coroutine's Future, and a batch.
+	AsyncTask<int> countLeaves(ThreadPool& pool, int depth, size_t batchSize, std::atomic<size_t>& numBatchTasks)
+	{
+		if (depth == 0)
+			co_return co_await pool.submitAsync([] { return 1; });
+
+		Future<int> right = pool.spawn(countLeaves(pool, depth - 1, batchSize, numBatchTasks));
+		int left = co_await countLeaves(pool, depth - 1, batchSize, numBatchTasks);
+		co_await countBatch(pool, batchSize, numBatchTasks);
+		co_return left + co_await std::move(right);
+	}
+
+	// Coroutines nested many deep wait on each other without holding a thread, so
+	// they finish even on a pool with a single thread
+	void checkNestedAwaits(SchedulerMode mode)
+	{
+		const int kDepth = 8;
+		const size_t kBatchSize = 16;
+		const size_t kNumThreads[] = { 1, 4 };
+
+		for (size_t numThreads : kNumThreads) {
+			// Leaked rather than destroyed if it deadlocks, as its threads would never finish
+			std::unique_ptr<ThreadPool> owner(new ThreadPool(numThreads));
+			ThreadPool& pool = *owner;
+			pool.setSchedulerMode(mode);
+			pool.start();
+
+			std::atomic<size_t> numBatchTasks{ 0 };
+			Future<int> leaves = pool.spawn(countLeaves(pool, kDepth, kBatchSize, numBatchTasks));
+			if (leaves.wait_for(std::chrono::seconds(60)) != std::future_status::ready) {
+				TEST_CHECK(false, modeName(mode) << ": coroutines nested " << kDepth << " deep on " << numThreads << " threads deadlocked");
+				owner.release();
+				continue;
+			}
+
+			size_t expectedBatchTasks = ((size_t{ 1 } << kDepth) - 1) * kBatchSize;
+			int numLeaves = leaves.get();
+			TEST_CHECK(numLeaves == 1 << kDepth && numBatchTasks == expectedBatchTasks,
+			           modeName(mode) << ": coroutines nested " << kDepth << " deep on " << numThreads << " threads counted "
+			           << numLeaves << " of " << (1 << kDepth) << " leaves and ran " << numBatchTasks << " of " << expectedBatchTasks << " batch tasks");
+			pool.stop();
+		}
+	}
+
+	AsyncTask<int> throwNow(const char* message)
+	{
+		throw std::runtime_error(message);
+		co_return 0;
+	}
+
+	// Awaits throwNow from a few coroutines down
+	AsyncTask<int> awaitThrowing(const char* message, int depth)
+	{
+		if (depth == 0)
+			co_return co_await throwNow(message);
+		co_return co_await awaitThrowing(message, depth - 1) + 1;
+	}
+
+	AsyncTask<int> awaitFailedFuture(ThreadPool& pool)
+	{
+		co_return co_await pool.submit([]() -> int { throw std::runtime_error("future failed"); });
+	}
+
+	AsyncTask<void> awaitFailedBatch(ThreadPool& pool)
+	{
+		co_await pool.submitBatch(100, [](size_t i) {
+			if (i == 50)
+				throw std::runtime_error("batch failed");
+		});
+	}
+
+	AsyncTask<int> awaitFailedSubmitAsync(ThreadPool& pool)
+	{
+		co_return co_await pool.submitAsync([]() -> int { throw std::runtime_error("submitAsync failed"); });
+	}
+
+	// Catches the exception of a nested coroutine and carries on
+	AsyncTask<int> catchThrowing()
+	{
+		try {
+			co_return co_await awaitThrowing("caught", 3);
+		}
+		catch (const std::runtime_error&) {
+		}
+		co_return -1;
+	}
+
+	// An exception thrown in a coroutine, or held by a future or batch it awaits,
+	// is rethrown from co_await and reaches the future spawn returned
+	void checkExceptions(SchedulerMode mode)
+	{
+		ThreadPool pool(2);
+		pool.setSchedulerMode(mode);
+		pool.start();
+
+		Future<int> nested = pool.spawn(awaitThrowing("nested", 5));
+		std::string error = errorOf(pool, nested);
+		TEST_CHECK(error == "nested", modeName(mode) << ": a coroutine 5 deep threw \"" << error << "\" to the top");
+
+		Future<int> future = pool.spawn(awaitFailedFuture(pool));
+		error = errorOf(pool, future);
+		TEST_CHECK(error == "future failed", modeName(mode) << ": awaiting a failed future threw \"" << error << "\"");
+
+		Future<void> batch = pool.spawn(awaitFailedBatch(pool));
+		error = errorOf(pool, batch);
+		TEST_CHECK(error == "batch failed", modeName(mode) << ": awaiting a failed batch threw \"" << error << "\"");
+
+		Future<int> submitted = pool.spawn(awaitFailedSubmitAsync(pool));
+		error = errorOf(pool, submitted);
+		TEST_CHECK(error == "submitAsync failed", modeName(mode) << ": awaiting a failed submitAsync threw \"" << error << "\"");
+
+		Future<int> caught = pool.spawn(catchThrowing());
+		pool.wait(caught);
+		TEST_CHECK(caught.get() == -1, modeName(mode) << ": a coroutine couldn't catch a nested coroutine's exception");
+		pool.stop();
+	}
+}
+
+void runCoroutineTests()
+{
+	for (SchedulerMode mode : g_kModes) {
+		checkResumeOnPool(mode);
+		checkNestedAwaits(mode);
+		checkExceptions(mode);
+	}
+}
+
+#endif
@@ -0,0 +1,244 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Checks quad-double arithmetic to about 60 digits, and that
+//                pixels iterated by perturbation from a reference orbit escape
+//                on the same iteration as iterating them directly in quad-double.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#include "Tests.h"
+#include "FractalKernel.h"
+#include "QuadDouble.h"
+#include "ReferenceOrbit.h"
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace
+{
+	// Quad-double keeps about 212 bits, so results must agree to 2^-200 or so of their size
+	const double g_kQuadTolerance = 1e-60;
+
+	// The pixels of a view sampled on a grid this many pixels wide and high
+	const size_t g_kSampleGrid = 9;
+
+	double magnitude(const QuadDouble& value)
+	{
+		return std::abs(static_cast<double>(value));
+	}
+
+	// Returns a random number in [-1, 1) with all four parts filled
+	QuadDouble randomQuad(std::mt19937& rng)
+	{
+		std::uniform_real_distribution<double> part(-1, 1);
+		QuadDouble value = part(rng);
+		for (int i = 1; i < 4; ++i)
+			value += QuadDouble(std::ldexp(part(rng), -53 * i));
+		return value;
+	}
+
+	// Checks |actual - expected| <= g_kQuadTolerance * scale
+	void checkClose(const char* what, const QuadDouble& actual, const QuadDouble& expected, double scale)
+	{
+		double error = magnitude(actual - expected);
+		TEST_CHECK(error <= g_kQuadTolerance * scale,
+		           what << " is out by " << error << ", more than " << g_kQuadTolerance << " of " << scale);
+	}
+
+	// Products whose exact results are known, and need every part to hold them
+	void checkExactProducts()
+	{
+		// (1 + 2^-52)^4 = 1 + 2^-50 + 6 2^-104 + 4 2^-156 + 2^-208
+		double a = 1 + std::ldexp(1.0, -52);
+		QuadDouble fourth = QuadDouble(a) * a * a * a;
+		QuadDouble expected(1 + std::ldexp(1.0, -50), std::ldexp(6.0, -104), std::ldexp(4.0, -156), std::ldexp(1.0, -208));
+		checkClose("(1 + 2^-52)^4 by doubles", fourth, expected, 1);
+		QuadDouble square = QuadDouble(a) * QuadDouble(a);
+		checkClose("(1 + 2^-52)^4 by quad-doubles", square * square, expected, 1);
+
+		// (2^100 + 1)(2^100 - 1) = 2^200 - 1, which is lost unless the product keeps 200 bits
+		QuadDouble big(std::ldexp(1.0, 100), 1, 0, 0);
+		QuadDouble product = big * QuadDouble(std::ldexp(1.0, 100), -1, 0, 0);
+		TEST_CHECK(static_cast<double>(product - QuadDouble(std::ldexp(1.0, 200))) == -1,
+		           "(2^100 + 1)(2^100 - 1) - 2^200 is " << static_cast<double>(product - QuadDouble(std::ldexp(1.0, 200))) << ", not -1");
+
+		// (2^150 + 2^75 + 1)^2 = 2^300 + 2^226 + 3 2^150 + 2^76 + 1
+		QuadDouble spread(std::ldexp(1.0, 150), std::ldexp(1.0, 75), 1, 0);
+		QuadDouble spreadSquared(std::ldexp(1.0, 300), std::ldexp(1.0, 226), std::ldexp(3.0, 150), std::ldexp(1.0, 76));
+		checkClose("(2^150 + 2^75 + 1)^2", spread * spread, spreadSquared, std::ldexp(1.0, 300));
+
+		// Adding a number 2^-100 the size of another and taking the other away leaves it exactly
+		QuadDouble small(std::ldexp(3.0, -100), std::ldexp(1.0, -160), 0, 0);
+		TEST_CHECK(static_cast<double>((QuadDouble(1) + small - QuadDouble(1)) - small) == 0,
+		           "(1 + 3 2^-100 + 2^-160) - 1 lost part of 3 2^-100 + 2^-160");
+	}
+
+	// Identities that hold for any numbers, on random numbers using every part
+	void checkIdentities()
+	{
+		std::mt19937 rng(4321);
+		for (int i = 0; i < 1000; ++i) {
+			QuadDouble x = randomQuad(rng);
+			QuadDouble y = randomQuad(rng);
+			QuadDouble z = randomQuad(rng);
+			double d = std::uniform_real_distribution<double>(-1, 1)(rng);
+
+			checkClose("(x + y) - y", (x + y) - y, x, magnitude(x) + magnitude(y));
+			checkClose("x(y + z)", x * (y + z), x * y + x * z, magnitude(x) * (magnitude(y) + magnitude(z)));
+			checkClose("(x + y)(x - y)", (x + y) * (x - y), x * x - y * y, magnitude(x * x) + magnitude(y * y));
+			checkClose("x * double", x * d, x * QuadDouble(d), magnitude(x) * std::abs(d));
+			TEST_CHECK((x < y) == (static_cast<double>(y - x) > 0), "x < y disagrees with y - x > 0");
+		}
+	}
+
+#if FRACTAL_HAS_QUAD
+	__float128 toQuad(const QuadDouble& value)
+	{
+		return static_cast<__float128>(value.part[0]) + (static_cast<__float128>(value.part[1])
+		     + (static_cast<__float128>(value.part[2]) + value.part[3]));
+	}
+
+	// __float128 only has 113 bits, so it can only check the leading parts
+	void checkAgainstFloat128()
+	{
+		const double kFloat128Tolerance = 1e-32;
+
+		std::mt19937 rng(8765);
+		for (int i = 0; i < 1000; ++i) {
+			QuadDouble x = randomQuad(rng);
+			QuadDouble y = randomQuad(rng);
+			__float128 sum = toQuad(x + y) - (toQuad(x) + toQuad(y));
+			__float128 product = toQuad(x * y) - toQuad(x) * toQuad(y);
+			double scale = magnitude(x) + magnitude(y);
+			TEST_CHECK(std::abs(static_cast<double>(sum)) <= kFloat128Tolerance * scale,
+			           "x + y differs from __float128 by " << static_cast<double>(sum));
+			TEST_CHECK(std::abs(static_cast<double>(product)) <= kFloat128Tolerance * magnitude(x) * magnitude(y),
+			           "x * y differs from __float128 by " << static_cast<double>(product));
+		}
+	}
+#endif
+
+	// Finds the Misiurewicz point where z4 = z3, near -0.228 + 1.115i, with Newton's method.
+	// Every zoom into it has detail, so a deep view of it isn't a single color.
+	void misiurewiczPoint(QuadDouble& re, QuadDouble& im)
+	{
+		re = -0.22815549365396;
+		im = 1.1151425080399;
+		for (int step = 0; step < 8; ++step) {
+			// z and its derivative by c, which only needs to be roughly right
+			QuadDouble zRe = 0, zIm = 0, z3Re = 0, z3Im = 0;
+			double dRe = 0, dIm = 0, d3Re = 0, d3Im = 0;
+			for (int n = 1; n <= 4; ++n) {
+				double nextDRe = 2 * (static_cast<double>(zRe) * dRe - static_cast<double>(zIm) * dIm) + 1;
+				double nextDIm = 2 * (static_cast<double>(zRe) * dIm + static_cast<double>(zIm) * dRe);
+				dRe = nextDRe;
+				dIm = nextDIm;
+				QuadDouble xy = zRe * zIm;
+				zRe = zRe * zRe - zIm * zIm + re;
+				zIm = xy + xy + im;
+				if (n == 3) {
+					z3Re = zRe;
+					z3Im = zIm;
+					d3Re = dRe;
+					d3Im = dIm;
+				}
+			}
+
+			// c -= (z4 - z3) / (z4' - z3')
+			QuadDouble fRe = zRe - z3Re;
+			QuadDouble fIm = zIm - z3Im;
+			double gRe = dRe - d3Re;
+			double gIm = dIm - d3Im;
+			double g2 = gRe * gRe + gIm * gIm;
+			re -= (fRe * gRe + fIm * gIm) * (1 / g2);
+			im -= (fIm * gRe - fRe * gIm) * (1 / g2);
+		}
+	}
+
+	// Iterates a grid of pixels across a view range wide, as main.cpp does, and compares
+	// the counts with iterating each pixel directly. Perturbation rounds differently, so
+	// pixels right on the edge of escaping may be one iteration out.
+	void checkView(const char* name, const QuadDouble& centerRe, const QuadDouble& centerIm, double range,
+	               uint32_t maxIterations, const ReferenceOrbit& orbit)
+	{
+		const size_t kMaxOffByOne = 2;
+
+		size_t numWrong = 0;
+		size_t numOffByOne = 0;
+		std::vector<double> deltaRe(g_kSampleGrid);
+		for (size_t x = 0; x < g_kSampleGrid; ++x)
+			deltaRe[x] = (static_cast<double>(x) / (g_kSampleGrid - 1) - 0.5) * range;
+
+		for (size_t y = 0; y < g_kSampleGrid; ++y) {
+			double deltaIm = (static_cast<double>(y) / (g_kSampleGrid - 1) - 0.5) * range;
+			std::vector<uint32_t> iterations(g_kSampleGrid);
+			orbit.iterateRow(deltaRe.data(), deltaIm, g_kSampleGrid, iterations.data());
+
+			for (size_t x = 0; x < g_kSampleGrid; ++x) {
+				QuadDouble re = centerRe + QuadDouble(deltaRe[x]);
+				QuadDouble im = centerIm + QuadDouble(deltaIm);
+				uint32_t expected = 0;
+				FractalSkipped skipped;
+				FractalKernel::iterateScalar(&re, &im, 0, 1, maxIterations, &expected, FractalShortcuts(), skipped);
+
+				uint32_t difference = iterations[x] > expected ? iterations[x] - expected : expected - iterations[x];
+				if (difference == 1)
+					++numOffByOne;
+				else if (difference != 0 && numWrong++ == 0)
+					TEST_CHECK(false, name << ": pixel " << x << "," << y << " escaped on iteration " << iterations[x]
+					           << ", not " << expected);
+			}
+		}
+		TEST_CHECK(numWrong == 0 && numOffByOne <= kMaxOffByOne,
+		           name << ": " << numWrong << " pixels were wrong and " << numOffByOne << " one iteration out");
+	}
+
+	void checkReferenceOrbits()
+	{
+		// Far too deep for doubles, so the series skips the start of every orbit
+		QuadDouble re, im;
+		misiurewiczPoint(re, im);
+		double range = 4e-45;
+		uint32_t maxIterations = 3000;
+		ReferenceOrbit deep(re, im, maxIterations, range * std::sqrt(0.5), range / 1023);
+		TEST_CHECK(deep.seriesIterations() > 0, "the series skipped no iterations at a zoom of 1e45");
+		checkView("zoom 1e45", re, im, range, maxIterations, deep);
+
+		// Just right of the cusp at 1/4 the reference escapes after about 30 iterations,
+		// while the pixels left of it never do. They rebase onto the start of the orbit.
+		QuadDouble cuspRe = 0.26;
+		range = 0.04;
+		maxIterations = 500;
+		ReferenceOrbit escaping(cuspRe, 0, maxIterations, range * std::sqrt(0.5), range / 1023);
+		TEST_CHECK(escaping.escapeIteration() < 100, "the reference right of the cusp took " << escaping.escapeIteration() << " iterations to escape");
+		checkView("rebasing at the cusp", cuspRe, 0, range, maxIterations, escaping);
+
+		// With no iterations, every pixel is taken to be in the set
+		ReferenceOrbit none(re, im, 0, range, range / 1023);
+		double deltaRe[3] = { -range, 0, range };
+		uint32_t iterations[3] = {};
+		none.iterateRow(deltaRe, range, 3, iterations);
+		TEST_CHECK(none.escapeIteration() == 1 && iterations[0] == 1 && iterations[1] == 1 && iterations[2] == 1,
+		           "with 0 iterations the reference escaped on " << none.escapeIteration() << " and the pixels on "
+		           << iterations[0] << ", " << iterations[1] << " and " << iterations[2] << ", not 1");
+	}
+}
+
+void runDeepZoomTests()
+{
+	checkExactProducts();
+	checkIdentities();
+#if FRACTAL_HAS_QUAD
+	checkAgainstFloat128();
+#endif
+	checkReferenceOrbits();
+}
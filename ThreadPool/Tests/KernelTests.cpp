@@ -0,0 +1,169 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Checks that every kernel this machine supports gives exactly the
+//                same iteration counts and skipped iterations as the scalar kernel,
+//                in every precision, with and without the shortcuts.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#include "Tests.h"
+#include "FractalKernel.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace
+{
+	// A window onto the complex plane, sampled at its pixel centres
+	struct View {
+		const char* name;
+		double left;
+		double top;
+		double step;
+		size_t width;
+		size_t height;
+	};
+
+	// The widths are odd, so every row ends in a part vector for each kernel
+	const View g_kViews[] = {
+		// The whole set, with every pixel of the cardioid and the period-2 bulb
+		{ "whole set", -2.2, -1.3, 0.05, 61, 53 },
+		// Seahorse valley, whose orbits are long and come close to repeating
+		{ "seahorse valley", -0.7475, 0.1025, 0.0002, 37, 29 },
+	};
+
+	const uint32_t g_kMaxIterations[] = { 1, 7, 256, 2000 };
+
+	const FractalKernelType g_kKernels[] = {
+		FractalKernelType::Scalar,
+		FractalKernelType::Sse2,
+		FractalKernelType::Avx2,
+		FractalKernelType::Avx512,
+	};
+
+	const char* onOff(bool value)
+	{
+		return value ? "on" : "off";
+	}
+
+	// Compares one kernel's counts against the scalar kernel's
+	void checkCounts(const char* test, FractalKernelType type, FractalPrecision precision, const View& view,
+	                 uint32_t maxIterations, const FractalShortcuts& shortcuts,
+	                 const std::vector<uint32_t>& iterations, const FractalSkipped& skipped,
+	                 const std::vector<uint32_t>& expectedIterations, const FractalSkipped& expectedSkipped)
+	{
+		size_t mismatch = 0;
+		while (mismatch < iterations.size() && iterations[mismatch] == expectedIterations[mismatch])
+			++mismatch;
+
+		TEST_CHECK(mismatch == iterations.size() && skipped.bulb == expectedSkipped.bulb && skipped.periodic == expectedSkipped.periodic,
+		           test << " with the " << FractalKernel::name(type) << " kernel in " << FractalKernel::name(precision)
+		           << " over " << view.name << ", " << maxIterations << " iterations, bulb check "
+		           << onOff(shortcuts.bulbCheck) << ", periodicity check " << onOff(shortcuts.periodicityCheck) << ": "
+		           << (mismatch < iterations.size() ? "pixel " + std::to_string(mismatch) + " took "
+		               + std::to_string(iterations[mismatch]) + " iterations, not " + std::to_string(expectedIterations[mismatch])
+		               : std::string("skipped iterations differ"))
+		           << " (bulb " << skipped.bulb << " vs " << expectedSkipped.bulb
+		           << ", periodic " << skipped.periodic << " vs " << expectedSkipped.periodic << ")");
+	}
+
+	// Iterates the view a row at a time, cutting up to 16 pixels off the end of
+	// each row so every length of part vector is tried
+	template<typename Real>
+	void checkRows(FractalKernelType type, FractalPrecision precision, const View& view,
+	               uint32_t maxIterations, const FractalShortcuts& shortcuts)
+	{
+		std::vector<Real> cr(view.width);
+		for (size_t x = 0; x < view.width; ++x)
+			cr[x] = Real(view.left + view.step * (static_cast<double>(x) + 0.5));
+
+		std::vector<uint32_t> iterations;
+		std::vector<uint32_t> expectedIterations;
+		for (size_t y = 0; y < view.height; ++y) {
+			FractalSkipped skipped;
+			FractalSkipped expectedSkipped;
+			Real ci = Real(view.top + view.step * (static_cast<double>(y) + 0.5));
+			size_t count = view.width - std::min<size_t>(y % 17, view.width - 1);
+			iterations.assign(count, 0);
+			expectedIterations.assign(count, 0);
+			FractalKernel::iterateRow(type, cr.data(), ci, count, maxIterations, iterations.data(), shortcuts, skipped);
+			FractalKernel::iterateScalar(cr.data(), &ci, 0, count, maxIterations, expectedIterations.data(), shortcuts, expectedSkipped);
+			checkCounts("iterateRow", type, precision, view, maxIterations, shortcuts, iterations, skipped, expectedIterations, expectedSkipped);
+		}
+	}
+
+	// Iterates every pixel of the view at once, in a shuffled order, so each
+	// vector holds pixels from all over the view
+	template<typename Real>
+	void checkPoints(FractalKernelType type, FractalPrecision precision, const View& view,
+	                 uint32_t maxIterations, const FractalShortcuts& shortcuts)
+	{
+		std::vector<size_t> order(view.width * view.height);
+		for (size_t i = 0; i < order.size(); ++i)
+			order[i] = i;
+		std::shuffle(order.begin(), order.end(), std::mt19937(12345));
+
+		std::vector<Real> cr(order.size());
+		std::vector<Real> ci(order.size());
+		for (size_t i = 0; i < order.size(); ++i) {
+			cr[i] = Real(view.left + view.step * (static_cast<double>(order[i] % view.width) + 0.5));
+			ci[i] = Real(view.top + view.step * (static_cast<double>(order[i] / view.width) + 0.5));
+		}
+
+		std::vector<uint32_t> iterations(order.size());
+		std::vector<uint32_t> expectedIterations(order.size());
+		FractalSkipped skipped;
+		FractalSkipped expectedSkipped;
+		FractalKernel::iteratePoints(type, cr.data(), ci.data(), order.size(), maxIterations, iterations.data(), shortcuts, skipped);
+		FractalKernel::iterateScalar(cr.data(), ci.data(), 1, order.size(), maxIterations, expectedIterations.data(), shortcuts, expectedSkipped);
+		checkCounts("iteratePoints", type, precision, view, maxIterations, shortcuts, iterations, skipped, expectedIterations, expectedSkipped);
+	}
+
+	// Precisions without SIMD kernels ignore the kernel type, so they are only run
+	// once, and only for short orbits as they are slow
+	template<typename Real>
+	void checkPrecision(FractalPrecision precision, bool hasSimdKernels)
+	{
+		if (!FractalKernel::isSupported(precision))
+			return;
+
+		for (FractalKernelType type : g_kKernels) {
+			if (!FractalKernel::isSupported(type) || (!hasSimdKernels && type != FractalKernelType::Scalar))
+				continue;
+			for (const View& view : g_kViews) {
+				for (uint32_t maxIterations : g_kMaxIterations) {
+					if (!hasSimdKernels && maxIterations > 256)
+						continue;
+					// All four combinations of the shortcuts
+					for (int flags = 0; flags < 4; ++flags) {
+						FractalShortcuts shortcuts;
+						shortcuts.bulbCheck = (flags & 1) != 0;
+						shortcuts.periodicityCheck = (flags & 2) != 0;
+						shortcuts.periodTolerance = view.step / 1024;
+						checkRows<Real>(type, precision, view, maxIterations, shortcuts);
+						checkPoints<Real>(type, precision, view, maxIterations, shortcuts);
+					}
+				}
+			}
+		}
+	}
+}
+
+void runKernelTests()
+{
+	checkPrecision<float>(FractalPrecision::Float, true);
+	checkPrecision<double>(FractalPrecision::Double, true);
+	checkPrecision<DoubleDouble>(FractalPrecision::DoubleDouble, false);
+#if FRACTAL_HAS_QUAD
+	checkPrecision<__float128>(FractalPrecision::Quad, false);
+#endif
+}
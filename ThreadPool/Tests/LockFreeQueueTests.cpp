@@ -0,0 +1,133 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Checks the lock free queue when full, when empty and as its
+//                positions wrap around the ring, and that every item is taken
+//                exactly once by many producers and consumers.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#include "Tests.h"
+#include "LockFreeQueue.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	const size_t g_kNumProducers = 3;
+	const size_t g_kNumConsumers = 3;
+	const size_t g_kItemsPerProducer = 100000;
+	// Small enough that producers often find the queue full and consumers find it empty
+	const size_t g_kStressCapacity = 8;
+
+	void checkFullAndEmpty()
+	{
+		LockFreeQueue<size_t> queue(4);
+		TEST_CHECK(queue.capacity() == 4, "a queue asked for 4 items holds " << queue.capacity());
+
+		size_t item = 0;
+		TEST_CHECK(queue.empty() && !queue.tryPop(item), "tryPop took " << item << " from a new queue");
+
+		for (size_t i = 0; i < queue.capacity(); ++i)
+			TEST_CHECK(queue.tryPush(size_t{ i }), "tryPush failed with " << queue.size() << " items queued");
+		size_t rejected = 42;
+		TEST_CHECK(!queue.tryPush(std::move(rejected)), "tryPush added a fifth item to a full queue");
+		TEST_CHECK(rejected == 42, "a failed tryPush changed its item to " << rejected);
+		TEST_CHECK(queue.size() == 4, "a full queue holds " << queue.size() << " items");
+
+		// Freeing one cell lets exactly one more item in, into the cell the first lap left
+		TEST_CHECK(queue.tryPop(item) && item == 0, "tryPop took " << item << " rather than the first item");
+		TEST_CHECK(queue.tryPush(size_t{ 4 }), "tryPush failed after a cell was freed");
+		TEST_CHECK(!queue.tryPush(size_t{ 5 }), "tryPush added an item to a full queue");
+
+		for (size_t expected = 1; expected <= 4; ++expected)
+			TEST_CHECK(queue.tryPop(item) && item == expected, "tryPop took " << item << " rather than " << expected);
+		TEST_CHECK(queue.empty() && !queue.tryPop(item), "tryPop took " << item << " from an emptied queue");
+	}
+
+	// Runs the positions many laps around the ring, at every fill level
+	void checkWrapAround()
+	{
+		LockFreeQueue<size_t> queue(4);
+		size_t nextPushed = 0;
+		size_t nextPopped = 0;
+		for (size_t lap = 0; lap < 1000; ++lap) {
+			size_t numPushes = lap % (queue.capacity() + 1);
+			for (size_t i = 0; i < numPushes; ++i)
+				TEST_CHECK(queue.tryPush(size_t{ nextPushed++ }), "tryPush failed on lap " << lap);
+
+			size_t item = 0;
+			while (queue.tryPop(item)) {
+				TEST_CHECK(item == nextPopped, "tryPop took " << item << " rather than " << nextPopped << " on lap " << lap);
+				nextPopped = item + 1;
+			}
+			TEST_CHECK(nextPopped == nextPushed, "the queue ran dry at " << nextPopped << " of " << nextPushed << " items on lap " << lap);
+		}
+	}
+
+	// Items are numbered by producer, so each consumer must see every producer's
+	// items in the order they were pushed
+	void checkProducersAgainstConsumers()
+	{
+		LockFreeQueue<size_t> queue(g_kStressCapacity);
+		const size_t numItems = g_kNumProducers * g_kItemsPerProducer;
+		std::atomic<size_t> numTaken{ 0 };
+		std::vector<std::vector<size_t>> taken(g_kNumConsumers);
+
+		std::vector<std::thread> threads;
+		for (size_t producer = 0; producer < g_kNumProducers; ++producer) {
+			threads.emplace_back([&queue, producer] {
+				for (size_t i = 0; i < g_kItemsPerProducer; ++i)
+					queue.push(producer * g_kItemsPerProducer + i);
+			});
+		}
+		for (size_t consumer = 0; consumer < g_kNumConsumers; ++consumer) {
+			threads.emplace_back([&queue, &numTaken, &taken, consumer, numItems] {
+				std::vector<size_t>& items = taken[consumer];
+				size_t item = 0;
+				while (numTaken.load(std::memory_order_relaxed) < numItems) {
+					if (queue.tryPop(item)) {
+						items.push_back(item);
+						numTaken.fetch_add(1, std::memory_order_relaxed);
+					}
+					else {
+						std::this_thread::yield();
+					}
+				}
+			});
+		}
+		for (std::thread& thread : threads)
+			thread.join();
+
+		checkExactlyOnce("producers against consumers", taken, numItems);
+		TEST_CHECK(queue.empty(), "the queue holds " << queue.size() << " items after every item was taken");
+
+		for (size_t consumer = 0; consumer < g_kNumConsumers; ++consumer) {
+			std::vector<size_t> lastSeen(g_kNumProducers, 0);
+			size_t numOutOfOrder = 0;
+			for (size_t item : taken[consumer]) {
+				size_t producer = item / g_kItemsPerProducer;
+				if (producer >= g_kNumProducers)
+					continue;
+				numOutOfOrder += item + 1 <= lastSeen[producer] ? 1 : 0;
+				lastSeen[producer] = item + 1;
+			}
+			TEST_CHECK(numOutOfOrder == 0, "consumer " << consumer << " took " << numOutOfOrder << " items out of order");
+		}
+	}
+}
+
+void runLockFreeQueueTests()
+{
+	checkFullAndEmpty();
+	checkWrapAround();
+	checkProducersAgainstConsumers();
+}
@@ -0,0 +1,126 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Runs the tests named on the command line, or all of them.
+//                Exits with a failure code if any check failed.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#include "Tests.h"
+#include "Coroutine.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	struct TestCase {
+		const char* name;
+		void (*run)();
+	};
+
+	const TestCase g_kTests[] = {
+		{ "kernels", runKernelTests },
+		{ "deque", runWorkStealingDequeTests },
+		{ "queue", runLockFreeQueueTests },
+		{ "deepzoom", runDeepZoomTests },
+		{ "timers", runTimerTests },
+		{ "pool", runThreadPoolTests },
+		{ "continuations", runContinuationTests },
+#if THREADPOOL_HAS_COROUTINES
+		{ "coroutines", runCoroutineTests },
+#endif
+	};
+
+	// A broken kernel can fail thousands of checks, so only the first few are printed
+	const size_t g_kMaxPrintedFailures = 20;
+
+	size_t g_numFailures = 0;
+
+	void printUsage()
+	{
+		std::cout << "Usage: tests [test...]\n"
+		          << "Runs the named tests, or all of them. The tests are:\n";
+		for (const TestCase& test : g_kTests)
+			std::cout << "  " << test.name << "\n";
+	}
+}
+
+void reportFailure(const char* file, int line, const std::string& message)
+{
+	if (g_numFailures++ < g_kMaxPrintedFailures)
+		std::cout << file << "(" << line << "): " << message << "\n";
+}
+
+void checkExactlyOnce(const char* test, const std::vector<std::vector<size_t>>& taken, size_t numItems)
+{
+	std::vector<size_t> timesTaken(numItems, 0);
+	size_t numUnknown = 0;
+	for (const std::vector<size_t>& items : taken) {
+		for (size_t item : items) {
+			if (item < numItems)
+				++timesTaken[item];
+			else
+				++numUnknown;
+		}
+	}
+
+	size_t numLost = 0;
+	size_t numDuplicated = 0;
+	for (size_t times : timesTaken) {
+		numLost += times == 0 ? 1 : 0;
+		numDuplicated += times > 1 ? 1 : 0;
+	}
+	TEST_CHECK(numLost == 0 && numDuplicated == 0 && numUnknown == 0,
+	           test << ": of " << numItems << " items, " << numLost << " were lost, " << numDuplicated
+	           << " were taken more than once and " << numUnknown << " unknown items were taken");
+}
+
+int main(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i) {
+		std::string name = argv[i];
+		bool known = false;
+		for (const TestCase& test : g_kTests)
+			known = known || name == test.name;
+		if (!known) {
+			printUsage();
+			return name == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	size_t numFailedTests = 0;
+	for (const TestCase& test : g_kTests) {
+		bool selected = argc == 1;
+		for (int i = 1; i < argc; ++i)
+			selected = selected || argv[i] == std::string(test.name);
+		if (!selected)
+			continue;
+
+		size_t failuresBefore = g_numFailures;
+		auto start = std::chrono::steady_clock::now();
+		test.run();
+		auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+		size_t failures = g_numFailures - failuresBefore;
+		if (failures != 0)
+			++numFailedTests;
+		std::cout << (failures == 0 ? "passed " : "FAILED ") << test.name << " (" << elapsedMs << " ms";
+		if (failures != 0)
+			std::cout << ", " << failures << " failed checks";
+		std::cout << ")\n";
+	}
+
+	if (g_numFailures > g_kMaxPrintedFailures)
+		std::cout << g_numFailures - g_kMaxPrintedFailures << " more failed checks were not printed\n";
+	return numFailedTests == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,63 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Checks shared by the tests. A failed check is reported and the
+//                test carries on, so one run shows every failure.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#pragma once
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Records a failed check made at file:line
+void reportFailure(const char* file, int line, const std::string& message);
+
+// Fails the running test if condition is false. message may use <<, and is only
+// built when the check fails.
+#define TEST_CHECK(condition, message)                                  \
+	do {                                                                \
+		if (!(condition)) {                                             \
+			std::ostringstream testMessage;                             \
+			testMessage << message;                                     \
+			reportFailure(__FILE__, __LINE__, testMessage.str());       \
+		}                                                               \
+	} while (false)
+
+// Checks that the items 0 to numItems - 1 were each taken exactly once, between
+// all the threads. Each thread records the items it took in its own list.
+void checkExactlyOnce(const char* test, const std::vector<std::vector<size_t>>& taken, size_t numItems);
+
+// Compares every SIMD kernel against FractalKernel::iterateScalar
+void runKernelTests();
+
+// Races the owner of a WorkStealingDeque against thieves
+void runWorkStealingDequeTests();
+
+// Checks the lock free queue's ring, alone and between producers and consumers
+void runLockFreeQueueTests();
+
+// Checks quad-double arithmetic, and perturbation from a ReferenceOrbit against
+// iterating in quad-double
+void runDeepZoomTests();
+
+// Checks timers fire on time from every level of the wheel, and stop once cancelled
+void runTimerTests();
+
+// Checks the thread pool's scheduling, resizing and cancellation under load
+void runThreadPoolTests();
+
+// Checks then, whenAll, whenAny and task graphs
+void runContinuationTests();
+
+// Checks coroutines resume on their own pool, nest and pass on exceptions. Only
+// registered when built as C++20.
+void runCoroutineTests();
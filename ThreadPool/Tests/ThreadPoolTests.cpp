@@ -0,0 +1,481 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Checks the thread pool runs every task exactly once while it
+//                is resized, that cancelled work is skipped without leaving
+//                futures unresolved, that priorities are kept without
+//                starving low priority work, and that tasks can wait on work
+//                they submit without deadlocking or losing their scratch
+//                memory, in each scheduler mode.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#include "Tests.h"
+#include "ThreadPool.h"
+#include "ThreadPoolStats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	// A way of setting up a pool, each is tried in turn
+	struct PoolConfig {
+		const char* name;
+		SchedulerMode schedulerMode;
+		QueueType queueType;
+	};
+
+	const PoolConfig g_kConfigs[] = {
+		{ "shared queue", SchedulerMode::SharedQueue, QueueType::Locking },
+		{ "lock free queue", SchedulerMode::SharedQueue, QueueType::LockFree },
+		{ "work stealing", SchedulerMode::WorkStealing, QueueType::Locking },
+	};
+
+	void configure(ThreadPool& pool, const PoolConfig& config)
+	{
+		pool.setSchedulerMode(config.schedulerMode);
+		pool.setQueueType(config.queueType);
+	}
+
+	// Keeps the thread busy for about ns nanoseconds
+	void spin(uint64_t ns)
+	{
+		uint64_t end = nowNs() + ns;
+		while (nowNs() < end) {
+		}
+	}
+
+	// Spins until the counter reaches count
+	void waitUntil(const std::atomic<size_t>& counter, size_t count)
+	{
+		while (counter < count)
+			std::this_thread::yield();
+	}
+
+	// Waits for the future and returns true if it holds a value, not an exception
+	template<typename FutureT>
+	bool succeeded(ThreadPool& pool, FutureT& future)
+	{
+		pool.wait(future);
+		try {
+			future.get();
+			return true;
+		}
+		catch (...) {
+			return false;
+		}
+	}
+
+	// Tasks are submitted in rounds with the pool resized after each, so threads
+	// are retired with tasks still queued and taken in bulk. Every task must run
+	// exactly once, and its thread's store must hold its share of the total.
+	void checkResizeUnderLoad(const PoolConfig& config)
+	{
+		const size_t kNumRounds = 40;
+		const size_t kTasksPerRound = 500;
+		const size_t kNumThreads[] = { 4, 1, 6, 2, 8, 3 };
+		const size_t kNumTasks = kNumRounds * kTasksPerRound;
+		const uint64_t kTaskNs = 2000;
+
+		ThreadPoolWithStorage<uint64_t> pool(kNumThreads[0]);
+		configure(pool, config);
+		pool.setMaxBulkPop(ThreadPool::kMaxBulkPop);
+		pool.start();
+
+		std::unique_ptr<std::atomic<int>[]> numRuns(new std::atomic<int>[kNumTasks]);
+		for (size_t i = 0; i < kNumTasks; ++i)
+			numRuns[i] = 0;
+
+		std::vector<Future<void>> futures;
+		futures.reserve(kNumTasks);
+		for (size_t round = 0; round < kNumRounds; ++round) {
+			for (size_t i = round * kTasksPerRound; i < (round + 1) * kTasksPerRound; ++i) {
+				futures.push_back(pool.submit([&pool, &numRuns, i] {
+					++numRuns[i];
+					pool.getThreadLocalStorage() += i;
+					spin(kTaskNs);
+				}));
+			}
+			// Once the round has started the threads have tasks in hand to give back
+			pool.wait(futures[round * kTasksPerRound + kTasksPerRound / 10]);
+			pool.setNumThreads(kNumThreads[(round + 1) % (sizeof(kNumThreads) / sizeof(kNumThreads[0]))]);
+		}
+
+		size_t numFailed = 0;
+		for (Future<void>& future : futures) {
+			if (!succeeded(pool, future))
+				++numFailed;
+		}
+		size_t numWrong = 0;
+		for (size_t i = 0; i < kNumTasks; ++i) {
+			if (numRuns[i] != 1 && numWrong++ == 0)
+				TEST_CHECK(false, config.name << ": task " << i << " ran " << numRuns[i] << " times");
+		}
+		TEST_CHECK(numFailed == 0 && numWrong == 0, config.name << ": while resizing " << numFailed << " of " << kNumTasks
+		           << " futures were broken and " << numWrong << " tasks didn't run exactly once");
+
+		uint64_t total = pool.combine(uint64_t{ 0 }, [](uint64_t sum, uint64_t store) { return sum + store; });
+		uint64_t expected = uint64_t{ kNumTasks } * (kNumTasks - 1) / 2;
+		TEST_CHECK(total == expected, config.name << ": the thread stores add up to " << total << ", not " << expected);
+		pool.stop();
+	}
+
+	// Every thread is held up by a task while tokened tasks and a batch queue up
+	// behind them. cancelAll must skip all of the queued work, still resolve every
+	// future, let the running tasks see their token cancelled, and leave tokens
+	// handed out afterwards alone.
+	void checkCancelAll(const PoolConfig& config)
+	{
+		const size_t kNumThreads = 2;
+		const size_t kNumTasks = 100;
+		const size_t kBatchSize = 100;
+
+		ThreadPool pool(kNumThreads);
+		configure(pool, config);
+		pool.start();
+
+		CancellationToken token = pool.getCancellationToken();
+		std::atomic_bool release{ false };
+		std::atomic<size_t> numBlocking{ 0 };
+		std::atomic<size_t> numSawCancel{ 0 };
+		std::vector<Future<void>> blockers;
+		for (size_t i = 0; i < kNumThreads; ++i) {
+			blockers.push_back(pool.submit([token, &release, &numBlocking, &numSawCancel] {
+				++numBlocking;
+				while (!release)
+					std::this_thread::yield();
+				if (token.isCancelled())
+					++numSawCancel;
+			}));
+		}
+		waitUntil(numBlocking, kNumThreads);
+
+		std::atomic<size_t> numRun{ 0 };
+		std::vector<Future<void>> futures;
+		for (size_t i = 0; i < kNumTasks; ++i)
+			futures.push_back(pool.submit(token, [&numRun] { ++numRun; }));
+		BatchFuture batch = pool.submitBatch(token, kBatchSize, [&numRun](size_t) { ++numRun; });
+
+		pool.cancelAll();
+		release = true;
+
+		size_t numResolved = 0;
+		for (Future<void>& future : futures) {
+			if (!succeeded(pool, future))
+				++numResolved;
+		}
+		bool batchResolved = !succeeded(pool, batch);
+		TEST_CHECK(numResolved == kNumTasks && batchResolved && numRun == 0,
+		           config.name << ": after cancelAll " << numRun << " queued tasks ran, " << numResolved << " of " << kNumTasks
+		           << " futures held an error and the batch " << (batchResolved ? "did" : "didn't"));
+
+		size_t numBlockersDone = 0;
+		for (Future<void>& blocker : blockers) {
+			if (succeeded(pool, blocker))
+				++numBlockersDone;
+		}
+		TEST_CHECK(numBlockersDone == kNumThreads && numSawCancel == kNumThreads,
+		           config.name << ": " << numBlockersDone << " of the " << kNumThreads << " running tasks finished and "
+		           << numSawCancel << " saw their token cancelled");
+
+		Future<int> after = pool.submit(pool.getCancellationToken(), [] { return 42; });
+		pool.wait(after);
+		TEST_CHECK(after.get() == 42, config.name << ": a task with a token from after cancelAll didn't run");
+		pool.stop();
+	}
+
+	// Cancelling a batch part way through skips the rest of it, and its future
+	// still becomes ready rather than waiting on tasks that will never run.
+	// cancelAll drops the queued tasks, cancelling the batch's own token leaves
+	// them queued to see it.
+	void checkCancelRunningBatch(const PoolConfig& config, bool useCancelAll)
+	{
+		const size_t kBatchSize = 10000;
+		const size_t kNumBeforeCancel = 10;
+		const uint64_t kTaskNs = 5000;
+
+		ThreadPool pool(2);
+		configure(pool, config);
+		pool.start();
+
+		CancellationSource source;
+		CancellationToken token = useCancelAll ? pool.getCancellationToken() : source.getToken();
+		std::atomic<size_t> numStarted{ 0 };
+		BatchFuture batch = pool.submitBatch(token, kBatchSize, [&numStarted](size_t) {
+			++numStarted;
+			spin(kTaskNs);
+		});
+		waitUntil(numStarted, kNumBeforeCancel);
+		if (useCancelAll)
+			pool.cancelAll();
+		else
+			source.cancel();
+
+		bool batchResolved = !succeeded(pool, batch);
+		TEST_CHECK(batchResolved && numStarted < kBatchSize,
+		           config.name << ": a batch cancelled part way by " << (useCancelAll ? "cancelAll" : "its token")
+		           << (batchResolved ? " held" : " didn't hold") << " an error, after " << numStarted << " of its "
+		           << kBatchSize << " tasks ran");
+		pool.stop();
+	}
+
+	// With the only thread held up, low, normal and high priority tasks are queued
+	// in that order. Once released every high priority task must run before any low
+	// priority one, with a normal one let through after each highBurst of them.
+	void checkPriorityOrder(const PoolConfig& config, size_t highBurst)
+	{
+		const size_t kTasksPerPriority = 50;
+		const Priority kPriorities[] = { Priority::Low, Priority::Normal, Priority::High };
+
+		ThreadPool pool(1);
+		configure(pool, config);
+		// Nothing waits long enough to age
+		pool.setPriorityPolicy(PriorityPolicy{ highBurst, std::chrono::seconds(60) });
+		pool.start();
+
+		std::atomic_bool release{ false };
+		std::atomic<size_t> numBlocking{ 0 };
+		Future<void> blocker = pool.submit([&release, &numBlocking] {
+			++numBlocking;
+			while (!release)
+				std::this_thread::yield();
+		});
+		waitUntil(numBlocking, 1);
+
+		std::mutex orderMutex;
+		std::vector<Priority> order;
+		std::vector<Future<void>> futures;
+		for (Priority priority : kPriorities) {
+			for (size_t i = 0; i < kTasksPerPriority; ++i) {
+				futures.push_back(pool.submit(priority, [priority, &orderMutex, &order] {
+					std::lock_guard<std::mutex> lock(orderMutex);
+					order.push_back(priority);
+				}));
+			}
+		}
+		release = true;
+		for (Future<void>& future : futures)
+			pool.wait(future);
+		pool.wait(blocker);
+		pool.stop();
+
+		size_t numHigh = 0;
+		size_t highStreak = 0;
+		size_t longestHighStreak = 0;
+		bool lowBeforeHigh = false;
+		for (Priority priority : order) {
+			if (priority == Priority::High) {
+				++numHigh;
+				longestHighStreak = std::max(longestHighStreak, ++highStreak);
+				continue;
+			}
+			highStreak = 0;
+			lowBeforeHigh = lowBeforeHigh || (priority == Priority::Low && numHigh < kTasksPerPriority);
+		}
+		size_t maxHighStreak = highBurst == 0 ? kTasksPerPriority : highBurst;
+		TEST_CHECK(order.size() == 3 * kTasksPerPriority && !lowBeforeHigh && longestHighStreak == maxHighStreak,
+		           config.name << ", high burst " << highBurst << ": " << order.size() << " tasks ran, "
+		           << (lowBeforeHigh ? "a low priority task ran before the high priority ones finished, " : "")
+		           << longestHighStreak << " high priority tasks ran in a row, not " << maxHighStreak);
+	}
+
+	// Keeps the pool busy with a stream of work that submits itself again as it
+	// finishes, until stop is set or endNs has passed
+	struct Stream {
+		static const uint64_t kTaskNs = 100000;
+
+		ThreadPool* pool;
+		Priority priority;
+		uint64_t endNs;
+		const std::atomic_bool* stop;
+		std::atomic<size_t>* numRunning;
+
+		void operator()() const
+		{
+			spin(kTaskNs);
+			if (*stop || nowNs() > endNs)
+				--*numRunning;
+			else
+				pool->submit(priority, *this);
+		}
+	};
+
+	// Low priority work is starved while normal and high priority work keeps
+	// coming, until it has waited lowMaxWait. Then it goes ahead of the rest.
+	void checkLowAging(const PoolConfig& config)
+	{
+		const std::chrono::milliseconds kLowMaxWait(20);
+		// Allows for the tasks run before the next aging check, and a busy machine
+		const std::chrono::milliseconds kLateness(500);
+
+		ThreadPool pool(1);
+		configure(pool, config);
+		pool.setPriorityPolicy(PriorityPolicy{ 8, kLowMaxWait });
+		pool.start();
+
+		// The stream ends on its own in case the low priority task never gets a turn
+		const Priority kStreams[] = { Priority::Normal, Priority::Normal, Priority::High, Priority::High };
+		uint64_t endNs = nowNs() + 5000000000;
+		std::atomic_bool stop{ false };
+		std::atomic<size_t> numRunning{ sizeof(kStreams) / sizeof(kStreams[0]) };
+		for (Priority priority : kStreams)
+			pool.submit(priority, Stream{ &pool, priority, endNs, &stop, &numRunning });
+
+		uint64_t submitNs = nowNs();
+		Future<uint64_t> low = pool.submit(Priority::Low, [] { return nowNs(); });
+		pool.wait(low);
+		std::chrono::nanoseconds waited(low.get() - submitNs);
+		stop = true;
+		while (numRunning != 0)
+			std::this_thread::yield();
+		pool.stop();
+
+		TEST_CHECK(waited >= kLowMaxWait && waited < kLowMaxWait + kLateness,
+		           config.name << ": a low priority task waited "
+		           << std::chrono::duration_cast<std::chrono::microseconds>(waited).count() << "us behind a stream of work, not "
+		           << std::chrono::duration_cast<std::chrono::microseconds>(kLowMaxWait).count() << "us");
+	}
+
+	// Every call submits both of its recursive calls and waits for them, so at any
+	// time most tasks are waiting. The two threads must run the calls they wait on.
+	int fibonacci(ThreadPool& pool, int n)
+	{
+		if (n < 2)
+			return n;
+		Future<int> a = pool.submit([&pool, n] { return fibonacci(pool, n - 1); });
+		Future<int> b = pool.submit([&pool, n] { return fibonacci(pool, n - 2); });
+		pool.wait(a);
+		pool.wait(b);
+		return a.get() + b.get();
+	}
+
+	// Tasks nested many deep wait on tasks and batches they submit, with fewer
+	// threads than waiting tasks
+	void checkNestedWaits(const PoolConfig& config)
+	{
+		const int kFibonacciN = 18;
+		const int kExpected = 2584;
+		const size_t kBatchSize = 64;
+		const std::chrono::seconds kDeadlock(60);
+
+		// Deadlocked threads can't be joined, so the pool is left running if they are
+		std::unique_ptr<ThreadPool> owner(new ThreadPool(2));
+		ThreadPool& pool = *owner;
+		configure(pool, config);
+		pool.start();
+
+		Future<int> fib = pool.submit([&pool] { return fibonacci(pool, kFibonacciN); });
+		// Each batch task waits on a batch of its own
+		std::atomic<size_t> numInner{ 0 };
+		Future<void> batches = pool.submit([&pool, &numInner] {
+			BatchFuture outer = pool.submitBatch(kBatchSize, [&pool, &numInner](size_t) {
+				BatchFuture inner = pool.submitBatch(kBatchSize, [&numInner](size_t) { ++numInner; });
+				pool.wait(inner);
+			});
+			pool.wait(outer);
+		});
+
+		if (fib.wait_for(kDeadlock) != std::future_status::ready || batches.wait_for(kDeadlock) != std::future_status::ready) {
+			TEST_CHECK(false, config.name << ": nested waits on 2 threads deadlocked");
+			owner.release();
+			return;
+		}
+		int result = fib.get();
+		TEST_CHECK(result == kExpected && numInner == kBatchSize * kBatchSize,
+		           config.name << ": nested waits gave fibonacci(" << kFibonacciN << ") = " << result << ", not " << kExpected
+		           << ", and ran " << numInner << " of " << kBatchSize * kBatchSize << " nested batch tasks");
+		pool.stop();
+	}
+
+	// Fills scratch memory from the running task's arena, every fourth block too
+	// big for the arena's first chunk
+	void fillScratch(size_t i)
+	{
+		const size_t kSmallBytes = 256;
+		const size_t kLargeBytes = TaskArena::kDefaultChunkSize + 1024;
+
+		size_t size = i % 4 == 0 ? kLargeBytes : kSmallBytes;
+		std::memset(ThreadPool::taskArena().allocate(size), 0xEE, size);
+	}
+
+	// Tasks take scratch memory from their arena and then wait on tasks and a batch
+	// that take their own. The tasks run during the wait must only free what they
+	// allocated, not the memory of the task waiting beneath them.
+	void checkArenaNestedWaits(const PoolConfig& config)
+	{
+		const size_t kNumOuter = 8;
+		const size_t kNumInner = 32;
+		const size_t kOuterBytes = 4096;
+
+		ThreadPool pool(2);
+		configure(pool, config);
+		pool.start();
+
+		std::atomic<size_t> numCorrupted{ 0 };
+		std::atomic<size_t> numOverlapping{ 0 };
+		std::vector<Future<void>> outers;
+		for (size_t outer = 0; outer < kNumOuter; ++outer) {
+			outers.push_back(pool.submit([&pool, outer, &numCorrupted, &numOverlapping] {
+				TaskArena& arena = ThreadPool::taskArena();
+				unsigned char* before = static_cast<unsigned char*>(arena.allocate(kOuterBytes));
+				std::memset(before, static_cast<int>(outer + 1), kOuterBytes);
+
+				std::vector<Future<void>> inners;
+				for (size_t i = 0; i < kNumInner; ++i)
+					inners.push_back(pool.submit(fillScratch, i));
+				BatchFuture batch = pool.submitBatch(kNumInner, fillScratch);
+				for (Future<void>& inner : inners)
+					pool.wait(inner);
+				pool.wait(batch);
+
+				// What was allocated before the wait is still there, and isn't handed out again
+				unsigned char* after = static_cast<unsigned char*>(arena.allocate(kOuterBytes));
+				std::memset(after, 0xDD, kOuterBytes);
+				for (size_t i = 0; i < kOuterBytes; ++i) {
+					if (before[i] != outer + 1) {
+						++numCorrupted;
+						break;
+					}
+				}
+				if (after < before + kOuterBytes && before < after + kOuterBytes)
+					++numOverlapping;
+			}));
+		}
+		for (Future<void>& outer : outers)
+			pool.wait(outer);
+		pool.stop();
+
+		TEST_CHECK(numCorrupted == 0 && numOverlapping == 0,
+		           config.name << ": of " << kNumOuter << " tasks waiting on tasks using the arena, " << numCorrupted
+		           << " had their scratch memory overwritten and " << numOverlapping << " were given it again");
+	}
+}
+
+void runThreadPoolTests()
+{
+	for (const PoolConfig& config : g_kConfigs) {
+		checkResizeUnderLoad(config);
+		checkCancelAll(config);
+		checkCancelRunningBatch(config, true);
+		checkCancelRunningBatch(config, false);
+		checkPriorityOrder(config, 0);
+		checkPriorityOrder(config, 4);
+		checkLowAging(config);
+		checkNestedWaits(config);
+		checkArenaNestedWaits(config);
+	}
+}
@@ -0,0 +1,164 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Drives a TimerWheel through made up times to check timers on
+//                every level come down to fire on their own tick, and that
+//                cancelled timers are swept out early. Also checks a pool's
+//                submitEvery stops once its token is cancelled.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#include "Tests.h"
+#include "ThreadPool.h"
+#include "ThreadPoolStats.h"
+#include "TimerWheel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	// Long ticks, so the wheel never catches up with the real clock while the
+	// test is adding timers. The times given to advance are made up anyway.
+	const uint64_t g_kTickNs = 1000000000;
+
+	// Deadlines in ticks from the start, either side of where each level of the
+	// wheel begins, and past the furthest the wheel holds, 2^24 ticks
+	const uint64_t g_kDeadlineTicks[] = {
+		1, 2, 63, 64, 65, 100, 4095, 4096, 4097, 5000, 262143, 262144, 262145,
+		1000000, (uint64_t{ 1 } << 24) - 1, (uint64_t{ 1 } << 24) + 1000,
+	};
+
+	// Returns a tick a little after now, so timers added from it are all in the future
+	uint64_t startTick()
+	{
+		return nowNs() / g_kTickNs + 2;
+	}
+
+	// Releases due timers and runs their tasks
+	void advance(TimerWheel& wheel, uint64_t timeNs)
+	{
+		std::vector<Task> expired;
+		TEST_CHECK(wheel.advance(timeNs, expired), "advance found the wheel busy with no other thread using it");
+		for (Task& task : expired)
+			task();
+	}
+
+	// Each timer must fire on its own tick, not a nanosecond early and not a tick late,
+	// however many levels it has to come down through
+	void checkDeadlines()
+	{
+		const size_t kNumTimers = sizeof(g_kDeadlineTicks) / sizeof(g_kDeadlineTicks[0]);
+
+		TimerWheel wheel(g_kTickNs);
+		uint64_t start = startTick();
+		std::vector<int> numRuns(kNumTimers, 0);
+		for (size_t i = 0; i < kNumTimers; ++i)
+			wheel.add((start + g_kDeadlineTicks[i]) * g_kTickNs, Task([&numRuns, i] { ++numRuns[i]; }));
+		TEST_CHECK(wheel.size() == kNumTimers, "the wheel holds " << wheel.size() << " timers, not " << kNumTimers);
+
+		for (size_t i = 0; i < kNumTimers; ++i) {
+			uint64_t deadlineNs = (start + g_kDeadlineTicks[i]) * g_kTickNs;
+			TEST_CHECK(wheel.nextDeadline() <= deadlineNs,
+			           "the next deadline is " << wheel.nextDeadline() - start * g_kTickNs << "ns from the start, after the timer due at "
+			           << g_kDeadlineTicks[i] << " ticks");
+
+			advance(wheel, deadlineNs - 1);
+			TEST_CHECK(numRuns[i] == 0, "the timer due at " << g_kDeadlineTicks[i] << " ticks fired early");
+			advance(wheel, deadlineNs);
+			for (size_t j = 0; j < kNumTimers; ++j)
+				TEST_CHECK(numRuns[j] == (j <= i ? 1 : 0), "at " << g_kDeadlineTicks[i] << " ticks the timer due at "
+				           << g_kDeadlineTicks[j] << " ticks has fired " << numRuns[j] << " times");
+		}
+		TEST_CHECK(wheel.empty() && wheel.nextDeadline() == TimerWheel::kNoDeadline,
+		           "the wheel still holds " << wheel.size() << " timers after they all fired");
+	}
+
+	// Timers far in the future whose token is cancelled are released within a turn
+	// of the sweep, 16 ticks for each of the 64 slots, while the rest stay put
+	void checkCancelledSwept()
+	{
+		const uint64_t kSweepTicks = 16 * 64;
+		// The first is on level 1, the rest on levels 2 and 3
+		const uint64_t kFarTicks[] = { 2000, 100000, 200000, 1000000, 10000000 };
+
+		TimerWheel wheel(g_kTickNs);
+		CancellationSource cancelled;
+		CancellationSource kept;
+		uint64_t start = startTick();
+		std::atomic<size_t> numCancelledRun{ 0 };
+		std::atomic<size_t> numKeptRun{ 0 };
+		for (uint64_t ticks : kFarTicks) {
+			for (int i = 0; i < 10; ++i) {
+				uint64_t deadlineNs = (start + ticks + i) * g_kTickNs;
+				wheel.add(deadlineNs, Task([&numCancelledRun] { ++numCancelledRun; }), cancelled.getToken());
+				wheel.add(deadlineNs, Task([&numKeptRun] { ++numKeptRun; }), kept.getToken());
+			}
+		}
+		size_t numTimers = wheel.size();
+
+		cancelled.cancel();
+		advance(wheel, (start + kSweepTicks + 1) * g_kTickNs);
+		TEST_CHECK(numCancelledRun == numTimers / 2 && numKeptRun == 0 && wheel.size() == numTimers / 2,
+		           numCancelledRun << " of " << numTimers / 2 << " cancelled timers were swept out and " << numKeptRun
+		           << " others fired early, leaving " << wheel.size() << " timers");
+
+		// The kept timers still fire on time after the sweeps
+		advance(wheel, (start + kFarTicks[0] + 10) * g_kTickNs);
+		TEST_CHECK(numKeptRun == 10, numKeptRun << " timers had fired by their deadline, not 10");
+	}
+
+	// A periodic task runs until its token is cancelled, then its future throws
+	// CancelledError and it never runs again
+	void checkEveryStopsOnCancel()
+	{
+		const size_t kMinRuns = 3;
+
+		ThreadPool pool(2);
+		pool.start();
+
+		CancellationSource source;
+		std::atomic<size_t> numRuns{ 0 };
+		Future<void> every = pool.submitEvery(std::chrono::milliseconds(1), source.getToken(), [&numRuns] { ++numRuns; });
+
+		auto giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while (numRuns < kMinRuns && std::chrono::steady_clock::now() < giveUp)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		TEST_CHECK(numRuns >= kMinRuns, "a task due every millisecond ran " << numRuns << " times in 10 seconds");
+
+		source.cancel();
+		pool.wait(every);
+		bool threwCancelled = false;
+		try {
+			every.get();
+		}
+		catch (const CancelledError&) {
+			threwCancelled = true;
+		}
+		catch (...) {
+		}
+		TEST_CHECK(threwCancelled, "a cancelled periodic task's future didn't throw CancelledError");
+
+		size_t numRunsAtCancel = numRuns;
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		TEST_CHECK(numRuns == numRunsAtCancel, "a periodic task ran " << numRuns - numRunsAtCancel << " more times after it was cancelled");
+		pool.stop();
+	}
+}
+
+void runTimerTests()
+{
+	checkDeadlines();
+	checkCancelledSwept();
+	checkEveryStopsOnCancel();
+}
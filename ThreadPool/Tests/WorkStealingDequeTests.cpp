@@ -0,0 +1,114 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Checks the work stealing deque's ordering, and that every item
+//                is taken exactly once while the owner pushes and pops against
+//                thieves, including races for the last item and growth.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#include "Tests.h"
+#include "WorkStealingDeque.h"
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	const size_t g_kNumStressRounds = 16;
+	const size_t g_kNumStressItems = 50000;
+	const size_t g_kNumThieves = 3;
+
+	// The owner pops from the bottom in LIFO order and thieves steal from the top in FIFO order
+	void checkOrder()
+	{
+		// Starts small so pushing grows the buffer several times
+		WorkStealingDeque<size_t> deque(2);
+		for (size_t i = 0; i < 100; ++i)
+			deque.push(i);
+		TEST_CHECK(deque.size() == 100, "deque holds " << deque.size() << " items after 100 pushes");
+
+		size_t item = 0;
+		TEST_CHECK(deque.pop(item) && item == 99, "pop took " << item << " rather than the last item pushed");
+		TEST_CHECK(deque.steal(item) && item == 0, "steal took " << item << " rather than the first item pushed");
+		for (size_t expected = 98; expected > 0; --expected)
+			TEST_CHECK(deque.pop(item) && item == expected, "pop took " << item << " rather than " << expected);
+
+		TEST_CHECK(deque.empty(), "deque holds " << deque.size() << " items after taking them all");
+		TEST_CHECK(!deque.pop(item), "pop took " << item << " from an empty deque");
+		TEST_CHECK(!deque.steal(item), "steal took " << item << " from an empty deque");
+
+		// An emptied deque carries on where it left off
+		deque.push(7);
+		TEST_CHECK(deque.steal(item) && item == 7, "steal took " << item << " rather than the only item");
+		TEST_CHECK(deque.empty(), "deque holds " << deque.size() << " items after stealing the only one");
+	}
+
+	// The owner pushes bursts of items and pops some of them back, often emptying
+	// the deque so it races the thieves for the last item
+	void checkOwnerAgainstThieves(unsigned int seed)
+	{
+		WorkStealingDeque<size_t> deque(2);
+		std::atomic<bool> ownerDone{ false };
+		std::vector<std::vector<size_t>> taken(g_kNumThieves + 1);
+
+		std::vector<std::thread> thieves;
+		for (size_t thief = 1; thief <= g_kNumThieves; ++thief) {
+			thieves.emplace_back([&deque, &ownerDone, &taken, thief] {
+				std::vector<size_t>& stolen = taken[thief];
+				size_t item = 0;
+				while (!ownerDone.load(std::memory_order_acquire)) {
+					if (deque.steal(item))
+						stolen.push_back(item);
+				}
+				while (deque.steal(item))
+					stolen.push_back(item);
+			});
+		}
+
+		std::vector<size_t>& popped = taken[0];
+		std::mt19937 random(seed);
+		size_t item = 0;
+		size_t next = 0;
+		while (next < g_kNumStressItems) {
+			size_t burst = std::min<size_t>(random() % 64 + 1, g_kNumStressItems - next);
+			for (size_t i = 0; i < burst; ++i)
+				deque.push(next++);
+
+			size_t numPops = random() % (burst + 2);
+			for (size_t i = 0; i < numPops; ++i) {
+				if (deque.pop(item))
+					popped.push_back(item);
+			}
+			// Lets the thieves in mid burst even when there are fewer cores than threads
+			if (random() % 16 == 0)
+				std::this_thread::yield();
+		}
+		// pop can lose the race for the last item, so keep going until the deque is empty
+		while (!deque.empty()) {
+			if (deque.pop(item))
+				popped.push_back(item);
+		}
+
+		ownerDone.store(true, std::memory_order_release);
+		for (std::thread& thief : thieves)
+			thief.join();
+
+		checkExactlyOnce("owner against thieves", taken, g_kNumStressItems);
+	}
+}
+
+void runWorkStealingDequeTests()
+{
+	checkOrder();
+	for (unsigned int round = 0; round < g_kNumStressRounds; ++round)
+		checkOwnerAgainstThieves(round);
+}
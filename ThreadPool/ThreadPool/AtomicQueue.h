@@ -14,8 +14,12 @@
 #ifndef WORKQUEUE_H
 #define WORKQUEUE_H
 
-#include <queue>
+#include <algorithm>
+#include <vector>
+#include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <utility>
 
 template<typename T>
 class AtomicQueue
@@ -24,25 +28,90 @@ public:
 	AtomicQueue() {}
 
 	// Insert an item at the back of the queue.
-	void push(const T&& item)
+	void push(T&& item)
 	{
-		std::lock_guard<std::mutex> lock(m_mutex);
-		m_workQueue.push(std::forward<const T>(item));
-		m_cvNotEmpty.notify_one(); 
+		bool hasWaiters;
+		{
+			std::unique_lock<std::mutex> lock = lockQueue();
+			if (m_count == m_workQueue.size())
+				grow();
+			m_workQueue[(m_head + m_count) & (m_workQueue.size() - 1)] = std::move(item);
+			++m_count;
+			publishSize();
+			hasWaiters = m_numWaiting > 0;
+		}
+		// Notify outside the lock so the woken thread doesn't immediately block on it,
+		// and only when someone is blocked in pop to save the system call
+		if (hasWaiters)
+			m_cvNotEmpty.notify_one();
+	}
+
+	// Inserts count items at the back of the queue while only locking once.
+	// makeItem(i) is called to create the i'th item.
+	template<typename Generator>
+	void pushBulk(size_t count, Generator&& makeItem)
+	{
+		if (count == 0)
+			return;
+		bool hasWaiters;
+		{
+			std::unique_lock<std::mutex> lock = lockQueue();
+			while (m_count + count > m_workQueue.size())
+				grow();
+			for (size_t i = 0; i < count; ++i)
+			{
+				m_workQueue[(m_head + m_count) & (m_workQueue.size() - 1)] = makeItem(i);
+				++m_count;
+			}
+			publishSize();
+			hasWaiters = m_numWaiting > 0;
+		}
+		if (!hasWaiters)
+			return;
+		if (count == 1)
+			m_cvNotEmpty.notify_one();
+		else
+			m_cvNotEmpty.notify_all();
 	}
 
 	// Attempts to get a workitem from the queue
 	// If the queue is empty just return false; 
 	bool tryPop(T& workItem)
 	{
-		std::lock_guard<std::mutex> lock(m_mutex);
+		std::unique_lock<std::mutex> lock = lockQueue();
 		//If the queue is empty return false
-		if(m_workQueue.empty())
+		if(m_count == 0)
+		{
+			return false;
+		}
+		popFront(workItem);
+		return true;
+	}
+
+	// Moves up to maxCount items from the front of the queue into out while only
+	// locking once. Returns the number of items moved, 0 if the queue was empty.
+	size_t popBulk(T* out, size_t maxCount)
+	{
+		std::unique_lock<std::mutex> lock = lockQueue();
+		size_t count = std::min(maxCount, m_count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			popFront(out[i]);
+		}
+		return count;
+	}
+
+	// Pops the front item only if shouldPop(front) returns true.
+	// Returns false if the queue is empty or the item was left in place.
+	template<typename Predicate>
+	bool tryPopIf(T& workItem, Predicate&& shouldPop)
+	{
+		std::unique_lock<std::mutex> lock = lockQueue();
+		if (m_count == 0 || !shouldPop(static_cast<const T&>(m_workQueue[m_head])))
 		{
 			return false;
 		}
-		workItem = std::move(m_workQueue.front());
-		m_workQueue.pop();
+		popFront(workItem);
 		return true;
 	}
 
@@ -50,36 +119,96 @@ public:
 	// If the queue is empty then block and wait for items.
 	void pop(T& workItem)
 	{
-		std::unique_lock<std::mutex> lock(m_mutex);
+		std::unique_lock<std::mutex> lock = lockQueue();
 		//If the queue is empty block the thread from running until a work item becomes available
-		m_cvNotEmpty.wait(lock, [this]{return !m_workQueue.empty();});
-		workItem = std::move(m_workQueue.front());
-		m_workQueue.pop();
+		++m_numWaiting;
+		m_cvNotEmpty.wait(lock, [this]{return m_count != 0;});
+		--m_numWaiting;
+		popFront(workItem);
 	}
 
 	// Clears the queue
 	void clear() {
-		std::lock_guard<std::mutex> lock(m_mutex);
-		m_workQueue.swap(std::queue<T>()); // Swap with empty queue to clear
+		std::vector<T> items;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			items.swap(m_workQueue);
+			m_head = 0;
+			m_count = 0;
+			publishSize();
+		}
+		// Items are destroyed outside the lock in case their destructors use the queue
 	}
 
-	// Checks if the queue is empty or not
+	// Checks if the queue is empty or not.
+	// Doesn't lock, so it is cheap enough for idle threads to poll.
 	bool empty() const
 	{
-		std::lock_guard<std::mutex> lock(m_mutex);
-		return m_workQueue.empty();
+		return m_size.load(std::memory_order_relaxed) == 0;
 	}
 
 	// Returns the number of items in the queue
 	size_t size() const
 	{
-		std::lock_guard<std::mutex> lock(m_mutex);
-		return m_workQueue.size();
+		return m_size.load(std::memory_order_relaxed);
+	}
+
+	// Returns the number of times a thread had to wait for another to unlock the queue
+	size_t numContended() const
+	{
+		return m_numContended.load(std::memory_order_relaxed);
 	}
 
 private:
-	std::queue<T> m_workQueue;
-	mutable std::mutex m_mutex;
+	// Locks the queue, counting the times it was already locked
+	std::unique_lock<std::mutex> lockQueue()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+		if (!lock.owns_lock()) {
+			m_numContended.fetch_add(1, std::memory_order_relaxed);
+			lock.lock();
+		}
+		return lock;
+	}
+
+	// Moves the front item out of the queue, the lock must be held
+	void popFront(T& workItem)
+	{
+		workItem = std::move(m_workQueue[m_head]);
+		m_head = (m_head + 1) & (m_workQueue.size() - 1);
+		--m_count;
+		publishSize();
+	}
+
+	// Makes the item count visible to readers that don't lock, the lock must be held
+	void publishSize()
+	{
+		m_size.store(m_count, std::memory_order_relaxed);
+	}
+
+	// Doubles the size of the ring buffer, the lock must be held
+	void grow()
+	{
+		std::vector<T> bigger(m_workQueue.empty() ? 16 : m_workQueue.size() * 2);
+		for (size_t i = 0; i < m_count; ++i)
+		{
+			bigger[i] = std::move(m_workQueue[(m_head + i) & (m_workQueue.size() - 1)]);
+		}
+		m_workQueue.swap(bigger);
+		m_head = 0;
+	}
+
+	// A ring buffer of items, reused between pushes so a steady stream of
+	// items doesn't allocate. The size is always zero or a power of two.
+	std::vector<T> m_workQueue;
+	size_t m_head = 0;
+	size_t m_count = 0;
+	// A copy of m_count that can be read without locking
+	std::atomic<size_t> m_size{ 0 };
+	// Number of threads blocked in pop
+	size_t m_numWaiting = 0;
+	std::atomic<size_t> m_numContended{ 0 };
+	std::mutex m_mutex;
 	std::condition_variable m_cvNotEmpty;
 	
 };
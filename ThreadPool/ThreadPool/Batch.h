@@ -0,0 +1,276 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Shared state and completion handle for a batch of tasks
+//                submitted together. The whole batch shares one countdown, so
+//                checking if it has finished is a single atomic load.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "BlockAllocator.h"
+#include "Future.h"
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <future>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// The parts of a batch's shared state that don't depend on the callable type.
+// Holds one reference for the handle and one shared by all of the batch's tasks.
+class BatchStateBase : public FutureStateBase
+{
+public:
+	// Waits for every task and throws the first exception any of them threw
+	void get()
+	{
+		wait();
+		rethrowIfException();
+	}
+
+protected:
+	explicit BatchStateBase(size_t numTasks)
+		: m_numRemaining{ numTasks }
+	{
+		if (numTasks == 0)
+			markReady();
+		else
+			addRef();
+	}
+
+	// Called once by each task in the batch, when it has run or been discarded.
+	// The last task to finish marks the batch ready and drops the tasks' reference.
+	void finishTask()
+	{
+		if (m_numRemaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			markReady();
+			release();
+		}
+	}
+
+	// Keeps the first exception thrown by a task in the batch
+	void storeException(std::exception_ptr exception)
+	{
+		if (!m_hasException.exchange(true, std::memory_order_relaxed))
+			m_exception = std::move(exception);
+	}
+
+private:
+	std::atomic<size_t> m_numRemaining;
+	std::atomic_bool m_hasException{ false };
+};
+
+// Shared state of a batch, owns the callable that every task in the batch invokes
+template<typename Callable>
+class BatchState : public BatchStateBase
+{
+public:
+	static BatchState* create(Callable&& callable, size_t numTasks)
+	{
+		void* memory = BlockAllocator::allocate(sizeof(BatchState));
+		return new (memory) BatchState(std::move(callable), numTasks);
+	}
+
+	// Invokes the callable for each index in [begin, end)
+	void run(size_t begin, size_t end)
+	{
+		try {
+			for (size_t i = begin; i < end; ++i)
+				m_callable(i);
+		} catch (...) {
+			storeException(std::current_exception());
+		}
+		finishTask();
+	}
+
+	// Called for tasks that are destroyed without being run
+	void abandon()
+	{
+		storeException(std::make_exception_ptr(makeFutureError(std::future_errc::broken_promise)));
+		finishTask();
+	}
+
+private:
+	BatchState(Callable&& callable, size_t numTasks)
+		: BatchStateBase(numTasks)
+		, m_callable{ std::move(callable) }
+	{
+	}
+
+	void destroy() override
+	{
+		this->~BatchState();
+		BlockAllocator::deallocate(this);
+	}
+
+	Callable m_callable;
+};
+
+// A single task of a batch, runs a range of indices of the batch's callable.
+// Small enough to be stored inline in a Task.
+template<typename Callable>
+class BatchTask
+{
+public:
+	BatchTask(BatchState<Callable>* state, size_t begin, size_t end)
+		: m_state{ state }
+		, m_begin{ begin }
+		, m_end{ end }
+	{
+	}
+
+	BatchTask(BatchTask&& other) noexcept
+		: m_state{ other.m_state }
+		, m_begin{ other.m_begin }
+		, m_end{ other.m_end }
+	{
+		other.m_state = nullptr;
+	}
+
+	~BatchTask()
+	{
+		if (m_state)
+			m_state->abandon();
+	}
+
+	// The BatchTask is non-copyable.
+	BatchTask(const BatchTask&) = delete;
+	BatchTask& operator= (const BatchTask&) = delete;
+	BatchTask& operator= (BatchTask&&) = delete;
+
+	void operator()()
+	{
+		BatchState<Callable>* state = m_state;
+		m_state = nullptr;
+		state->run(m_begin, m_end);
+	}
+
+private:
+	BatchState<Callable>* m_state;
+	size_t m_begin;
+	size_t m_end;
+};
+
+// Tracks the completion of a batch of tasks.
+// Works like a Future<void> for the whole batch.
+class BatchFuture
+{
+public:
+	BatchFuture() {}
+
+	explicit BatchFuture(BatchStateBase* state)
+		: m_state{ state }
+	{
+	}
+
+	BatchFuture(BatchFuture&& other) noexcept
+		: m_state{ other.m_state }
+	{
+		other.m_state = nullptr;
+	}
+
+	BatchFuture& operator= (BatchFuture&& other) noexcept
+	{
+		if (this != &other) {
+			if (m_state)
+				m_state->release();
+			m_state = other.m_state;
+			other.m_state = nullptr;
+		}
+		return *this;
+	}
+
+	~BatchFuture()
+	{
+		if (m_state)
+			m_state->release();
+	}
+
+	// The BatchFuture is non-copyable.
+	BatchFuture(const BatchFuture&) = delete;
+	BatchFuture& operator= (const BatchFuture&) = delete;
+
+	// Returns true if the handle refers to a batch
+	bool valid() const
+	{
+		return m_state != nullptr;
+	}
+
+	// Returns true once every task in the batch has finished
+	bool isReady() const
+	{
+		return m_state && m_state->isReady();
+	}
+
+	// Blocks until every task in the batch has finished
+	void wait() const
+	{
+		m_state->wait();
+	}
+
+	// Blocks until every task in the batch has finished or the timeout expires
+	template<typename Rep, typename Period>
+	std::future_status wait_for(const std::chrono::duration<Rep, Period>& timeout) const
+	{
+		return m_state->waitFor(timeout) ? std::future_status::ready : std::future_status::timeout;
+	}
+
+	// Waits for the batch and throws the first exception thrown by any of its
+	// tasks. The handle is invalid afterwards.
+	void get()
+	{
+		if (!m_state)
+			throw makeFutureError(std::future_errc::no_state);
+		BatchFuture batch(std::move(*this));
+		batch.m_state->get();
+	}
+
+	// Calls callback(batch) once every task in the batch has finished, passing
+	// this handle. Called on the thread that finished the last task, or on this
+	// thread if the batch already has, so callback shouldn't block.
+	// The handle is invalid afterwards.
+	template<typename Callback>
+	void onReady(Callback&& callback)
+	{
+		if (!m_state)
+			throw makeFutureError(std::future_errc::no_state);
+
+		BatchStateBase* state = m_state;
+		m_state = nullptr;
+		auto continuation = [state, callback = std::forward<Callback>(callback)]() mutable {
+			callback(BatchFuture(state));
+		};
+		state->addContinuation(CallableContinuation<decltype(continuation)>::create(std::move(continuation)));
+	}
+
+	// Runs the continuation once every task in the batch has finished, see
+	// Continuation::run. The continuation must stay alive until it has run.
+	void addContinuation(Continuation* continuation) const
+	{
+		if (!m_state)
+			throw makeFutureError(std::future_errc::no_state);
+		m_state->addContinuation(continuation);
+	}
+
+private:
+	BatchStateBase* m_state = nullptr;
+};
+
+// Returns true when every task in a batch has finished
+inline bool isReady(const BatchFuture& batch)
+{
+	return batch.isReady();
+}
+
+#endif
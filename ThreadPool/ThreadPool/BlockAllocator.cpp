@@ -0,0 +1,249 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : A thread caching allocator for small, short lived blocks
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+//Library Includes
+#include <atomic>
+#include <cstdint>
+#include <new>
+
+//This Include
+#include "BlockAllocator.h"
+
+thread_local BlockAllocator::ThreadCache* BlockAllocator::tl_cache = nullptr;
+thread_local bool BlockAllocator::tl_cacheDestroyed = false;
+
+namespace {
+	// Size classes are 64, 128, 256 and 512 bytes
+	const size_t kNumSizeClasses = 4;
+	const size_t kMinBlockSize = 64;
+
+	// The most blocks of each size class a thread keeps around
+	const size_t kMaxCachedBlocks = 1024;
+
+	size_t classBlockSize(size_t sizeClass)
+	{
+		return kMinBlockSize << sizeClass;
+	}
+}
+
+// Sits in front of every block. Kept at 16 bytes so the block stays 16 byte aligned.
+struct BlockAllocator::BlockHeader {
+	// The thread cache that created the block, nullptr for large blocks
+	ThreadCache* owner;
+	size_t sizeClass;
+
+	void* payload() { return this + 1; }
+
+	// Free blocks are linked through their payload
+	BlockHeader*& next() { return *static_cast<BlockHeader**>(payload()); }
+};
+
+class BlockAllocator::ThreadCache
+{
+public:
+	// Before C++17 new ignores alignments wider than std::max_align_t, so the cache
+	// is aligned by hand, with the start of its memory stored just before it
+	static ThreadCache* create()
+	{
+		void* memory = ::operator new(sizeof(void*) + alignof(ThreadCache) - 1 + sizeof(ThreadCache));
+		uintptr_t address = reinterpret_cast<uintptr_t>(memory) + sizeof(void*);
+		address = (address + alignof(ThreadCache) - 1) & ~static_cast<uintptr_t>(alignof(ThreadCache) - 1);
+		reinterpret_cast<void**>(address)[-1] = memory;
+		return new (reinterpret_cast<void*>(address)) ThreadCache();
+	}
+
+	// Takes a block from the local free lists, refilling them from blocks other
+	// threads have handed back if needed. Returns nullptr if none are cached.
+	BlockHeader* pop(size_t sizeClass)
+	{
+		if (!m_freeLists[sizeClass])
+			collectRemoteFrees();
+
+		BlockHeader* block = m_freeLists[sizeClass];
+		if (block) {
+			m_freeLists[sizeClass] = block->next();
+			--m_numCached[sizeClass];
+		}
+		return block;
+	}
+
+	// Creates a new block owned by this cache
+	BlockHeader* create(size_t sizeClass)
+	{
+		void* memory = ::operator new(sizeof(BlockHeader) + classBlockSize(sizeClass));
+		m_numBlocks.fetch_add(1, std::memory_order_relaxed);
+		return new (memory) BlockHeader{ this, sizeClass };
+	}
+
+	// Returns a block owned by this cache, called by the owning thread
+	void pushLocal(BlockHeader* block)
+	{
+		size_t sizeClass = block->sizeClass;
+		if (m_numCached[sizeClass] >= kMaxCachedBlocks) {
+			destroy(block);
+			return;
+		}
+		block->next() = m_freeLists[sizeClass];
+		m_freeLists[sizeClass] = block;
+		++m_numCached[sizeClass];
+	}
+
+	// Returns a block owned by this cache, called from another thread
+	void pushRemote(BlockHeader* block)
+	{
+		BlockHeader* head = m_remoteFrees.load(std::memory_order_relaxed);
+		do {
+			// The owning thread has exited, nobody will collect the block
+			if (head == orphaned()) {
+				destroy(block);
+				return;
+			}
+			block->next() = head;
+		} while (!m_remoteFrees.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	// Called when the owning thread exits. Frees every cached block. The cache
+	// itself is deleted once the last block it owns has been freed.
+	void orphan()
+	{
+		BlockHeader* remote = m_remoteFrees.exchange(orphaned(), std::memory_order_acquire);
+		size_t numFreed = freeList(remote);
+		for (size_t i = 0; i < kNumSizeClasses; ++i) {
+			numFreed += freeList(m_freeLists[i]);
+			m_freeLists[i] = nullptr;
+		}
+
+		// Drop the owning thread's reference along with the freed blocks
+		releaseBlocks(numFreed + 1);
+	}
+
+private:
+	static BlockHeader* orphaned()
+	{
+		static BlockHeader s_orphaned{ nullptr, 0 };
+		return &s_orphaned;
+	}
+
+	void collectRemoteFrees()
+	{
+		if (!m_remoteFrees.load(std::memory_order_relaxed))
+			return;
+
+		BlockHeader* block = m_remoteFrees.exchange(nullptr, std::memory_order_acquire);
+		while (block) {
+			BlockHeader* next = block->next();
+			pushLocal(block);
+			block = next;
+		}
+	}
+
+	void destroy(BlockHeader* block)
+	{
+		block->~BlockHeader();
+		::operator delete(block);
+		releaseBlocks(1);
+	}
+
+	size_t freeList(BlockHeader* block)
+	{
+		size_t numFreed = 0;
+		while (block) {
+			BlockHeader* next = block->next();
+			block->~BlockHeader();
+			::operator delete(block);
+			block = next;
+			++numFreed;
+		}
+		return numFreed;
+	}
+
+	void releaseBlocks(size_t count)
+	{
+		if (m_numBlocks.fetch_sub(count, std::memory_order_acq_rel) == count) {
+			void* memory = reinterpret_cast<void**>(this)[-1];
+			this->~ThreadCache();
+			::operator delete(memory);
+		}
+	}
+
+	ThreadCache() {}
+
+	BlockHeader* m_freeLists[kNumSizeClasses] = {};
+	size_t m_numCached[kNumSizeClasses] = {};
+
+	// Number of blocks owned by this cache that still exist,
+	// plus one for the owning thread while it is alive
+	std::atomic<size_t> m_numBlocks{ 1 };
+
+	// Blocks freed by other threads waiting to be collected by the owner
+	alignas(64) std::atomic<BlockHeader*> m_remoteFrees{ nullptr };
+};
+
+void* BlockAllocator::allocate(size_t size)
+{
+	ThreadCache* cache = size <= kMaxBlockSize ? threadCache() : nullptr;
+	if (!cache) {
+		void* memory = ::operator new(sizeof(BlockHeader) + size);
+		return (new (memory) BlockHeader{ nullptr, 0 })->payload();
+	}
+
+	size_t blockClass = sizeClass(size);
+	BlockHeader* block = cache->pop(blockClass);
+	if (!block)
+		block = cache->create(blockClass);
+	return block->payload();
+}
+
+void BlockAllocator::deallocate(void* block)
+{
+	if (!block)
+		return;
+
+	BlockHeader* header = static_cast<BlockHeader*>(block) - 1;
+	if (!header->owner) {
+		header->~BlockHeader();
+		::operator delete(header);
+	} else if (header->owner == tl_cache) {
+		header->owner->pushLocal(header);
+	} else {
+		header->owner->pushRemote(header);
+	}
+}
+
+size_t BlockAllocator::sizeClass(size_t size)
+{
+	size_t sizeClass = 0;
+	while (classBlockSize(sizeClass) < size)
+		++sizeClass;
+	return sizeClass;
+}
+
+BlockAllocator::ThreadCache* BlockAllocator::threadCache()
+{
+	// The cache can outlive its thread while other threads still hold its blocks,
+	// so it is heap allocated and orphaned rather than destroyed on thread exit.
+	struct CacheHolder {
+		CacheHolder() { tl_cache = ThreadCache::create(); }
+		~CacheHolder()
+		{
+			tl_cache->orphan();
+			tl_cache = nullptr;
+			tl_cacheDestroyed = true;
+		}
+	};
+
+	if (!tl_cache && !tl_cacheDestroyed) {
+		static thread_local CacheHolder tl_cacheHolder;
+	}
+	return tl_cache;
+}
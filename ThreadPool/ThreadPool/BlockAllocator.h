@@ -0,0 +1,51 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : A thread caching allocator for small, short lived blocks
+//                such as task shared states. Freed blocks are kept on per
+//                thread free lists and reused, so steady state allocation
+//                does not touch the global heap.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#ifndef BLOCKALLOCATOR_H
+#define BLOCKALLOCATOR_H
+
+#include <cstddef>
+
+class BlockAllocator
+{
+public:
+	// Allocates a block of at least size bytes, aligned for any fundamental type.
+	// Blocks larger than kMaxBlockSize come straight from the global heap.
+	static void* allocate(size_t size);
+
+	// Returns a block to the allocator. May be called from any thread, blocks
+	// freed on a different thread are handed back to the thread that owns them.
+	static void deallocate(void* block);
+
+	// The largest block that will be cached
+	static const size_t kMaxBlockSize = 512;
+
+private:
+	class ThreadCache;
+	struct BlockHeader;
+
+	// Returns the size class index for a block size
+	static size_t sizeClass(size_t size);
+
+	// Returns the cache for the calling thread, creating it if needed.
+	// Returns nullptr once the thread has started shutting down.
+	static ThreadCache* threadCache();
+
+	static thread_local ThreadCache* tl_cache;
+	static thread_local bool tl_cacheDestroyed;
+};
+
+#endif
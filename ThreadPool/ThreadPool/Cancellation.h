@@ -0,0 +1,107 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Cooperative cancellation for work submitted to a thread pool.
+//                A CancellationSource hands out tokens for its current
+//                generation. Cancelling starts a new generation, which
+//                cancels every token handed out before it.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#ifndef CANCELLATION_H
+#define CANCELLATION_H
+
+#include <atomic>
+#include <stdexcept>
+#include <type_traits>
+
+// Thrown from tasks that were cancelled before they finished
+class CancelledError : public std::runtime_error
+{
+public:
+	CancelledError()
+		: std::runtime_error("The task was cancelled")
+	{
+	}
+};
+
+// Lets running work check if it has been cancelled.
+// Tokens are cheap to copy and polling is a single relaxed atomic load.
+// The CancellationSource a token came from must outlive the token.
+class CancellationToken
+{
+public:
+	// A token that is never cancelled
+	CancellationToken() {}
+
+	// Returns true if the source that created the token has been cancelled
+	bool isCancelled() const
+	{
+		return m_generation && m_generation->load(std::memory_order_relaxed) != m_expectedGeneration;
+	}
+
+	// Returns false for tokens that are never cancelled
+	bool canBeCancelled() const
+	{
+		return m_generation != nullptr;
+	}
+
+	// Throws a CancelledError if the token has been cancelled
+	void throwIfCancelled() const
+	{
+		if (isCancelled())
+			throw CancelledError();
+	}
+
+private:
+	friend class CancellationSource;
+
+	CancellationToken(const std::atomic<size_t>* generation, size_t expectedGeneration)
+		: m_generation{ generation }
+		, m_expectedGeneration{ expectedGeneration }
+	{
+	}
+
+	const std::atomic<size_t>* m_generation = nullptr;
+	size_t m_expectedGeneration = 0;
+};
+
+// Creates tokens and cancels them.
+class CancellationSource
+{
+public:
+	CancellationSource() {}
+
+	// The CancellationSource is non-copyable.
+	CancellationSource(const CancellationSource&) = delete;
+	CancellationSource& operator= (const CancellationSource&) = delete;
+
+	// Returns a token for the current generation.
+	// It is cancelled by the next call to cancel().
+	CancellationToken getToken() const
+	{
+		return CancellationToken(&m_generation, m_generation.load(std::memory_order_relaxed));
+	}
+
+	// Cancels every token handed out so far.
+	// Tokens requested afterwards are not cancelled.
+	void cancel()
+	{
+		m_generation.fetch_add(1, std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<size_t> m_generation{ 0 };
+};
+
+// True if T is a CancellationToken, ignoring references and cv qualifiers
+template<typename T>
+struct IsCancellationToken : std::is_same<std::decay_t<T>, CancellationToken> { };
+
+#endif
@@ -0,0 +1,280 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : C++20 coroutine support for the thread pool. AsyncTask is a
+//                lazily started coroutine, and Futures and BatchFutures can be
+//                awaited without blocking a thread. Empty before C++20.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#pragma once
+
+#if defined(__cpp_impl_coroutine)
+#define THREADPOOL_HAS_COROUTINES 1
+#else
+#define THREADPOOL_HAS_COROUTINES 0
+#endif
+
+#if THREADPOOL_HAS_COROUTINES
+
+#include "Batch.h"
+#include "BlockAllocator.h"
+#include "Future.h"
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+class ThreadPool;
+
+template<typename T>
+class AsyncTask;
+
+namespace CoroutineDetail {
+	// Coroutine frames come from the BlockAllocator, like futures' shared states
+	struct PoolAllocated {
+		static void* operator new(size_t size)
+		{
+			return BlockAllocator::allocate(size);
+		}
+
+		static void operator delete(void* frame)
+		{
+			BlockAllocator::deallocate(frame);
+		}
+	};
+
+	// Resumes the coroutine awaiting the one that finished, if any
+	struct FinalAwaiter {
+		bool await_ready() noexcept { return false; }
+
+		template<typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept
+		{
+			std::coroutine_handle<> continuation = finished.promise().continuation;
+			return continuation ? continuation : std::noop_coroutine();
+		}
+
+		void await_resume() noexcept {}
+	};
+
+	template<typename T>
+	struct AsyncTaskPromiseBase : PoolAllocated {
+		// The coroutine awaiting this one
+		std::coroutine_handle<> continuation;
+		std::exception_ptr exception;
+
+		// Nothing runs until the task is awaited
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		FinalAwaiter final_suspend() noexcept { return {}; }
+
+		void unhandled_exception()
+		{
+			exception = std::current_exception();
+		}
+
+		AsyncTask<T> get_return_object() noexcept;
+	};
+
+	template<typename T>
+	struct AsyncTaskPromise : AsyncTaskPromiseBase<T> {
+		std::optional<T> value;
+
+		template<typename U>
+		void return_value(U&& result)
+		{
+			value.emplace(std::forward<U>(result));
+		}
+
+		T result()
+		{
+			if (this->exception)
+				std::rethrow_exception(this->exception);
+			return std::move(*value);
+		}
+	};
+
+	template<>
+	struct AsyncTaskPromise<void> : AsyncTaskPromiseBase<void> {
+		void return_void() {}
+
+		void result()
+		{
+			if (exception)
+				std::rethrow_exception(exception);
+		}
+	};
+
+	// A coroutine that starts straight away and frees itself when it finishes
+	struct DetachedCoroutine {
+		struct promise_type : PoolAllocated {
+			DetachedCoroutine get_return_object() noexcept { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception() { std::terminate(); }
+		};
+	};
+
+	// Suspends until a future or batch is ready. Resumes on the thread that made it ready
+	// if that thread belongs to the pool the coroutine was running on, otherwise the
+	// coroutine is queued on that pool. Coroutines outside any pool resume on the thread.
+	template<typename FutureT>
+	class ReadyAwaiter : public Continuation
+	{
+	public:
+		explicit ReadyAwaiter(FutureT&& future)
+			: m_future(std::move(future))
+		{
+		}
+
+		bool await_ready() const
+		{
+			return m_future.isReady();
+		}
+
+		void await_suspend(std::coroutine_handle<> awaiting);
+
+		auto await_resume()
+		{
+			return m_future.get();
+		}
+
+		void run() override;
+
+	private:
+		FutureT m_future;
+		std::coroutine_handle<> m_awaiting;
+		// The pool the coroutine was running on when it suspended, nullptr if none
+		ThreadPool* m_pool = nullptr;
+	};
+}
+
+// The result of a coroutine that starts running when it is first awaited, on
+// the awaiting thread. co_await on it returns the coroutine's result or rethrows
+// its exception. Use ThreadPool::spawn to start one from outside a coroutine.
+template<typename T>
+class AsyncTask
+{
+public:
+	using promise_type = CoroutineDetail::AsyncTaskPromise<T>;
+
+	AsyncTask() {}
+
+	explicit AsyncTask(std::coroutine_handle<promise_type> handle)
+		: m_handle(handle)
+	{
+	}
+
+	AsyncTask(AsyncTask&& other) noexcept
+		: m_handle(std::exchange(other.m_handle, nullptr))
+	{
+	}
+
+	AsyncTask& operator= (AsyncTask&& other) noexcept
+	{
+		if (this != &other) {
+			if (m_handle)
+				m_handle.destroy();
+			m_handle = std::exchange(other.m_handle, nullptr);
+		}
+		return *this;
+	}
+
+	~AsyncTask()
+	{
+		if (m_handle)
+			m_handle.destroy();
+	}
+
+	// The AsyncTask is non-copyable.
+	AsyncTask(const AsyncTask&) = delete;
+	AsyncTask& operator= (const AsyncTask&) = delete;
+
+	// Returns true if the task refers to a coroutine
+	bool valid() const
+	{
+		return static_cast<bool>(m_handle);
+	}
+
+	// Returns true once the coroutine has finished
+	bool isReady() const
+	{
+		return m_handle && m_handle.done();
+	}
+
+	auto operator co_await() && noexcept
+	{
+		struct Awaiter {
+			std::coroutine_handle<promise_type> handle;
+
+			bool await_ready() const noexcept
+			{
+				return handle.done();
+			}
+
+			// Starts the task, it resumes the awaiting coroutine when it finishes
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+			{
+				handle.promise().continuation = awaiting;
+				return handle;
+			}
+
+			T await_resume()
+			{
+				return handle.promise().result();
+			}
+		};
+		return Awaiter{ m_handle };
+	}
+
+private:
+	std::coroutine_handle<promise_type> m_handle;
+};
+
+template<typename T>
+inline AsyncTask<T> CoroutineDetail::AsyncTaskPromiseBase<T>::get_return_object() noexcept
+{
+	using PromiseT = AsyncTaskPromise<T>;
+	return AsyncTask<T>(std::coroutine_handle<PromiseT>::from_promise(static_cast<PromiseT&>(*this)));
+}
+
+// Awaits a future without blocking. A coroutine running on a pool resumes on that
+// pool, on the thread that stores the result if it is one of the pool's threads.
+template<typename T>
+CoroutineDetail::ReadyAwaiter<Future<T>> operator co_await(Future<T>&& future)
+{
+	return CoroutineDetail::ReadyAwaiter<Future<T>>(std::move(future));
+}
+
+// Awaits every task in a batch without blocking, rethrowing the first exception.
+inline CoroutineDetail::ReadyAwaiter<BatchFuture> operator co_await(BatchFuture&& batch)
+{
+	return CoroutineDetail::ReadyAwaiter<BatchFuture>(std::move(batch));
+}
+
+// Moves the awaiting coroutine onto one of a ThreadPool's threads, see ThreadPool::schedule
+class ScheduleAwaitable
+{
+public:
+	explicit ScheduleAwaitable(ThreadPool& pool)
+		: m_pool(pool)
+	{
+	}
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> awaiting);
+	void await_resume() const noexcept {}
+
+private:
+	ThreadPool& m_pool;
+};
+
+#endif
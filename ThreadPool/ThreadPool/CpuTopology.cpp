@@ -0,0 +1,304 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Detects how logical CPUs are grouped into cores and NUMA
+//                nodes, and pins threads to them.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+//Library Includes
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <tuple>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#endif
+
+//This Include
+#include "CpuTopology.h"
+
+namespace {
+	// Reads the first line of a file
+	bool readLine(const std::string& path, std::string& line)
+	{
+		std::ifstream file(path);
+		return file && std::getline(file, line);
+	}
+
+	bool readUnsigned(const std::string& path, unsigned int& value)
+	{
+		std::ifstream file(path);
+		return file && (file >> value);
+	}
+
+	// Sorts so CPUs sharing a core are adjacent, and cores sharing a node are adjacent
+	void sortCompact(std::vector<LogicalCpu>& cpus)
+	{
+		std::sort(cpus.begin(), cpus.end(), [](const LogicalCpu& a, const LogicalCpu& b) {
+			return std::tie(a.node, a.package, a.core, a.id) < std::tie(b.node, b.package, b.core, b.id);
+		});
+	}
+
+	// For CPUs in compact order, returns how many CPUs of the same core come before each one.
+	// Rank 0 is the first hardware thread of each core.
+	std::vector<size_t> smtRanks(const std::vector<LogicalCpu>& cpus)
+	{
+		std::vector<size_t> ranks(cpus.size(), 0);
+		for (size_t i = 1; i < cpus.size(); ++i)
+		{
+			const LogicalCpu& previous = cpus[i - 1];
+			if (cpus[i].package == previous.package && cpus[i].core == previous.core && cpus[i].node == previous.node)
+				ranks[i] = ranks[i - 1] + 1;
+		}
+		return ranks;
+	}
+}
+
+std::vector<LogicalCpu> CpuTopology::detect()
+{
+	std::vector<LogicalCpu> cpus;
+
+#if defined(__linux__)
+	std::string onlineList;
+	std::vector<unsigned int> onlineIds;
+	if (readLine("/sys/devices/system/cpu/online", onlineList) && parseCpuList(onlineList, onlineIds))
+	{
+		// Leave out CPUs the process isn't allowed to run on (taskset, cgroups)
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		bool haveAllowed = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+		for (unsigned int id : onlineIds)
+		{
+			if (haveAllowed && id < CPU_SETSIZE && !CPU_ISSET(id, &allowed))
+				continue;
+
+			LogicalCpu cpu;
+			cpu.id = id;
+			cpu.core = id;
+			std::string topologyDir = "/sys/devices/system/cpu/cpu" + std::to_string(id) + "/topology/";
+			readUnsigned(topologyDir + "core_id", cpu.core);
+			readUnsigned(topologyDir + "physical_package_id", cpu.package);
+			cpus.push_back(cpu);
+		}
+
+		// Machines without NUMA support don't have the node directory, everything stays on node 0
+		std::string nodeList;
+		std::vector<unsigned int> nodeIds;
+		if (readLine("/sys/devices/system/node/online", nodeList) && parseCpuList(nodeList, nodeIds))
+		{
+			for (unsigned int node : nodeIds)
+			{
+				std::string cpuList;
+				std::vector<unsigned int> nodeCpus;
+				if (!readLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", cpuList)
+				    || !parseCpuList(cpuList, nodeCpus))
+					continue;
+				for (LogicalCpu& cpu : cpus)
+				{
+					if (std::find(nodeCpus.begin(), nodeCpus.end(), cpu.id) != nodeCpus.end())
+						cpu.node = node;
+				}
+			}
+		}
+	}
+#elif defined(_WIN32)
+	// Only covers the first processor group (up to 64 logical CPUs)
+	DWORD length = 0;
+	GetLogicalProcessorInformation(nullptr, &length);
+	std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+	if (!infos.empty() && GetLogicalProcessorInformation(infos.data(), &length))
+	{
+		const unsigned int kMaskBits = sizeof(ULONG_PTR) * 8;
+		std::vector<LogicalCpu> cpusById(kMaskBits);
+		std::vector<bool> present(kMaskBits, false);
+		unsigned int coreIndex = 0;
+		unsigned int packageIndex = 0;
+		for (const SYSTEM_LOGICAL_PROCESSOR_INFORMATION& info : infos)
+		{
+			for (unsigned int id = 0; id < kMaskBits; ++id)
+			{
+				if (!(info.ProcessorMask & (ULONG_PTR{ 1 } << id)))
+					continue;
+				cpusById[id].id = id;
+				if (info.Relationship == RelationProcessorCore)
+				{
+					present[id] = true;
+					cpusById[id].core = coreIndex;
+				}
+				else if (info.Relationship == RelationProcessorPackage)
+				{
+					cpusById[id].package = packageIndex;
+				}
+				else if (info.Relationship == RelationNumaNode)
+				{
+					cpusById[id].node = info.NumaNode.NodeNumber;
+				}
+			}
+			if (info.Relationship == RelationProcessorCore)
+				++coreIndex;
+			else if (info.Relationship == RelationProcessorPackage)
+				++packageIndex;
+		}
+		for (unsigned int id = 0; id < kMaskBits; ++id)
+		{
+			if (present[id])
+				cpus.push_back(cpusById[id]);
+		}
+	}
+#endif
+
+	if (cpus.empty())
+	{
+		unsigned int numCpus = std::max(std::thread::hardware_concurrency(), 1u);
+		for (unsigned int id = 0; id < numCpus; ++id)
+		{
+			LogicalCpu cpu;
+			cpu.id = id;
+			cpu.core = id;
+			cpus.push_back(cpu);
+		}
+	}
+	return cpus;
+}
+
+std::vector<LogicalCpu> CpuTopology::order(const std::vector<LogicalCpu>& cpus, AffinityPolicy policy,
+                                           const std::vector<unsigned int>& explicitCpus)
+{
+	std::vector<LogicalCpu> ordered;
+	switch (policy)
+	{
+	case AffinityPolicy::None:
+		break;
+
+	case AffinityPolicy::Compact:
+		ordered = cpus;
+		sortCompact(ordered);
+		break;
+
+	case AffinityPolicy::Scatter:
+	{
+		std::vector<LogicalCpu> compact = cpus;
+		sortCompact(compact);
+		std::vector<size_t> ranks = smtRanks(compact);
+
+		// Position of each CPU among the CPUs with the same node and SMT rank
+		std::vector<size_t> positions(compact.size());
+		for (size_t i = 0; i < compact.size(); ++i)
+		{
+			size_t position = 0;
+			for (size_t j = 0; j < i; ++j)
+			{
+				if (compact[j].node == compact[i].node && ranks[j] == ranks[i])
+					++position;
+			}
+			positions[i] = position;
+		}
+
+		// Round robin over nodes, then over cores, then over the hardware threads of each core
+		std::vector<size_t> indices(compact.size());
+		for (size_t i = 0; i < indices.size(); ++i)
+			indices[i] = i;
+		std::sort(indices.begin(), indices.end(), [&](size_t a, size_t b) {
+			return std::tie(ranks[a], positions[a], compact[a].node) < std::tie(ranks[b], positions[b], compact[b].node);
+		});
+		for (size_t index : indices)
+			ordered.push_back(compact[index]);
+		break;
+	}
+
+	case AffinityPolicy::PhysicalCores:
+	{
+		std::vector<LogicalCpu> compact = cpus;
+		sortCompact(compact);
+		std::vector<size_t> ranks = smtRanks(compact);
+		for (size_t i = 0; i < compact.size(); ++i)
+		{
+			if (ranks[i] == 0)
+				ordered.push_back(compact[i]);
+		}
+		break;
+	}
+
+	case AffinityPolicy::Explicit:
+		for (unsigned int id : explicitCpus)
+		{
+			auto found = std::find_if(cpus.begin(), cpus.end(), [id](const LogicalCpu& cpu) { return cpu.id == id; });
+			if (found != cpus.end())
+			{
+				ordered.push_back(*found);
+			}
+			else
+			{
+				LogicalCpu cpu;
+				cpu.id = id;
+				cpu.core = id;
+				ordered.push_back(cpu);
+			}
+		}
+		break;
+	}
+	return ordered;
+}
+
+bool CpuTopology::pinCurrentThread(unsigned int cpuId)
+{
+#if defined(__linux__)
+	if (cpuId >= CPU_SETSIZE)
+		return false;
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	CPU_SET(cpuId, &cpuSet);
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+#elif defined(_WIN32)
+	if (cpuId >= sizeof(DWORD_PTR) * 8)
+		return false;
+	return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR{ 1 } << cpuId) != 0;
+#else
+	return false;
+#endif
+}
+
+bool CpuTopology::parseCpuList(const std::string& list, std::vector<unsigned int>& cpus)
+{
+	std::vector<unsigned int> parsed;
+	std::istringstream listStream(list);
+	std::string range;
+	while (std::getline(listStream, range, ','))
+	{
+		std::istringstream rangeStream(range);
+		unsigned int first, last;
+		char dash;
+		if (!(rangeStream >> first))
+			return false;
+		if (rangeStream >> dash)
+		{
+			if (dash != '-' || !(rangeStream >> last) || last < first)
+				return false;
+		}
+		else
+		{
+			last = first;
+		}
+		for (unsigned int id = first; id <= last; ++id)
+			parsed.push_back(id);
+	}
+	if (parsed.empty())
+		return false;
+	cpus = std::move(parsed);
+	return true;
+}
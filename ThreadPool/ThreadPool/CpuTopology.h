@@ -0,0 +1,64 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Detects how logical CPUs are grouped into cores and NUMA
+//                nodes, and pins threads to them.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// How the threads of a ThreadPool are placed on logical CPUs
+enum class AffinityPolicy {
+	// Threads are not pinned, the OS may move them anywhere
+	None,
+	// Consecutive threads fill one core, then one node, before moving on
+	Compact,
+	// Consecutive threads are spread across nodes, then across cores,
+	// and only share a core once every core has a thread
+	Scatter,
+	// One thread per physical core, SMT siblings are left idle
+	PhysicalCores,
+	// Threads are pinned to a list of CPUs supplied by the user
+	Explicit
+};
+
+// A logical CPU (hardware thread) and where it sits in the machine
+struct LogicalCpu {
+	// The operating system's number for the CPU
+	unsigned int id = 0;
+	// Physical package (socket) and the core within it
+	unsigned int package = 0;
+	unsigned int core = 0;
+	// NUMA node the CPU's local memory belongs to
+	unsigned int node = 0;
+};
+
+namespace CpuTopology {
+	// Returns the logical CPUs this process may run on, ordered by id.
+	// Where the topology can't be read every CPU is treated as its own core on node 0.
+	std::vector<LogicalCpu> detect();
+
+	// Orders CPUs in the order threads should be placed on them by the policy.
+	// explicitCpus is only used by AffinityPolicy::Explicit, ids that aren't
+	// found in cpus are kept and assumed to be on node 0.
+	std::vector<LogicalCpu> order(const std::vector<LogicalCpu>& cpus, AffinityPolicy policy,
+	                              const std::vector<unsigned int>& explicitCpus);
+
+	// Pins the calling thread to a logical CPU. Returns false if that failed
+	// or isn't supported on this platform.
+	bool pinCurrentThread(unsigned int cpuId);
+
+	// Parses a CPU list such as "0-3,8,10-11" into CPU ids.
+	// Returns false if the list is malformed.
+	bool parseCpuList(const std::string& list, std::vector<unsigned int>& cpus);
+}
@@ -0,0 +1,128 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : A number stored as the unevaluated sum of two doubles, giving
+//                about 32 significant digits at a fraction of the cost of a
+//                software big number.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#pragma once
+
+#include <cmath>
+
+// hi holds the value rounded to a double and lo the rounding error, |lo| <= ulp(hi) / 2
+struct DoubleDouble {
+	double hi = 0;
+	double lo = 0;
+
+	DoubleDouble() = default;
+
+	DoubleDouble(double value)
+		: hi(value)
+	{
+	}
+
+	DoubleDouble(double high, double low)
+		: hi(high)
+		, lo(low)
+	{
+	}
+
+	explicit operator double() const
+	{
+		return hi + lo;
+	}
+};
+
+namespace DoubleDoubleDetail {
+	// Returns a + b exactly as hi + lo, for |a| >= |b|
+	inline DoubleDouble quickTwoSum(double a, double b)
+	{
+		double sum = a + b;
+		return { sum, b - (sum - a) };
+	}
+
+	// Returns a + b exactly as hi + lo
+	inline DoubleDouble twoSum(double a, double b)
+	{
+		double sum = a + b;
+		double bRounded = sum - a;
+		return { sum, (a - (sum - bRounded)) + (b - bRounded) };
+	}
+
+	// Returns a * b exactly as hi + lo
+	inline DoubleDouble twoProduct(double a, double b)
+	{
+		double product = a * b;
+#if defined(__FMA__) || defined(FP_FAST_FMA)
+		return { product, std::fma(a, b, -product) };
+#else
+		// Dekker's product splits each factor into halves whose products are exact
+		const double kSplitter = 134217729.0; // 2^27 + 1
+		double aScaled = kSplitter * a;
+		double aHigh = aScaled - (aScaled - a);
+		double aLow = a - aHigh;
+		double bScaled = kSplitter * b;
+		double bHigh = bScaled - (bScaled - b);
+		double bLow = b - bHigh;
+		return { product, ((aHigh * bHigh - product) + aHigh * bLow + aLow * bHigh) + aLow * bLow };
+#endif
+	}
+}
+
+inline DoubleDouble operator- (const DoubleDouble& value)
+{
+	return { -value.hi, -value.lo };
+}
+
+inline DoubleDouble operator+ (const DoubleDouble& a, const DoubleDouble& b)
+{
+	DoubleDouble high = DoubleDoubleDetail::twoSum(a.hi, b.hi);
+	DoubleDouble low = DoubleDoubleDetail::twoSum(a.lo, b.lo);
+	high = DoubleDoubleDetail::quickTwoSum(high.hi, high.lo + low.hi);
+	return DoubleDoubleDetail::quickTwoSum(high.hi, high.lo + low.lo);
+}
+
+inline DoubleDouble operator- (const DoubleDouble& a, const DoubleDouble& b)
+{
+	return a + -b;
+}
+
+inline DoubleDouble operator* (const DoubleDouble& a, const DoubleDouble& b)
+{
+	DoubleDouble product = DoubleDoubleDetail::twoProduct(a.hi, b.hi);
+	return DoubleDoubleDetail::quickTwoSum(product.hi, product.lo + (a.hi * b.lo + a.lo * b.hi));
+}
+
+inline DoubleDouble operator* (const DoubleDouble& a, double b)
+{
+	DoubleDouble product = DoubleDoubleDetail::twoProduct(a.hi, b);
+	return DoubleDoubleDetail::quickTwoSum(product.hi, product.lo + a.lo * b);
+}
+
+inline DoubleDouble& operator+= (DoubleDouble& a, const DoubleDouble& b)
+{
+	return a = a + b;
+}
+
+inline DoubleDouble& operator-= (DoubleDouble& a, const DoubleDouble& b)
+{
+	return a = a - b;
+}
+
+inline bool operator< (const DoubleDouble& a, const DoubleDouble& b)
+{
+	return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo);
+}
+
+inline bool operator> (const DoubleDouble& a, const DoubleDouble& b)
+{
+	return b < a;
+}
@@ -0,0 +1,133 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : An eventcount, a condition variable for lock free code.
+//                Waiters announce themselves before checking their condition,
+//                so notifying is a single atomic load when nobody is waiting.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+// Usage:
+//   Waiter:                                  Notifier:
+//     auto key = ec.prepareWait();             make the condition true
+//     if (condition) ec.cancelWait();          ec.notifyOne();
+//     else ec.wait(key);
+//
+
+#ifndef EVENTCOUNT_H
+#define EVENTCOUNT_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+class EventCount
+{
+public:
+	using Key = uint32_t;
+
+	EventCount() {}
+
+	// The EventCount is non-copyable.
+	EventCount(const EventCount&) = delete;
+	EventCount& operator= (const EventCount&) = delete;
+
+	// Registers the calling thread as a waiter. The caller must check its
+	// condition afterwards, then call either cancelWait or wait.
+	Key prepareWait()
+	{
+		uint64_t state = m_state.fetch_add(kWaiterInc, std::memory_order_seq_cst);
+		// Pairs with the fence in notify, so either we see the notifier's
+		// change to the condition or the notifier sees us waiting
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		return epochOf(state);
+	}
+
+	// Unregisters a waiter whose condition turned out to be true
+	void cancelWait()
+	{
+		m_state.fetch_sub(kWaiterInc, std::memory_order_relaxed);
+	}
+
+	// Blocks until notify is called after the matching prepareWait
+	void wait(Key key)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv.wait(lock, [this, key] { return epochOf(m_state.load(std::memory_order_relaxed)) != key; });
+		}
+		m_state.fetch_sub(kWaiterInc, std::memory_order_relaxed);
+	}
+
+	// As wait, but gives up once deadline has passed. Returns false if it timed out.
+	template<typename Clock, typename Duration>
+	bool waitUntil(Key key, const std::chrono::time_point<Clock, Duration>& deadline)
+	{
+		bool notified;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			notified = m_cv.wait_until(lock, deadline, [this, key] { return epochOf(m_state.load(std::memory_order_relaxed)) != key; });
+		}
+		m_state.fetch_sub(kWaiterInc, std::memory_order_relaxed);
+		return notified;
+	}
+
+	// Wakes one waiting thread, if there are any
+	void notifyOne()
+	{
+		if (beginNotify())
+			m_cv.notify_one();
+	}
+
+	// Wakes every waiting thread
+	void notifyAll()
+	{
+		if (beginNotify())
+			m_cv.notify_all();
+	}
+
+	// Returns the number of threads between prepareWait and the end of wait or cancelWait
+	size_t numWaiters() const
+	{
+		return static_cast<size_t>(m_state.load(std::memory_order_relaxed) & kWaiterMask);
+	}
+
+private:
+	// The low half of the state counts waiters, the high half is the epoch
+	static const uint64_t kWaiterInc = 1;
+	static const uint64_t kWaiterMask = 0xFFFFFFFF;
+	static const uint64_t kEpochInc = uint64_t{ 1 } << 32;
+
+	static Key epochOf(uint64_t state)
+	{
+		return static_cast<Key>(state >> 32);
+	}
+
+	// Starts a new epoch if anyone is waiting. Returns true if there are waiters to wake.
+	bool beginNotify()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if ((m_state.load(std::memory_order_relaxed) & kWaiterMask) == 0)
+			return false;
+
+		// Changing the epoch under the lock means a waiter can't check it and then miss the notification
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_state.fetch_add(kEpochInc, std::memory_order_relaxed);
+		}
+		return true;
+	}
+
+	std::atomic<uint64_t> m_state{ 0 };
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+};
+
+#endif
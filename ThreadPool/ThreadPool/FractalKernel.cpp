@@ -0,0 +1,474 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Escape time kernels for the Mandelbrot set, picked at runtime from CPUID,
+//                and the choice of precision for a zoom level
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+//Library Includes
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <limits>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define FRACTAL_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#else
+#define FRACTAL_X86 0
+#endif
+
+// GCC and Clang only emit wider instructions in functions marked for them, so the
+// rest of the program still runs on older CPUs. MSVC allows intrinsics anywhere.
+#if defined(__GNUC__)
+#define FRACTAL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define FRACTAL_TARGET(isa)
+#endif
+
+// The kernels only agree if no multiply and add are fused into one rounding.
+// GCC fuses them in functions targeting AVX-512, intrinsics included.
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+// AVX-512 intrinsics arrived in Visual Studio 2017
+#if FRACTAL_X86 && (defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1911))
+#define FRACTAL_HAS_AVX512 1
+#else
+#define FRACTAL_HAS_AVX512 0
+#endif
+
+//This Include
+#include "FractalKernel.h"
+
+namespace {
+#if FRACTAL_X86
+	struct CpuFeatures {
+		bool sse2 = false;
+		bool avx2 = false;
+		bool avx512 = false;
+	};
+
+	void cpuid(int leaf, int subleaf, int registers[4])
+	{
+#if defined(_MSC_VER)
+		__cpuidex(registers, leaf, subleaf);
+#else
+		unsigned int eax, ebx, ecx, edx;
+		__cpuid_count(leaf, subleaf, eax, ebx, ecx, edx);
+		registers[0] = static_cast<int>(eax);
+		registers[1] = static_cast<int>(ebx);
+		registers[2] = static_cast<int>(ecx);
+		registers[3] = static_cast<int>(edx);
+#endif
+	}
+
+	// Returns which register states the OS saves on a context switch
+	uint64_t enabledRegisterStates()
+	{
+#if defined(_MSC_VER)
+		return _xgetbv(0);
+#else
+		unsigned int eax, edx;
+		__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+	}
+
+	CpuFeatures detectFeatures()
+	{
+		CpuFeatures features;
+		int registers[4];
+		cpuid(0, 0, registers);
+		int maxLeaf = registers[0];
+
+		cpuid(1, 0, registers);
+		features.sse2 = (registers[3] & (1 << 26)) != 0;
+		bool osxsave = (registers[2] & (1 << 27)) != 0;
+		if (!osxsave || maxLeaf < 7)
+			return features;
+
+		// The CPU supporting wide registers isn't enough, the OS has to save them too
+		uint64_t states = enabledRegisterStates();
+		bool ymmSaved = (states & 0x6) == 0x6;
+		bool zmmSaved = (states & 0xE6) == 0xE6;
+
+		cpuid(7, 0, registers);
+		features.avx2 = ymmSaved && (registers[1] & (1 << 5)) != 0;
+		features.avx512 = zmmSaved && (registers[1] & (1 << 16)) != 0;
+		return features;
+	}
+
+	const CpuFeatures& cpuFeatures()
+	{
+		static const CpuFeatures s_features = detectFeatures();
+		return s_features;
+	}
+
+	// Every kernel does the same operations in the same order as
+	// FractalKernel::iterateScalar, so they all round the same way and agree
+	// exactly. Each instruction set has a kernel templated on a Simd type that
+	// wraps the float or double instructions. Iteration counts are kept as
+	// floating point vectors, which hold them exactly up to 2^24.
+
+	unsigned countBits(unsigned bits)
+	{
+		unsigned count = 0;
+		for (; bits != 0; bits &= bits - 1)
+			++count;
+		return count;
+	}
+
+	struct Sse2Double {
+		using Real = double;
+		using Vector = __m128d;
+		using Mask = __m128d;
+		static const size_t kLanes = 2;
+
+		FRACTAL_TARGET("sse2") static Vector set(Real value) { return _mm_set1_pd(value); }
+		FRACTAL_TARGET("sse2") static Vector load(const Real* values) { return _mm_loadu_pd(values); }
+		FRACTAL_TARGET("sse2") static Vector add(Vector a, Vector b) { return _mm_add_pd(a, b); }
+		FRACTAL_TARGET("sse2") static Vector sub(Vector a, Vector b) { return _mm_sub_pd(a, b); }
+		FRACTAL_TARGET("sse2") static Vector mul(Vector a, Vector b) { return _mm_mul_pd(a, b); }
+		FRACTAL_TARGET("sse2") static Mask allLanes() { return _mm_castsi128_pd(_mm_set1_epi32(-1)); }
+		// Returns the active lanes where a > b
+		FRACTAL_TARGET("sse2") static Mask greater(Vector a, Vector b, Mask active) { return _mm_and_pd(_mm_cmpgt_pd(a, b), active); }
+		FRACTAL_TARGET("sse2") static Vector select(Mask mask, Vector a, Vector b) { return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b)); }
+		FRACTAL_TARGET("sse2") static Mask remove(Mask active, Mask lanes) { return _mm_andnot_pd(lanes, active); }
+		FRACTAL_TARGET("sse2") static bool any(Mask mask) { return _mm_movemask_pd(mask) != 0; }
+		FRACTAL_TARGET("sse2") static unsigned count(Mask mask) { return countBits(static_cast<unsigned>(_mm_movemask_pd(mask))); }
+		FRACTAL_TARGET("sse2") static void storeCounts(uint32_t* out, Vector counts)
+		{
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_cvtpd_epi32(counts));
+		}
+	};
+
+	struct Sse2Float {
+		using Real = float;
+		using Vector = __m128;
+		using Mask = __m128;
+		static const size_t kLanes = 4;
+
+		FRACTAL_TARGET("sse2") static Vector set(Real value) { return _mm_set1_ps(value); }
+		FRACTAL_TARGET("sse2") static Vector load(const Real* values) { return _mm_loadu_ps(values); }
+		FRACTAL_TARGET("sse2") static Vector add(Vector a, Vector b) { return _mm_add_ps(a, b); }
+		FRACTAL_TARGET("sse2") static Vector sub(Vector a, Vector b) { return _mm_sub_ps(a, b); }
+		FRACTAL_TARGET("sse2") static Vector mul(Vector a, Vector b) { return _mm_mul_ps(a, b); }
+		FRACTAL_TARGET("sse2") static Mask allLanes() { return _mm_castsi128_ps(_mm_set1_epi32(-1)); }
+		FRACTAL_TARGET("sse2") static Mask greater(Vector a, Vector b, Mask active) { return _mm_and_ps(_mm_cmpgt_ps(a, b), active); }
+		FRACTAL_TARGET("sse2") static Vector select(Mask mask, Vector a, Vector b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+		FRACTAL_TARGET("sse2") static Mask remove(Mask active, Mask lanes) { return _mm_andnot_ps(lanes, active); }
+		FRACTAL_TARGET("sse2") static bool any(Mask mask) { return _mm_movemask_ps(mask) != 0; }
+		FRACTAL_TARGET("sse2") static unsigned count(Mask mask) { return countBits(static_cast<unsigned>(_mm_movemask_ps(mask))); }
+		FRACTAL_TARGET("sse2") static void storeCounts(uint32_t* out, Vector counts)
+		{
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_cvtps_epi32(counts));
+		}
+	};
+
+	struct Avx2Double {
+		using Real = double;
+		using Vector = __m256d;
+		using Mask = __m256d;
+		static const size_t kLanes = 4;
+
+		FRACTAL_TARGET("avx2") static Vector set(Real value) { return _mm256_set1_pd(value); }
+		FRACTAL_TARGET("avx2") static Vector load(const Real* values) { return _mm256_loadu_pd(values); }
+		FRACTAL_TARGET("avx2") static Vector add(Vector a, Vector b) { return _mm256_add_pd(a, b); }
+		FRACTAL_TARGET("avx2") static Vector sub(Vector a, Vector b) { return _mm256_sub_pd(a, b); }
+		FRACTAL_TARGET("avx2") static Vector mul(Vector a, Vector b) { return _mm256_mul_pd(a, b); }
+		FRACTAL_TARGET("avx2") static Mask allLanes() { return _mm256_castsi256_pd(_mm256_set1_epi64x(-1)); }
+		FRACTAL_TARGET("avx2") static Mask greater(Vector a, Vector b, Mask active) { return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_GT_OQ), active); }
+		FRACTAL_TARGET("avx2") static Vector select(Mask mask, Vector a, Vector b) { return _mm256_blendv_pd(b, a, mask); }
+		FRACTAL_TARGET("avx2") static Mask remove(Mask active, Mask lanes) { return _mm256_andnot_pd(lanes, active); }
+		FRACTAL_TARGET("avx2") static bool any(Mask mask) { return _mm256_movemask_pd(mask) != 0; }
+		FRACTAL_TARGET("avx2") static unsigned count(Mask mask) { return countBits(static_cast<unsigned>(_mm256_movemask_pd(mask))); }
+		FRACTAL_TARGET("avx2") static void storeCounts(uint32_t* out, Vector counts)
+		{
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_cvtpd_epi32(counts));
+		}
+	};
+
+	struct Avx2Float {
+		using Real = float;
+		using Vector = __m256;
+		using Mask = __m256;
+		static const size_t kLanes = 8;
+
+		FRACTAL_TARGET("avx2") static Vector set(Real value) { return _mm256_set1_ps(value); }
+		FRACTAL_TARGET("avx2") static Vector load(const Real* values) { return _mm256_loadu_ps(values); }
+		FRACTAL_TARGET("avx2") static Vector add(Vector a, Vector b) { return _mm256_add_ps(a, b); }
+		FRACTAL_TARGET("avx2") static Vector sub(Vector a, Vector b) { return _mm256_sub_ps(a, b); }
+		FRACTAL_TARGET("avx2") static Vector mul(Vector a, Vector b) { return _mm256_mul_ps(a, b); }
+		FRACTAL_TARGET("avx2") static Mask allLanes() { return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+		FRACTAL_TARGET("avx2") static Mask greater(Vector a, Vector b, Mask active) { return _mm256_and_ps(_mm256_cmp_ps(a, b, _CMP_GT_OQ), active); }
+		FRACTAL_TARGET("avx2") static Vector select(Mask mask, Vector a, Vector b) { return _mm256_blendv_ps(b, a, mask); }
+		FRACTAL_TARGET("avx2") static Mask remove(Mask active, Mask lanes) { return _mm256_andnot_ps(lanes, active); }
+		FRACTAL_TARGET("avx2") static bool any(Mask mask) { return _mm256_movemask_ps(mask) != 0; }
+		FRACTAL_TARGET("avx2") static unsigned count(Mask mask) { return countBits(static_cast<unsigned>(_mm256_movemask_ps(mask))); }
+		FRACTAL_TARGET("avx2") static void storeCounts(uint32_t* out, Vector counts)
+		{
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_cvtps_epi32(counts));
+		}
+	};
+
+	// GCC only lets a function use instructions it is marked for, so each instruction
+	// set needs its own copy of the kernel. They are all made from the one body.
+#define FRACTAL_KERNEL_NAME iterateSse2
+#define FRACTAL_KERNEL_TARGET "sse2"
+#include "FractalKernelSimd.inl"
+
+#define FRACTAL_KERNEL_NAME iterateAvx2
+#define FRACTAL_KERNEL_TARGET "avx2"
+#include "FractalKernelSimd.inl"
+
+#if FRACTAL_HAS_AVX512
+	// Lanes are masked with mask registers rather than vectors
+	struct Avx512Double {
+		using Real = double;
+		using Vector = __m512d;
+		using Mask = __mmask8;
+		static const size_t kLanes = 8;
+
+		FRACTAL_TARGET("avx512f") static Vector set(Real value) { return _mm512_set1_pd(value); }
+		FRACTAL_TARGET("avx512f") static Vector load(const Real* values) { return _mm512_loadu_pd(values); }
+		FRACTAL_TARGET("avx512f") static Vector add(Vector a, Vector b) { return _mm512_add_pd(a, b); }
+		FRACTAL_TARGET("avx512f") static Vector sub(Vector a, Vector b) { return _mm512_sub_pd(a, b); }
+		FRACTAL_TARGET("avx512f") static Vector mul(Vector a, Vector b) { return _mm512_mul_pd(a, b); }
+		FRACTAL_TARGET("avx512f") static Mask allLanes() { return 0xFF; }
+		FRACTAL_TARGET("avx512f") static Mask greater(Vector a, Vector b, Mask active) { return _mm512_mask_cmp_pd_mask(active, a, b, _CMP_GT_OQ); }
+		FRACTAL_TARGET("avx512f") static Vector select(Mask mask, Vector a, Vector b) { return _mm512_mask_blend_pd(mask, b, a); }
+		FRACTAL_TARGET("avx512f") static Mask remove(Mask active, Mask lanes) { return static_cast<Mask>(active & ~lanes); }
+		FRACTAL_TARGET("avx512f") static bool any(Mask mask) { return mask != 0; }
+		FRACTAL_TARGET("avx512f") static unsigned count(Mask mask) { return countBits(mask); }
+		FRACTAL_TARGET("avx512f") static void storeCounts(uint32_t* out, Vector counts)
+		{
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm512_maskz_cvtpd_epi32(0xFF, counts));
+		}
+	};
+
+	struct Avx512Float {
+		using Real = float;
+		using Vector = __m512;
+		using Mask = __mmask16;
+		static const size_t kLanes = 16;
+
+		FRACTAL_TARGET("avx512f") static Vector set(Real value) { return _mm512_set1_ps(value); }
+		FRACTAL_TARGET("avx512f") static Vector load(const Real* values) { return _mm512_loadu_ps(values); }
+		FRACTAL_TARGET("avx512f") static Vector add(Vector a, Vector b) { return _mm512_add_ps(a, b); }
+		FRACTAL_TARGET("avx512f") static Vector sub(Vector a, Vector b) { return _mm512_sub_ps(a, b); }
+		FRACTAL_TARGET("avx512f") static Vector mul(Vector a, Vector b) { return _mm512_mul_ps(a, b); }
+		FRACTAL_TARGET("avx512f") static Mask allLanes() { return 0xFFFF; }
+		FRACTAL_TARGET("avx512f") static Mask greater(Vector a, Vector b, Mask active) { return _mm512_mask_cmp_ps_mask(active, a, b, _CMP_GT_OQ); }
+		FRACTAL_TARGET("avx512f") static Vector select(Mask mask, Vector a, Vector b) { return _mm512_mask_blend_ps(mask, b, a); }
+		FRACTAL_TARGET("avx512f") static Mask remove(Mask active, Mask lanes) { return static_cast<Mask>(active & ~lanes); }
+		FRACTAL_TARGET("avx512f") static bool any(Mask mask) { return mask != 0; }
+		FRACTAL_TARGET("avx512f") static unsigned count(Mask mask) { return countBits(mask); }
+		FRACTAL_TARGET("avx512f") static void storeCounts(uint32_t* out, Vector counts)
+		{
+			_mm512_storeu_si512(out, _mm512_maskz_cvtps_epi32(0xFFFF, counts));
+		}
+	};
+
+#define FRACTAL_KERNEL_NAME iterateAvx512
+#define FRACTAL_KERNEL_TARGET "avx512f"
+#include "FractalKernelSimd.inl"
+#endif
+#endif
+
+#if FRACTAL_X86
+	// The Simd types for each instruction set that work on Real
+	template<typename Real>
+	struct SimdTypes;
+
+	template<>
+	struct SimdTypes<double> {
+		using Sse2 = Sse2Double;
+		using Avx2 = Avx2Double;
+#if FRACTAL_HAS_AVX512
+		using Avx512 = Avx512Double;
+#endif
+	};
+
+	template<>
+	struct SimdTypes<float> {
+		using Sse2 = Sse2Float;
+		using Avx2 = Avx2Float;
+#if FRACTAL_HAS_AVX512
+		using Avx512 = Avx512Float;
+#endif
+	};
+#endif
+
+	template<typename Real>
+	void dispatch(FractalKernelType type, const Real* cr, const Real* ci, size_t ciStride, size_t count,
+	                 uint32_t maxIterations, uint32_t* iterations, const FractalShortcuts& shortcuts, FractalSkipped& skipped)
+	{
+		if (!FractalKernel::isSupported(type))
+			type = FractalKernel::best();
+
+		switch (type)
+		{
+#if FRACTAL_X86
+		case FractalKernelType::Sse2:
+			iterateSse2<typename SimdTypes<Real>::Sse2>(cr, ci, ciStride, count, maxIterations, iterations, shortcuts, skipped);
+			return;
+		case FractalKernelType::Avx2:
+			iterateAvx2<typename SimdTypes<Real>::Avx2>(cr, ci, ciStride, count, maxIterations, iterations, shortcuts, skipped);
+			return;
+#if FRACTAL_HAS_AVX512
+		case FractalKernelType::Avx512:
+			iterateAvx512<typename SimdTypes<Real>::Avx512>(cr, ci, ciStride, count, maxIterations, iterations, shortcuts, skipped);
+			return;
+#endif
+#endif
+		default:
+			FractalKernel::iterateScalar(cr, ci, ciStride, count, maxIterations, iterations, shortcuts, skipped);
+			return;
+		}
+	}
+}
+
+FractalKernelType FractalKernel::best()
+{
+	if (isSupported(FractalKernelType::Avx512))
+		return FractalKernelType::Avx512;
+	if (isSupported(FractalKernelType::Avx2))
+		return FractalKernelType::Avx2;
+	if (isSupported(FractalKernelType::Sse2))
+		return FractalKernelType::Sse2;
+	return FractalKernelType::Scalar;
+}
+
+bool FractalKernel::isSupported(FractalKernelType type)
+{
+	switch (type)
+	{
+	case FractalKernelType::Scalar:
+		return true;
+#if FRACTAL_X86
+	case FractalKernelType::Sse2:
+		return cpuFeatures().sse2;
+	case FractalKernelType::Avx2:
+		return cpuFeatures().avx2;
+	case FractalKernelType::Avx512:
+		return FRACTAL_HAS_AVX512 && cpuFeatures().avx512;
+#endif
+	default:
+		return false;
+	}
+}
+
+const char* FractalKernel::name(FractalKernelType type)
+{
+	switch (type)
+	{
+	case FractalKernelType::Sse2:
+		return "SSE2";
+	case FractalKernelType::Avx2:
+		return "AVX2";
+	case FractalKernelType::Avx512:
+		return "AVX-512";
+	default:
+		return "Scalar";
+	}
+}
+
+bool FractalKernel::parse(const std::string& text, FractalKernelType& type)
+{
+	std::string lower = text;
+	std::transform(lower.begin(), lower.end(), lower.begin(), [](char c) {
+		return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	});
+
+	if (lower == "auto")
+		type = best();
+	else if (lower == "scalar")
+		type = FractalKernelType::Scalar;
+	else if (lower == "sse2")
+		type = FractalKernelType::Sse2;
+	else if (lower == "avx2")
+		type = FractalKernelType::Avx2;
+	else if (lower == "avx512" || lower == "avx-512")
+		type = FractalKernelType::Avx512;
+	else
+		return false;
+	return true;
+}
+
+bool FractalKernel::isSupported(FractalPrecision precision)
+{
+	return precision != FractalPrecision::Quad || FRACTAL_HAS_QUAD;
+}
+
+const char* FractalKernel::name(FractalPrecision precision)
+{
+	switch (precision)
+	{
+	case FractalPrecision::Float:
+		return "Float";
+	case FractalPrecision::Double:
+		return "Double";
+	case FractalPrecision::DoubleDouble:
+		return "Double-double";
+	default:
+		return "Quad";
+	}
+}
+
+FractalPrecision FractalKernel::choosePrecision(double pixelStep, double magnitude)
+{
+	// Neighbouring pixels should be this many rounding errors apart
+	const double kMargin = 256;
+	// |z| reaches 2 before a pixel escapes, so errors are relative to at least that
+	double step = pixelStep / std::max(magnitude, 2.0);
+
+	if (step > kMargin * std::numeric_limits<float>::epsilon())
+		return FractalPrecision::Float;
+	if (step > kMargin * std::numeric_limits<double>::epsilon())
+		return FractalPrecision::Double;
+	// A double double has a 106 bit mantissa, counting the sign of lo
+	if (step > kMargin * std::ldexp(1.0, -104) || !isSupported(FractalPrecision::Quad))
+		return FractalPrecision::DoubleDouble;
+	// Past here even quad precision runs out, but it is still the most precise there is
+	return FractalPrecision::Quad;
+}
+
+void FractalKernel::iterateRow(FractalKernelType type, const double* cr, double ci, size_t count, uint32_t maxIterations,
+                               uint32_t* iterations, const FractalShortcuts& shortcuts, FractalSkipped& skipped)
+{
+	dispatch(type, cr, &ci, 0, count, maxIterations, iterations, shortcuts, skipped);
+}
+
+void FractalKernel::iterateRow(FractalKernelType type, const float* cr, float ci, size_t count, uint32_t maxIterations,
+                               uint32_t* iterations, const FractalShortcuts& shortcuts, FractalSkipped& skipped)
+{
+	dispatch(type, cr, &ci, 0, count, maxIterations, iterations, shortcuts, skipped);
+}
+
+void FractalKernel::iteratePoints(FractalKernelType type, const double* cr, const double* ci, size_t count, uint32_t maxIterations,
+                                  uint32_t* iterations, const FractalShortcuts& shortcuts, FractalSkipped& skipped)
+{
+	dispatch(type, cr, ci, 1, count, maxIterations, iterations, shortcuts, skipped);
+}
+
+void FractalKernel::iteratePoints(FractalKernelType type, const float* cr, const float* ci, size_t count, uint32_t maxIterations,
+                                  uint32_t* iterations, const FractalShortcuts& shortcuts, FractalSkipped& skipped)
+{
+	dispatch(type, cr, ci, 1, count, maxIterations, iterations, shortcuts, skipped);
+}
@@ -0,0 +1,203 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Escape time kernels for the Mandelbrot set. The SIMD kernels
+//                iterate several pixels per instruction and give exactly the
+//                same iteration counts as the scalar kernel. Deep zooms use
+//                wider number types, which only have a scalar kernel.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#pragma once
+
+#include "DoubleDouble.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// GCC and Clang have a software 128 bit float on x86-64
+#if defined(__SIZEOF_FLOAT128__)
+#define FRACTAL_HAS_QUAD 1
+#else
+#define FRACTAL_HAS_QUAD 0
+#endif
+
+// An instruction set to iterate pixels with
+enum class FractalKernelType {
+	// One pixel at a time, runs anywhere
+	Scalar,
+	// 2 pixels at a time
+	Sse2,
+	// 4 pixels at a time
+	Avx2,
+	// 8 pixels at a time
+	Avx512
+};
+
+// A number type to iterate pixels with, from cheapest to most precise
+enum class FractalPrecision {
+	Float,
+	Double,
+	DoubleDouble,
+	// __float128, only where FRACTAL_HAS_QUAD
+	Quad
+};
+
+// Ways to stop iterating pixels that are known to be in the set. They only change
+// pixels right on the edge of the set, where rounding decides anyway.
+struct FractalShortcuts {
+	// Skips pixels in the main cardioid or the period-2 bulb, which a formula finds
+	bool bulbCheck = false;
+	// Stops iterating a pixel once its orbit comes back within periodTolerance of
+	// the point it was at on the last power of two iteration, as in Brent's cycle
+	// detection. Such an orbit has become periodic and will never escape.
+	bool periodicityCheck = false;
+	double periodTolerance = 0;
+};
+
+// Iterations the shortcuts saved
+struct FractalSkipped {
+	uint64_t bulb = 0;
+	uint64_t periodic = 0;
+};
+
+namespace FractalKernel {
+	// Returns the widest kernel supported by both the CPU, checked with CPUID, and the compiler
+	FractalKernelType best();
+
+	// Returns true if the kernel can run on this machine
+	bool isSupported(FractalKernelType type);
+
+	// Returns a kernel's name as shown in the stats and accepted by parse
+	const char* name(FractalKernelType type);
+
+	// Parses a kernel name, case insensitively. "auto" gives best().
+	// Returns false if the name isn't recognised.
+	bool parse(const std::string& text, FractalKernelType& type);
+
+	// Returns true if the precision can be used on this machine
+	bool isSupported(FractalPrecision precision);
+
+	// Returns a precision's name as shown in the stats
+	const char* name(FractalPrecision precision);
+
+	// Returns the cheapest precision that can still tell neighbouring pixels apart
+	// when they are pixelStep apart and coordinates are up to magnitude in size.
+	// Rounding errors grow as a pixel is iterated, so this leaves a wide margin.
+	FractalPrecision choosePrecision(double pixelStep, double magnitude);
+
+	// Iterates z = z * z + c from z = 0 for count pixels of a row, where pixel k
+	// has c = cr[k] + ci * i. iterations[k] is set to the iteration on which |z|
+	// first exceeded 2, or maxIterations + 1 if it never did. The iterations the
+	// shortcuts save are added to skipped. Unsupported kernels fall back to best().
+	void iterateRow(FractalKernelType type, const double* cr, double ci, size_t count, uint32_t maxIterations,
+	                uint32_t* iterations, const FractalShortcuts& shortcuts, FractalSkipped& skipped);
+
+	// Single precision kernels do twice as many pixels per instruction
+	void iterateRow(FractalKernelType type, const float* cr, float ci, size_t count, uint32_t maxIterations,
+	                uint32_t* iterations, const FractalShortcuts& shortcuts, FractalSkipped& skipped);
+
+	// Types without SIMD kernels, such as DoubleDouble, ignore the kernel type
+	template<typename Real>
+	void iterateRow(FractalKernelType type, const Real* cr, Real ci, size_t count, uint32_t maxIterations,
+	                uint32_t* iterations, const FractalShortcuts& shortcuts, FractalSkipped& skipped);
+
+	// As iterateRow, but pixel k has c = cr[k] + ci[k] * i, so the pixels can come
+	// from anywhere in the view and still fill whole vectors
+	void iteratePoints(FractalKernelType type, const double* cr, const double* ci, size_t count, uint32_t maxIterations,
+	                   uint32_t* iterations, const FractalShortcuts& shortcuts, FractalSkipped& skipped);
+
+	void iteratePoints(FractalKernelType type, const float* cr, const float* ci, size_t count, uint32_t maxIterations,
+	                   uint32_t* iterations, const FractalShortcuts& shortcuts, FractalSkipped& skipped);
+
+	template<typename Real>
+	void iteratePoints(FractalKernelType type, const Real* cr, const Real* ci, size_t count, uint32_t maxIterations,
+	                   uint32_t* iterations, const FractalShortcuts& shortcuts, FractalSkipped& skipped);
+
+	// The kernel every other kernel gives the same results as. Pixel k has
+	// c = cr[k] + ci[k * ciStride] * i, so a ciStride of 0 iterates a row.
+	template<typename Real>
+	void iterateScalar(const Real* cr, const Real* ci, size_t ciStride, size_t count, uint32_t maxIterations,
+	                   uint32_t* iterations, const FractalShortcuts& shortcuts, FractalSkipped& skipped);
+}
+
+template<typename Real>
+void FractalKernel::iterateRow(FractalKernelType, const Real* cr, Real ci, size_t count, uint32_t maxIterations,
+                               uint32_t* iterations, const FractalShortcuts& shortcuts, FractalSkipped& skipped)
+{
+	iterateScalar(cr, &ci, 0, count, maxIterations, iterations, shortcuts, skipped);
+}
+
+template<typename Real>
+void FractalKernel::iteratePoints(FractalKernelType, const Real* cr, const Real* ci, size_t count, uint32_t maxIterations,
+                                  uint32_t* iterations, const FractalShortcuts& shortcuts, FractalSkipped& skipped)
+{
+	iterateScalar(cr, ci, 1, count, maxIterations, iterations, shortcuts, skipped);
+}
+
+template<typename Real>
+void FractalKernel::iterateScalar(const Real* cr, const Real* ci, size_t ciStride, size_t count, uint32_t maxIterations,
+                                  uint32_t* iterations, const FractalShortcuts& shortcuts, FractalSkipped& skipped)
+{
+	const Real kFour = Real(4);
+	const Real kPeriodTolerance2 = Real(shortcuts.periodTolerance * shortcuts.periodTolerance);
+	for (size_t k = 0; k < count; ++k)
+	{
+		Real img = ci[k * ciStride];
+		if (shortcuts.bulbCheck)
+		{
+			// The main cardioid is q(q + x - 1/4) < y^2 / 4 where q = (x - 1/4)^2 + y^2,
+			// and the period-2 bulb is the circle of radius 1/4 around -1
+			Real ci2 = img * img;
+			Real cardioidRe = cr[k] - Real(0.25);
+			Real q = cardioidRe * cardioidRe + ci2;
+			Real bulbRe = cr[k] + Real(1);
+			if (ci2 * Real(0.25) > q * (q + cardioidRe) || Real(0.0625) > bulbRe * bulbRe + ci2)
+			{
+				iterations[k] = maxIterations + 1;
+				skipped.bulb += maxIterations;
+				continue;
+			}
+		}
+
+		Real x = Real(0);
+		Real y = Real(0);
+		Real savedX = Real(0);
+		Real savedY = Real(0);
+		uint32_t iteration = 1;
+		for (; iteration <= maxIterations; ++iteration)
+		{
+			Real xy = x * y;
+			x = x * x - y * y + cr[k];
+			y = xy + xy + img;
+			if (x * x + y * y > kFour)
+				break;
+
+			if (shortcuts.periodicityCheck)
+			{
+				Real dx = x - savedX;
+				Real dy = y - savedY;
+				if (kPeriodTolerance2 > dx * dx + dy * dy)
+				{
+					skipped.periodic += maxIterations - iteration;
+					iteration = maxIterations + 1;
+					break;
+				}
+				// The saved point moves on ever more rarely, so cycles of any length are caught
+				if ((iteration & (iteration - 1)) == 0)
+				{
+					savedX = x;
+					savedY = y;
+				}
+			}
+		}
+		iterations[k] = iteration;
+	}
+}
@@ -0,0 +1,92 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : The body of the SIMD escape time kernels. FractalKernel.cpp includes it
+//                once per instruction set, with FRACTAL_KERNEL_NAME and
+//                FRACTAL_KERNEL_TARGET defined, so every kernel is the same code.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+// Iterates count points with the instructions of Simd, finishing any left over
+// with FractalKernel::iterateScalar
+template<typename Simd>
+FRACTAL_TARGET(FRACTAL_KERNEL_TARGET)
+void FRACTAL_KERNEL_NAME(const typename Simd::Real* cr, const typename Simd::Real* ci, size_t ciStride, size_t count,
+                         uint32_t maxIterations, uint32_t* iterations, const FractalShortcuts& shortcuts, FractalSkipped& skipped)
+{
+	using Vector = typename Simd::Vector;
+	using Mask = typename Simd::Mask;
+	using Real = typename Simd::Real;
+	const Vector kFour = Simd::set(4);
+	const Vector kOne = Simd::set(1);
+	const Vector kQuarter = Simd::set(Real(0.25));
+	const Vector kSixteenth = Simd::set(Real(0.0625));
+	const Vector kPeriodTolerance2 = Simd::set(Real(shortcuts.periodTolerance * shortcuts.periodTolerance));
+
+	size_t k = 0;
+	for (; k + Simd::kLanes <= count; k += Simd::kLanes)
+	{
+		Vector vcr = Simd::load(cr + k);
+		Vector vci = ciStride ? Simd::load(ci + k) : Simd::set(ci[0]);
+		Vector ci2 = Simd::mul(vci, vci);
+		Vector escapedAt = Simd::set(static_cast<Real>(maxIterations + 1.0));
+		// Lanes that haven't escaped yet. Escaped lanes keep iterating, their results are ignored.
+		Mask active = Simd::allLanes();
+		if (shortcuts.bulbCheck)
+		{
+			Vector cardioidRe = Simd::sub(vcr, kQuarter);
+			Vector q = Simd::add(Simd::mul(cardioidRe, cardioidRe), ci2);
+			Mask inCardioid = Simd::greater(Simd::mul(ci2, kQuarter), Simd::mul(q, Simd::add(q, cardioidRe)), active);
+			active = Simd::remove(active, inCardioid);
+			Vector bulbRe = Simd::add(vcr, kOne);
+			Mask inBulb = Simd::greater(kSixteenth, Simd::add(Simd::mul(bulbRe, bulbRe), ci2), active);
+			active = Simd::remove(active, inBulb);
+			skipped.bulb += uint64_t{ maxIterations } * (Simd::count(inCardioid) + Simd::count(inBulb));
+		}
+
+		Vector x = Simd::set(0);
+		Vector y = Simd::set(0);
+		Vector savedX = Simd::set(0);
+		Vector savedY = Simd::set(0);
+		Vector iteration = kOne;
+		for (uint32_t i = 1; i <= maxIterations && Simd::any(active); ++i)
+		{
+			Vector xy = Simd::mul(x, y);
+			x = Simd::add(Simd::sub(Simd::mul(x, x), Simd::mul(y, y)), vcr);
+			y = Simd::add(Simd::add(xy, xy), vci);
+			Vector norm = Simd::add(Simd::mul(x, x), Simd::mul(y, y));
+			Mask escaped = Simd::greater(norm, kFour, active);
+			escapedAt = Simd::select(escaped, iteration, escapedAt);
+			active = Simd::remove(active, escaped);
+
+			if (shortcuts.periodicityCheck)
+			{
+				Vector dx = Simd::sub(x, savedX);
+				Vector dy = Simd::sub(y, savedY);
+				Mask periodic = Simd::greater(kPeriodTolerance2, Simd::add(Simd::mul(dx, dx), Simd::mul(dy, dy)), active);
+				if (Simd::any(periodic))
+				{
+					skipped.periodic += uint64_t{ maxIterations - i } * Simd::count(periodic);
+					active = Simd::remove(active, periodic);
+				}
+				if ((i & (i - 1)) == 0)
+				{
+					savedX = x;
+					savedY = y;
+				}
+			}
+			iteration = Simd::add(iteration, kOne);
+		}
+		Simd::storeCounts(iterations + k, escapedAt);
+	}
+	FractalKernel::iterateScalar(cr + k, ci + k * ciStride, ciStride, count - k, maxIterations, iterations + k, shortcuts, skipped);
+}
+
+#undef FRACTAL_KERNEL_NAME
+#undef FRACTAL_KERNEL_TARGET
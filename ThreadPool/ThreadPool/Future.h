@@ -0,0 +1,592 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : A lightweight promise / future pair.
+//                Works like std::promise and std::future but the shared state
+//                is reference counted intrusively and allocated from the
+//                BlockAllocator, so no global heap allocation is needed.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#ifndef FUTURE_H
+#define FUTURE_H
+
+#include "BlockAllocator.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Creates a std::future_error for an error condition.
+// Standard libraries disagree on which of its constructors are public.
+inline std::future_error makeFutureError(std::future_errc errc)
+{
+#ifdef _MSC_VER
+	return std::future_error(std::make_error_code(errc));
+#else
+	return std::future_error(errc);
+#endif
+}
+
+// A callback run by a future's shared state once it becomes ready.
+// Continuations form an intrusive list so registering one doesn't allocate.
+class Continuation
+{
+public:
+	virtual ~Continuation() {}
+
+	// Called once, on the thread that made the state ready, or on the thread
+	// registering the continuation if the state already was. Should not block or throw.
+	// Responsible for destroying the continuation.
+	virtual void run() = 0;
+
+private:
+	friend class FutureStateBase;
+	Continuation* m_next = nullptr;
+};
+
+// A continuation that calls a callable, allocated from the BlockAllocator
+template<typename Callable>
+class CallableContinuation : public Continuation
+{
+public:
+	static CallableContinuation* create(Callable&& callable)
+	{
+		void* memory = BlockAllocator::allocate(sizeof(CallableContinuation));
+		return new (memory) CallableContinuation(std::move(callable));
+	}
+
+	void run() override
+	{
+		// Free the continuation first so the callable can register new ones without growing the cache
+		Callable callable(std::move(m_callable));
+		this->~CallableContinuation();
+		BlockAllocator::deallocate(this);
+		callable();
+	}
+
+private:
+	explicit CallableContinuation(Callable&& callable)
+		: m_callable{ std::move(callable) }
+	{
+	}
+
+	Callable m_callable;
+};
+
+// The parts of a future's shared state that don't depend on the result type
+class FutureStateBase
+{
+public:
+	// The FutureStateBase is non-copyable.
+	FutureStateBase(const FutureStateBase&) = delete;
+	FutureStateBase& operator= (const FutureStateBase&) = delete;
+
+	void addRef()
+	{
+		m_refCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Destroys the state when the last reference is released
+	void release()
+	{
+		if (m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			destroy();
+	}
+
+	// Returns true once a value or exception has been stored
+	bool isReady() const
+	{
+		return m_ready.load(std::memory_order_acquire);
+	}
+
+	// Blocks until a value or exception has been stored
+	void wait()
+	{
+		if (isReady())
+			return;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cvReady.wait(lock, [this] { return isReady(); });
+	}
+
+	// Blocks until a value or exception has been stored or the timeout expires.
+	// Returns true if the state is ready.
+	template<typename Rep, typename Period>
+	bool waitFor(const std::chrono::duration<Rep, Period>& timeout)
+	{
+		if (isReady())
+			return true;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_cvReady.wait_for(lock, timeout, [this] { return isReady(); });
+	}
+
+	void setException(std::exception_ptr exception)
+	{
+		m_exception = std::move(exception);
+		markReady();
+	}
+
+	// Throws the stored exception, if there is one
+	void rethrowIfException() const
+	{
+		if (m_exception)
+			std::rethrow_exception(m_exception);
+	}
+
+	// Runs the continuation once a value or exception has been stored,
+	// straight away if one already has been.
+	void addContinuation(Continuation* continuation)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!isReady()) {
+				continuation->m_next = m_continuations;
+				m_continuations = continuation;
+				return;
+			}
+		}
+		continuation->run();
+	}
+
+	// Marks the future as handed out, returns false if it already was.
+	// Kept here rather than in the Promise to keep Promises pointer sized.
+	bool retrieveFuture()
+	{
+		return !m_futureRetrieved.exchange(true, std::memory_order_relaxed);
+	}
+
+protected:
+	FutureStateBase() {}
+	virtual ~FutureStateBase() {}
+
+	// Called after the result has been stored
+	void markReady()
+	{
+		Continuation* continuations;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_ready.store(true, std::memory_order_release);
+			continuations = m_continuations;
+			m_continuations = nullptr;
+		}
+		m_cvReady.notify_all();
+
+		// The caller still holds a reference, so the state outlives the continuations
+		while (continuations) {
+			Continuation* next = continuations->m_next;
+			continuations->run();
+			continuations = next;
+		}
+	}
+
+	// Destroys the state and frees its memory
+	virtual void destroy() = 0;
+
+	std::exception_ptr m_exception;
+
+private:
+	std::atomic<unsigned int> m_refCount{ 1 };
+	std::atomic_bool m_ready{ false };
+	std::atomic_bool m_futureRetrieved{ false };
+	std::mutex m_mutex;
+	std::condition_variable m_cvReady;
+	// Continuations waiting for the state to become ready, the newest first.
+	// Guarded by m_mutex.
+	Continuation* m_continuations = nullptr;
+};
+
+// The shared state between a Promise and a Future
+template<typename T>
+class FutureState : public FutureStateBase
+{
+public:
+	// References are stored as reference_wrappers so the storage is assignable
+	using StorageT = std::conditional_t<std::is_reference<T>::value, std::reference_wrapper<std::remove_reference_t<T>>, T>;
+
+	// Creates a new state with a reference count of one
+	static FutureState* create()
+	{
+		void* memory = BlockAllocator::allocate(sizeof(FutureState));
+		return new (memory) FutureState();
+	}
+
+	template<typename U>
+	void setValue(U&& value)
+	{
+		new (&m_storage) StorageT(std::forward<U>(value));
+		m_hasValue = true;
+		markReady();
+	}
+
+	// Moves the stored value out of the state
+	T takeValue()
+	{
+		return static_cast<T>(std::move(*reinterpret_cast<StorageT*>(&m_storage)));
+	}
+
+private:
+	FutureState() {}
+
+	~FutureState()
+	{
+		if (m_hasValue)
+			reinterpret_cast<StorageT*>(&m_storage)->~StorageT();
+	}
+
+	void destroy() override
+	{
+		this->~FutureState();
+		BlockAllocator::deallocate(this);
+	}
+
+	typename std::aligned_storage<sizeof(StorageT), alignof(StorageT)>::type m_storage;
+	bool m_hasValue = false;
+};
+
+template<>
+class FutureState<void> : public FutureStateBase
+{
+public:
+	static FutureState* create()
+	{
+		void* memory = BlockAllocator::allocate(sizeof(FutureState));
+		return new (memory) FutureState();
+	}
+
+	void setValue()
+	{
+		markReady();
+	}
+
+	void takeValue()
+	{
+	}
+
+private:
+	FutureState() {}
+
+	void destroy() override
+	{
+		this->~FutureState();
+		BlockAllocator::deallocate(this);
+	}
+};
+
+template<typename T>
+class Promise;
+
+// The result of an asynchronous operation.
+// Has the same interface as std::future.
+template<typename T>
+class Future
+{
+public:
+	Future() {}
+	Future(Future&& other) noexcept;
+	Future& operator= (Future&& other) noexcept;
+	~Future();
+
+	// The Future is non-copyable.
+	Future(const Future&) = delete;
+	Future& operator= (const Future&) = delete;
+
+	// Returns true if the future refers to a shared state
+	bool valid() const;
+
+	// Returns true if the result is available
+	bool isReady() const;
+
+	// Blocks until the result is available
+	void wait() const;
+
+	// Blocks until the result is available or the timeout expires
+	template<typename Rep, typename Period>
+	std::future_status wait_for(const std::chrono::duration<Rep, Period>& timeout) const;
+
+	// Waits for the result and returns it, or throws the exception stored
+	// by the asynchronous operation. The future is invalid afterwards.
+	T get();
+
+	// Calls callback(future) once the result is available, passing this future
+	// so get() won't block. Called on the thread that stores the result, or on
+	// this thread if it is already available, so callback shouldn't block.
+	// The future is invalid afterwards.
+	template<typename Callback>
+	void onReady(Callback&& callback);
+
+	// Runs the continuation once the result is available, see Continuation::run.
+	// The continuation must stay alive until it has run.
+	void addContinuation(Continuation* continuation) const;
+
+private:
+	friend class Promise<T>;
+
+	explicit Future(FutureState<T>* state);
+
+	FutureState<T>* m_state = nullptr;
+};
+
+// Stores the result of an asynchronous operation for retrieval through a Future.
+// Has the same interface as std::promise. A Promise that is destroyed without
+// a result stores a broken_promise error.
+template<typename T>
+class Promise
+{
+public:
+	Promise();
+	Promise(Promise&& other) noexcept;
+	Promise& operator= (Promise&& other) noexcept;
+	~Promise();
+
+	// The Promise is non-copyable.
+	Promise(const Promise&) = delete;
+	Promise& operator= (const Promise&) = delete;
+
+	// Returns the future associated with this promise.
+	// Can only be called once.
+	Future<T> getFuture();
+
+	// Stores a value in the shared state
+	template<typename... U>
+	void setValue(U&&... value);
+
+	// Stores an exception in the shared state
+	void setException(std::exception_ptr exception);
+
+	// Invokes callable with args and stores the result, or any exception thrown.
+	template<typename Callable, typename... Args>
+	void setResultOf(Callable&& callable, Args&&... args);
+
+private:
+	template<typename Callable, typename... Args>
+	void invokeAndStore(std::false_type /*isVoid*/, Callable&& callable, Args&&... args);
+
+	template<typename Callable, typename... Args>
+	void invokeAndStore(std::true_type /*isVoid*/, Callable&& callable, Args&&... args);
+
+	// Releases the shared state, breaking the promise if no result was stored
+	void abandon();
+
+	FutureState<T>* m_state;
+};
+
+// Returns true when a future is ready (when the associated task has finished its work)
+template<typename T>
+bool isReady(const Future<T>& future)
+{
+	return future.isReady();
+}
+
+template<typename T>
+inline Future<T>::Future(FutureState<T>* state)
+	: m_state{ state }
+{
+}
+
+template<typename T>
+inline Future<T>::Future(Future&& other) noexcept
+	: m_state{ other.m_state }
+{
+	other.m_state = nullptr;
+}
+
+template<typename T>
+inline Future<T>& Future<T>::operator=(Future&& other) noexcept
+{
+	if (this != &other) {
+		if (m_state)
+			m_state->release();
+		m_state = other.m_state;
+		other.m_state = nullptr;
+	}
+	return *this;
+}
+
+template<typename T>
+inline Future<T>::~Future()
+{
+	if (m_state)
+		m_state->release();
+}
+
+template<typename T>
+inline bool Future<T>::valid() const
+{
+	return m_state != nullptr;
+}
+
+template<typename T>
+inline bool Future<T>::isReady() const
+{
+	return m_state && m_state->isReady();
+}
+
+template<typename T>
+inline void Future<T>::wait() const
+{
+	m_state->wait();
+}
+
+template<typename T>
+template<typename Rep, typename Period>
+inline std::future_status Future<T>::wait_for(const std::chrono::duration<Rep, Period>& timeout) const
+{
+	return m_state->waitFor(timeout) ? std::future_status::ready : std::future_status::timeout;
+}
+
+template<typename T>
+inline T Future<T>::get()
+{
+	if (!m_state)
+		throw makeFutureError(std::future_errc::no_state);
+
+	// Release our reference however we leave
+	struct StateReleaser {
+		FutureState<T>* state;
+		~StateReleaser() { state->release(); }
+	} releaser{ m_state };
+	m_state = nullptr;
+
+	releaser.state->wait();
+	releaser.state->rethrowIfException();
+	return releaser.state->takeValue();
+}
+
+template<typename T>
+template<typename Callback>
+inline void Future<T>::onReady(Callback&& callback)
+{
+	if (!m_state)
+		throw makeFutureError(std::future_errc::no_state);
+
+	// The continuation takes over our reference to the state
+	FutureState<T>* state = m_state;
+	m_state = nullptr;
+	auto continuation = [state, callback = std::forward<Callback>(callback)]() mutable {
+		callback(Future<T>(state));
+	};
+	state->addContinuation(CallableContinuation<decltype(continuation)>::create(std::move(continuation)));
+}
+
+template<typename T>
+inline void Future<T>::addContinuation(Continuation* continuation) const
+{
+	if (!m_state)
+		throw makeFutureError(std::future_errc::no_state);
+	m_state->addContinuation(continuation);
+}
+
+template<typename T>
+inline Promise<T>::Promise()
+	: m_state{ FutureState<T>::create() }
+{
+}
+
+template<typename T>
+inline Promise<T>::Promise(Promise&& other) noexcept
+	: m_state{ other.m_state }
+{
+	other.m_state = nullptr;
+}
+
+template<typename T>
+inline Promise<T>& Promise<T>::operator=(Promise&& other) noexcept
+{
+	if (this != &other) {
+		abandon();
+		m_state = other.m_state;
+		other.m_state = nullptr;
+	}
+	return *this;
+}
+
+template<typename T>
+inline Promise<T>::~Promise()
+{
+	abandon();
+}
+
+template<typename T>
+inline Future<T> Promise<T>::getFuture()
+{
+	if (!m_state)
+		throw makeFutureError(std::future_errc::no_state);
+	if (!m_state->retrieveFuture())
+		throw makeFutureError(std::future_errc::future_already_retrieved);
+
+	m_state->addRef();
+	return Future<T>(m_state);
+}
+
+template<typename T>
+template<typename... U>
+inline void Promise<T>::setValue(U&&... value)
+{
+	if (!m_state)
+		throw makeFutureError(std::future_errc::no_state);
+	if (m_state->isReady())
+		throw makeFutureError(std::future_errc::promise_already_satisfied);
+	m_state->setValue(std::forward<U>(value)...);
+}
+
+template<typename T>
+inline void Promise<T>::setException(std::exception_ptr exception)
+{
+	if (!m_state)
+		throw makeFutureError(std::future_errc::no_state);
+	if (m_state->isReady())
+		throw makeFutureError(std::future_errc::promise_already_satisfied);
+	m_state->setException(std::move(exception));
+}
+
+template<typename T>
+template<typename Callable, typename... Args>
+inline void Promise<T>::setResultOf(Callable&& callable, Args&&... args)
+{
+	try {
+		invokeAndStore(typename std::is_void<T>::type(), std::forward<Callable>(callable), std::forward<Args>(args)...);
+	} catch (...) {
+		setException(std::current_exception());
+	}
+}
+
+template<typename T>
+template<typename Callable, typename... Args>
+inline void Promise<T>::invokeAndStore(std::false_type, Callable&& callable, Args&&... args)
+{
+	setValue(std::forward<Callable>(callable)(std::forward<Args>(args)...));
+}
+
+template<typename T>
+template<typename Callable, typename... Args>
+inline void Promise<T>::invokeAndStore(std::true_type, Callable&& callable, Args&&... args)
+{
+	std::forward<Callable>(callable)(std::forward<Args>(args)...);
+	setValue();
+}
+
+template<typename T>
+inline void Promise<T>::abandon()
+{
+	if (!m_state)
+		return;
+	if (!m_state->isReady())
+		m_state->setException(std::make_exception_ptr(makeFutureError(std::future_errc::broken_promise)));
+	m_state->release();
+	m_state = nullptr;
+}
+
+#endif
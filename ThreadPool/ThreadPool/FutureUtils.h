@@ -0,0 +1,170 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Combines futures without blocking a thread to wait on them.
+//                Works with Future<T> and BatchFuture.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#ifndef FUTUREUTILS_H
+#define FUTUREUTILS_H
+
+#include "BlockAllocator.h"
+#include "Future.h"
+
+#include <atomic>
+#include <new>
+#include <utility>
+#include <vector>
+
+// The result of whenAny
+template<typename FutureT>
+struct WhenAnyResult {
+	// Index of the first future to become ready
+	size_t index;
+	// That future, ready so get() won't block
+	FutureT future;
+};
+
+// Shared state of a whenAll, destroyed by the last future to become ready
+template<typename FutureT>
+class WhenAllState
+{
+public:
+	static WhenAllState* create(size_t numFutures)
+	{
+		void* memory = BlockAllocator::allocate(sizeof(WhenAllState));
+		return new (memory) WhenAllState(numFutures);
+	}
+
+	Future<std::vector<FutureT>> getFuture()
+	{
+		return m_promise.getFuture();
+	}
+
+	// Stores the index'th future once it is ready
+	void complete(size_t index, FutureT&& future)
+	{
+		m_futures[index] = std::move(future);
+		if (m_numRemaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			m_promise.setValue(std::move(m_futures));
+			this->~WhenAllState();
+			BlockAllocator::deallocate(this);
+		}
+	}
+
+private:
+	explicit WhenAllState(size_t numFutures)
+		: m_futures(numFutures)
+		, m_numRemaining{ numFutures }
+	{
+	}
+
+	std::vector<FutureT> m_futures;
+	Promise<std::vector<FutureT>> m_promise;
+	std::atomic<size_t> m_numRemaining;
+};
+
+// Shared state of a whenAny, destroyed by the last future to become ready
+template<typename FutureT>
+class WhenAnyState
+{
+public:
+	static WhenAnyState* create(size_t numFutures)
+	{
+		void* memory = BlockAllocator::allocate(sizeof(WhenAnyState));
+		return new (memory) WhenAnyState(numFutures);
+	}
+
+	Future<WhenAnyResult<FutureT>> getFuture()
+	{
+		return m_promise.getFuture();
+	}
+
+	// Stores the index'th future if it is the first to be ready
+	void complete(size_t index, FutureT&& future)
+	{
+		if (!m_hasResult.exchange(true, std::memory_order_relaxed))
+			m_promise.setValue(WhenAnyResult<FutureT>{ index, std::move(future) });
+		if (m_numRemaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			this->~WhenAnyState();
+			BlockAllocator::deallocate(this);
+		}
+	}
+
+private:
+	explicit WhenAnyState(size_t numFutures)
+		: m_numRemaining{ numFutures }
+	{
+	}
+
+	Promise<WhenAnyResult<FutureT>> m_promise;
+	std::atomic_bool m_hasResult{ false };
+	std::atomic<size_t> m_numRemaining;
+};
+
+// Returns a future that becomes ready with every future once they are all ready.
+// No thread waits for them, the last one to finish stores the result.
+// Throws std::future_error if any future is invalid.
+template<typename FutureT>
+Future<std::vector<FutureT>> whenAll(std::vector<FutureT> futures)
+{
+	for (const FutureT& future : futures) {
+		if (!future.valid())
+			throw makeFutureError(std::future_errc::no_state);
+	}
+
+	if (futures.empty()) {
+		Promise<std::vector<FutureT>> promise;
+		Future<std::vector<FutureT>> result = promise.getFuture();
+		promise.setValue(std::vector<FutureT>());
+		return result;
+	}
+
+	// Take the result before registering, the state is gone once the last future is ready
+	WhenAllState<FutureT>* state = WhenAllState<FutureT>::create(futures.size());
+	Future<std::vector<FutureT>> result = state->getFuture();
+	for (size_t i = 0; i < futures.size(); ++i) {
+		futures[i].onReady([state, i](FutureT ready) {
+			state->complete(i, std::move(ready));
+		});
+	}
+	return result;
+}
+
+// Returns a future that becomes ready with the first of the futures to be ready.
+// The results of the other futures are discarded. If futures is empty the
+// result is ready straight away with an invalid future.
+// Throws std::future_error if any future is invalid.
+template<typename FutureT>
+Future<WhenAnyResult<FutureT>> whenAny(std::vector<FutureT> futures)
+{
+	for (const FutureT& future : futures) {
+		if (!future.valid())
+			throw makeFutureError(std::future_errc::no_state);
+	}
+
+	if (futures.empty()) {
+		Promise<WhenAnyResult<FutureT>> promise;
+		Future<WhenAnyResult<FutureT>> result = promise.getFuture();
+		promise.setValue(WhenAnyResult<FutureT>{ 0, FutureT() });
+		return result;
+	}
+
+	WhenAnyState<FutureT>* state = WhenAnyState<FutureT>::create(futures.size());
+	Future<WhenAnyResult<FutureT>> result = state->getFuture();
+	for (size_t i = 0; i < futures.size(); ++i) {
+		futures[i].onReady([state, i](FutureT ready) {
+			state->complete(i, std::move(ready));
+		});
+	}
+	return result;
+}
+
+#endif
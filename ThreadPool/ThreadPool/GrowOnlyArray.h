@@ -0,0 +1,132 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : An array that can be read from any thread while one thread
+//                appends to it. Elements never move, and the table of element
+//                pointers is replaced as a whole when it needs to grow.
+//                Elements get their type's alignment even when it is wider
+//                than new guarantees, so cache line aligned types stay isolated.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#ifndef GROWONLYARRAY_H
+#define GROWONLYARRAY_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+template<typename T>
+class GrowOnlyArray
+{
+public:
+	GrowOnlyArray() {}
+
+	// The GrowOnlyArray is non-copyable.
+	GrowOnlyArray(const GrowOnlyArray&) = delete;
+	GrowOnlyArray& operator= (const GrowOnlyArray&) = delete;
+
+	// Returns the number of elements. Safe to call while another thread grows the array.
+	size_t size() const
+	{
+		return m_size.load(std::memory_order_acquire);
+	}
+
+	// Returns the element at index, which must be less than a value previously
+	// returned by size(). Safe to call while another thread grows the array.
+	T& operator[](size_t index) const
+	{
+		return *m_table.load(std::memory_order_acquire)[index];
+	}
+
+	// Returns the element at index, throws std::out_of_range if there isn't one
+	T& at(size_t index) const
+	{
+		if (index >= size())
+			throw std::out_of_range("GrowOnlyArray index out of range");
+		return (*this)[index];
+	}
+
+	// Default constructs elements until the array holds at least newSize elements.
+	// Only one thread may grow the array at a time.
+	void growTo(size_t newSize)
+	{
+		size_t oldSize = m_elements.size();
+		if (newSize <= oldSize)
+			return;
+
+		// Readers may still be using the old table, so it is kept until clear()
+		std::unique_ptr<T*[]> table = std::make_unique<T*[]>(newSize);
+		for (size_t i = 0; i < oldSize; ++i)
+			table[i] = m_elements[i].get();
+		for (size_t i = oldSize; i < newSize; ++i)
+		{
+			m_elements.push_back(ElementPtr(createElement()));
+			table[i] = m_elements.back().get();
+		}
+
+		// Publish the table before the size so a reader never indexes past the table it sees
+		m_table.store(table.get(), std::memory_order_release);
+		m_tables.push_back(std::move(table));
+		m_size.store(newSize, std::memory_order_release);
+	}
+
+	// Destroys every element.
+	// Must not be called while other threads are using the array.
+	void clear()
+	{
+		m_size.store(0, std::memory_order_relaxed);
+		m_table.store(nullptr, std::memory_order_relaxed);
+		m_tables.clear();
+		m_elements.clear();
+	}
+
+private:
+	// Before C++17 new ignores alignments wider than std::max_align_t, so each
+	// element's block is aligned by hand, with the block's start stored just before it
+	static const size_t kAlignment = alignof(T) > alignof(std::max_align_t) ? alignof(T) : alignof(std::max_align_t);
+
+	struct ElementDeleter {
+		void operator()(T* element) const
+		{
+			void* block = reinterpret_cast<void**>(element)[-1];
+			element->~T();
+			::operator delete(block);
+		}
+	};
+	using ElementPtr = std::unique_ptr<T, ElementDeleter>;
+
+	static T* createElement()
+	{
+		void* block = ::operator new(sizeof(void*) + kAlignment - 1 + sizeof(T));
+		uintptr_t address = reinterpret_cast<uintptr_t>(block) + sizeof(void*);
+		address = (address + kAlignment - 1) & ~static_cast<uintptr_t>(kAlignment - 1);
+		reinterpret_cast<void**>(address)[-1] = block;
+		try {
+			return new (reinterpret_cast<void*>(address)) T();
+		}
+		catch (...) {
+			::operator delete(block);
+			throw;
+		}
+	}
+
+	std::atomic<size_t> m_size{ 0 };
+	std::atomic<T**> m_table{ nullptr };
+
+	// Every table published since the last clear, the newest last
+	std::vector<std::unique_ptr<T*[]>> m_tables;
+	std::vector<ElementPtr> m_elements;
+};
+
+#endif
@@ -0,0 +1,200 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : A bounded lock free multi producer, multi consumer queue.
+//                Each cell in the ring buffer carries a sequence number that
+//                tells producers and consumers whether the cell is free to
+//                write or ready to read, so no locks are needed.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#ifndef LOCKFREEQUEUE_H
+#define LOCKFREEQUEUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+template<typename T>
+class LockFreeQueue
+{
+public:
+	// capacity is rounded up to a power of two.
+	explicit LockFreeQueue(size_t capacity = 1024);
+	~LockFreeQueue();
+
+	// The LockFreeQueue is non-copyable.
+	LockFreeQueue(const LockFreeQueue&) = delete;
+	LockFreeQueue& operator= (const LockFreeQueue&) = delete;
+
+	// Insert an item at the back of the queue.
+	// If the queue is full then yield until space becomes available.
+	void push(T&& item);
+
+	// Attempts to insert an item at the back of the queue.
+	// If the queue is full just return false, item is left untouched.
+	bool tryPush(T&& item);
+
+	// Attempts to get a workitem from the queue
+	// If the queue is empty just return false;
+	bool tryPop(T& workItem);
+
+	// Attempts to get a workitem from the queue
+	// If the queue is empty then yield until an item becomes available.
+	void pop(T& workItem);
+
+	// Clears the queue
+	void clear();
+
+	// Checks if the queue is empty or not
+	bool empty() const;
+
+	// Returns the approximate number of items in the queue
+	size_t size() const;
+
+	// Returns the maximum number of items the queue can hold
+	size_t capacity() const;
+
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+	};
+
+	size_t m_mask;
+	std::unique_ptr<Cell[]> m_cells;
+
+	// Producers and consumers each hammer their own position, keep them on separate cache lines
+	alignas(64) std::atomic<size_t> m_enqueuePos{ 0 };
+	alignas(64) std::atomic<size_t> m_dequeuePos{ 0 };
+};
+
+template<typename T>
+inline LockFreeQueue<T>::LockFreeQueue(size_t capacity)
+{
+	size_t powerOfTwo = 2;
+	while (powerOfTwo < capacity)
+		powerOfTwo <<= 1;
+
+	m_mask = powerOfTwo - 1;
+	m_cells.reset(new Cell[powerOfTwo]);
+	for (size_t i = 0; i < powerOfTwo; ++i)
+		m_cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+template<typename T>
+inline LockFreeQueue<T>::~LockFreeQueue()
+{
+	clear();
+}
+
+template<typename T>
+inline void LockFreeQueue<T>::push(T&& item)
+{
+	while (!tryPush(std::move(item)))
+		std::this_thread::yield();
+}
+
+template<typename T>
+inline bool LockFreeQueue<T>::tryPush(T&& item)
+{
+	Cell* cell;
+	size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+	for (;;) {
+		cell = &m_cells[pos & m_mask];
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+		if (diff == 0) {
+			// Cell is free, try to claim it
+			if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			// Cell still holds an item from the previous lap, the queue is full
+			return false;
+		} else {
+			// Another producer claimed the cell first
+			pos = m_enqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+
+	new (&cell->storage) T(std::move(item));
+	cell->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+template<typename T>
+inline bool LockFreeQueue<T>::tryPop(T& workItem)
+{
+	Cell* cell;
+	size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+	for (;;) {
+		cell = &m_cells[pos & m_mask];
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+		if (diff == 0) {
+			// Cell holds an item, try to claim it
+			if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			// Cell has not been written yet, the queue is empty
+			return false;
+		} else {
+			// Another consumer claimed the cell first
+			pos = m_dequeuePos.load(std::memory_order_relaxed);
+		}
+	}
+
+	T* item = reinterpret_cast<T*>(&cell->storage);
+	workItem = std::move(*item);
+	item->~T();
+
+	// Mark the cell as free for the producer on the next lap
+	cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+	return true;
+}
+
+template<typename T>
+inline void LockFreeQueue<T>::pop(T& workItem)
+{
+	while (!tryPop(workItem))
+		std::this_thread::yield();
+}
+
+template<typename T>
+inline void LockFreeQueue<T>::clear()
+{
+	T item;
+	while (tryPop(item)) {}
+}
+
+template<typename T>
+inline bool LockFreeQueue<T>::empty() const
+{
+	return size() == 0;
+}
+
+template<typename T>
+inline size_t LockFreeQueue<T>::size() const
+{
+	size_t dequeuePos = m_dequeuePos.load(std::memory_order_seq_cst);
+	size_t enqueuePos = m_enqueuePos.load(std::memory_order_seq_cst);
+	return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+}
+
+template<typename T>
+inline size_t LockFreeQueue<T>::capacity() const
+{
+	return m_mask + 1;
+}
+
+#endif
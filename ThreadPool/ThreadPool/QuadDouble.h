@@ -0,0 +1,223 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : A number stored as the unevaluated sum of four doubles, giving
+//                about 64 significant digits. Holds the center of the view,
+//                which must stay exact long after the pixels are offsets from it.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#pragma once
+
+#include "DoubleDouble.h"
+
+#include <cstddef>
+
+// part[0] holds the value rounded to a double, and each later part the rounding
+// error of the parts before it, |part[i + 1]| <= ulp(part[i]) / 2
+struct QuadDouble {
+	double part[4] = {};
+
+	QuadDouble() = default;
+
+	QuadDouble(double value)
+		: part{ value, 0, 0, 0 }
+	{
+	}
+
+	QuadDouble(double part0, double part1, double part2, double part3)
+		: part{ part0, part1, part2, part3 }
+	{
+	}
+
+	explicit operator double() const
+	{
+		return part[0] + part[1];
+	}
+
+	explicit operator DoubleDouble() const
+	{
+		return DoubleDoubleDetail::quickTwoSum(part[0], part[1] + part[2]);
+	}
+};
+
+// The algorithms are those of Hida, Li and Bailey's QD library
+namespace QuadDoubleDetail {
+	// Replaces a, b and c with their sum as a + b, with c the error left
+	inline void threeSum(double& a, double& b, double& c)
+	{
+		DoubleDouble ab = DoubleDoubleDetail::twoSum(a, b);
+		DoubleDouble abc = DoubleDoubleDetail::twoSum(c, ab.hi);
+		DoubleDouble errors = DoubleDoubleDetail::twoSum(ab.lo, abc.lo);
+		a = abc.hi;
+		b = errors.hi;
+		c = errors.lo;
+	}
+
+	// As threeSum, but only keeps the sum to a + b
+	inline void threeSum2(double& a, double& b, double c)
+	{
+		DoubleDouble ab = DoubleDoubleDetail::twoSum(a, b);
+		DoubleDouble abc = DoubleDoubleDetail::twoSum(c, ab.hi);
+		a = abc.hi;
+		b = ab.lo + abc.lo;
+	}
+
+	// Returns c0 + c1 + c2 + c3 + c4, where each is roughly smaller than the one
+	// before, as four parts that don't overlap
+	inline QuadDouble renormalize(double c0, double c1, double c2, double c3, double c4)
+	{
+		using DoubleDoubleDetail::quickTwoSum;
+
+		// Adds from the bottom up so each part carries the error of the ones below it
+		DoubleDouble sum = quickTwoSum(c3, c4);
+		c4 = sum.lo;
+		sum = quickTwoSum(c2, sum.hi);
+		c3 = sum.lo;
+		sum = quickTwoSum(c1, sum.hi);
+		c2 = sum.lo;
+		sum = quickTwoSum(c0, sum.hi);
+		c1 = sum.lo;
+		c0 = sum.hi;
+
+		// Then from the top down, skipping errors of 0 so no part is left empty
+		double parts[4] = { c0, 0, 0, 0 };
+		const double rest[4] = { c1, c2, c3, c4 };
+		size_t last = 0;
+		for (size_t i = 0; i < 4; ++i)
+		{
+			sum = quickTwoSum(parts[last], rest[i]);
+			parts[last] = sum.hi;
+			if (sum.lo == 0)
+				continue;
+			if (last == 3)
+			{
+				parts[last] += sum.lo;
+				continue;
+			}
+			parts[++last] = sum.lo;
+		}
+		return { parts[0], parts[1], parts[2], parts[3] };
+	}
+}
+
+inline QuadDouble operator- (const QuadDouble& value)
+{
+	return { -value.part[0], -value.part[1], -value.part[2], -value.part[3] };
+}
+
+inline QuadDouble operator+ (const QuadDouble& a, const QuadDouble& b)
+{
+	using DoubleDoubleDetail::twoSum;
+
+	// Adds the parts pairwise, then folds each error into the part below
+	DoubleDouble s0 = twoSum(a.part[0], b.part[0]);
+	DoubleDouble s1 = twoSum(a.part[1], b.part[1]);
+	DoubleDouble s2 = twoSum(a.part[2], b.part[2]);
+	DoubleDouble s3 = twoSum(a.part[3], b.part[3]);
+
+	DoubleDouble carry = twoSum(s1.hi, s0.lo);
+	double t0 = carry.lo;
+	double t1 = s1.lo;
+	double t2 = s2.lo;
+	double sum2 = s2.hi;
+	QuadDoubleDetail::threeSum(sum2, t0, t1);
+	double sum3 = s3.hi;
+	QuadDoubleDetail::threeSum2(sum3, t0, t2);
+	t0 = t0 + t1 + s3.lo;
+	return QuadDoubleDetail::renormalize(s0.hi, carry.hi, sum2, sum3, t0);
+}
+
+inline QuadDouble operator- (const QuadDouble& a, const QuadDouble& b)
+{
+	return a + -b;
+}
+
+inline QuadDouble operator* (const QuadDouble& a, const QuadDouble& b)
+{
+	using DoubleDoubleDetail::twoProduct;
+	using DoubleDoubleDetail::twoSum;
+
+	// Products of the parts, grouped by how much smaller than a * b they are
+	DoubleDouble p0 = twoProduct(a.part[0], b.part[0]);
+	DoubleDouble p1 = twoProduct(a.part[0], b.part[1]);
+	DoubleDouble p2 = twoProduct(a.part[1], b.part[0]);
+	DoubleDouble p3 = twoProduct(a.part[0], b.part[2]);
+	DoubleDouble p4 = twoProduct(a.part[1], b.part[1]);
+	DoubleDouble p5 = twoProduct(a.part[2], b.part[0]);
+
+	double sum1 = p1.hi;
+	double sum2 = p2.hi;
+	double error0 = p0.lo;
+	QuadDoubleDetail::threeSum(sum1, sum2, error0);
+
+	double q1 = p1.lo;
+	double q2 = p2.lo;
+	QuadDoubleDetail::threeSum(sum2, q1, q2);
+	double r3 = p3.hi;
+	double r4 = p4.hi;
+	double r5 = p5.hi;
+	QuadDoubleDetail::threeSum(r3, r4, r5);
+
+	DoubleDouble s0 = twoSum(sum2, r3);
+	DoubleDouble s1 = twoSum(q1, r4);
+	double s2 = q2 + r5;
+	DoubleDouble carry = twoSum(s1.hi, s0.lo);
+	s2 += carry.lo + s1.lo;
+
+	// The smallest terms only need to be roughly right
+	double s3 = carry.hi + (a.part[0] * b.part[3] + a.part[1] * b.part[2] + a.part[2] * b.part[1] + a.part[3] * b.part[0]
+	                        + error0 + p3.lo + p4.lo + p5.lo);
+	return QuadDoubleDetail::renormalize(p0.hi, sum1, s0.hi, s3, s2);
+}
+
+inline QuadDouble operator* (const QuadDouble& a, double b)
+{
+	using DoubleDoubleDetail::twoProduct;
+	using DoubleDoubleDetail::twoSum;
+
+	DoubleDouble p0 = twoProduct(a.part[0], b);
+	DoubleDouble p1 = twoProduct(a.part[1], b);
+	DoubleDouble p2 = twoProduct(a.part[2], b);
+	double p3 = a.part[3] * b;
+
+	DoubleDouble s1 = twoSum(p0.lo, p1.hi);
+	double s2 = s1.lo;
+	double q1 = p1.lo;
+	double r2 = p2.hi;
+	QuadDoubleDetail::threeSum(s2, q1, r2);
+	double q2 = p2.lo;
+	QuadDoubleDetail::threeSum2(q1, q2, p3);
+	return QuadDoubleDetail::renormalize(p0.hi, s1.hi, s2, q1, q2 + r2);
+}
+
+inline QuadDouble& operator+= (QuadDouble& a, const QuadDouble& b)
+{
+	return a = a + b;
+}
+
+inline QuadDouble& operator-= (QuadDouble& a, const QuadDouble& b)
+{
+	return a = a - b;
+}
+
+inline bool operator< (const QuadDouble& a, const QuadDouble& b)
+{
+	for (size_t i = 0; i < 3; ++i)
+	{
+		if (a.part[i] != b.part[i])
+			return a.part[i] < b.part[i];
+	}
+	return a.part[3] < b.part[3];
+}
+
+inline bool operator> (const QuadDouble& a, const QuadDouble& b)
+{
+	return b < a;
+}
@@ -0,0 +1,160 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Renders deep zooms with perturbation theory
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+//Library Includes
+#include <cmath>
+
+//This Include
+#include "ReferenceOrbit.h"
+
+ReferenceOrbit::ReferenceOrbit(const QuadDouble& re, const QuadDouble& im, uint32_t maxIterations, double maxDelta, double pixelStep)
+	: m_maxIterations(maxIterations)
+	, m_escapeIteration(maxIterations + 1)
+{
+	// The series is trusted while its error is this fraction of the distance between
+	// pixels. The error is only estimated, and looser values visibly shift pixels.
+	const double kSeriesTolerance = 1e-7;
+	double maxDelta2 = maxDelta * maxDelta;
+	double maxDelta3 = maxDelta2 * maxDelta;
+
+	m_re.reserve(maxIterations + 1);
+	m_im.reserve(maxIterations + 1);
+	m_re.push_back(0);
+	m_im.push_back(0);
+
+	// The orbit must be exact to well within a pixel, which in double-double runs out
+	// around a zoom of 1e30. Quad-double lasts until about 1e60.
+	QuadDouble x = 0;
+	QuadDouble y = 0;
+	double aRe = 0, aIm = 0;
+	double bRe = 0, bIm = 0;
+	double cRe = 0, cIm = 0;
+	bool seriesValid = true;
+	for (uint32_t iteration = 1; iteration <= maxIterations; ++iteration)
+	{
+		if (seriesValid)
+		{
+			// Substituting the series into d' = 2Zd + d^2 + dc gives
+			// A' = 2ZA + 1, B' = 2ZB + A^2 and C' = 2ZC + 2AB
+			double zRe = m_re.back();
+			double zIm = m_im.back();
+			double nextARe = 2 * (zRe * aRe - zIm * aIm) + 1;
+			double nextAIm = 2 * (zRe * aIm + zIm * aRe);
+			double nextBRe = 2 * (zRe * bRe - zIm * bIm) + (aRe * aRe - aIm * aIm);
+			double nextBIm = 2 * (zRe * bIm + zIm * bRe) + 2 * aRe * aIm;
+			double nextCRe = 2 * (zRe * cRe - zIm * cIm) + 2 * (aRe * bRe - aIm * bIm);
+			double nextCIm = 2 * (zRe * cIm + zIm * cRe) + 2 * (aRe * bIm + aIm * bRe);
+			aRe = nextARe;
+			aIm = nextAIm;
+			bRe = nextBRe;
+			bIm = nextBIm;
+			cRe = nextCRe;
+			cIm = nextCIm;
+		}
+
+		QuadDouble xy = x * y;
+		x = x * x - y * y + re;
+		y = xy + xy + im;
+		double zRe = static_cast<double>(x);
+		double zIm = static_cast<double>(y);
+		m_re.push_back(zRe);
+		m_im.push_back(zIm);
+		double norm = zRe * zRe + zIm * zIm;
+		if (norm > 4)
+		{
+			m_escapeIteration = iteration;
+			break;
+		}
+
+		if (seriesValid)
+		{
+			// The terms left out are about the size of the last term. Every pixel
+			// must also be certain not to have escaped during the skipped iterations.
+			double a = std::hypot(aRe, aIm);
+			double error = std::hypot(cRe, cIm) * maxDelta3;
+			double reach = a * maxDelta + std::hypot(bRe, bIm) * maxDelta2 + error;
+			// Written so that overflowing to infinity or NaN ends the series too
+			seriesValid = error <= kSeriesTolerance * a * pixelStep && std::sqrt(norm) + reach <= 2;
+			if (seriesValid)
+			{
+				m_seriesIterations = iteration;
+				m_seriesRe[0] = aRe;
+				m_seriesIm[0] = aIm;
+				m_seriesRe[1] = bRe;
+				m_seriesIm[1] = bIm;
+				m_seriesRe[2] = cRe;
+				m_seriesIm[2] = cIm;
+			}
+		}
+	}
+}
+
+void ReferenceOrbit::iterateRow(const double* deltaRe, double deltaIm, size_t count, uint32_t* iterations) const
+{
+	// The last iteration of the reference, pixels go back to the start once they reach it
+	size_t last = m_re.size() - 1;
+	for (size_t k = 0; k < count; ++k)
+	{
+		double dcRe = deltaRe[k];
+		double dcIm = deltaIm;
+
+		// Starts from the series, d = A dc + B dc^2 + C dc^3
+		double dc2Re = dcRe * dcRe - dcIm * dcIm;
+		double dc2Im = 2 * dcRe * dcIm;
+		double dc3Re = dc2Re * dcRe - dc2Im * dcIm;
+		double dc3Im = dc2Re * dcIm + dc2Im * dcRe;
+		double dRe = (m_seriesRe[0] * dcRe - m_seriesIm[0] * dcIm)
+		           + (m_seriesRe[1] * dc2Re - m_seriesIm[1] * dc2Im)
+		           + (m_seriesRe[2] * dc3Re - m_seriesIm[2] * dc3Im);
+		double dIm = (m_seriesRe[0] * dcIm + m_seriesIm[0] * dcRe)
+		           + (m_seriesRe[1] * dc2Im + m_seriesIm[1] * dc2Re)
+		           + (m_seriesRe[2] * dc3Im + m_seriesIm[2] * dc3Re);
+
+		size_t m = m_seriesIterations;
+		if (m >= last)
+		{
+			// The reference ends where the series does, so the pixel starts over from it
+			dRe += m_re[m];
+			dIm += m_im[m];
+			m = 0;
+		}
+
+		uint32_t iteration = m_seriesIterations + 1;
+		for (; iteration <= m_maxIterations; ++iteration)
+		{
+			double zRe = m_re[m];
+			double zIm = m_im[m];
+			double nextRe = 2 * (zRe * dRe - zIm * dIm) + (dRe * dRe - dIm * dIm) + dcRe;
+			double nextIm = 2 * (zRe * dIm + zIm * dRe) + 2 * dRe * dIm + dcIm;
+			dRe = nextRe;
+			dIm = nextIm;
+			++m;
+
+			double pixelRe = m_re[m] + dRe;
+			double pixelIm = m_im[m] + dIm;
+			double norm = pixelRe * pixelRe + pixelIm * pixelIm;
+			if (norm > 4)
+				break;
+
+			// Rebases when the pixel is nearer 0 than the reference, where d would lose
+			// its precision, or when the reference has run out
+			if (norm < dRe * dRe + dIm * dIm || m == last)
+			{
+				dRe = pixelRe;
+				dIm = pixelIm;
+				m = 0;
+			}
+		}
+		iterations[k] = iteration;
+	}
+}
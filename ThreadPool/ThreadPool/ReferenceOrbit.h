@@ -0,0 +1,78 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Renders deep zooms with perturbation theory. One point is
+//                iterated in quad-double, and every pixel is iterated in
+//                double as an offset from it.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#pragma once
+
+#include "QuadDouble.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// If the reference point's orbit is Z and a pixel is dc away from it, the
+// pixel's orbit is Z + d where d' = 2Zd + d^2 + dc. d stays small enough for
+// doubles long after the pixels themselves are too close together to tell apart.
+//
+// The first iterations of d are a polynomial in dc whose coefficients are the
+// same for every pixel, so they are skipped while a cubic approximates it well.
+//
+// d loses precision when the pixel's orbit passes closer to 0 than the reference
+// does, which shows up as blocks of flat color. Those pixels are rebased: the
+// pixel's orbit becomes d, relative to the start of the reference orbit.
+class ReferenceOrbit
+{
+public:
+	// Iterates the reference point until it escapes or reaches maxIterations.
+	// The series is used while its error, for pixels up to maxDelta away, stays
+	// well below the distance between neighbouring pixels pixelStep apart.
+	ReferenceOrbit(const QuadDouble& re, const QuadDouble& im, uint32_t maxIterations, double maxDelta, double pixelStep);
+
+	// The ReferenceOrbit is non-copyable.
+	ReferenceOrbit(const ReferenceOrbit&) = delete;
+	ReferenceOrbit& operator= (const ReferenceOrbit&) = delete;
+
+	// Iterates count pixels of a row, where pixel k is (deltaRe[k], deltaIm) away
+	// from the reference point. iterations[k] is set to the iteration on which it
+	// escaped, or maxIterations + 1 if it never did, like FractalKernel::iterateRow.
+	void iterateRow(const double* deltaRe, double deltaIm, size_t count, uint32_t* iterations) const;
+
+	// Returns the iterations every pixel skips using the series
+	uint32_t seriesIterations() const;
+
+	// Returns the iteration the reference point escaped on, or maxIterations + 1
+	uint32_t escapeIteration() const;
+
+private:
+	// The reference orbit rounded to doubles, from Z0 = 0 to the last iteration
+	std::vector<double> m_re;
+	std::vector<double> m_im;
+	uint32_t m_maxIterations;
+	uint32_t m_escapeIteration;
+
+	// d = A dc + B dc^2 + C dc^3 after m_seriesIterations iterations
+	uint32_t m_seriesIterations = 0;
+	double m_seriesRe[3] = {};
+	double m_seriesIm[3] = {};
+};
+
+inline uint32_t ReferenceOrbit::seriesIterations() const
+{
+	return m_seriesIterations;
+}
+
+inline uint32_t ReferenceOrbit::escapeIteration() const
+{
+	return m_escapeIteration;
+}
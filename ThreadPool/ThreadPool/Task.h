@@ -0,0 +1,223 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : A move only, type erased callable taking no arguments.
+//                Small callables are stored inline so creating a task does
+//                not allocate. Larger callables fall back to the BlockAllocator.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#ifndef TASK_H
+#define TASK_H
+
+#include "BlockAllocator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+class Task
+{
+public:
+	// Callables up to this size are stored inside the task itself
+	static const size_t kInlineSize = 64;
+
+	Task() {}
+
+	// Wraps any callable that can be invoked with no arguments
+	template<typename Callable, typename = std::enable_if_t<!std::is_same<std::decay_t<Callable>, Task>::value>>
+	Task(Callable&& callable);
+
+	Task(Task&& other) noexcept;
+	Task& operator= (Task&& other) noexcept;
+	~Task();
+
+	// The Task is non-copyable.
+	Task(const Task&) = delete;
+	Task& operator= (const Task&) = delete;
+
+	// Invokes the wrapped callable
+	void operator()();
+
+	// Returns true if the task holds a callable
+	explicit operator bool() const;
+
+	// Destroys the wrapped callable, leaving the task empty
+	void reset();
+
+	// The time the task was submitted in nanoseconds, see nowNs().
+	// Only recorded when the ThreadPool is collecting statistics, 0 otherwise.
+	uint64_t submitTime() const;
+	void setSubmitTime(uint64_t submitTime);
+
+private:
+	// Type erased operations on the stored callable
+	struct Ops {
+		void(*invoke)(void* storage);
+		void(*move)(void* dst, void* src); // Move constructs dst from src and destroys src
+		void(*destroy)(void* storage);
+	};
+
+	// Stores the callable inside the task
+	template<typename Callable>
+	void emplace(Callable&& callable, std::true_type /*fitsInline*/);
+
+	// Stores the callable in a separately allocated block
+	template<typename Callable>
+	void emplace(Callable&& callable, std::false_type /*fitsInline*/);
+
+	// Operations for callables stored inline
+	template<typename Callable>
+	static const Ops* inlineOps();
+
+	// Operations for callables stored in a separately allocated block,
+	// the storage holds a pointer to the callable
+	template<typename Callable>
+	static const Ops* allocatedOps();
+
+	typename std::aligned_storage<kInlineSize, alignof(std::max_align_t)>::type m_storage;
+	const Ops* m_ops = nullptr;
+	uint64_t m_submitTime = 0;
+};
+
+template<typename Callable, typename>
+inline Task::Task(Callable&& callable)
+{
+	using CallableT = std::decay_t<Callable>;
+
+	// Only store inline if moving can't throw, so moving tasks between queues can't throw
+	using FitsInline = std::integral_constant<bool,
+		sizeof(CallableT) <= kInlineSize
+		&& alignof(CallableT) <= alignof(std::max_align_t)
+		&& std::is_nothrow_move_constructible<CallableT>::value>;
+
+	emplace(std::forward<Callable>(callable), FitsInline());
+}
+
+template<typename Callable>
+inline void Task::emplace(Callable&& callable, std::true_type)
+{
+	using CallableT = std::decay_t<Callable>;
+	new (&m_storage) CallableT(std::forward<Callable>(callable));
+	m_ops = inlineOps<CallableT>();
+}
+
+template<typename Callable>
+inline void Task::emplace(Callable&& callable, std::false_type)
+{
+	using CallableT = std::decay_t<Callable>;
+	void* block = BlockAllocator::allocate(sizeof(CallableT));
+	try {
+		*reinterpret_cast<CallableT**>(&m_storage) = new (block) CallableT(std::forward<Callable>(callable));
+	} catch (...) {
+		BlockAllocator::deallocate(block);
+		throw;
+	}
+	m_ops = allocatedOps<CallableT>();
+}
+
+inline Task::Task(Task&& other) noexcept
+	: m_submitTime{ other.m_submitTime }
+{
+	if (other.m_ops) {
+		other.m_ops->move(&m_storage, &other.m_storage);
+		m_ops = other.m_ops;
+		other.m_ops = nullptr;
+	}
+}
+
+inline Task& Task::operator=(Task&& other) noexcept
+{
+	if (this != &other) {
+		reset();
+		m_submitTime = other.m_submitTime;
+		if (other.m_ops) {
+			other.m_ops->move(&m_storage, &other.m_storage);
+			m_ops = other.m_ops;
+			other.m_ops = nullptr;
+		}
+	}
+	return *this;
+}
+
+inline Task::~Task()
+{
+	reset();
+}
+
+inline void Task::operator()()
+{
+	m_ops->invoke(&m_storage);
+}
+
+inline Task::operator bool() const
+{
+	return m_ops != nullptr;
+}
+
+inline void Task::reset()
+{
+	if (m_ops) {
+		m_ops->destroy(&m_storage);
+		m_ops = nullptr;
+	}
+}
+
+inline uint64_t Task::submitTime() const
+{
+	return m_submitTime;
+}
+
+inline void Task::setSubmitTime(uint64_t submitTime)
+{
+	m_submitTime = submitTime;
+}
+
+template<typename Callable>
+inline const Task::Ops* Task::inlineOps()
+{
+	static const Ops s_ops{
+		[](void* storage) {
+			(*static_cast<Callable*>(storage))();
+		},
+		[](void* dst, void* src) {
+			Callable* srcCallable = static_cast<Callable*>(src);
+			new (dst) Callable(std::move(*srcCallable));
+			srcCallable->~Callable();
+		},
+		[](void* storage) {
+			static_cast<Callable*>(storage)->~Callable();
+		}
+	};
+	return &s_ops;
+}
+
+template<typename Callable>
+inline const Task::Ops* Task::allocatedOps()
+{
+	static const Ops s_ops{
+		[](void* storage) {
+			(**static_cast<Callable**>(storage))();
+		},
+		[](void* dst, void* src) {
+			// Just steal the pointer
+			*static_cast<Callable**>(dst) = *static_cast<Callable**>(src);
+		},
+		[](void* storage) {
+			Callable* callable = *static_cast<Callable**>(storage);
+			callable->~Callable();
+			BlockAllocator::deallocate(callable);
+		}
+	};
+	return &s_ops;
+}
+
+#endif
@@ -0,0 +1,74 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : A bump allocator for scratch memory that only lives as long as a task
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+//Library Includes
+#include <algorithm>
+
+//This Include
+#include "TaskArena.h"
+
+const size_t TaskArena::kDefaultChunkSize;
+const size_t TaskArena::kMaxRetainedSize;
+
+TaskArena::TaskArena(size_t chunkSize)
+	: m_chunkSize(chunkSize)
+{
+}
+
+void* TaskArena::allocateSlow(size_t size, size_t alignment)
+{
+	// An empty arena's marker is {0, 0}, so the first chunk is only counted once it exists
+	if (!m_chunks.empty())
+	{
+		while (m_current + 1 < m_chunks.size())
+		{
+			++m_current;
+			m_offset = 0;
+			void* memory = tryAllocate(size, alignment);
+			if (memory)
+				return memory;
+		}
+	}
+
+	// Room to align the allocation, as chunks are only aligned for fundamental types
+	Chunk chunk;
+	chunk.size = std::max(m_chunkSize, size + alignment);
+	chunk.data.reset(new unsigned char[chunk.size]);
+	m_chunks.push_back(std::move(chunk));
+	m_current = m_chunks.size() - 1;
+	m_offset = 0;
+	return tryAllocate(size, alignment);
+}
+
+void TaskArena::reset()
+{
+	m_current = 0;
+	m_offset = 0;
+	if (m_chunks.size() <= 1)
+		return;
+
+	size_t total = capacity();
+	m_chunks.clear();
+	Chunk chunk;
+	chunk.size = std::min(total, kMaxRetainedSize);
+	chunk.data.reset(new unsigned char[chunk.size]);
+	m_chunks.push_back(std::move(chunk));
+}
+
+size_t TaskArena::capacity() const
+{
+	size_t total = 0;
+	for (const Chunk& chunk : m_chunks)
+		total += chunk.size;
+	return total;
+}
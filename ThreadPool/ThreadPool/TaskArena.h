@@ -0,0 +1,218 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : A bump allocator for scratch memory that only lives as long
+//                as a task. Allocating moves a pointer forward, and everything
+//                allocated since a marker is freed at once by rewinding to it.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#ifndef TASKARENA_H
+#define TASKARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#if defined(__has_include)
+#if __has_include(<memory_resource>) && ((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
+#define THREADPOOL_HAS_PMR 1
+#endif
+#endif
+#ifndef THREADPOOL_HAS_PMR
+#define THREADPOOL_HAS_PMR 0
+#endif
+
+#if THREADPOOL_HAS_PMR
+#include <memory_resource>
+#endif
+
+// Only one thread may use an arena. Memory is never freed individually,
+// deallocating does nothing until the arena is rewound.
+class TaskArena
+{
+public:
+	// A position in the arena to rewind to
+	struct Marker {
+		size_t chunk;
+		size_t offset;
+	};
+
+	explicit TaskArena(size_t chunkSize = kDefaultChunkSize);
+
+	// The TaskArena is non-copyable.
+	TaskArena(const TaskArena&) = delete;
+	TaskArena& operator= (const TaskArena&) = delete;
+
+	// Returns size bytes aligned to alignment, which must be a power of two
+	void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+	// Returns the current position
+	Marker mark() const;
+
+	// Frees everything allocated since marker was taken
+	void rewind(const Marker& marker);
+
+	// Frees everything. When the last use needed more than one chunk they are
+	// replaced by a single larger one, so the next use doesn't need new chunks.
+	void reset();
+
+	// Returns the number of bytes held by the arena
+	size_t capacity() const;
+
+#if THREADPOOL_HAS_PMR
+	// Returns a memory resource allocating from this arena, for std::pmr containers
+	std::pmr::memory_resource* resource();
+#endif
+
+	// The size of the first chunk, larger allocations get a chunk of their own
+	static const size_t kDefaultChunkSize = 64 * 1024;
+
+	// The most memory an arena keeps when it is reset
+	static const size_t kMaxRetainedSize = 4 * 1024 * 1024;
+
+private:
+	struct Chunk {
+		std::unique_ptr<unsigned char[]> data;
+		size_t size;
+	};
+
+	// Moves to a later chunk that fits the allocation, adding one if none do
+	void* allocateSlow(size_t size, size_t alignment);
+
+	// Aligns the allocation inside the current chunk, returns nullptr if it doesn't fit
+	void* tryAllocate(size_t size, size_t alignment);
+
+#if THREADPOOL_HAS_PMR
+	class Resource : public std::pmr::memory_resource {
+	public:
+		explicit Resource(TaskArena& arena)
+			: m_arena(arena)
+		{
+		}
+
+	private:
+		void* do_allocate(size_t size, size_t alignment) override
+		{
+			return m_arena.allocate(size, alignment);
+		}
+
+		void do_deallocate(void*, size_t, size_t) override {}
+
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+		{
+			return this == &other;
+		}
+
+		TaskArena& m_arena;
+	};
+
+	Resource m_resource{ *this };
+#endif
+
+	size_t m_chunkSize;
+	// Chunks after the current one are kept for reuse after a rewind
+	std::vector<Chunk> m_chunks;
+	size_t m_current = 0;
+	size_t m_offset = 0;
+};
+
+// Lets standard containers allocate from a TaskArena before std::pmr is available
+template<typename T>
+class TaskArenaAllocator
+{
+public:
+	using value_type = T;
+
+	explicit TaskArenaAllocator(TaskArena& arena)
+		: m_arena(&arena)
+	{
+	}
+
+	template<typename U>
+	TaskArenaAllocator(const TaskArenaAllocator<U>& other)
+		: m_arena(other.arena())
+	{
+	}
+
+	T* allocate(size_t count)
+	{
+		return static_cast<T*>(m_arena->allocate(count * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T*, size_t) {}
+
+	TaskArena* arena() const
+	{
+		return m_arena;
+	}
+
+private:
+	TaskArena* m_arena;
+};
+
+template<typename T, typename U>
+bool operator== (const TaskArenaAllocator<T>& a, const TaskArenaAllocator<U>& b)
+{
+	return a.arena() == b.arena();
+}
+
+template<typename T, typename U>
+bool operator!= (const TaskArenaAllocator<T>& a, const TaskArenaAllocator<U>& b)
+{
+	return !(a == b);
+}
+
+inline void* TaskArena::tryAllocate(size_t size, size_t alignment)
+{
+	const Chunk& chunk = m_chunks[m_current];
+	uintptr_t start = reinterpret_cast<uintptr_t>(chunk.data.get());
+	uintptr_t address = (start + m_offset + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+	if (address - start > chunk.size || chunk.size - (address - start) < size)
+		return nullptr;
+	m_offset = address - start + size;
+	return reinterpret_cast<void*>(address);
+}
+
+inline void* TaskArena::allocate(size_t size, size_t alignment)
+{
+	if (m_current < m_chunks.size())
+	{
+		void* memory = tryAllocate(size, alignment);
+		if (memory)
+			return memory;
+	}
+	return allocateSlow(size, alignment);
+}
+
+inline TaskArena::Marker TaskArena::mark() const
+{
+	return { m_current, m_offset };
+}
+
+inline void TaskArena::rewind(const Marker& marker)
+{
+	if (marker.chunk == 0 && marker.offset == 0)
+	{
+		reset();
+		return;
+	}
+	m_current = marker.chunk;
+	m_offset = marker.offset;
+}
+
+#if THREADPOOL_HAS_PMR
+inline std::pmr::memory_resource* TaskArena::resource()
+{
+	return &m_resource;
+}
+#endif
+
+#endif
@@ -0,0 +1,99 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : A graph of tasks where each task runs once all of its
+//                predecessors have finished. Run with ThreadPool::run.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#ifndef TASKGRAPH_H
+#define TASKGRAPH_H
+
+#include "Future.h"
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+class ThreadPool;
+
+class TaskGraph
+{
+public:
+	using NodeId = size_t;
+
+	TaskGraph() {}
+
+	// The TaskGraph is non-copyable.
+	TaskGraph(const TaskGraph&) = delete;
+	TaskGraph& operator= (const TaskGraph&) = delete;
+
+	// Adds a node that calls fn once every predecessor has finished.
+	// Returns the ID used to make other nodes depend on this one.
+	template<typename Callable>
+	NodeId addNode(Callable&& fn, std::initializer_list<NodeId> predecessors = {})
+	{
+		NodeId id = m_nodes.size();
+		m_nodes.emplace_back();
+		m_nodes.back().work = std::forward<Callable>(fn);
+		for (NodeId predecessor : predecessors)
+			addDependency(predecessor, id);
+		return id;
+	}
+
+	// Makes successor wait for predecessor to finish
+	void addDependency(NodeId predecessor, NodeId successor)
+	{
+		if (predecessor >= m_nodes.size() || successor >= m_nodes.size())
+			throw std::out_of_range("TaskGraph node ID out of range");
+		m_nodes[predecessor].successors.push_back(successor);
+		++m_nodes[successor].numPredecessors;
+	}
+
+	// Returns the number of nodes in the graph
+	size_t size() const
+	{
+		return m_nodes.size();
+	}
+
+	// Removes every node
+	void clear()
+	{
+		m_nodes.clear();
+	}
+
+private:
+	friend class ThreadPool;
+
+	struct Node {
+		std::function<void()> work;
+		std::vector<NodeId> successors;
+		size_t numPredecessors = 0;
+	};
+
+	std::vector<Node> m_nodes;
+
+	// State of the current run, reset by ThreadPool::run.
+	// Number of unfinished predecessors of each node
+	std::unique_ptr<std::atomic<size_t>[]> m_numPending;
+	size_t m_numPendingSize = 0;
+	// Number of nodes that haven't finished, zero when the graph isn't running
+	std::atomic<size_t> m_numRemaining{ 0 };
+	// Set by the first node to throw, the nodes that haven't started yet are skipped
+	std::atomic_bool m_failed{ false };
+	std::exception_ptr m_exception;
+	Promise<void> m_promise;
+};
+
+#endif
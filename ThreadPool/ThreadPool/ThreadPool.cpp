@@ -15,14 +15,65 @@
 #include <iostream>
 #include <thread>
 #include <functional>
+#include <algorithm>
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 //Local Includes
 #include "AtomicQueue.h"
+#include "BlockAllocator.h"
+#include "CpuTopology.h"
 
 //This Include
 #include "ThreadPool.h"
 
 thread_local size_t ThreadPool::tl_threadId;
+thread_local ThreadPool* ThreadPool::tl_threadPool = nullptr;
+thread_local ThreadPool::Worker* ThreadPool::tl_worker = nullptr;
+thread_local size_t ThreadPool::tl_node = 0;
+thread_local size_t ThreadPool::tl_taskDepth = 0;
+thread_local TraceEvent* ThreadPool::tl_traceEvent = nullptr;
+thread_local uint64_t ThreadPool::tl_dequeueNs = 0;
+thread_local std::vector<Task> ThreadPool::tl_expiredTimers;
+thread_local ThreadPool::LocalBatch* ThreadPool::tl_localBatch = nullptr;
+thread_local size_t ThreadPool::tl_highStreak = 0;
+thread_local size_t ThreadPool::tl_agingCountdown = 0;
+thread_local TaskArena ThreadPool::tl_externalArena;
+
+const size_t ThreadPool::kMaxBulkPop;
+
+namespace {
+	// Threads look for aged low priority work once every this many tasks,
+	// so a busy low priority queue doesn't add a lock to every dequeue
+	const size_t g_kAgingCheckInterval = 16;
+
+	// Tells the CPU we are in a spin loop, so it can save power and
+	// give resources to the other hyperthread on the core
+	inline void pauseCpu()
+	{
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+		_mm_pause();
+#else
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+	}
+
+	// Moves a task into a block so it can be stored in a work stealing deque
+	Task* allocateTaskNode(Task&& task)
+	{
+		return new (BlockAllocator::allocate(sizeof(Task))) Task(std::move(task));
+	}
+
+	// Moves a task out of its block and frees the block
+	Task takeTaskNode(Task* node)
+	{
+		Task task(std::move(*node));
+		node->~Task();
+		BlockAllocator::deallocate(node);
+		return task;
+	}
+}
 
 ThreadPool::ThreadPool() :
 	m_numThreads{ std::thread::hardware_concurrency() }
@@ -44,37 +95,149 @@ ThreadPool::~ThreadPool()
 
 void ThreadPool::start()
 {
+	std::lock_guard<std::mutex> resizeLock(m_resizeMutex);
 	m_stop = false;
-	for (size_t i = 0; i < m_numThreads; ++i)
+	m_running = true;
+	if (m_queueType == QueueType::LockFree)
 	{
-		// Use i+1 as thread id becuase ID 0 is reserved for the main thread
-		m_workerThreads.push_back(std::thread(&ThreadPool::doWork, this, i+1)); 
+		m_lockFreeQueue = std::make_unique<LockFreeQueue<Task>>(m_queueCapacity);
 	}
+	placeThreads();
+	// Use 1 as the first thread id becuase ID 0 is reserved for the main thread
+	spawnThreads(1, m_numThreads);
 }
 
 void ThreadPool::stop()
 {
+	std::lock_guard<std::mutex> resizeLock(m_resizeMutex);
 	m_stop = true;
-	for (size_t i = 0; i < m_numThreads; ++i)
+	wakeAll();
+	for (auto& thread : m_workerThreads)
 	{
-		m_workQueue.push([]() {}); // Dummy task to wake threads up
+		thread.join();
 	}
-	for (size_t i = 0; i < m_numThreads; ++i)
+	if (m_running && m_tracing && !m_traceFile.empty())
 	{
-		m_workerThreads[i].join();
+		writeTrace(m_traceFile);
 	}
-	m_workQueue.clear();
+	m_running = false;
+	clearWork();
 	m_workerThreads.clear();
+	m_workers.clear();
+	m_lockFreeQueue.reset();
+	m_nodeQueues.clear();
+	m_cpuOrder.clear();
+	m_cpuNodes.clear();
 }
 
 void ThreadPool::clearWork()
 {
+	// Timers dropped for a cancelled token still run here. They see the token and
+	// complete their futures with CancelledError instead of breaking them.
+	std::vector<Task> cancelledTimers;
+	m_timers.clear(cancelledTimers);
+	for (Task& timer : cancelledTimers)
+		timer();
+
 	m_workQueue.clear();
+	m_highQueue.clear();
+	m_lowQueue.clear();
+	if (m_lockFreeQueue)
+		m_lockFreeQueue->clear();
+	for (auto& nodeQueue : m_nodeQueues)
+		nodeQueue->clear();
+
+	// Stealing is safe from any thread
+	Task* node;
+	for (size_t i = 0; i < m_workers.size(); ++i)
+	{
+		while (m_workers[i].deque.steal(node))
+			takeTaskNode(node);
+	}
+}
+
+CancellationToken ThreadPool::getCancellationToken() const
+{
+	return m_cancellationSource.getToken();
+}
+
+void ThreadPool::cancelAll()
+{
+	// Cancel first so work popped while clearing sees the new generation
+	m_cancellationSource.cancel();
+	clearWork();
+}
+
+Future<void> ThreadPool::run(TaskGraph& graph)
+{
+	if (graph.m_numRemaining.load(std::memory_order_acquire) != 0)
+		throw std::logic_error("TaskGraph is already running");
+
+	size_t numNodes = graph.m_nodes.size();
+	if (graph.m_numPendingSize != numNodes)
+	{
+		graph.m_numPending = std::make_unique<std::atomic<size_t>[]>(numNodes);
+		graph.m_numPendingSize = numNodes;
+	}
+
+	// Find the nodes without predecessors, and check every node can be reached
+	// from them, otherwise some would never run
+	std::vector<size_t> roots;
+	std::vector<size_t> order;
+	std::vector<size_t> numPending(numNodes);
+	for (size_t i = 0; i < numNodes; ++i)
+	{
+		numPending[i] = graph.m_nodes[i].numPredecessors;
+		graph.m_numPending[i].store(numPending[i], std::memory_order_relaxed);
+		if (numPending[i] == 0)
+			roots.push_back(i);
+	}
+	order = roots;
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		for (size_t successor : graph.m_nodes[order[i]].successors)
+		{
+			if (--numPending[successor] == 0)
+				order.push_back(successor);
+		}
+	}
+	if (order.size() != numNodes)
+		throw std::logic_error("TaskGraph has a cycle");
+
+	graph.m_promise = Promise<void>();
+	Future<void> future = graph.m_promise.getFuture();
+	if (numNodes == 0)
+	{
+		graph.m_promise.setValue();
+		return future;
+	}
+
+	graph.m_failed.store(false, std::memory_order_relaxed);
+	graph.m_exception = nullptr;
+	graph.m_numRemaining.store(numNodes, std::memory_order_release);
+	enqueueBatch(roots.size(), [this, &graph, &roots](size_t i) {
+		size_t nodeId = roots[i];
+		return Task([this, &graph, nodeId] { runGraphNode(graph, nodeId); });
+	});
+	return future;
 }
 
 void ThreadPool::setNumThreads(size_t numThreads)
 {
+	std::lock_guard<std::mutex> resizeLock(m_resizeMutex);
+
+	// Per thread state must exist before a thread with a new ID starts
+	onNumThreadsChanged(numThreads);
+
+	size_t oldNumThreads = m_numThreads;
 	m_numThreads = numThreads;
+	if (!m_running)
+		return;
+
+	if (numThreads > oldNumThreads)
+		spawnThreads(oldNumThreads + 1, numThreads);
+	else if (numThreads < oldNumThreads)
+		retireThreads(numThreads);
 }
 
 size_t ThreadPool::getNumThreads() const
@@ -82,23 +245,777 @@ size_t ThreadPool::getNumThreads() const
 	return m_numThreads;
 }
 
+void ThreadPool::setSchedulerMode(SchedulerMode mode)
+{
+	m_schedulerMode = mode;
+}
+
+SchedulerMode ThreadPool::getSchedulerMode() const
+{
+	return m_schedulerMode;
+}
+
+void ThreadPool::setQueueType(QueueType queueType)
+{
+	m_queueType = queueType;
+}
+
+QueueType ThreadPool::getQueueType() const
+{
+	return m_queueType;
+}
+
+void ThreadPool::setQueueCapacity(size_t capacity)
+{
+	m_queueCapacity = capacity;
+}
+
+void ThreadPool::setIdlePolicy(const IdlePolicy& idlePolicy)
+{
+	m_idlePolicy = idlePolicy;
+}
+
+IdlePolicy ThreadPool::getIdlePolicy() const
+{
+	return m_idlePolicy;
+}
+
+void ThreadPool::setMaxBulkPop(size_t maxTasks)
+{
+	m_maxBulkPop = std::min(std::max<size_t>(maxTasks, 1), kMaxBulkPop);
+}
+
+size_t ThreadPool::getMaxBulkPop() const
+{
+	return m_maxBulkPop;
+}
+
+void ThreadPool::setPriorityPolicy(const PriorityPolicy& priorityPolicy)
+{
+	m_priorityPolicy = priorityPolicy;
+}
+
+PriorityPolicy ThreadPool::getPriorityPolicy() const
+{
+	return m_priorityPolicy;
+}
+
+void ThreadPool::setAffinityPolicy(AffinityPolicy policy)
+{
+	m_affinityPolicy = policy;
+}
+
+void ThreadPool::setAffinityCpus(const std::vector<unsigned int>& cpus)
+{
+	m_affinityPolicy = AffinityPolicy::Explicit;
+	m_affinityCpus = cpus;
+}
+
+AffinityPolicy ThreadPool::getAffinityPolicy() const
+{
+	return m_affinityPolicy;
+}
+
+void ThreadPool::setNumaAware(bool numaAware)
+{
+	m_numaAware = numaAware;
+}
+
+bool ThreadPool::isNumaAware() const
+{
+	return m_numaAware;
+}
+
+void ThreadPool::placeThreads()
+{
+	AffinityPolicy policy = m_affinityPolicy;
+	// Grouping threads by node means nothing if the OS can move them, so NUMA mode always pins
+	if (m_numaAware && policy == AffinityPolicy::None)
+		policy = AffinityPolicy::Scatter;
+
+	m_cpuOrder.clear();
+	m_cpuNodes.clear();
+	if (policy != AffinityPolicy::None)
+		m_cpuOrder = CpuTopology::order(CpuTopology::detect(), policy, m_affinityCpus);
+
+	// Number the nodes threads are placed on from 0
+	std::vector<unsigned int> nodeIds;
+	for (const LogicalCpu& cpu : m_cpuOrder)
+	{
+		auto found = std::find(nodeIds.begin(), nodeIds.end(), cpu.node);
+		m_cpuNodes.push_back(found - nodeIds.begin());
+		if (found == nodeIds.end())
+			nodeIds.push_back(cpu.node);
+	}
+
+	m_nodeQueues.clear();
+	if (m_numaAware && nodeIds.size() > 1)
+	{
+		for (size_t node = 0; node < nodeIds.size(); ++node)
+			m_nodeQueues.push_back(std::make_unique<AtomicQueue<Task>>());
+	}
+}
+
+void ThreadPool::setCollectStats(bool collectStats)
+{
+	m_collectStats = collectStats;
+	m_instrumented = m_collectStats || m_tracing;
+}
+
+bool ThreadPool::isCollectingStats() const
+{
+	return m_collectStats;
+}
+
+ThreadPoolStats ThreadPool::snapshotStats() const
+{
+	ThreadPoolStats stats;
+	size_t numWorkers = std::min<size_t>(m_stats.size(), m_numThreads);
+	for (size_t i = 0; i < numWorkers; ++i)
+	{
+		WorkerStats workerStats = m_stats[i].snapshot();
+		if (i < m_workers.size())
+			workerStats.stealContention = m_workers[i].deque.numLostRaces();
+		stats.workers.push_back(workerStats);
+	}
+
+	stats.queueContention = m_workQueue.numContended();
+	for (const auto& nodeQueue : m_nodeQueues)
+		stats.queueContention += nodeQueue->numContended();
+	return stats;
+}
+
+void ThreadPool::setTracing(bool tracing, size_t eventsPerThread)
+{
+	m_tracing = tracing;
+	m_traceEventsPerThread = eventsPerThread;
+	m_instrumented = m_collectStats || m_tracing;
+	if (m_tracing && m_traceEpoch == 0)
+		m_traceEpoch = nowNs();
+}
+
+bool ThreadPool::isTracing() const
+{
+	return m_tracing;
+}
+
+void ThreadPool::setTraceFile(const std::string& path)
+{
+	m_traceFile = path;
+}
+
+bool ThreadPool::writeTrace(const std::string& path)
+{
+	std::lock_guard<std::mutex> traceLock(m_traceMutex);
+	std::vector<std::pair<size_t, std::vector<TraceEvent>>> threads;
+	for (size_t i = 0; i < m_traceBuffers.size(); ++i)
+	{
+		threads.emplace_back(i + 1, std::vector<TraceEvent>());
+		m_traceBuffers[i].drain(threads.back().second);
+	}
+	return writeChromeTrace(path, threads, m_traceEpoch);
+}
+
+size_t ThreadPool::nodeOfThread(size_t threadId) const
+{
+	if (m_cpuNodes.empty())
+		return 0;
+	return m_cpuNodes[(threadId - 1) % m_cpuNodes.size()];
+}
+
+void ThreadPool::spawnThreads(size_t firstThreadId, size_t lastThreadId)
+{
+	m_arenas.growTo(lastThreadId);
+	if (m_collectStats)
+		m_stats.growTo(lastThreadId);
+	if (m_tracing)
+	{
+		m_traceBuffers.growTo(lastThreadId);
+		for (size_t threadId = firstThreadId; threadId <= lastThreadId; ++threadId)
+			m_traceBuffers[threadId - 1].reserve(m_traceEventsPerThread);
+	}
+	if (m_schedulerMode == SchedulerMode::WorkStealing)
+	{
+		// Workers of retired threads are reused when their IDs come back
+		m_workers.growTo(lastThreadId);
+		for (size_t threadId = firstThreadId; threadId <= lastThreadId; ++threadId)
+		{
+			m_workers[threadId - 1].rng.seed(static_cast<unsigned int>(threadId));
+		}
+	}
+	for (size_t threadId = firstThreadId; threadId <= lastThreadId; ++threadId)
+	{
+		m_workerThreads.push_back(std::thread(&ThreadPool::doWork, this, threadId));
+	}
+}
+
+void ThreadPool::retireThreads(size_t numThreads)
+{
+	// Threads check shouldExit between work items, so running work is finished first
+	wakeAll();
+	for (size_t i = numThreads; i < m_workerThreads.size(); ++i)
+	{
+		m_workerThreads[i].join();
+	}
+	m_workerThreads.erase(m_workerThreads.begin() + numThreads, m_workerThreads.end());
+
+	// Hand the work left in the retired threads' deques to the remaining threads
+	size_t numMoved = 0;
+	Task* node;
+	for (size_t i = numThreads; i < m_workers.size(); ++i)
+	{
+		while (m_workers[i].deque.steal(node))
+		{
+			pushShared(takeTaskNode(node));
+			++numMoved;
+		}
+	}
+	if (numMoved > 0)
+		wakeWorkers(numMoved);
+}
+
+void ThreadPool::runGraphNode(TaskGraph& graph, size_t nodeId)
+{
+	const size_t kNoNode = static_cast<size_t>(-1);
+	while (nodeId != kNoNode)
+	{
+		TaskGraph::Node& node = graph.m_nodes[nodeId];
+		if (!graph.m_failed.load(std::memory_order_relaxed))
+		{
+			try {
+				node.work();
+			} catch (...) {
+				if (!graph.m_failed.exchange(true, std::memory_order_relaxed))
+					graph.m_exception = std::current_exception();
+			}
+		}
+
+		// Run the first successor that is ready on this thread, it probably uses what this node just produced
+		size_t nextNodeId = kNoNode;
+		for (size_t successor : node.successors)
+		{
+			if (graph.m_numPending[successor].fetch_sub(1, std::memory_order_acq_rel) != 1)
+				continue;
+			if (nextNodeId == kNoNode)
+				nextNodeId = successor;
+			else
+				enqueue([this, &graph, successor] { runGraphNode(graph, successor); });
+		}
+
+		if (graph.m_numRemaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			// The graph may be destroyed as soon as the promise is set
+			Promise<void> promise = std::move(graph.m_promise);
+			if (graph.m_exception)
+				promise.setException(graph.m_exception);
+			else
+				promise.setValue();
+			return;
+		}
+		nodeId = nextNodeId;
+	}
+}
+
+bool ThreadPool::shouldExit(size_t threadId) const
+{
+	return m_stop || threadId > m_numThreads;
+}
+
+void ThreadPool::wakeAll()
+{
+	m_workAvailable.notifyAll();
+}
+
+void ThreadPool::enqueue(Task&& workItem, Priority priority)
+{
+	// Low priority work always needs the time for aging
+	if (m_instrumented || priority == Priority::Low)
+		workItem.setSubmitTime(nowNs());
+
+	if (priority == Priority::High)
+		m_highQueue.push(std::move(workItem));
+	else if (priority == Priority::Low)
+		m_lowQueue.push(std::move(workItem));
+	// Work submitted from one of our own threads stays local to that thread
+	else if (m_schedulerMode == SchedulerMode::WorkStealing && tl_threadPool == this)
+		pushLocal(std::move(workItem));
+	else
+		pushShared(std::move(workItem));
+
+	wakeWorker();
+}
+
+void ThreadPool::pushLocal(Task&& workItem)
+{
+	tl_worker->deque.push(allocateTaskNode(std::move(workItem)));
+}
+
+void ThreadPool::pushShared(Task&& workItem)
+{
+	// Our own threads keep work on their node, other threads spread it over every node
+	if (!m_nodeQueues.empty())
+	{
+		size_t node = tl_threadPool == this ? tl_node : m_nextNode.fetch_add(1, std::memory_order_relaxed) % m_nodeQueues.size();
+		m_nodeQueues[node]->push(std::move(workItem));
+		return;
+	}
+	// Spill over into the locking queue when the ring is full (or not created yet)
+	if (m_lockFreeQueue && m_lockFreeQueue->tryPush(std::move(workItem)))
+		return;
+	m_workQueue.push(std::move(workItem));
+}
+
+bool ThreadPool::tryPopShared(Task& workItem)
+{
+	// Work taken in bulk earlier goes first
+	if (tl_localBatch && tl_localBatch->pop(workItem))
+		return true;
+
+	size_t numNodes = m_nodeQueues.size();
+	for (size_t i = 0; i < numNodes; ++i)
+	{
+		if (tryPopNode((tl_node + i) % numNodes, workItem))
+			return true;
+	}
+	if (m_lockFreeQueue && m_lockFreeQueue->tryPop(workItem))
+		return true;
+	return tryPopBulk(m_workQueue, workItem);
+}
+
+bool ThreadPool::tryPopNode(size_t node, Task& workItem)
+{
+	// Check without locking first, idle threads look at every node
+	AtomicQueue<Task>& nodeQueue = *m_nodeQueues[node];
+	return !nodeQueue.empty() && tryPopBulk(nodeQueue, workItem);
+}
+
+bool ThreadPool::tryPopBulk(AtomicQueue<Task>& queue, Task& workItem)
+{
+	// Only take a share of the queue so the other threads have work too
+	size_t maxTasks = std::min(m_maxBulkPop, queue.size() / (2 * std::max<size_t>(m_numThreads, 1)));
+	if (maxTasks <= 1 || !(tl_worker || tl_localBatch))
+		return queue.tryPop(workItem);
+
+	if (tl_localBatch)
+	{
+		LocalBatch& batch = *tl_localBatch;
+		batch.count = queue.popBulk(batch.tasks, maxTasks);
+		batch.next = 0;
+		batch.popNs = m_tracing ? nowNs() : 0;
+		return batch.pop(workItem);
+	}
+
+	// Work stealing threads keep the rest in their deque where idle threads can steal it
+	Task tasks[kMaxBulkPop];
+	size_t count = queue.popBulk(tasks, maxTasks);
+	if (count == 0)
+		return false;
+	for (size_t i = count - 1; i > 0; --i)
+		pushLocal(std::move(tasks[i]));
+	workItem = std::move(tasks[0]);
+	wakeWorkers(count - 1);
+	return true;
+}
+
+bool ThreadPool::LocalBatch::pop(Task& workItem)
+{
+	if (next == count)
+		return false;
+	workItem = std::move(tasks[next++]);
+	tl_dequeueNs = popNs;
+	return true;
+}
+
 void ThreadPool::doWork(size_t threadId)
 {
 	//Entry point of  a thread.
 	tl_threadId = threadId;
+	tl_threadPool = this;
+	tl_node = nodeOfThread(threadId);
+	if (!m_cpuOrder.empty())
+		CpuTopology::pinCurrentThread(m_cpuOrder[(threadId - 1) % m_cpuOrder.size()].id);
+
+	if (m_schedulerMode == SchedulerMode::WorkStealing)
+	{
+		doWorkStealing(threadId);
+		return;
+	}
+
+	LocalBatch localBatch;
+	tl_localBatch = &localBatch;
 
 	//std::cout << std::endl << "Thread with id " << thread_idx << "starting........" << std::endl;
-	while(!m_stop)
+	while(!shouldExit(threadId))
 	{
-		std::function<void()> task;
+		Task task;
 		//If there is an item in the queue to be processed; just take it off the q and process it
-		m_workQueue.pop(task);
+		if (!nextTask(threadId, task))
+		{
+			idle(threadId);
+			continue;
+		}
 		//std::cout << std::endl << "Thread with id " << thread_idx << " is working on an item in the work queue" << std::endl;
-		task();
+		runTask(task);
 		//std::cout << std::endl << "Thread with id " << thread_idx << " finished processing an item " << std::endl;
 		//std::cout << "Items remaining: " << m_work_queue.size() << std::endl;
 		//Sleep to simulate work being done
 		//std::this_thread::sleep_for(std::chrono::milliseconds(rand()%101));
 	}
+
+	// A retired thread hands back the work it took but didn't get to
+	tl_localBatch = nullptr;
+	Task task;
+	size_t numReturned = 0;
+	while (localBatch.pop(task))
+	{
+		pushShared(std::move(task));
+		++numReturned;
+	}
+	if (numReturned > 0)
+		wakeWorkers(numReturned);
 }
 
+void ThreadPool::runTask(Task& workItem)
+{
+	// Scratch memory is freed when the task returns. Tasks run while waiting
+	// inside another task only free their own, the outer task's stays put.
+	TaskArena& arena = taskArena();
+	TaskArena::Marker arenaMarker = arena.mark();
+
+	if (!m_instrumented)
+	{
+		workItem();
+		arena.rewind(arenaMarker);
+		return;
+	}
+
+	uint64_t start = nowNs();
+	TraceEvent event;
+	TraceEvent* outerEvent = tl_traceEvent;
+	if (m_tracing)
+	{
+		event.submitNs = workItem.submitTime();
+		event.dequeueNs = tl_dequeueNs != 0 ? tl_dequeueNs : start;
+		tl_traceEvent = &event;
+		event.beginNs = nowNs();
+	}
+
+	++tl_taskDepth;
+	workItem();
+	--tl_taskDepth;
+	uint64_t end = nowNs();
+	arena.rewind(arenaMarker);
+
+	if (m_tracing)
+	{
+		// Tasks run while waiting inside another task get their own events
+		tl_traceEvent = outerEvent;
+		event.endNs = end;
+		m_traceBuffers[tl_threadId - 1].push(event);
+	}
+
+	if (m_collectStats)
+	{
+		WorkerStatsSlot& stats = m_stats[tl_threadId - 1];
+		uint64_t submitTime = workItem.submitTime();
+		stats.addTask(submitTime != 0, start > submitTime ? start - submitTime : 0, end - start);
+		// Tasks run while waiting inside another task are already part of its time
+		if (tl_taskDepth == 0)
+			stats.addBusy(end - start);
+	}
+}
+
+void ThreadPool::addTimer(uint64_t deadlineNs, Task&& workItem, CancellationToken token)
+{
+	// The thread sleeping until the old earliest deadline has to wait for this one instead
+	if (m_timers.add(deadlineNs, std::move(workItem), token))
+		wakeAll();
+}
+
+bool ThreadPool::timerDue() const
+{
+	uint64_t deadline = m_timers.nextDeadline();
+	return deadline != TimerWheel::kNoDeadline && deadline <= nowNs();
+}
+
+void ThreadPool::fireTimers()
+{
+	// Kept between calls so firing timers doesn't allocate
+	std::vector<Task>& expired = tl_expiredTimers;
+	if (m_timers.advance(nowNs(), expired) && !expired.empty())
+	{
+		enqueueBatch(expired.size(), [&expired](size_t i) {
+			return std::move(expired[i]);
+		});
+	}
+	expired.clear();
+}
+
+TaskArena& ThreadPool::taskArena()
+{
+	if (tl_threadPool && tl_threadId != 0)
+		return tl_threadPool->m_arenas[tl_threadId - 1];
+	return tl_externalArena;
+}
+
+void ThreadPool::idle(size_t threadId)
+{
+	if (!m_collectStats)
+	{
+		waitForWork(threadId);
+		return;
+	}
+
+	uint64_t start = nowNs();
+	waitForWork(threadId);
+	m_stats[threadId - 1].addIdle(nowNs() - start);
+}
+
+void ThreadPool::doWorkStealing(size_t threadId)
+{
+	tl_worker = &m_workers[threadId - 1];
+	while (!shouldExit(threadId))
+	{
+		Task workItem;
+		if (nextTask(threadId, workItem))
+			runTask(workItem);
+		else
+			idle(threadId);
+	}
+	tl_worker = nullptr;
+}
+
+bool ThreadPool::nextTask(size_t threadId, Task& workItem)
+{
+	// Tasks taken in bulk keep the time of the bulk pop, which LocalBatch::pop sets
+	tl_dequeueNs = 0;
+	if (!popTask(threadId, workItem))
+		return false;
+	if (m_tracing && tl_dequeueNs == 0)
+		tl_dequeueNs = nowNs();
+	return true;
+}
+
+bool ThreadPool::popTask(size_t threadId, Task& workItem)
+{
+	// Timers are serviced by whichever thread notices one is due
+	if (timerDue())
+		fireTimers();
+
+	// Low priority work that has waited too long goes ahead of everything else
+	if (tl_agingCountdown-- == 0)
+	{
+		tl_agingCountdown = g_kAgingCheckInterval;
+		if (!m_lowQueue.empty() && tryPopAgedLow(workItem))
+			return true;
+	}
+
+	// High priority work preempts normal work, except for one turn after every burst of it
+	size_t highBurst = m_priorityPolicy.highBurst;
+	if ((highBurst == 0 || tl_highStreak < highBurst) && !m_highQueue.empty() && m_highQueue.tryPop(workItem))
+	{
+		++tl_highStreak;
+		return true;
+	}
+	tl_highStreak = 0;
+
+	bool foundWork = m_schedulerMode == SchedulerMode::WorkStealing ? findWork(threadId, workItem) : tryPopShared(workItem);
+	if (foundWork)
+		return true;
+
+	// High priority work skipped for a turn above
+	if (!m_highQueue.empty() && m_highQueue.tryPop(workItem))
+	{
+		tl_highStreak = 1;
+		return true;
+	}
+	return !m_lowQueue.empty() && m_lowQueue.tryPop(workItem);
+}
+
+bool ThreadPool::tryPopAgedLow(Task& workItem)
+{
+	uint64_t now = nowNs();
+	uint64_t maxWaitNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(m_priorityPolicy.lowMaxWait).count());
+	return m_lowQueue.tryPopIf(workItem, [now, maxWaitNs](const Task& task) {
+		// Work queued after now was read hasn't waited at all
+		return task.submitTime() + maxWaitNs <= now;
+	});
+}
+
+bool ThreadPool::findWork(size_t threadId, Task& workItem)
+{
+	Worker& self = *tl_worker;
+
+	// Newest local work first, it is most likely to still be in cache
+	Task* node;
+	if (self.deque.pop(node))
+	{
+		workItem = takeTaskNode(node);
+		return true;
+	}
+
+	// Then work whose memory is likely on our own node
+	bool numa = !m_nodeQueues.empty();
+	if (numa && (tryPopNode(tl_node, workItem) || stealWork(threadId, StealScope::LocalNode, workItem)))
+		return true;
+
+	if (tryPopShared(workItem))
+		return true;
+
+	return stealWork(threadId, numa ? StealScope::RemoteNodes : StealScope::AllNodes, workItem);
+}
+
+bool ThreadPool::stealWork(size_t threadId, StealScope scope, Task& workItem)
+{
+	Worker& self = *tl_worker;
+
+	// Try each other thread once, starting from a random victim.
+	// Retired threads are skipped, their work is moved to the shared queue.
+	size_t numWorkers = std::min<size_t>(m_workers.size(), m_numThreads);
+	if (numWorkers <= 1)
+		return false;
+
+	size_t start = self.rng() % numWorkers;
+	for (size_t i = 0; i < numWorkers; ++i)
+	{
+		size_t victim = (start + i) % numWorkers;
+		if (victim == threadId - 1)
+			continue;
+		bool sameNode = nodeOfThread(victim + 1) == tl_node;
+		if ((scope == StealScope::LocalNode && !sameNode) || (scope == StealScope::RemoteNodes && sameNode))
+			continue;
+		Task* node;
+		if (m_workers[victim].deque.steal(node))
+		{
+			workItem = takeTaskNode(node);
+			if (m_collectStats)
+				m_stats[threadId - 1].addSteal();
+			return true;
+		}
+	}
+	if (m_collectStats)
+		m_stats[threadId - 1].addFailedSteal();
+	return false;
+}
+
+bool ThreadPool::hasQueuedWork() const
+{
+	if (!m_workQueue.empty() || !m_highQueue.empty() || !m_lowQueue.empty())
+		return true;
+	if (m_lockFreeQueue && !m_lockFreeQueue->empty())
+		return true;
+	for (const auto& nodeQueue : m_nodeQueues)
+	{
+		if (!nodeQueue->empty())
+			return true;
+	}
+	for (size_t i = 0; i < m_workers.size(); ++i)
+	{
+		if (!m_workers[i].deque.empty())
+			return true;
+	}
+	return false;
+}
+
+void ThreadPool::waitForWork(size_t threadId, const std::atomic_bool* done)
+{
+	// Work tends to arrive in bursts, so spin for a while before giving up the core
+	for (size_t i = 0; i < m_idlePolicy.spinCount; ++i)
+	{
+		if (shouldStopWaiting(threadId, done))
+			return;
+		pauseCpu();
+	}
+	for (size_t i = 0; i < m_idlePolicy.yieldCount; ++i)
+	{
+		if (shouldStopWaiting(threadId, done))
+			return;
+		std::this_thread::yield();
+	}
+	sleepUntilWork(threadId, done);
+}
+
+void ThreadPool::sleepUntilWork(size_t threadId, const std::atomic_bool* done)
+{
+	// Register as sleeping before the final check so that a concurrent
+	// enqueue either sees us sleeping or we see its work.
+	EventCount::Key key = m_workAvailable.prepareWait();
+	if (shouldStopWaiting(threadId, done))
+	{
+		m_workAvailable.cancelWait();
+		return;
+	}
+
+	// One sleeping thread wakes up for the next timer. Adding an earlier timer wakes it to recheck.
+	uint64_t deadline = m_timers.nextDeadline();
+	if (deadline != TimerWheel::kNoDeadline && !m_timerWatcher.exchange(true, std::memory_order_acquire))
+	{
+		m_workAvailable.waitUntil(key, std::chrono::steady_clock::time_point(std::chrono::nanoseconds(deadline)));
+		m_timerWatcher.store(false, std::memory_order_release);
+		return;
+	}
+	m_workAvailable.wait(key);
+}
+
+bool ThreadPool::shouldStopWaiting(size_t threadId, const std::atomic_bool* done) const
+{
+	if (hasQueuedWork() || timerDue())
+		return true;
+	// A thread waiting on a future has to keep going until it is ready, even if the pool is stopping
+	if (done)
+		return done->load(std::memory_order_acquire);
+	return shouldExit(threadId);
+}
+
+void ThreadPool::helpUntil(const std::atomic_bool& done)
+{
+	size_t threadId = tl_threadId;
+	while (!done.load(std::memory_order_acquire))
+	{
+		Task workItem;
+		if (nextTask(threadId, workItem))
+			runTask(workItem);
+		else
+			waitForWork(threadId, &done);
+	}
+}
+
+void ThreadPool::WaitContinuation::run()
+{
+	// The waiting thread may return as soon as done is set, so don't touch this afterwards
+	ThreadPool& pool = m_pool;
+	done.store(true, std::memory_order_release);
+	// We don't know which sleeping thread is the waiter
+	pool.m_workAvailable.notifyAll();
+}
+
+void ThreadPool::wait(const BatchFuture& batch)
+{
+	if (tl_threadPool != this)
+	{
+		batch.wait();
+		return;
+	}
+	WaitContinuation continuation(*this);
+	batch.addContinuation(&continuation);
+	helpUntil(continuation.done);
+}
+
+void ThreadPool::wakeWorker()
+{
+	// Only costs an atomic load when no thread is sleeping
+	m_workAvailable.notifyOne();
+}
+
+void ThreadPool::wakeWorkers(size_t count)
+{
+	if (count >= m_workAvailable.numWaiters())
+	{
+		m_workAvailable.notifyAll();
+	}
+	else
+	{
+		for (size_t i = 0; i < count; ++i)
+			m_workAvailable.notifyOne();
+	}
+}
@@ -15,8 +15,24 @@
 #define THREADPOOL_H
 
 #include "AtomicQueue.h"
+#include "Batch.h"
+#include "Cancellation.h"
+#include "Coroutine.h"
+#include "CpuTopology.h"
+#include "EventCount.h"
+#include "Future.h"
+#include "GrowOnlyArray.h"
+#include "LockFreeQueue.h"
+#include "Task.h"
+#include "TaskArena.h"
+#include "TaskGraph.h"
+#include "ThreadPoolStats.h"
+#include "ThreadPoolTrace.h"
+#include "TimerWheel.h"
+#include "WorkStealingDeque.h"
 #include "Utils.h"
 
+#include <cstdio>
 #include <vector>
 #include <thread>
 #include <atomic>
@@ -27,6 +43,63 @@
 #include <utility>
 #include <memory>
 #include <string>
+#include <random>
+#include <mutex>
+#include <algorithm>
+#include <chrono>
+
+// How work items are distributed between the threads in a ThreadPool.
+enum class SchedulerMode {
+	// All threads push and pop from a single shared queue.
+	SharedQueue,
+	// Each thread owns a work stealing deque. Work submitted from outside the
+	// pool goes to a shared injection queue, work submitted from inside the pool
+	// goes to the submitting thread's deque. Idle threads steal from random victims.
+	WorkStealing
+};
+
+// The type of queue used for the shared work queue (the injection queue when work stealing).
+enum class QueueType {
+	// An unbounded queue protected by a mutex.
+	Locking,
+	// A bounded lock free ring buffer. Work that does not fit in the ring
+	// spills over into a locking queue so submission never blocks.
+	LockFree
+};
+
+// How long idle threads keep looking for work before going to sleep.
+// Spinning keeps the latency of bursts of work low at the cost of CPU time.
+struct IdlePolicy {
+	// Number of times to check for work, pausing the CPU in between
+	size_t spinCount = 256;
+	// Number of times to check for work, yielding the thread in between
+	size_t yieldCount = 8;
+};
+
+// How urgently submitted work should run. Each priority has its own queue,
+// threads take the most urgent work first every time they look for work.
+enum class Priority {
+	// Work the user is waiting on right now, runs before everything else
+	High,
+	// The default for submit, parallelFor and submitBatch
+	Normal,
+	// Background work that only runs when nothing else is queued, or once it has aged
+	Low
+};
+
+// True if T is a Priority, ignoring references and cv qualifiers
+template<typename T>
+struct IsPriority : std::is_same<std::decay_t<T>, Priority> { };
+
+// How threads choose between priorities
+struct PriorityPolicy {
+	// Number of high priority tasks a thread runs in a row before it gives
+	// lower priority work a turn, so a stream of high priority work can't starve
+	// it. 0 always runs high priority work first.
+	size_t highBurst = 8;
+	// Low priority work that has been queued for longer than this runs before normal work
+	std::chrono::microseconds lowMaxWait{ 50000 };
+};
 
 class ThreadPool
 {
@@ -44,8 +117,126 @@ public:
 	// Submits a function the thread pool for execution.
 	// Arguments to the callable can be supplied after the callable.
 	// To pass a value by reference use std::ref otherwise values will be copied.
+	// Small callables are submitted without any heap allocation.
+	template<typename Callable, typename = std::enable_if_t<!IsCancellationToken<Callable>::value && !IsPriority<Callable>::value>, typename... Args>
+	Future<std::result_of_t<Callable(Args...)>> submit(Callable&& workItem, Args&&... args);
+
+	// Submits a function to run at the given priority, see Priority.
+	template<typename Callable, typename = std::enable_if_t<!IsCancellationToken<Callable>::value>, typename... Args>
+	Future<std::result_of_t<Callable(Args...)>> submit(Priority priority, Callable&& workItem, Args&&... args);
+
+	// Submits a function that is skipped if the token is cancelled before it starts.
+	// A skipped function's future throws CancelledError. Running functions are
+	// not interrupted, they should poll the token themselves.
+	template<typename Callable, typename... Args>
+	Future<std::result_of_t<Callable(Args...)>> submit(CancellationToken token, Callable&& workItem, Args&&... args);
+
+	// Submits a cancellable function to run at the given priority.
 	template<typename Callable, typename... Args>
-	std::future<std::result_of_t<Callable(Args...)>> submit(Callable&& workItem, Args&&... args);
+	Future<std::result_of_t<Callable(Args...)>> submit(Priority priority, CancellationToken token, Callable&& workItem, Args&&... args);
+
+	// Submits a function to run once delay has passed. Timers wait in a timer wheel
+	// that the pool's threads service between tasks, no thread is kept per timer.
+	// Timers never run early, but may run late while every thread is busy.
+	template<typename Rep, typename Period, typename Callable, typename = std::enable_if_t<!IsCancellationToken<Callable>::value>, typename... Args>
+	Future<std::result_of_t<Callable(Args...)>> submitAfter(std::chrono::duration<Rep, Period> delay, Callable&& workItem, Args&&... args);
+
+	// As submitAfter, but the function is skipped if the token is cancelled first,
+	// like submit(token, ...). Cancelled timers don't wait out the rest of their delay.
+	template<typename Rep, typename Period, typename Callable, typename... Args>
+	Future<std::result_of_t<Callable(Args...)>> submitAfter(std::chrono::duration<Rep, Period> delay, CancellationToken token, Callable&& workItem, Args&&... args);
+
+	// Submits a function to run once time has passed. Any clock can be used.
+	template<typename Clock, typename Duration, typename Callable, typename = std::enable_if_t<!IsCancellationToken<Callable>::value>, typename... Args>
+	Future<std::result_of_t<Callable(Args...)>> submitAt(std::chrono::time_point<Clock, Duration> time, Callable&& workItem, Args&&... args);
+
+	template<typename Clock, typename Duration, typename Callable, typename... Args>
+	Future<std::result_of_t<Callable(Args...)>> submitAt(std::chrono::time_point<Clock, Duration> time, CancellationToken token, Callable&& workItem, Args&&... args);
+
+	// Calls fn() every period, starting one period from now, until the token is
+	// cancelled. Calls due while fn is still running are skipped rather than piling up.
+	// The future throws CancelledError once the timer has stopped for the token,
+	// or the exception fn threw, which also stops it.
+	template<typename Rep, typename Period, typename Callable>
+	Future<void> submitEvery(std::chrono::duration<Rep, Period> period, CancellationToken token, Callable&& fn);
+
+	// As submitEvery, but only stops when the timer is dropped by clearWork, cancelAll or stop.
+	template<typename Rep, typename Period, typename Callable>
+	Future<void> submitEvery(std::chrono::duration<Rep, Period> period, Callable&& fn);
+
+	// Calls fn(i) for every i in [begin, end) on the thread pool.
+	// The range is split into tasks of grainSize indices which are all queued
+	// at once. Returns a single handle that becomes ready when every call has
+	// finished, and rethrows the first exception thrown by fn from get().
+	template<typename Callable>
+	BatchFuture parallelFor(size_t begin, size_t end, size_t grainSize, Callable&& fn);
+
+	// Submits numTasks tasks that call fn(taskIndex), with taskIndex in [0, numTasks).
+	// Returns a single handle for the whole batch, like parallelFor.
+	template<typename Callable>
+	BatchFuture submitBatch(size_t numTasks, Callable&& fn);
+
+	// As parallelFor, but calls for indices that haven't started when the token
+	// is cancelled are skipped, and the batch's get() throws CancelledError.
+	template<typename Callable>
+	BatchFuture parallelFor(CancellationToken token, size_t begin, size_t end, size_t grainSize, Callable&& fn);
+
+	// As submitBatch, but tasks that haven't started when the token is cancelled are skipped.
+	template<typename Callable>
+	BatchFuture submitBatch(CancellationToken token, size_t numTasks, Callable&& fn);
+
+	// As parallelFor and submitBatch, with every task queued at the given priority.
+	template<typename Callable>
+	BatchFuture parallelFor(Priority priority, size_t begin, size_t end, size_t grainSize, Callable&& fn);
+
+	template<typename Callable>
+	BatchFuture submitBatch(Priority priority, size_t numTasks, Callable&& fn);
+
+	template<typename Callable>
+	BatchFuture submitBatch(Priority priority, CancellationToken token, size_t numTasks, Callable&& fn);
+
+	// Waits for the future to become ready. When called from one of this pool's
+	// threads, the thread runs other queued work while it waits instead of
+	// blocking, so tasks can wait on work they submit without deadlocking.
+	template<typename T>
+	void wait(const Future<T>& future);
+
+	// Waits for every task in the batch to finish, like wait(future).
+	void wait(const BatchFuture& batch);
+
+	// Runs fn(antecedent) on the thread pool once the antecedent is ready.
+	// No thread waits for it, the thread that finishes the antecedent queues fn.
+	// fn is passed the ready future so get() won't block and rethrows its exception.
+	template<typename T, typename Callable>
+	Future<std::result_of_t<Callable(Future<T>)>> then(Future<T>&& antecedent, Callable&& fn);
+
+	// Runs fn(antecedent) on the thread pool once every task in the batch has finished.
+	template<typename Callable>
+	Future<std::result_of_t<Callable(BatchFuture)>> then(BatchFuture&& antecedent, Callable&& fn);
+
+#if THREADPOOL_HAS_COROUTINES
+	// co_await pool.schedule() suspends the calling coroutine and resumes it on one of the pool's threads
+	ScheduleAwaitable schedule();
+
+	// Returns a coroutine that calls workItem(args...) on the thread pool once it is
+	// awaited, and resumes the awaiting coroutine on that thread when it returns.
+	// Nothing is queued until then, and no thread blocks while waiting for it.
+	template<typename Callable, typename... Args>
+	AsyncTask<std::result_of_t<Callable(Args...)>> submitAsync(Callable workItem, Args... args);
+
+	// Starts running a coroutine on the thread pool, and returns a future for its result.
+	template<typename T>
+	Future<T> spawn(AsyncTask<T> task);
+#endif
+
+	// Runs every node of the graph, each once all of its predecessors have finished.
+	// Nodes are queued by the thread that finishes their last predecessor, which
+	// runs one of them itself. Returns a future that becomes ready when every
+	// node has finished and rethrows the first exception a node threw, nodes that
+	// hadn't started by then are skipped. The graph must not be changed or
+	// destroyed until the future is ready.
+	// Throws std::logic_error if the graph is already running or has a cycle.
+	Future<void> run(TaskGraph& graph);
 	
 	// Start executing work items submitted to the threadpool
 	void start();
@@ -55,34 +246,451 @@ public:
 	// and it is safe to call start again.
 	void stop();
 
-	// Empty all work items from the work queue.
+	// Empty all work items from the work queue, and drop every timer.
+	// Timers whose token is cancelled complete their futures with CancelledError.
 	void clearWork();
 
-	// Sets the number of threads to run inside the thread pool
-	// WARNING: Using this after the threadpool has started will
-	// result in undefined behavior, and likely crash.
+	// Returns a token that is cancelled by the next call to cancelAll
+	CancellationToken getCancellationToken() const;
+
+	// Cancels every token from getCancellationToken, so running work that polls
+	// them can stop early, and empties the work queue.
+	// Tokens requested afterwards are not cancelled.
+	void cancelAll();
+
+	// Sets the number of threads to run inside the thread pool.
+	// Safe to call while the pool is running. New threads are started with
+	// the next unused IDs, and threads with the highest IDs are retired after
+	// finishing their current work item. Queued work is never dropped.
+	// Blocks until retired threads have exited, so it must not be called
+	// from inside the pool.
 	void setNumThreads(size_t numThreads);
 
 	// Gets the number of threads running or that will run in the
 	// thread pool.
 	size_t getNumThreads() const;
 
+	// Sets how work is distributed between threads.
+	// This must be called before the thread pool is started.
+	void setSchedulerMode(SchedulerMode mode);
+
+	// Gets how work is distributed between threads.
+	SchedulerMode getSchedulerMode() const;
+
+	// Sets the type of queue used for the shared work queue.
+	// This must be called before the thread pool is started.
+	void setQueueType(QueueType queueType);
+
+	// Gets the type of queue used for the shared work queue.
+	QueueType getQueueType() const;
+
+	// Sets the number of items the lock free queue can hold before
+	// spilling over into the locking queue.
+	// This must be called before the thread pool is started.
+	void setQueueCapacity(size_t capacity);
+
+	// Sets how long idle threads look for work before going to sleep.
+	// This must be called before the thread pool is started.
+	void setIdlePolicy(const IdlePolicy& idlePolicy);
+
+	// Gets how long idle threads look for work before going to sleep.
+	IdlePolicy getIdlePolicy() const;
+
+	// Sets the most tasks a thread takes from a shared queue each time it locks it,
+	// up to kMaxBulkPop. Fewer are taken when the queue is short, so every thread
+	// still gets a share of the work. Extra tasks go to the thread's deque when work
+	// stealing, otherwise to a buffer only that thread runs. 1 takes one at a time.
+	// clearWork and cancelAll don't remove tasks already in a buffer.
+	// This must be called before the thread pool is started.
+	void setMaxBulkPop(size_t maxTasks);
+
+	// Gets the most tasks a thread takes from a shared queue at once.
+	size_t getMaxBulkPop() const;
+
+	// The largest value setMaxBulkPop accepts
+	static const size_t kMaxBulkPop = 32;
+
+	// Sets how threads choose between high, normal and low priority work.
+	// This must be called before the thread pool is started.
+	void setPriorityPolicy(const PriorityPolicy& priorityPolicy);
+
+	// Gets how threads choose between high, normal and low priority work.
+	PriorityPolicy getPriorityPolicy() const;
+
+	// Sets how threads are pinned to CPUs. Thread IDs are assigned to the CPUs
+	// in the order given by the policy, wrapping around if there are more threads.
+	// This must be called before the thread pool is started.
+	void setAffinityPolicy(AffinityPolicy policy);
+
+	// Pins thread i to cpus[(i - 1) % cpus.size()] and sets the policy to Explicit.
+	// This must be called before the thread pool is started.
+	void setAffinityCpus(const std::vector<unsigned int>& cpus);
+
+	// Gets how threads are pinned to CPUs.
+	AffinityPolicy getAffinityPolicy() const;
+
+	// Groups threads by NUMA node. The shared queue is split into one locking
+	// queue per node and threads take work from their own node, including
+	// stealing from threads on it, before taking work from other nodes.
+	// Threads are spread over the nodes with AffinityPolicy::Scatter unless
+	// another policy is set. Has no effect on machines with a single node.
+	// This must be called before the thread pool is started.
+	void setNumaAware(bool numaAware);
+
+	// Returns true if threads are grouped by NUMA node.
+	bool isNumaAware() const;
+
+	// Turns collecting statistics on or off. Costs a few clock reads per task.
+	// This must be called before the thread pool is started.
+	void setCollectStats(bool collectStats);
+
+	// Returns true if statistics are being collected.
+	bool isCollectingStats() const;
+
+	// Returns the statistics of the threads currently in the pool, collected
+	// since the pool was created. Doesn't lock or slow down the threads, so it
+	// is cheap enough to call every frame.
+	// Counters may be a little out of date, and out of step with each other.
+	ThreadPoolStats snapshotStats() const;
+
+	// Turns recording a trace of every task on or off. Each thread keeps the
+	// submit, dequeue, start and end times of its tasks in a ring buffer of
+	// eventsPerThread events, events are dropped while a buffer is full.
+	// This must be called before the thread pool is started.
+	void setTracing(bool tracing, size_t eventsPerThread = 16384);
+
+	// Returns true if a trace is being recorded.
+	bool isTracing() const;
+
+	// Sets a file the trace is written to when the pool stops. Empty for none.
+	void setTraceFile(const std::string& path);
+
+	// Writes the events recorded since the last write to a Chrome trace event
+	// file, for chrome://tracing or ui.perfetto.dev. Safe to call while running.
+	// Returns false if the file couldn't be written.
+	bool writeTrace(const std::string& path);
+
+	// Names the task running on the calling thread in the trace, using printf
+	// formatting. Does nothing if the task isn't being traced, so it costs a
+	// single branch when tracing is off.
+	template<typename... Args>
+	static void setTaskLabel(const char* format, Args... args);
+
+	// Returns the calling thread's arena for scratch memory, such as buffers a
+	// task only needs while it runs. Everything a task allocates from it is freed
+	// when the task returns, so nothing allocated here may outlive the task.
+	// Threads outside a pool get their own arena, which is only rewound by tasks
+	// they run while waiting.
+	static TaskArena& taskArena();
+
 private:
+#if THREADPOOL_HAS_COROUTINES
+	friend class ScheduleAwaitable;
+	template<typename FutureT>
+	friend class CoroutineDetail::ReadyAwaiter;
+#endif
+
+	// State owned by a single worker thread when work stealing
+	struct Worker {
+		// Work submitted from this thread. Tasks are moved into blocks from
+		// the BlockAllocator because the deque can only hold trivially copyable types.
+		WorkStealingDeque<Task*> deque;
+		// Used for picking random victims to steal from
+		std::minstd_rand rng;
+	};
+
+	// Tasks a thread took from a shared queue in one go when not work stealing.
+	// Lives on the thread's stack, only that thread touches it.
+	struct LocalBatch {
+		Task tasks[kMaxBulkPop];
+		size_t next = 0;
+		size_t count = 0;
+		// When the tasks were taken from the queue, only recorded while tracing
+		uint64_t popNs = 0;
+
+		// Takes the next task, returns false once the batch is used up
+		bool pop(Task& workItem);
+	};
+
+	// Which threads findWork may steal from
+	enum class StealScope {
+		AllNodes,
+		LocalNode,
+		RemoteNodes
+	};
+
+	// Starts threads with IDs in [firstThreadId, lastThreadId], the resize lock must be held
+	void spawnThreads(size_t firstThreadId, size_t lastThreadId);
+
+	// Stops and joins threads with IDs greater than numThreads and moves
+	// their queued work to the shared queue, the resize lock must be held
+	void retireThreads(size_t numThreads);
+
+	// Returns true if the thread should stop taking work, either because
+	// the pool is stopping or the thread has been retired
+	bool shouldExit(size_t threadId) const;
+
+	// Wakes every thread waiting for work so they can check shouldExit
+	void wakeAll();
+
+	// Adds a work item to the appropriate queue and wakes a thread to run it.
+	void enqueue(Task&& workItem, Priority priority = Priority::Normal);
+
+	// Adds many work items to the appropriate queues and wakes threads to run them.
+	// makeTask(i) is called to create the i'th work item.
+	template<typename TaskGenerator>
+	void enqueueBatch(size_t numTasks, TaskGenerator makeTask, Priority priority = Priority::Normal);
+
+	// Gets the next work item for a thread to run, noting when it was taken while tracing
+	bool nextTask(size_t threadId, Task& workItem);
+
+	// Takes the next work item for a thread to run, taking priorities into account.
+	// Normal priority work comes from tryPopShared or findWork depending on the scheduler.
+	bool popTask(size_t threadId, Task& workItem);
+
+	// Pops low priority work that has been queued for longer than the priority policy allows
+	bool tryPopAgedLow(Task& workItem);
+
+	// Wraps a call so its result or exception goes to the promise, skipping it if the token is cancelled
+	template<typename ResultT, typename Callable, typename... Args>
+	static Task bindWork(Promise<ResultT>&& promise, CancellationToken token, Callable&& workItem, Args&&... args);
+
+	// Submits a function to run once deadlineNs, a time from nowNs(), has passed
+	template<typename Callable, typename... Args>
+	Future<std::result_of_t<Callable(Args...)>> submitTimer(uint64_t deadlineNs, CancellationToken token, Callable&& workItem, Args&&... args);
+
+	// Returns the nowNs() time delay from now, a negative delay is treated as 0
+	template<typename Rep, typename Period>
+	static uint64_t deadlineAfter(std::chrono::duration<Rep, Period> delay);
+
+	// Calls a function every period, see submitEvery. Each call adds the timer for the next.
+	template<typename Callable>
+	class PeriodicTask;
+
+	// Adds a work item to the timer wheel and wakes sleeping threads if it is the next due
+	void addTimer(uint64_t deadlineNs, Task&& workItem, CancellationToken token);
+
+	// Returns true if a timer is due
+	bool timerDue() const;
+
+	// Queues the work of every due timer. Does nothing if another thread is already doing it.
+	void fireTimers();
+
+	// Queues fn(antecedent) once the antecedent, a Future or BatchFuture, is ready
+	template<typename FutureT, typename Callable>
+	Future<std::result_of_t<Callable(FutureT)>> continueWith(FutureT&& antecedent, Callable&& fn);
+
+	// Runs a node of a graph, then queues its successors that have become ready.
+	// Keeps going with one of those successors instead of queueing it.
+	void runGraphNode(TaskGraph& graph, size_t nodeId);
+
+	// Adds a work item to the calling thread's work stealing deque
+	void pushLocal(Task&& workItem);
+
+	// Adds a work item to the shared work queue
+	void pushShared(Task&& workItem);
+
+	// Attempts to get a work item from the shared work queue, preferring the
+	// calling thread's node queue in NUMA mode.
+	// If the queue is empty just return false
+	bool tryPopShared(Task& workItem);
+
+	// Attempts to get a work item from the queue of a NUMA node
+	bool tryPopNode(size_t node, Task& workItem);
+
+	// Pops a work item from a shared queue, taking more for later when the queue
+	// is deep enough. The rest go to the calling thread's deque or local batch.
+	bool tryPopBulk(AtomicQueue<Task>& queue, Task& workItem);
+
+	// Attempts to steal a work item from another thread's deque, starting from a random victim
+	bool stealWork(size_t threadId, StealScope scope, Task& workItem);
+
+	// Works out which CPUs threads are pinned to and creates the node queues, the resize lock must be held
+	void placeThreads();
+
+	// Returns the index of the NUMA node the thread is placed on
+	size_t nodeOfThread(size_t threadId) const;
+
+	// Runs a work item, recording statistics if they are being collected
+	void runTask(Task& workItem);
+
+	// Waits for work like waitForWork, recording the idle time if statistics are being collected
+	void idle(size_t threadId);
+
 	// The main function that threads are executing in.
 	// Handles removing work items from the queue and executing them.
 	void doWork(size_t threadId);
 
+	// The main function that threads are executing in when work stealing.
+	void doWorkStealing(size_t threadId);
+
+	// Gets a work item from the thread's own deque, the injection queue
+	// or another thread's deque, in that order. In NUMA mode work on the
+	// thread's own node is tried before the injection queue.
+	// Returns false if no work could be found.
+	bool findWork(size_t threadId, Task& workItem);
+
+	// Returns true if any queue or deque has items in it
+	bool hasQueuedWork() const;
+
+	// Waits for work to be submitted following the idle policy. Returns early
+	// if the thread should exit, or when waiting on a future, once done is set.
+	void waitForWork(size_t threadId, const std::atomic_bool* done = nullptr);
+
+	// Blocks the calling thread until work is submitted or waitForWork should return
+	void sleepUntilWork(size_t threadId, const std::atomic_bool* done);
+
+	// Returns true once waitForWork should return
+	bool shouldStopWaiting(size_t threadId, const std::atomic_bool* done) const;
+
+	// Runs queued work on the calling pool thread until done is set
+	void helpUntil(const std::atomic_bool& done);
+
+	// Wakes a pool thread that is waiting on a future in wait()
+	class WaitContinuation : public Continuation
+	{
+	public:
+		explicit WaitContinuation(ThreadPool& pool)
+			: m_pool(pool)
+		{
+		}
+
+		void run() override;
+
+		std::atomic_bool done{ false };
+
+	private:
+		ThreadPool& m_pool;
+	};
+
+	// Wakes a sleeping thread if there are any
+	void wakeWorker();
+
+	// Wakes up to count sleeping threads
+	void wakeWorkers(size_t count);
+
 	// An atomic boolean variable to stop all threads in the threadpool.
 	std::atomic_bool m_stop{ false };
 
-	//A WorkQueue of tasks which are functors
-	AtomicQueue<std::function<void()>> m_workQueue;
+	//A WorkQueue of tasks which are functors.
+	//Used as the injection queue when work stealing and as the
+	//overflow for the lock free queue.
+	AtomicQueue<Task> m_workQueue;
+
+	// The shared work queue when using QueueType::LockFree.
+	// Created by start() so the capacity can be configured.
+	std::unique_ptr<LockFreeQueue<Task>> m_lockFreeQueue;
+
+	// Queues for high and low priority work, normal priority work uses the queues above
+	AtomicQueue<Task> m_highQueue;
+	AtomicQueue<Task> m_lowQueue;
 
 	//Create a pool of worker threads
 	std::vector<std::thread> m_workerThreads; 
+
+	SchedulerMode m_schedulerMode = SchedulerMode::SharedQueue;
+	QueueType m_queueType = QueueType::Locking;
+	size_t m_queueCapacity = 4096;
+	size_t m_maxBulkPop = 1;
+
+	// Per thread state for work stealing, indexed by threadId - 1.
+	// Grows with the number of threads but never shrinks while running,
+	// so other threads can keep stealing from it without locking.
+	GrowOnlyArray<Worker> m_workers;
+
+	// Serializes start, stop and setNumThreads
+	std::mutex m_resizeMutex;
+	bool m_running = false;
+
+	// Hands out the tokens cancelled by cancelAll
+	CancellationSource m_cancellationSource;
+
+	// Idle threads sleep on this once they have finished spinning
+	EventCount m_workAvailable;
+
+	// Delayed and periodic work waiting for its time
+	TimerWheel m_timers;
+	// Set while a sleeping thread waits for the next timer, the other sleeping threads wait for work
+	std::atomic_bool m_timerWatcher{ false };
+	IdlePolicy m_idlePolicy;
+
+	PriorityPolicy m_priorityPolicy;
+
+	AffinityPolicy m_affinityPolicy = AffinityPolicy::None;
+	std::vector<unsigned int> m_affinityCpus;
+	bool m_numaAware = false;
+
+	// The CPUs threads are pinned to, indexed by (threadId - 1) % size.
+	// Empty when threads aren't pinned. Set by start().
+	std::vector<LogicalCpu> m_cpuOrder;
+	// Node index of each CPU in m_cpuOrder, numbered from 0 without gaps
+	std::vector<size_t> m_cpuNodes;
+
+	// One queue per NUMA node replacing the shared queue in NUMA mode.
+	// Empty unless NUMA mode is on and there is more than one node.
+	std::vector<std::unique_ptr<AtomicQueue<Task>>> m_nodeQueues;
+	// Spreads work submitted from outside the pool over the nodes
+	std::atomic<size_t> m_nextNode{ 0 };
+
+	// Statistics for each thread, indexed by threadId - 1.
+	// Kept when threads are retired or the pool is stopped.
+	bool m_collectStats = false;
+	GrowOnlyArray<WorkerStatsSlot> m_stats;
+
+	// Trace events of each thread, indexed by threadId - 1
+	bool m_tracing = false;
+	size_t m_traceEventsPerThread = 16384;
+	GrowOnlyArray<TraceBuffer> m_traceBuffers;
+	std::string m_traceFile;
+	// Trace times are written relative to this
+	uint64_t m_traceEpoch = 0;
+	// Only one thread may drain the trace buffers at a time
+	std::mutex m_traceMutex;
+
+	// Scratch memory for each thread, indexed by threadId - 1
+	GrowOnlyArray<TaskArena> m_arenas;
+
+	// True if statistics or tracing are on, so running a task only checks one flag
+	bool m_instrumented = false;
+
+	// The pool the current thread is a worker of, nullptr for other threads
+	static thread_local ThreadPool* tl_threadPool;
+
+	// The current thread's work stealing state, nullptr for other threads
+	static thread_local Worker* tl_worker;
+
+	// The NUMA node the current thread is placed on, 0 for other threads
+	static thread_local size_t tl_node;
+
+	// Number of tasks running on the current thread, more than 1 when
+	// running work while waiting on a future
+	static thread_local size_t tl_taskDepth;
+
+	// The current thread's local batch, nullptr when work stealing or outside the pool
+	static thread_local LocalBatch* tl_localBatch;
+
+	// The scratch arena of a thread that isn't one of a pool's workers
+	static thread_local TaskArena tl_externalArena;
+
+	// High priority tasks the current thread has run in a row
+	static thread_local size_t tl_highStreak;
+	// Tasks the current thread takes before it next checks for aged low priority work
+	static thread_local size_t tl_agingCountdown;
+
+	// The trace event of the task running on the current thread, nullptr if it isn't traced
+	static thread_local TraceEvent* tl_traceEvent;
+	// When the task nextTask last returned was taken from its queue, 0 if it wasn't traced
+	static thread_local uint64_t tl_dequeueNs;
+
+	// Tasks of timers the current thread has found due, see fireTimers
+	static thread_local std::vector<Task> tl_expiredTimers;
 protected:
+	// Called with the new thread count whenever it changes, before any thread
+	// with a new ID starts. Used to grow per thread state.
+	virtual void onNumThreadsChanged(size_t /*numThreads*/) {}
+
 	//A variable to hold the number of threads we want in the pool
-	size_t m_numThreads;
+	std::atomic<size_t> m_numThreads;
 
 	static thread_local size_t tl_threadId;
 };
@@ -103,51 +711,513 @@ public:
 	// executing on the thread pool.
 	ThreadLocalStorageT& getThreadLocalStorage();
 
+	// Calls fn(store) on every storage object, including the main thread's and
+	// those of threads removed by setNumThreads, in thread ID order. Use it to
+	// reduce or reset per thread results once the tasks writing them are done.
+	template<typename Fn>
+	void forEachStore(Fn&& fn);
+
+	// Folds every storage object into the first with
+	// reducer(const ThreadLocalStorageT& a, const ThreadLocalStorageT& b) -> ThreadLocalStorageT.
+	// Like forEachStore, only call it while no tasks are writing to their stores.
+	template<typename Reducer>
+	ThreadLocalStorageT combine(Reducer&& reducer);
+
+	// Folds every storage object into init with
+	// reducer(ResultT accumulated, const ThreadLocalStorageT& store) -> ResultT.
+	template<typename ResultT, typename Reducer>
+	ResultT combine(ResultT init, Reducer&& reducer);
+
+protected:
+	void onNumThreadsChanged(size_t numThreads) override;
+
 private:
-	std::vector<ThreadLocalStorageT> m_threadStores;
+	// Each store gets whole cache lines to itself, so threads writing to
+	// their own stores never invalidate each other's lines
+	struct alignas(64) PaddedStore {
+		ThreadLocalStorageT store;
+	};
+
+	// Stores are kept when the pool shrinks so thread IDs keep their storage,
+	// and results written by removed threads are still combined
+	GrowOnlyArray<PaddedStore> m_threadStores;
 };
 
 template<typename ThreadLocalStorageT>
 inline ThreadPoolWithStorage<ThreadLocalStorageT>::ThreadPoolWithStorage()
 	: ThreadPool()
-	, m_threadStores{ m_numThreads + 1 } // Extra store for main thread
 {
+	m_threadStores.growTo(m_numThreads + 1); // Extra store for main thread
 }
 
 template<typename ThreadLocalStorageT>
 inline ThreadPoolWithStorage<ThreadLocalStorageT>::ThreadPoolWithStorage(size_t size)
 	: ThreadPool(size)
-	, m_threadStores{ m_numThreads + 1 } // Extra store for main thread
 {
+	m_threadStores.growTo(m_numThreads + 1); // Extra store for main thread
+}
+
+template<typename ThreadLocalStorageT>
+inline void ThreadPoolWithStorage<ThreadLocalStorageT>::onNumThreadsChanged(size_t numThreads)
+{
+	m_threadStores.growTo(numThreads + 1);
 }
 
 template<typename ThreadLocalStorageT>
 inline ThreadLocalStorageT & ThreadPoolWithStorage<ThreadLocalStorageT>::getThreadLocalStorage(size_t threadId)
 {
-	return m_threadStores.at(threadId);
+	return m_threadStores.at(threadId).store;
 }
 
 template<typename ThreadLocalStorageT>
 inline ThreadLocalStorageT& ThreadPoolWithStorage<ThreadLocalStorageT>::getThreadLocalStorage()
 {
-	return m_threadStores.at(tl_threadId);
+	return m_threadStores.at(tl_threadId).store;
+}
+
+template<typename ThreadLocalStorageT>
+template<typename Fn>
+inline void ThreadPoolWithStorage<ThreadLocalStorageT>::forEachStore(Fn&& fn)
+{
+	size_t numStores = m_threadStores.size();
+	for (size_t i = 0; i < numStores; ++i)
+		fn(m_threadStores[i].store);
+}
+
+template<typename ThreadLocalStorageT>
+template<typename Reducer>
+inline ThreadLocalStorageT ThreadPoolWithStorage<ThreadLocalStorageT>::combine(Reducer&& reducer)
+{
+	// There is always at least the main thread's store
+	ThreadLocalStorageT result = m_threadStores[0].store;
+	size_t numStores = m_threadStores.size();
+	for (size_t i = 1; i < numStores; ++i)
+	{
+		const ThreadLocalStorageT& store = m_threadStores[i].store;
+		result = reducer(static_cast<const ThreadLocalStorageT&>(result), store);
+	}
+	return result;
+}
+
+template<typename ThreadLocalStorageT>
+template<typename ResultT, typename Reducer>
+inline ResultT ThreadPoolWithStorage<ThreadLocalStorageT>::combine(ResultT init, Reducer&& reducer)
+{
+	size_t numStores = m_threadStores.size();
+	for (size_t i = 0; i < numStores; ++i)
+	{
+		const ThreadLocalStorageT& store = m_threadStores[i].store;
+		init = reducer(std::move(init), store);
+	}
+	return init;
 }
 
 // Arguments will all be stored by copy for safety
-template<typename Callable, typename... Args>
-inline std::future<std::result_of_t<Callable(Args...)>> ThreadPool::submit(Callable&& workItem, Args&&... args)
+template<typename Callable, typename, typename... Args>
+inline Future<std::result_of_t<Callable(Args...)>> ThreadPool::submit(Callable&& workItem, Args&&... args)
+{
+	return submit(Priority::Normal, std::forward<Callable>(workItem), std::forward<Args>(args)...);
+}
+
+template<typename Callable, typename, typename... Args>
+inline Future<std::result_of_t<Callable(Args...)>> ThreadPool::submit(Priority priority, Callable&& workItem, Args&&... args)
 {
 	using ResultT = std::result_of_t<Callable(Args...)>; // result_of_t returns the result type of calling Callable with Args
-	using TaskT = std::packaged_task<ResultT(Args...)>;
+	using CallableT = std::decay_t<Callable>;
+
+	Promise<ResultT> promise;
+	Future<ResultT> future = promise.getFuture();
+
+	// The promise, callable and arguments are all stored inside the Task
+	enqueue(std::bind([](Promise<ResultT>& promise, CallableT& callable, InvokeTypeT<Args>... args) { // Bind always passes in arguments by lvalue
+		promise.setResultOf(callable, args...);
+	}, std::move(promise), std::forward<Callable>(workItem), std::forward<Args>(args)...), priority);
+
+	return future;
+}
+
+template<typename Callable, typename... Args>
+inline Future<std::result_of_t<Callable(Args...)>> ThreadPool::submit(CancellationToken token, Callable&& workItem, Args&&... args)
+{
+	return submit(Priority::Normal, std::move(token), std::forward<Callable>(workItem), std::forward<Args>(args)...);
+}
+
+template<typename Callable, typename... Args>
+inline Future<std::result_of_t<Callable(Args...)>> ThreadPool::submit(Priority priority, CancellationToken token, Callable&& workItem, Args&&... args)
+{
+	using ResultT = std::result_of_t<Callable(Args...)>;
+
+	Promise<ResultT> promise;
+	Future<ResultT> future = promise.getFuture();
+	enqueue(bindWork(std::move(promise), token, std::forward<Callable>(workItem), std::forward<Args>(args)...), priority);
+	return future;
+}
+
+template<typename ResultT, typename Callable, typename... Args>
+inline Task ThreadPool::bindWork(Promise<ResultT>&& promise, CancellationToken token, Callable&& workItem, Args&&... args)
+{
+	using CallableT = std::decay_t<Callable>;
+
+	return std::bind([token](Promise<ResultT>& promise, CallableT& callable, InvokeTypeT<Args>... args) {
+		promise.setResultOf([&]() -> ResultT {
+			token.throwIfCancelled();
+			return callable(args...);
+		});
+	}, std::move(promise), std::forward<Callable>(workItem), std::forward<Args>(args)...);
+}
+
+template<typename Rep, typename Period, typename Callable, typename, typename... Args>
+inline Future<std::result_of_t<Callable(Args...)>> ThreadPool::submitAfter(std::chrono::duration<Rep, Period> delay, Callable&& workItem, Args&&... args)
+{
+	return submitTimer(deadlineAfter(delay), CancellationToken(), std::forward<Callable>(workItem), std::forward<Args>(args)...);
+}
+
+template<typename Rep, typename Period, typename Callable, typename... Args>
+inline Future<std::result_of_t<Callable(Args...)>> ThreadPool::submitAfter(std::chrono::duration<Rep, Period> delay, CancellationToken token, Callable&& workItem, Args&&... args)
+{
+	return submitTimer(deadlineAfter(delay), token, std::forward<Callable>(workItem), std::forward<Args>(args)...);
+}
+
+template<typename Clock, typename Duration, typename Callable, typename, typename... Args>
+inline Future<std::result_of_t<Callable(Args...)>> ThreadPool::submitAt(std::chrono::time_point<Clock, Duration> time, Callable&& workItem, Args&&... args)
+{
+	return submitTimer(deadlineAfter(time - Clock::now()), CancellationToken(), std::forward<Callable>(workItem), std::forward<Args>(args)...);
+}
+
+template<typename Clock, typename Duration, typename Callable, typename... Args>
+inline Future<std::result_of_t<Callable(Args...)>> ThreadPool::submitAt(std::chrono::time_point<Clock, Duration> time, CancellationToken token, Callable&& workItem, Args&&... args)
+{
+	return submitTimer(deadlineAfter(time - Clock::now()), token, std::forward<Callable>(workItem), std::forward<Args>(args)...);
+}
+
+template<typename Callable, typename... Args>
+inline Future<std::result_of_t<Callable(Args...)>> ThreadPool::submitTimer(uint64_t deadlineNs, CancellationToken token, Callable&& workItem, Args&&... args)
+{
+	using ResultT = std::result_of_t<Callable(Args...)>;
+
+	Promise<ResultT> promise;
+	Future<ResultT> future = promise.getFuture();
+	addTimer(deadlineNs, bindWork(std::move(promise), token, std::forward<Callable>(workItem), std::forward<Args>(args)...), token);
+	return future;
+}
+
+template<typename Rep, typename Period>
+inline uint64_t ThreadPool::deadlineAfter(std::chrono::duration<Rep, Period> delay)
+{
+	long long delayNs = std::chrono::duration_cast<std::chrono::nanoseconds>(delay).count();
+	return nowNs() + static_cast<uint64_t>(std::max<long long>(delayNs, 0));
+}
+
+template<typename Callable>
+class ThreadPool::PeriodicTask
+{
+public:
+	PeriodicTask(ThreadPool& pool, Callable&& fn, Promise<void>&& promise, CancellationToken token, uint64_t periodNs)
+		: m_pool(&pool)
+		, m_state(std::make_shared<State>(State{ std::move(fn), std::move(promise) }))
+		, m_token(token)
+		, m_periodNs(std::max<uint64_t>(periodNs, 1))
+		, m_deadlineNs(nowNs() + m_periodNs)
+	{
+	}
+
+	// Adds the timer for the first call
+	void schedule()
+	{
+		m_pool->addTimer(m_deadlineNs, Task(*this), m_token);
+	}
+
+	void operator()()
+	{
+		if (m_token.isCancelled())
+		{
+			m_state->promise.setException(std::make_exception_ptr(CancelledError()));
+			return;
+		}
+		try {
+			m_state->fn();
+		}
+		catch (...) {
+			m_state->promise.setException(std::current_exception());
+			return;
+		}
+
+		// Calls stay on the original schedule, ones missed while fn was running are skipped
+		uint64_t now = nowNs();
+		m_deadlineNs += m_periodNs;
+		if (m_deadlineNs <= now)
+			m_deadlineNs += ((now - m_deadlineNs) / m_periodNs + 1) * m_periodNs;
+		schedule();
+	}
+
+private:
+	// Shared by every copy. The promise is broken if the timer is dropped, unless
+	// it was dropped for a cancelled token, see clearWork.
+	struct State {
+		Callable fn;
+		Promise<void> promise;
+	};
+
+	ThreadPool* m_pool;
+	std::shared_ptr<State> m_state;
+	CancellationToken m_token;
+	uint64_t m_periodNs;
+	uint64_t m_deadlineNs;
+};
+
+template<typename Rep, typename Period, typename Callable>
+inline Future<void> ThreadPool::submitEvery(std::chrono::duration<Rep, Period> period, CancellationToken token, Callable&& fn)
+{
+	using CallableT = std::decay_t<Callable>;
+
+	Promise<void> promise;
+	Future<void> future = promise.getFuture();
+	uint64_t periodNs = static_cast<uint64_t>(std::max<long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(period).count(), 0));
+	PeriodicTask<CallableT>(*this, CallableT(std::forward<Callable>(fn)), std::move(promise), token, periodNs).schedule();
+	return future;
+}
+
+template<typename Rep, typename Period, typename Callable>
+inline Future<void> ThreadPool::submitEvery(std::chrono::duration<Rep, Period> period, Callable&& fn)
+{
+	return submitEvery(period, CancellationToken(), std::forward<Callable>(fn));
+}
+
+template<typename Callable>
+inline BatchFuture ThreadPool::parallelFor(size_t begin, size_t end, size_t grainSize, Callable&& fn)
+{
+	return parallelFor(Priority::Normal, begin, end, grainSize, std::forward<Callable>(fn));
+}
+
+template<typename Callable>
+inline BatchFuture ThreadPool::parallelFor(Priority priority, size_t begin, size_t end, size_t grainSize, Callable&& fn)
+{
+	using CallableT = std::decay_t<Callable>;
 
-	auto task = std::make_shared<TaskT>(std::forward<Callable>(workItem));
-	std::future<ResultT> future = task->get_future();
+	size_t numIndices = end > begin ? end - begin : 0;
+	grainSize = std::max<size_t>(grainSize, 1);
+	size_t numTasks = (numIndices + grainSize - 1) / grainSize;
 
-	m_workQueue.push(std::bind([](const std::shared_ptr<TaskT>& task, InvokeTypeT<Args>... args) { // Bind always passes in arguments by lvalue
-		(*task)(args...);
-	}, std::move(task), std::forward<Args>(args)...));
+	// Every task shares the callable and one countdown in the batch state
+	BatchState<CallableT>* state = BatchState<CallableT>::create(CallableT(std::forward<Callable>(fn)), numTasks);
+	BatchFuture batch(state);
+
+	enqueueBatch(numTasks, [state, begin, end, grainSize](size_t i) {
+		size_t taskBegin = begin + i * grainSize;
+		size_t taskEnd = std::min(taskBegin + grainSize, end);
+		return Task(BatchTask<CallableT>(state, taskBegin, taskEnd));
+	}, priority);
+
+	return batch;
+}
+
+template<typename Callable>
+inline BatchFuture ThreadPool::submitBatch(size_t numTasks, Callable&& fn)
+{
+	return parallelFor(0, numTasks, 1, std::forward<Callable>(fn));
+}
+
+template<typename Callable>
+inline BatchFuture ThreadPool::parallelFor(CancellationToken token, size_t begin, size_t end, size_t grainSize, Callable&& fn)
+{
+	// The first cancelled index throws, which skips the rest of its task
+	return parallelFor(begin, end, grainSize, [token, fn = std::forward<Callable>(fn)](size_t i) mutable {
+		token.throwIfCancelled();
+		fn(i);
+	});
+}
+
+template<typename Callable>
+inline BatchFuture ThreadPool::submitBatch(CancellationToken token, size_t numTasks, Callable&& fn)
+{
+	return parallelFor(token, 0, numTasks, 1, std::forward<Callable>(fn));
+}
+
+template<typename Callable>
+inline BatchFuture ThreadPool::submitBatch(Priority priority, size_t numTasks, Callable&& fn)
+{
+	return parallelFor(priority, 0, numTasks, 1, std::forward<Callable>(fn));
+}
+
+template<typename Callable>
+inline BatchFuture ThreadPool::submitBatch(Priority priority, CancellationToken token, size_t numTasks, Callable&& fn)
+{
+	return parallelFor(priority, 0, numTasks, 1, [token, fn = std::forward<Callable>(fn)](size_t i) mutable {
+		token.throwIfCancelled();
+		fn(i);
+	});
+}
+
+template<typename... Args>
+inline void ThreadPool::setTaskLabel(const char* format, Args... args)
+{
+	if (tl_traceEvent)
+		std::snprintf(tl_traceEvent->label, TraceEvent::kLabelSize, format, args...);
+}
+
+template<typename T>
+inline void ThreadPool::wait(const Future<T>& future)
+{
+	if (tl_threadPool != this)
+	{
+		future.wait();
+		return;
+	}
+	// The continuation lives on this stack, helpUntil doesn't return until it has run
+	WaitContinuation continuation(*this);
+	future.addContinuation(&continuation);
+	helpUntil(continuation.done);
+}
+
+template<typename T, typename Callable>
+inline Future<std::result_of_t<Callable(Future<T>)>> ThreadPool::then(Future<T>&& antecedent, Callable&& fn)
+{
+	return continueWith(std::move(antecedent), std::forward<Callable>(fn));
+}
 
+template<typename Callable>
+inline Future<std::result_of_t<Callable(BatchFuture)>> ThreadPool::then(BatchFuture&& antecedent, Callable&& fn)
+{
+	return continueWith(std::move(antecedent), std::forward<Callable>(fn));
+}
+
+template<typename FutureT, typename Callable>
+inline Future<std::result_of_t<Callable(FutureT)>> ThreadPool::continueWith(FutureT&& antecedent, Callable&& fn)
+{
+	using ResultT = std::result_of_t<Callable(FutureT)>;
+	using CallableT = std::decay_t<Callable>;
+
+	Promise<ResultT> promise;
+	Future<ResultT> future = promise.getFuture();
+
+	// Runs on the thread that finished the antecedent, so only queue the work here
+	antecedent.onReady([this, promise = std::move(promise), fn = CallableT(std::forward<Callable>(fn))](FutureT ready) mutable {
+		enqueue([promise = std::move(promise), fn = std::move(fn), ready = std::move(ready)]() mutable {
+			promise.setResultOf(fn, std::move(ready));
+		});
+	});
+
+	return future;
+}
+
+template<typename TaskGenerator>
+inline void ThreadPool::enqueueBatch(size_t numTasks, TaskGenerator makeTask, Priority priority)
+{
+	if (numTasks == 0)
+		return;
+
+	// One clock read for the whole batch, low priority work always needs it for aging
+	uint64_t submitTime = m_instrumented || priority == Priority::Low ? nowNs() : 0;
+	auto makeTimedTask = [&makeTask, submitTime](size_t i) {
+		Task task = makeTask(i);
+		task.setSubmitTime(submitTime);
+		return task;
+	};
+
+	if (priority != Priority::Normal)
+	{
+		AtomicQueue<Task>& priorityQueue = priority == Priority::High ? m_highQueue : m_lowQueue;
+		priorityQueue.pushBulk(numTasks, makeTimedTask);
+	}
+	else if (m_schedulerMode == SchedulerMode::WorkStealing && tl_threadPool == this)
+	{
+		for (size_t i = 0; i < numTasks; ++i)
+			pushLocal(makeTimedTask(i));
+	}
+	else if (!m_nodeQueues.empty())
+	{
+		// Give each node a contiguous share of the batch, neighbouring tasks tend to touch neighbouring memory
+		size_t numNodes = m_nodeQueues.size();
+		size_t firstTask = 0;
+		for (size_t node = 0; node < numNodes; ++node)
+		{
+			size_t count = numTasks / numNodes + (node < numTasks % numNodes ? 1 : 0);
+			m_nodeQueues[node]->pushBulk(count, [&makeTimedTask, firstTask](size_t i) { return makeTimedTask(firstTask + i); });
+			firstTask += count;
+		}
+	}
+	else if (m_lockFreeQueue)
+	{
+		for (size_t i = 0; i < numTasks; ++i)
+			pushShared(makeTimedTask(i));
+	}
+	else
+	{
+		// Only lock the queue once for the whole batch
+		m_workQueue.pushBulk(numTasks, makeTimedTask);
+	}
+
+	wakeWorkers(numTasks);
+}
+
+#if THREADPOOL_HAS_COROUTINES
+inline void ScheduleAwaitable::await_suspend(std::coroutine_handle<> awaiting)
+{
+	m_pool.enqueue(Task([awaiting]() { awaiting.resume(); }));
+}
+
+template<typename FutureT>
+inline void CoroutineDetail::ReadyAwaiter<FutureT>::await_suspend(std::coroutine_handle<> awaiting)
+{
+	m_awaiting = awaiting;
+	m_pool = ThreadPool::tl_threadPool;
+	// May resume the coroutine straight away, this awaiter can't be touched after
+	m_future.addContinuation(this);
+}
+
+template<typename FutureT>
+inline void CoroutineDetail::ReadyAwaiter<FutureT>::run()
+{
+	// Results stored by the main thread or another pool's threads don't get to run the coroutine
+	if (m_pool && ThreadPool::tl_threadPool != m_pool)
+	{
+		m_pool->enqueue(Task([awaiting = m_awaiting]() { awaiting.resume(); }));
+		return;
+	}
+	m_awaiting.resume();
+}
+
+inline ScheduleAwaitable ThreadPool::schedule()
+{
+	return ScheduleAwaitable(*this);
+}
+
+template<typename Callable, typename... Args>
+inline AsyncTask<std::result_of_t<Callable(Args...)>> ThreadPool::submitAsync(Callable workItem, Args... args)
+{
+	co_await schedule();
+	co_return workItem(args...);
+}
+
+namespace CoroutineDetail {
+	// Runs a task on the pool and stores its result in promise
+	template<typename T>
+	DetachedCoroutine runDetached(ThreadPool& pool, AsyncTask<T> task, Promise<T> promise)
+	{
+		co_await pool.schedule();
+		try {
+			if constexpr (std::is_void<T>::value) {
+				co_await std::move(task);
+				promise.setValue();
+			}
+			else {
+				promise.setValue(co_await std::move(task));
+			}
+		}
+		catch (...) {
+			promise.setException(std::current_exception());
+		}
+	}
+}
+
+template<typename T>
+inline Future<T> ThreadPool::spawn(AsyncTask<T> task)
+{
+	Promise<T> promise;
+	Future<T> future = promise.getFuture();
+	CoroutineDetail::runDetached(*this, std::move(task), std::move(promise));
 	return future;
 }
+#endif
 
 #endif
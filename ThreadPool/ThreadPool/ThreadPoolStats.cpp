@@ -0,0 +1,195 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Scheduling statistics collected by each thread of a ThreadPool
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+//Library Includes
+#include <algorithm>
+#include <chrono>
+
+//This Include
+#include "ThreadPoolStats.h"
+
+uint64_t nowNs()
+{
+	using namespace std::chrono;
+	return static_cast<uint64_t>(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+size_t DurationHistogram::bucketOf(uint64_t ns)
+{
+	if (ns < kSubBuckets)
+		return static_cast<size_t>(ns);
+
+	// The bucket is found from the highest set bit and the kSubBucketBits below it
+	size_t exponent = 0;
+	while ((ns >> exponent) >= 2 * kSubBuckets)
+		++exponent;
+	size_t bucket = (exponent + 1) * kSubBuckets + static_cast<size_t>((ns >> exponent) - kSubBuckets);
+	return std::min(bucket, kNumBuckets - 1);
+}
+
+uint64_t DurationHistogram::bucketStart(size_t bucket)
+{
+	if (bucket < kSubBuckets)
+		return bucket;
+	size_t exponent = bucket / kSubBuckets - 1;
+	return (kSubBuckets + bucket % kSubBuckets) << exponent;
+}
+
+uint64_t DurationHistogram::bucketWidth(size_t bucket)
+{
+	return bucket < kSubBuckets ? 1 : uint64_t{ 1 } << (bucket / kSubBuckets - 1);
+}
+
+uint64_t DurationHistogram::count() const
+{
+	uint64_t total = 0;
+	for (uint64_t bucketCount : buckets)
+		total += bucketCount;
+	return total;
+}
+
+uint64_t DurationHistogram::percentile(double p) const
+{
+	uint64_t total = count();
+	if (total == 0)
+		return 0;
+
+	// Durations are taken to be spread evenly across their bucket
+	double rank = std::max(0.0, std::min(p, 1.0)) * (total - 1);
+	uint64_t seen = 0;
+	for (size_t i = 0; i < kNumBuckets; ++i)
+	{
+		if (buckets[i] == 0 || seen + buckets[i] <= rank)
+		{
+			seen += buckets[i];
+			continue;
+		}
+		double fraction = (rank - seen + 0.5) / buckets[i];
+		return bucketStart(i) + static_cast<uint64_t>(fraction * bucketWidth(i));
+	}
+	return bucketStart(kNumBuckets - 1) + bucketWidth(kNumBuckets - 1);
+}
+
+double WorkerStats::utilization() const
+{
+	uint64_t measured = busyNs + idleNs;
+	return measured > 0 ? static_cast<double>(busyNs) / measured : 0.0;
+}
+
+WorkerStats WorkerStats::since(const WorkerStats& earlier) const
+{
+	WorkerStats delta;
+	delta.tasksExecuted = tasksExecuted - earlier.tasksExecuted;
+	delta.busyNs = busyNs - earlier.busyNs;
+	delta.idleNs = idleNs - earlier.idleNs;
+	delta.tasksStolen = tasksStolen - earlier.tasksStolen;
+	delta.failedSteals = failedSteals - earlier.failedSteals;
+	delta.stealContention = stealContention - earlier.stealContention;
+	for (size_t i = 0; i < DurationHistogram::kNumBuckets; ++i)
+	{
+		delta.queueLatency.buckets[i] = queueLatency.buckets[i] - earlier.queueLatency.buckets[i];
+		delta.runTime.buckets[i] = runTime.buckets[i] - earlier.runTime.buckets[i];
+	}
+	return delta;
+}
+
+void WorkerStats::merge(const WorkerStats& other)
+{
+	tasksExecuted += other.tasksExecuted;
+	busyNs += other.busyNs;
+	idleNs += other.idleNs;
+	tasksStolen += other.tasksStolen;
+	failedSteals += other.failedSteals;
+	stealContention += other.stealContention;
+	for (size_t i = 0; i < DurationHistogram::kNumBuckets; ++i)
+	{
+		queueLatency.buckets[i] += other.queueLatency.buckets[i];
+		runTime.buckets[i] += other.runTime.buckets[i];
+	}
+}
+
+WorkerStats ThreadPoolStats::total() const
+{
+	WorkerStats sum;
+	for (const WorkerStats& worker : workers)
+		sum.merge(worker);
+	return sum;
+}
+
+ThreadPoolStats ThreadPoolStats::since(const ThreadPoolStats& earlier) const
+{
+	// Threads that didn't exist in the earlier snapshot are compared against zero
+	ThreadPoolStats delta;
+	delta.queueContention = queueContention - std::min(queueContention, earlier.queueContention);
+	for (size_t i = 0; i < workers.size(); ++i)
+		delta.workers.push_back(i < earlier.workers.size() ? workers[i].since(earlier.workers[i]) : workers[i]);
+	return delta;
+}
+
+WorkerStatsSlot::WorkerStatsSlot()
+	: m_tasksExecuted{ 0 }
+	, m_busyNs{ 0 }
+	, m_idleNs{ 0 }
+	, m_tasksStolen{ 0 }
+	, m_failedSteals{ 0 }
+{
+	for (size_t i = 0; i < DurationHistogram::kNumBuckets; ++i)
+	{
+		m_queueLatency[i].store(0, std::memory_order_relaxed);
+		m_runTime[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+void WorkerStatsSlot::addTask(bool hasQueueLatency, uint64_t queueLatencyNs, uint64_t runTimeNs)
+{
+	increase(m_tasksExecuted, 1);
+	if (hasQueueLatency)
+		increase(m_queueLatency[DurationHistogram::bucketOf(queueLatencyNs)], 1);
+	increase(m_runTime[DurationHistogram::bucketOf(runTimeNs)], 1);
+}
+
+void WorkerStatsSlot::addBusy(uint64_t ns)
+{
+	increase(m_busyNs, ns);
+}
+
+void WorkerStatsSlot::addIdle(uint64_t ns)
+{
+	increase(m_idleNs, ns);
+}
+
+void WorkerStatsSlot::addSteal()
+{
+	increase(m_tasksStolen, 1);
+}
+
+void WorkerStatsSlot::addFailedSteal()
+{
+	increase(m_failedSteals, 1);
+}
+
+WorkerStats WorkerStatsSlot::snapshot() const
+{
+	WorkerStats stats;
+	stats.tasksExecuted = m_tasksExecuted.load(std::memory_order_relaxed);
+	stats.busyNs = m_busyNs.load(std::memory_order_relaxed);
+	stats.idleNs = m_idleNs.load(std::memory_order_relaxed);
+	stats.tasksStolen = m_tasksStolen.load(std::memory_order_relaxed);
+	stats.failedSteals = m_failedSteals.load(std::memory_order_relaxed);
+	for (size_t i = 0; i < DurationHistogram::kNumBuckets; ++i)
+	{
+		stats.queueLatency.buckets[i] = m_queueLatency[i].load(std::memory_order_relaxed);
+		stats.runTime.buckets[i] = m_runTime[i].load(std::memory_order_relaxed);
+	}
+	return stats;
+}
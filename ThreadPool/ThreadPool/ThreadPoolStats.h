@@ -0,0 +1,134 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Scheduling statistics collected by each thread of a ThreadPool
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#ifndef THREADPOOLSTATS_H
+#define THREADPOOLSTATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Returns the time in nanoseconds on a clock that never goes backwards
+uint64_t nowNs();
+
+// Counts durations in log-linear buckets: each power of two nanoseconds is split
+// into kSubBuckets equal buckets, so a bucket is at most 1/kSubBuckets of its
+// lower bound wide. Durations under 2 * kSubBuckets ns are counted exactly.
+struct DurationHistogram {
+	static const size_t kSubBucketBits = 3;
+	static const size_t kSubBuckets = size_t{ 1 } << kSubBucketBits;
+	// Enough buckets for durations up to 2^40 ns, the last bucket also counts anything longer
+	static const size_t kNumBuckets = (40 - kSubBucketBits + 1) * kSubBuckets;
+
+	// Returns the bucket a duration falls in
+	static size_t bucketOf(uint64_t ns);
+
+	// Returns the shortest duration counted by a bucket, and how many nanoseconds it spans
+	static uint64_t bucketStart(size_t bucket);
+	static uint64_t bucketWidth(size_t bucket);
+
+	// Returns the total number of durations counted
+	uint64_t count() const;
+
+	// Estimates the duration below which the fraction p of durations fall, by
+	// interpolating within the bucket holding it. Returns 0 if nothing was counted.
+	uint64_t percentile(double p) const;
+
+	uint64_t buckets[kNumBuckets] = {};
+};
+
+// The statistics of a single thread
+struct WorkerStats {
+	// Number of tasks the thread ran, including ones run while waiting on a future
+	uint64_t tasksExecuted = 0;
+	// Time spent running tasks. Tasks run while waiting on a future inside another
+	// task are only counted once.
+	uint64_t busyNs = 0;
+	// Time spent waiting for work to be submitted
+	uint64_t idleNs = 0;
+	// Tasks taken from other threads' deques
+	uint64_t tasksStolen = 0;
+	// Searches of every other thread's deque that found nothing
+	uint64_t failedSteals = 0;
+	// Times a thief lost a race with another thread for an item in this thread's deque
+	uint64_t stealContention = 0;
+	// Time from a task being submitted until it starts
+	DurationHistogram queueLatency;
+	// Time a task takes to run
+	DurationHistogram runTime;
+
+	// Returns the fraction of the measured time the thread was busy
+	double utilization() const;
+
+	// Returns the statistics for the period between an earlier snapshot and this one
+	WorkerStats since(const WorkerStats& earlier) const;
+
+	// Adds another thread's statistics to these
+	void merge(const WorkerStats& other);
+};
+
+// A snapshot of a ThreadPool's statistics
+struct ThreadPoolStats {
+	// Per thread statistics, indexed by threadId - 1
+	std::vector<WorkerStats> workers;
+	// Times a thread had to wait for the lock of a shared work queue
+	uint64_t queueContention = 0;
+
+	// Returns every thread's statistics added together
+	WorkerStats total() const;
+
+	// Returns the statistics for the period between an earlier snapshot and this one
+	ThreadPoolStats since(const ThreadPoolStats& earlier) const;
+};
+
+// The live statistics of one thread. Only the owning thread writes to it, so
+// counters are updated without read-modify-write instructions, and any thread
+// can take a snapshot without locking. Padded to a cache line so threads
+// updating their own slots don't slow each other down.
+class alignas(64) WorkerStatsSlot
+{
+public:
+	WorkerStatsSlot();
+
+	// The WorkerStatsSlot is non-copyable.
+	WorkerStatsSlot(const WorkerStatsSlot&) = delete;
+	WorkerStatsSlot& operator= (const WorkerStatsSlot&) = delete;
+
+	// Records a task that ran. queueLatencyNs is ignored if hasQueueLatency is false.
+	void addTask(bool hasQueueLatency, uint64_t queueLatencyNs, uint64_t runTimeNs);
+	void addBusy(uint64_t ns);
+	void addIdle(uint64_t ns);
+	void addSteal();
+	void addFailedSteal();
+
+	// Copies the counters, safe to call from any thread
+	WorkerStats snapshot() const;
+
+private:
+	// Only the owning thread writes, so a plain load and store is enough
+	static void increase(std::atomic<uint64_t>& counter, uint64_t amount)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	std::atomic<uint64_t> m_tasksExecuted;
+	std::atomic<uint64_t> m_busyNs;
+	std::atomic<uint64_t> m_idleNs;
+	std::atomic<uint64_t> m_tasksStolen;
+	std::atomic<uint64_t> m_failedSteals;
+	std::atomic<uint64_t> m_queueLatency[DurationHistogram::kNumBuckets];
+	std::atomic<uint64_t> m_runTime[DurationHistogram::kNumBuckets];
+};
+
+#endif
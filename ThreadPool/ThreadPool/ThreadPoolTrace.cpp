@@ -0,0 +1,132 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Records when each task of a ThreadPool was submitted and run,
+//                and writes the records as a Chrome trace event file.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+//Library Includes
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+
+//This Include
+#include "ThreadPoolTrace.h"
+
+namespace {
+	// Writes a string as a JSON string literal
+	void writeJsonString(std::ofstream& file, const char* text)
+	{
+		file << '"';
+		for (const char* c = text; *c != '\0'; ++c)
+		{
+			if (*c == '"' || *c == '\\')
+			{
+				file << '\\' << *c;
+			}
+			else if (static_cast<unsigned char>(*c) < 0x20)
+			{
+				char escaped[8];
+				std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned int>(*c));
+				file << escaped;
+			}
+			else
+			{
+				file << *c;
+			}
+		}
+		file << '"';
+	}
+
+	// Converts a time to the microseconds used by trace files
+	double toTraceTime(uint64_t ns, uint64_t epochNs)
+	{
+		return ns >= epochNs ? (ns - epochNs) / 1000.0 : -((epochNs - ns) / 1000.0);
+	}
+}
+
+void TraceBuffer::reserve(size_t capacity)
+{
+	if (m_events)
+		return;
+	size_t powerOfTwo = 1;
+	while (powerOfTwo < capacity)
+		powerOfTwo <<= 1;
+	m_events = std::make_unique<TraceEvent[]>(powerOfTwo);
+	m_mask = powerOfTwo - 1;
+}
+
+void TraceBuffer::push(const TraceEvent& event)
+{
+	size_t head = m_head.load(std::memory_order_relaxed);
+	if (head - m_tail.load(std::memory_order_acquire) > m_mask)
+	{
+		m_numDropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	m_events[head & m_mask] = event;
+	m_head.store(head + 1, std::memory_order_release);
+}
+
+void TraceBuffer::drain(std::vector<TraceEvent>& events)
+{
+	size_t tail = m_tail.load(std::memory_order_relaxed);
+	size_t head = m_head.load(std::memory_order_acquire);
+	for (; tail != head; ++tail)
+		events.push_back(m_events[tail & m_mask]);
+	m_tail.store(tail, std::memory_order_release);
+}
+
+size_t TraceBuffer::numDropped() const
+{
+	return m_numDropped.load(std::memory_order_relaxed);
+}
+
+bool writeChromeTrace(const std::string& path, const std::vector<std::pair<size_t, std::vector<TraceEvent>>>& threads,
+                      uint64_t epochNs)
+{
+	std::ofstream file(path);
+	if (!file)
+		return false;
+
+	// Microseconds with nanosecond precision, never in scientific notation
+	file << std::fixed << std::setprecision(3);
+	file << "{\"traceEvents\":[\n";
+	bool first = true;
+	for (const auto& thread : threads)
+	{
+		size_t threadId = thread.first;
+		if (!first)
+			file << ",\n";
+		first = false;
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << threadId
+		     << ",\"args\":{\"name\":\"Thread " << threadId << "\"}}";
+
+		for (const TraceEvent& event : thread.second)
+		{
+			// One complete event per task, the queue times are in its arguments
+			file << ",\n{\"name\":";
+			writeJsonString(file, event.label[0] != '\0' ? event.label : "Task");
+			file << ",\"cat\":\"task\",\"ph\":\"X\",\"pid\":1,\"tid\":" << threadId
+			     << ",\"ts\":" << toTraceTime(event.beginNs, epochNs)
+			     << ",\"dur\":" << (event.endNs - event.beginNs) / 1000.0
+			     << ",\"args\":{\"dequeueUs\":" << toTraceTime(event.dequeueNs, epochNs)
+			     << ",\"heldUs\":" << (event.beginNs - event.dequeueNs) / 1000.0;
+			if (event.submitNs != 0)
+			{
+				file << ",\"submitUs\":" << toTraceTime(event.submitNs, epochNs)
+				     << ",\"queuedUs\":" << (event.dequeueNs - event.submitNs) / 1000.0;
+			}
+			file << "}}";
+		}
+	}
+	file << "\n]}\n";
+	return static_cast<bool>(file);
+}
@@ -0,0 +1,79 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : Records when each task of a ThreadPool was submitted and run,
+//                and writes the records as a Chrome trace event file.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#ifndef THREADPOOLTRACE_H
+#define THREADPOOLTRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The lifetime of a single task, times are in nanoseconds from nowNs()
+struct TraceEvent {
+	static const size_t kLabelSize = 40;
+
+	// 0 if the task was queued before tracing started
+	uint64_t submitNs = 0;
+	// When the task was taken from its queue, earlier than beginNs if it was taken in bulk
+	uint64_t dequeueNs = 0;
+	uint64_t beginNs = 0;
+	uint64_t endNs = 0;
+	// Set by the task with ThreadPool::setTaskLabel, empty if it didn't
+	char label[kLabelSize] = {};
+};
+
+// A ring buffer of events recorded by one thread and read by another.
+// Neither side locks. Events recorded while the buffer is full are dropped.
+class TraceBuffer
+{
+public:
+	TraceBuffer() {}
+
+	// The TraceBuffer is non-copyable.
+	TraceBuffer(const TraceBuffer&) = delete;
+	TraceBuffer& operator= (const TraceBuffer&) = delete;
+
+	// Allocates room for at least capacity events, if the buffer hasn't been already.
+	// Must not be called while the buffer is being used.
+	void reserve(size_t capacity);
+
+	// Adds an event. Only called by the thread that owns the buffer.
+	void push(const TraceEvent& event);
+
+	// Moves every event into events. Only one thread may drain at a time.
+	void drain(std::vector<TraceEvent>& events);
+
+	// Returns the number of events dropped because the buffer was full
+	size_t numDropped() const;
+
+private:
+	std::unique_ptr<TraceEvent[]> m_events;
+	size_t m_mask = 0;
+	// Written by the owner and the reader respectively, keep them on separate cache lines
+	alignas(64) std::atomic<size_t> m_head{ 0 };
+	alignas(64) std::atomic<size_t> m_tail{ 0 };
+	std::atomic<size_t> m_numDropped{ 0 };
+};
+
+// Writes events to a JSON file in the Chrome trace event format, which can be
+// opened in chrome://tracing or ui.perfetto.dev. Each element of threads is a
+// thread ID and its events, times are written relative to epochNs.
+// Returns false if the file couldn't be written.
+bool writeChromeTrace(const std::string& path, const std::vector<std::pair<size_t, std::vector<TraceEvent>>>& threads,
+                      uint64_t epochNs);
+
+#endif
@@ -0,0 +1,259 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : A hierarchical timer wheel holding tasks until their deadline
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+//Library Includes
+#include <algorithm>
+#include <new>
+
+//Local Includes
+#include "BlockAllocator.h"
+#include "ThreadPoolStats.h"
+
+//This Include
+#include "TimerWheel.h"
+
+const uint64_t TimerWheel::kDefaultTickNs;
+const uint64_t TimerWheel::kNoDeadline;
+const uint64_t TimerWheel::kMaxDelta;
+const uint64_t TimerWheel::kSweepInterval;
+
+struct TimerWheel::Timer {
+	uint64_t deadlineTick;
+	Task task;
+	CancellationToken token;
+	Timer* next;
+};
+
+TimerWheel::TimerWheel(uint64_t tickNs)
+	: m_tickNs(std::max<uint64_t>(tickNs, 1))
+{
+}
+
+TimerWheel::~TimerWheel()
+{
+	clear();
+}
+
+bool TimerWheel::add(uint64_t deadlineNs, Task&& task, CancellationToken token)
+{
+	// Rounded up so the timer can't be released before its deadline
+	uint64_t deadlineTick = deadlineNs / m_tickNs + (deadlineNs % m_tickNs != 0 ? 1 : 0);
+	Timer* timer = new (BlockAllocator::allocate(sizeof(Timer))) Timer{ deadlineTick, std::move(task), token, nullptr };
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	// An empty wheel has nothing to catch up on, so it starts again from now
+	if (m_size.load(std::memory_order_relaxed) == 0)
+		m_currentTick = std::max(m_currentTick, nowNs() / m_tickNs);
+
+	uint64_t oldNextTick = m_nextTick;
+	if (token.canBeCancelled() && m_numCancellable++ == 0)
+	{
+		m_sweepTick = m_currentTick + kSweepInterval;
+		m_nextTick = std::min(m_nextTick, m_sweepTick);
+	}
+	insert(timer);
+	m_size.fetch_add(1, std::memory_order_relaxed);
+	publishNextDeadline();
+	return m_nextTick < oldNextTick;
+}
+
+bool TimerWheel::advance(uint64_t nowNs, std::vector<Task>& expired)
+{
+	std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+	if (!lock.owns_lock())
+		return false;
+
+	uint64_t nowTick = nowNs / m_tickNs;
+	while (m_nextTick <= nowTick)
+	{
+		// Nothing happens on the ticks in between, so they are skipped
+		m_currentTick = m_nextTick;
+		processTick(expired);
+		if (m_numCancellable > 0 && m_sweepTick <= m_currentTick)
+			sweep(expired);
+		++m_currentTick;
+		updateNextTick();
+	}
+	if (m_currentTick <= nowTick)
+	{
+		m_currentTick = nowTick + 1;
+		updateNextTick();
+	}
+	return true;
+}
+
+void TimerWheel::clear()
+{
+	std::vector<Task> cancelled;
+	clear(cancelled);
+}
+
+void TimerWheel::clear(std::vector<Task>& cancelled)
+{
+	// Destroying a task can run continuations that add timers, so it is done outside the lock
+	Timer* timers = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t level = 0; level < kNumLevels; ++level)
+		{
+			for (size_t slot = 0; slot < kNumSlots; ++slot)
+			{
+				Timer* timer = m_slots[level][slot];
+				m_slots[level][slot] = nullptr;
+				while (timer)
+				{
+					Timer* next = timer->next;
+					timer->next = timers;
+					timers = timer;
+					timer = next;
+				}
+			}
+		}
+		m_size.store(0, std::memory_order_relaxed);
+		m_numCancellable = 0;
+		m_nextTick = kNoDeadline;
+		publishNextDeadline();
+	}
+
+	while (timers)
+	{
+		Timer* next = timers->next;
+		if (timers->token.isCancelled())
+			cancelled.push_back(std::move(timers->task));
+		timers->~Timer();
+		BlockAllocator::deallocate(timers);
+		timers = next;
+	}
+}
+
+void TimerWheel::insert(Timer* timer)
+{
+	uint64_t delta = timer->deadlineTick > m_currentTick ? timer->deadlineTick - m_currentTick : 0;
+	delta = std::min(delta, kMaxDelta);
+
+	// Each level's slots are 64 times as long as the level below
+	size_t level = 0;
+	while (level + 1 < kNumLevels && delta >> (kSlotBits * (level + 1)) != 0)
+		++level;
+	size_t slot = static_cast<size_t>(((m_currentTick + delta) >> (kSlotBits * level)) & (kNumSlots - 1));
+
+	timer->next = m_slots[level][slot];
+	m_slots[level][slot] = timer;
+	m_nextTick = std::min(m_nextTick, slotTick(level, slot));
+}
+
+void TimerWheel::cascade(size_t level, size_t slot, std::vector<Task>& expired)
+{
+	Timer* timer = m_slots[level][slot];
+	m_slots[level][slot] = nullptr;
+	while (timer)
+	{
+		Timer* next = timer->next;
+		if (timer->token.isCancelled())
+			release(timer, expired);
+		else
+			insert(timer);
+		timer = next;
+	}
+}
+
+void TimerWheel::processTick(std::vector<Task>& expired)
+{
+	// A higher level slot is moved down when every level below it wraps around
+	for (size_t level = 1; level < kNumLevels; ++level)
+	{
+		size_t shift = kSlotBits * level;
+		if ((m_currentTick & ((uint64_t{ 1 } << shift) - 1)) != 0)
+			break;
+		cascade(level, static_cast<size_t>((m_currentTick >> shift) & (kNumSlots - 1)), expired);
+	}
+
+	size_t slot = static_cast<size_t>(m_currentTick & (kNumSlots - 1));
+	Timer* timer = m_slots[0][slot];
+	m_slots[0][slot] = nullptr;
+	while (timer)
+	{
+		Timer* next = timer->next;
+		if (timer->deadlineTick <= m_currentTick || timer->token.isCancelled())
+			release(timer, expired);
+		else
+			insert(timer);
+		timer = next;
+	}
+}
+
+void TimerWheel::sweep(std::vector<Task>& expired)
+{
+	for (size_t level = 1; level < kNumLevels; ++level)
+	{
+		Timer** link = &m_slots[level][m_sweepSlot];
+		while (*link)
+		{
+			Timer* timer = *link;
+			if (timer->token.isCancelled())
+			{
+				*link = timer->next;
+				release(timer, expired);
+			}
+			else
+			{
+				link = &timer->next;
+			}
+		}
+	}
+	m_sweepSlot = (m_sweepSlot + 1) & (kNumSlots - 1);
+	m_sweepTick = m_currentTick + kSweepInterval;
+}
+
+void TimerWheel::release(Timer* timer, std::vector<Task>& expired)
+{
+	if (timer->token.canBeCancelled())
+		--m_numCancellable;
+	expired.push_back(std::move(timer->task));
+	timer->~Timer();
+	BlockAllocator::deallocate(timer);
+	m_size.fetch_sub(1, std::memory_order_relaxed);
+}
+
+uint64_t TimerWheel::slotTick(size_t level, size_t slot) const
+{
+	size_t shift = kSlotBits * level;
+	uint64_t blockStart = (m_currentTick >> shift) << shift;
+	uint64_t distance = (slot - ((m_currentTick >> shift) & (kNumSlots - 1))) & (kNumSlots - 1);
+	// The current slot of a higher level was processed when its block started,
+	// unless the current tick is that start. Timers put in it since wait a full turn.
+	if (distance == 0 && blockStart != m_currentTick)
+		distance = kNumSlots;
+	return blockStart + (distance << shift);
+}
+
+void TimerWheel::updateNextTick()
+{
+	m_nextTick = kNoDeadline;
+	for (size_t level = 0; level < kNumLevels; ++level)
+	{
+		for (size_t slot = 0; slot < kNumSlots; ++slot)
+		{
+			if (m_slots[level][slot])
+				m_nextTick = std::min(m_nextTick, slotTick(level, slot));
+		}
+	}
+	if (m_numCancellable > 0)
+		m_nextTick = std::min(m_nextTick, std::max(m_sweepTick, m_currentTick));
+	publishNextDeadline();
+}
+
+void TimerWheel::publishNextDeadline()
+{
+	m_nextDeadline.store(m_nextTick == kNoDeadline ? kNoDeadline : m_nextTick * m_tickNs, std::memory_order_release);
+}
@@ -0,0 +1,142 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : A hierarchical timer wheel holding tasks until their deadline.
+//                Adding a timer and expiring it are constant time, so it scales
+//                to hundreds of thousands of timers. Nothing runs on its own,
+//                whoever owns the wheel calls advance to collect due tasks.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include "Cancellation.h"
+#include "Task.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Times are in nanoseconds from nowNs(), rounded up to whole ticks so a timer
+// never expires early. The wheel has 4 levels of 64 slots, a timer is kept in
+// the coarsest level that fits and moved down a level each time its slot comes up.
+class TimerWheel
+{
+public:
+	explicit TimerWheel(uint64_t tickNs = kDefaultTickNs);
+	~TimerWheel();
+
+	// The TimerWheel is non-copyable.
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator= (const TimerWheel&) = delete;
+
+	// Adds a timer that releases task once deadlineNs has passed. If the token is
+	// cancelled the task is released early, within about a second.
+	// Returns true if the timer is now the earliest, so threads sleeping until the
+	// old earliest deadline need waking.
+	bool add(uint64_t deadlineNs, Task&& task, CancellationToken token = {});
+
+	// Moves the tasks of every timer due at nowNs to the end of expired, along with
+	// cancelled timers found on the way. Returns false without doing anything if
+	// another thread is already advancing the wheel.
+	bool advance(uint64_t nowNs, std::vector<Task>& expired);
+
+	// Returns the earliest time advance could release a task, kNoDeadline if there
+	// are no timers. A single atomic load, safe to call from any thread.
+	uint64_t nextDeadline() const;
+
+	// Returns true if there are no timers
+	bool empty() const;
+
+	// Returns the number of timers
+	size_t size() const;
+
+	// Destroys every timer without running its task
+	void clear();
+
+	// As clear, but the tasks of timers whose token is cancelled are moved to the end
+	// of cancelled instead, so they can still run and see the token
+	void clear(std::vector<Task>& cancelled);
+
+	// One millisecond
+	static const uint64_t kDefaultTickNs = 1000000;
+
+	static const uint64_t kNoDeadline = UINT64_MAX;
+
+private:
+	struct Timer;
+
+	static const size_t kSlotBits = 6;
+	static const size_t kNumSlots = size_t{ 1 } << kSlotBits;
+	static const size_t kNumLevels = 4;
+	// Timers further away than this are parked in the last level until they come closer
+	static const uint64_t kMaxDelta = (uint64_t{ 1 } << (kSlotBits * kNumLevels)) - 1;
+	// Ticks between sweeps for cancelled timers. Each sweep checks one slot of every
+	// level above the first, so every slot is checked once every 64 sweeps.
+	static const uint64_t kSweepInterval = 16;
+
+	// Puts a timer in the slot for its deadline relative to the current tick
+	void insert(Timer* timer);
+
+	// Moves every timer in a slot down to the level that now fits it
+	void cascade(size_t level, size_t slot, std::vector<Task>& expired);
+
+	// Releases the timers of the current tick, after cascading any higher slots starting on it
+	void processTick(std::vector<Task>& expired);
+
+	// Releases cancelled timers from the next slot of each level above the first.
+	// The first level's timers are all released within a turn of the wheel anyway.
+	void sweep(std::vector<Task>& expired);
+
+	// Hands a timer's task over and destroys the timer
+	void release(Timer* timer, std::vector<Task>& expired);
+
+	// Returns the tick at which a slot is next processed
+	uint64_t slotTick(size_t level, size_t slot) const;
+
+	// Finds the earliest non-empty slot and publishes when it is due
+	void updateNextTick();
+
+	void publishNextDeadline();
+
+	uint64_t m_tickNs;
+	// The next tick to process, every earlier tick has been processed
+	uint64_t m_currentTick = 0;
+	// The earliest tick with a slot to process, exact so empty ticks can be skipped
+	uint64_t m_nextTick = kNoDeadline;
+	Timer* m_slots[kNumLevels][kNumSlots] = {};
+
+	// Timers whose token can be cancelled, sweeps only happen while there are some
+	size_t m_numCancellable = 0;
+	uint64_t m_sweepTick = 0;
+	size_t m_sweepSlot = 0;
+
+	std::atomic<uint64_t> m_nextDeadline{ kNoDeadline };
+	std::atomic<size_t> m_size{ 0 };
+	std::mutex m_mutex;
+};
+
+inline uint64_t TimerWheel::nextDeadline() const
+{
+	return m_nextDeadline.load(std::memory_order_acquire);
+}
+
+inline bool TimerWheel::empty() const
+{
+	return m_size.load(std::memory_order_relaxed) == 0;
+}
+
+inline size_t TimerWheel::size() const
+{
+	return m_size.load(std::memory_order_relaxed);
+}
+
+#endif
@@ -79,7 +79,7 @@ IntT randomInt(IntT min = 0, IntT max = 1)
 template<typename Iter, typename RandomGenerator>
 Iter selectRandomly(Iter start, Iter end, RandomGenerator& g)
 {
-	std::uniform_int_distribution<std::_Iter_diff_t<Iter>> dist(0, std::distance(start, end) - 1);
+	std::uniform_int_distribution<typename std::iterator_traits<Iter>::difference_type> dist(0, std::distance(start, end) - 1);
 	std::advance(start, dist(g));
 	return start;
 }
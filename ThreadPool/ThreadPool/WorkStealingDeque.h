@@ -0,0 +1,216 @@
+//
+// Bachelor of Software Engineering
+// Media Design School
+// Auckland
+// New Zealand
+//
+// (c) 2017 Media Design School
+//
+// Description  : A lock free Chase-Lev work stealing deque.
+//                The owning thread pushes and pops at the bottom of the deque,
+//                any other thread may steal from the top.
+// Author       : Lance Chaney
+// Mail         : lance.cha7337@mediadesign.school.nz
+//
+
+#ifndef WORKSTEALINGDEQUE_H
+#define WORKSTEALINGDEQUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+template<typename T>
+class WorkStealingDeque
+{
+	// Items are read speculatively by thieves before they are claimed, so they
+	// must be safe to copy while another thread overwrites them.
+	static_assert(std::is_trivially_copyable<T>::value, "WorkStealingDeque items must be trivially copyable");
+
+public:
+	// capacity is rounded up to a power of two. The deque grows as needed.
+	explicit WorkStealingDeque(size_t capacity = 256);
+	~WorkStealingDeque();
+
+	// The WorkStealingDeque is non-copyable.
+	WorkStealingDeque(const WorkStealingDeque&) = delete;
+	WorkStealingDeque& operator= (const WorkStealingDeque&) = delete;
+
+	// Pushes an item onto the bottom of the deque.
+	// Must only be called by the owning thread.
+	void push(T item);
+
+	// Pops an item from the bottom of the deque (LIFO order).
+	// Returns false if the deque is empty.
+	// Must only be called by the owning thread.
+	bool pop(T& item);
+
+	// Steals an item from the top of the deque (FIFO order).
+	// Returns false if the deque is empty or the steal lost a race with
+	// another thread.
+	// Safe to call from any thread.
+	bool steal(T& item);
+
+	// Checks if the deque is empty or not
+	bool empty() const;
+
+	// Returns the approximate number of items in the deque
+	size_t size() const;
+
+	// Returns the number of times a steal lost a race with another thread
+	size_t numLostRaces() const;
+
+private:
+	// A circular array of atomic slots
+	class Buffer
+	{
+	public:
+		explicit Buffer(size_t capacity)
+			: m_capacity{ capacity }
+			, m_mask{ capacity - 1 }
+			, m_items{ new std::atomic<T>[capacity] }
+		{
+		}
+
+		size_t capacity() const { return m_capacity; }
+
+		T get(int64_t i) const
+		{
+			return m_items[static_cast<size_t>(i) & m_mask].load(std::memory_order_relaxed);
+		}
+
+		void put(int64_t i, T item)
+		{
+			m_items[static_cast<size_t>(i) & m_mask].store(item, std::memory_order_relaxed);
+		}
+
+		// Returns a buffer of twice the size containing the items in [top, bottom)
+		Buffer* grow(int64_t bottom, int64_t top) const
+		{
+			Buffer* buffer = new Buffer(m_capacity * 2);
+			for (int64_t i = top; i != bottom; ++i)
+				buffer->put(i, get(i));
+			return buffer;
+		}
+
+	private:
+		size_t m_capacity;
+		size_t m_mask;
+		std::unique_ptr<std::atomic<T>[]> m_items;
+	};
+
+	// Top and bottom are written by different threads, keep them on separate cache lines
+	alignas(64) std::atomic<int64_t> m_top{ 0 };
+	// Only written by thieves that lost a race for m_top, so it shares its cache line
+	std::atomic<size_t> m_numLostRaces{ 0 };
+	alignas(64) std::atomic<int64_t> m_bottom{ 0 };
+	std::atomic<Buffer*> m_buffer;
+
+	// Buffers replaced by grow() may still be read by thieves, so they are
+	// kept alive until the deque is destroyed. Only touched by the owner.
+	std::vector<std::unique_ptr<Buffer>> m_retiredBuffers;
+};
+
+template<typename T>
+inline WorkStealingDeque<T>::WorkStealingDeque(size_t capacity)
+{
+	size_t powerOfTwo = 1;
+	while (powerOfTwo < capacity)
+		powerOfTwo <<= 1;
+	m_buffer.store(new Buffer(powerOfTwo), std::memory_order_relaxed);
+}
+
+template<typename T>
+inline WorkStealingDeque<T>::~WorkStealingDeque()
+{
+	delete m_buffer.load(std::memory_order_relaxed);
+}
+
+template<typename T>
+inline void WorkStealingDeque<T>::push(T item)
+{
+	int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+	int64_t top = m_top.load(std::memory_order_acquire);
+	Buffer* buffer = m_buffer.load(std::memory_order_relaxed);
+
+	// Grow when full
+	if (bottom - top > static_cast<int64_t>(buffer->capacity()) - 1) {
+		Buffer* bigger = buffer->grow(bottom, top);
+		m_retiredBuffers.emplace_back(buffer);
+		m_buffer.store(bigger, std::memory_order_release);
+		buffer = bigger;
+	}
+
+	buffer->put(bottom, item);
+	m_bottom.store(bottom + 1, std::memory_order_release);
+}
+
+template<typename T>
+inline bool WorkStealingDeque<T>::pop(T& item)
+{
+	int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+	Buffer* buffer = m_buffer.load(std::memory_order_relaxed);
+	m_bottom.store(bottom, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t top = m_top.load(std::memory_order_relaxed);
+
+	// Deque was empty, restore bottom
+	if (top > bottom) {
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return false;
+	}
+
+	item = buffer->get(bottom);
+	if (top == bottom) {
+		// Last item, race thieves for it
+		bool won = m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return won;
+	}
+	return true;
+}
+
+template<typename T>
+inline bool WorkStealingDeque<T>::steal(T& item)
+{
+	int64_t top = m_top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t bottom = m_bottom.load(std::memory_order_acquire);
+
+	if (top >= bottom)
+		return false;
+
+	Buffer* buffer = m_buffer.load(std::memory_order_acquire);
+	T stolen = buffer->get(top);
+	if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+		m_numLostRaces.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	item = stolen;
+	return true;
+}
+
+template<typename T>
+inline size_t WorkStealingDeque<T>::numLostRaces() const
+{
+	return m_numLostRaces.load(std::memory_order_relaxed);
+}
+
+template<typename T>
+inline bool WorkStealingDeque<T>::empty() const
+{
+	return size() == 0;
+}
+
+template<typename T>
+inline size_t WorkStealingDeque<T>::size() const
+{
+	int64_t bottom = m_bottom.load(std::memory_order_seq_cst);
+	int64_t top = m_top.load(std::memory_order_seq_cst);
+	return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+}
+
+#endif
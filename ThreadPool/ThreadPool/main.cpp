@@ -22,6 +22,9 @@
 #include "GLUtils.h"
 #include "Utils.h"
 #include "INIParser.h"
+#include "FractalKernel.h"
+#include "QuadDouble.h"
+#include "ReferenceOrbit.h"
 
 #include <glad\glad.h>
 #include <GLFW\glfw3.h>
@@ -35,10 +38,10 @@
 #include <thread>
 #include <chrono>
 #include <functional>
-#include <complex>
 #include <cmath>
 #include <vector>
-//#include <mutex>
+#include <algorithm>
+#include <mutex>
 //#include <vld.h>
 
 using glm::mat4;
@@ -72,12 +75,50 @@ size_t g_kRegionHeight = g_kPixelsVert / g_regionsVert;
 
 bool g_fractalRenderRequest = false;
 double g_fractalZoomAmount = 1;
-double g_fractalCenterRe = -0.5;
-double g_fractalCenterIm = 0;
+// Kept in quad-double, more precise than any precision pixels are calculated in,
+// so deep zooms can still find their way to the center
+QuadDouble g_fractalCenterRe = -0.5;
+QuadDouble g_fractalCenterIm = 0;
+// The iteration depth of the current view, for the overlay
 size_t g_fractalRecursionDepth = g_fractalInitialDepth;
-
-NDArray<GLubyte, g_kPixelsVert, g_kPixelsHoriz, 3> g_textureData;
-std::vector<std::future<void>> g_futures;
+FractalKernelType g_fractalKernel = FractalKernelType::Scalar;
+FractalPrecision g_fractalPrecision = FractalPrecision::Double;
+bool g_fractalPerturbation = true;
+bool g_fractalBulbCheck = true;
+bool g_fractalPeriodicityCheck = true;
+bool g_fractalSubdivision = false;
+bool g_fractalProgressive = true;
+// Whether the current view is rendered with perturbation, and the iterations its series skips
+bool g_fractalPerturbing = false;
+std::atomic<uint32_t> g_fractalSeriesIterations{ 0 };
+// Iterations the current view skipped inside the bulbs and on periodic orbits
+std::atomic<uint64_t> g_fractalBulbIterations{ 0 };
+std::atomic<uint64_t> g_fractalPeriodicIterations{ 0 };
+// Set as each pass of a progressive view finishes, and the time the first one took in seconds
+std::atomic<bool> g_fractalPassReady{ false };
+std::atomic<double> g_fractalFirstPassTime{ 0 };
+
+using TextureData = NDArray<GLubyte, g_kPixelsVert, g_kPixelsHoriz, 3>;
+// Each pass of a progressive view draws into the buffer that isn't shown, and the two swap
+// when it finishes. Views in a single pass draw into the shown buffer, to show their progress.
+TextureData g_textureData[2];
+// The buffer the render loop uploads, guarded by g_fractalPassMutex
+size_t g_fractalShownTexture = 0;
+std::mutex g_fractalPassMutex;
+// The iteration each pixel escaped on, so subdivision can compare the pixels of a border
+NDArray<uint32_t, g_kPixelsVert, g_kPixelsHoriz> g_fractalIterations;
+// How often the thread stats are updated
+const auto g_kStatsInterval = std::chrono::milliseconds(500);
+
+// Becomes ready with the calculation time, in seconds, once the current view is finished.
+// A cancelled view's timer becomes ready once its regions have stopped, without a time.
+Future<double> g_fractalTimer;
+
+// Set by pressing T, the tasks traced since the last press are written to a
+// numbered copy of g_traceFile. The rest are written to g_traceFile on exit.
+bool g_traceRequest = false;
+size_t g_traceSnapshots = 0;
+std::string g_traceFile;
 
 // Callback for handling glfw errors
 void errorCallback(int error, const char* description)
@@ -90,6 +131,8 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 {
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, GLFW_TRUE);
+	if (key == GLFW_KEY_T && action == GLFW_PRESS)
+		g_traceRequest = true;
 }
 
 // Handles zooming in and out of the mandelbrot fractal
@@ -109,10 +152,8 @@ void scrollCallback(GLFWwindow* window, double xoffset, double yoffset)
 	// Calculate current cursor position in the fractals current domain.
 	// Set it to be the new fractal center position.
 	double range = g_kFractalDomainRange / g_fractalZoomAmount;
-	double minRe = g_fractalCenterRe - range / 2;
-	double minIm = g_fractalCenterIm - range / 2;
-	g_fractalCenterRe = minRe + xpos / (g_kPixelsHoriz - 1) * range;
-	g_fractalCenterIm = minIm + ypos / (g_kPixelsVert - 1) * range;
+	g_fractalCenterRe += (xpos / (g_kPixelsHoriz - 1) - 0.5) * range;
+	g_fractalCenterIm += (ypos / (g_kPixelsVert - 1) - 0.5) * range;
 
 	// Increase zoom
 	if (yoffset > 0)
@@ -275,7 +316,8 @@ void init(GLFWwindow*& window, NVGcontext*& nvgCtx, GLuint& program, GLuint& VAO
 }
 
 // Send the current version of the mandelbrot from the CPU to the GPU texture
-void updateTexture(GLuint texture, size_t regionStartX, size_t regionStartY, size_t regionWidth, size_t regionHeight)
+void updateTexture(GLuint texture, const TextureData& textureData
+                  , size_t regionStartX, size_t regionStartY, size_t regionWidth, size_t regionHeight)
 {
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, texture);
@@ -286,103 +328,752 @@ void updateTexture(GLuint texture, size_t regionStartX, size_t regionStartY, siz
 	                static_cast<GLint>(regionStartX), static_cast<GLint>(regionStartY),
 	                static_cast<GLsizei>(regionWidth), static_cast<GLsizei>(regionHeight),
 	                GL_RGB, GL_UNSIGNED_BYTE, 
-	                &g_textureData[regionStartY][regionStartX][0]);
+	                &textureData[regionStartY][regionStartX][0]);
 }
 
-// Calculate the pixel colors for a region of the mandelbrot fractal
-void processRegion(GLuint texture, size_t regionStartX, size_t regionStartY
-                  , size_t width, size_t height)
+// Returns the iterations to do before assuming a pixel is in the set, more as the view zooms in
+size_t iterationDepth(double zoomAmount)
 {
-	g_fractalRecursionDepth = g_fractalInitialDepth + static_cast<size_t>(
-	                          (std::log(M_E + std::max(0.0, g_fractalZoomAmount - 1)) - 1)
-	                        * g_fractalZoomSensitivity * g_fractalDepthIncrement);
+	return g_fractalInitialDepth + static_cast<size_t>(
+	       (std::log(M_E + std::max(0.0, zoomAmount - 1)) - 1)
+	     * g_fractalZoomSensitivity * g_fractalDepthIncrement);
+}
 
-	size_t regionEndY = regionStartY + height;
-	size_t regionEndX = regionStartX + width;
-	for (size_t i = regionStartY; i < regionEndY && i < g_textureData.size(); ++i)
+// The part of the plane a view shows and the iterations done before assuming a pixel is
+// in the set. Taken once when the view starts, as scrolling changes the globals it comes
+// from while the view's regions are still being calculated.
+struct FractalView {
+	QuadDouble centerRe;
+	QuadDouble centerIm;
+	double range;
+	uint32_t depth;
+};
+
+// Colors pixels [startX, endX) of a row of the texture by the iteration they escaped on, out of depth
+void colorRow(TextureData& texture, size_t row, size_t startX, size_t endX, const uint32_t* iterations, uint32_t depth)
+{
+	for (size_t j = startX; j < endX; ++j)
 	{
-		for (size_t j = regionStartX; j < regionEndX && j < g_textureData[i].size(); ++j)
-		{
-			// Convert from pixel coordinates (integers) to domain of the mandelbrot set 
-			// being calculated (complex numbers in range [minRe, maxRe]x[minIm, maxIm])
-			double range = g_kFractalDomainRange / g_fractalZoomAmount;
-			double minRe = g_fractalCenterRe - range / 2;
-			double minIm = g_fractalCenterIm - range / 2;
-			double real = minRe + static_cast<double>(j) / (g_kPixelsHoriz - 1) * range;
-			double img = minIm + static_cast<double>(i) / (g_kPixelsVert - 1) * range;
-			std::complex<double> c = {real, img};
-			std::complex<double> z = 0;
-			double norm = 0;
-			bool diverges = false;
-			size_t iteration = 0;
-			for (iteration = 1; iteration <= g_fractalRecursionDepth; ++iteration) {
-
-				z = std::pow(z, 2) + c;
-
-				norm = std::norm(z);
-				if (norm > 4) {
-					diverges = true;
-					break;
-				}
-			}
+		size_t iteration = iterations[j - startX];
+		bool diverges = iteration <= depth;
+		double alpha = 2 * static_cast<double>(iteration) / depth;
+		
+		texture[row][j][0] = 0;
+		texture[row][j][1] = diverges ? lerp(GLubyte{ 0 }, GLubyte{ 255 }, alpha) : 0;
+		texture[row][j][2] = diverges ? lerp(GLubyte{ 0 }, GLubyte{ 255 }, alpha) : 0;
+	}
+}
+
+// Rounds a coordinate to the precision a region is calculated in
+template<typename Real>
+Real toPrecision(const QuadDouble& value)
+{
+	return static_cast<Real>(static_cast<double>(value));
+}
+
+template<>
+DoubleDouble toPrecision<DoubleDouble>(const QuadDouble& value)
+{
+	return static_cast<DoubleDouble>(value);
+}
+
+#if FRACTAL_HAS_QUAD
+// A quad has 113 bits, which the first three parts more than cover
+template<>
+__float128 toPrecision<__float128>(const QuadDouble& value)
+{
+	return static_cast<__float128>(value.part[0]) + (static_cast<__float128>(value.part[1]) + value.part[2]);
+}
+#endif
+
+// Returns the shortcuts the kernels take for a view range wide.
+// Orbits that come back well within a pixel of themselves are taken to be periodic.
+FractalShortcuts fractalShortcuts(double range)
+{
+	FractalShortcuts shortcuts;
+	shortcuts.bulbCheck = g_fractalBulbCheck;
+	shortcuts.periodicityCheck = g_fractalPeriodicityCheck;
+	shortcuts.periodTolerance = range / (g_kPixelsHoriz - 1) / 1024;
+	return shortcuts;
+}
+
+// Adds the iterations a task skipped to the view's totals. Done once per task so the counters are rarely contended.
+void addSkipped(const FractalSkipped& skipped)
+{
+	g_fractalBulbIterations.fetch_add(skipped.bulb, std::memory_order_relaxed);
+	g_fractalPeriodicIterations.fetch_add(skipped.periodic, std::memory_order_relaxed);
+}
+
+// Calculates the pixel colors for a region with Real numbers
+template<typename Real>
+void processRegionIn(const FractalView& view, TextureData& texture, size_t regionStartX, size_t regionStartY, size_t width, size_t height, const CancellationToken& token)
+{
+	size_t regionEndY = std::min(regionStartY + height, texture.size());
+	size_t regionEndX = std::min(regionStartX + width, texture[0].size());
+	if (regionEndX <= regionStartX)
+		return;
+	size_t rowLength = regionEndX - regionStartX;
+
+	// Convert from pixel coordinates (integers) to domain of the mandelbrot set 
+	// being calculated (complex numbers in range [minRe, maxRe]x[minIm, maxIm]).
+	// Pixels are offset from the center, which needs more precision than the offsets.
+	double range = view.range;
+
+	// The real parts are the same for every row, the kernel iterates a whole row at once
+	TaskArena& arena = ThreadPool::taskArena();
+	std::vector<Real, TaskArenaAllocator<Real>> rowReal(rowLength, Real(0), TaskArenaAllocator<Real>(arena));
+	for (size_t j = regionStartX; j < regionEndX; ++j)
+		rowReal[j - regionStartX] = toPrecision<Real>(view.centerRe + (static_cast<double>(j) / (g_kPixelsHoriz - 1) - 0.5) * range);
+
+	FractalShortcuts shortcuts = fractalShortcuts(range);
+	FractalSkipped skipped;
+	for (size_t i = regionStartY; i < regionEndY; ++i)
+	{
+		// The view has changed, this row is stale
+		if (token.isCancelled())
+			break;
+
+		Real img = toPrecision<Real>(view.centerIm + (static_cast<double>(i) / (g_kPixelsVert - 1) - 0.5) * range);
+		uint32_t* rowIterations = &g_fractalIterations[i][regionStartX];
+		FractalKernel::iterateRow(g_fractalKernel, rowReal.data(), img, rowLength, view.depth, rowIterations, shortcuts, skipped);
+		colorRow(texture, i, regionStartX, regionEndX, rowIterations, view.depth);
+	}
+	addSkipped(skipped);
+}
+
+// Calculates the pixel colors for a region as offsets from a reference orbit at the center of the view
+void processRegionPerturbed(const FractalView& view, TextureData& texture, const ReferenceOrbit& reference, size_t regionStartX, size_t regionStartY
+                           , size_t width, size_t height, const CancellationToken& token)
+{
+	size_t regionEndY = std::min(regionStartY + height, texture.size());
+	size_t regionEndX = std::min(regionStartX + width, texture[0].size());
+	if (regionEndX <= regionStartX)
+		return;
+	size_t rowLength = regionEndX - regionStartX;
+
+	// The offsets are as small as the view, so doubles hold them however deep it is
+	double range = view.range;
+	TaskArena& arena = ThreadPool::taskArena();
+	std::vector<double, TaskArenaAllocator<double>> rowDelta(rowLength, 0.0, TaskArenaAllocator<double>(arena));
+	for (size_t j = regionStartX; j < regionEndX; ++j)
+		rowDelta[j - regionStartX] = (static_cast<double>(j) / (g_kPixelsHoriz - 1) - 0.5) * range;
+
+	for (size_t i = regionStartY; i < regionEndY; ++i)
+	{
+		// The view has changed, this row is stale
+		if (token.isCancelled())
+			return;
+
+		double deltaIm = (static_cast<double>(i) / (g_kPixelsVert - 1) - 0.5) * range;
+		uint32_t* rowIterations = &g_fractalIterations[i][regionStartX];
+		reference.iterateRow(rowDelta.data(), deltaIm, rowLength, rowIterations);
+		colorRow(texture, i, regionStartX, regionEndX, rowIterations, view.depth);
+	}
+}
+
+// A pixel of the view, for calculating pixels that aren't next to each other
+struct Pixel {
+	uint32_t x;
+	uint32_t y;
+};
+
+using PixelList = std::vector<Pixel, TaskArenaAllocator<Pixel>>;
+
+// A region calculated a few pixels at a time. Every pixel of a column has the same real
+// part and every pixel of a row the same imaginary part, so they are worked out once for
+// the region. With a reference orbit they are offsets from it instead.
+template<typename Real>
+struct FractalRegion {
+	ThreadPoolT& threadPool;
+	const FractalView& view;
+	TextureData& texture;
+	const ReferenceOrbit* reference;
+	CancellationToken token;
+	size_t startX;
+	size_t startY;
+	// Pixels on a grid knownStep apart from the region's corner were calculated by an earlier pass,
+	// 0 if there wasn't one
+	size_t knownStep;
+	std::vector<Real, TaskArenaAllocator<Real>> re;
+	std::vector<Real, TaskArenaAllocator<Real>> im;
+};
+
+// Returns a region covering [startX, endX) x [startY, endY), allocated from the task's arena
+template<typename Real>
+FractalRegion<Real> makeRegion(ThreadPoolT& threadPool, const FractalView& view, TextureData& texture, size_t startX, size_t startY, size_t endX, size_t endY
+                              , const ReferenceOrbit* reference, size_t knownStep, const CancellationToken& token)
+{
+	double range = view.range;
+	TaskArena& arena = ThreadPool::taskArena();
+	FractalRegion<Real> region{ threadPool, view, texture, reference, token, startX, startY, knownStep
+	                          , { endX - startX, Real(0), TaskArenaAllocator<Real>(arena) }
+	                          , { endY - startY, Real(0), TaskArenaAllocator<Real>(arena) } };
+	for (size_t j = startX; j < endX; ++j) {
+		double offset = (static_cast<double>(j) / (g_kPixelsHoriz - 1) - 0.5) * range;
+		region.re[j - startX] = reference ? static_cast<Real>(offset) : toPrecision<Real>(view.centerRe + offset);
+	}
+	for (size_t i = startY; i < endY; ++i) {
+		double offset = (static_cast<double>(i) / (g_kPixelsVert - 1) - 0.5) * range;
+		region.im[i - startY] = reference ? static_cast<Real>(offset) : toPrecision<Real>(view.centerIm + offset);
+	}
+	return region;
+}
 
-			double alpha = 2 * static_cast<double>(iteration) / g_fractalRecursionDepth;
-			
-			g_textureData[i][j][0] = 0;
-			g_textureData[i][j][1] = diverges ? lerp(GLubyte{ 0 }, GLubyte{ 255 }, alpha) : 0;
-			g_textureData[i][j][2] = diverges ? lerp(GLubyte{ 0 }, GLubyte{ 255 }, alpha) : 0;
+// Adds a pixel to the list unless an earlier pass already calculated it. Steps are powers of two.
+template<typename Real>
+void addPixel(const FractalRegion<Real>& region, PixelList& pixels, size_t x, size_t y)
+{
+	if (region.knownStep == 0 || (((x - region.startX) | (y - region.startY)) & (region.knownStep - 1)) != 0)
+		pixels.push_back({ static_cast<uint32_t>(x), static_cast<uint32_t>(y) });
+}
+
+// Iterates pixel k at c = cr[k] + ci[k] * i. Only doubles are ever perturbed.
+template<typename Real>
+void iteratePoints(const FractalView& view, const ReferenceOrbit*, const Real* cr, const Real* ci, size_t count, uint32_t* iterations, FractalSkipped& skipped)
+{
+	FractalKernel::iteratePoints(g_fractalKernel, cr, ci, count, view.depth, iterations, fractalShortcuts(view.range), skipped);
+}
+
+// Perturbed pixels are iterated one at a time anyway
+void iteratePoints(const FractalView& view, const ReferenceOrbit* reference, const double* cr, const double* ci, size_t count, uint32_t* iterations, FractalSkipped& skipped)
+{
+	if (!reference) {
+		iteratePoints<double>(view, nullptr, cr, ci, count, iterations, skipped);
+		return;
+	}
+	for (size_t k = 0; k < count; ++k)
+		reference->iterateRow(cr + k, ci[k], 1, iterations + k);
+}
+
+// Iterates a whole row of a region at once, as processRegionIn does
+template<typename Real>
+void iterateRow(const FractalView& view, const ReferenceOrbit*, const Real* cr, Real ci, size_t count, uint32_t* iterations, FractalSkipped& skipped)
+{
+	FractalKernel::iterateRow(g_fractalKernel, cr, ci, count, view.depth, iterations, fractalShortcuts(view.range), skipped);
+}
+
+void iterateRow(const FractalView& view, const ReferenceOrbit* reference, const double* cr, double ci, size_t count, uint32_t* iterations, FractalSkipped& skipped)
+{
+	if (!reference) {
+		iterateRow<double>(view, nullptr, cr, ci, count, iterations, skipped);
+		return;
+	}
+	reference->iterateRow(cr, ci, count, iterations);
+}
+
+// Calculates the pixel colors for a list of pixels of a region. They are iterated
+// together so the kernels can fill their vectors even when no two share a row.
+// Stops early if the region's token is cancelled, which is checked every row's worth of pixels.
+template<typename Real>
+void processPixels(const FractalRegion<Real>& region, const PixelList& pixels)
+{
+	const size_t kPixelsPerCheck = 64;
+
+	size_t count = pixels.size();
+	if (count == 0)
+		return;
+
+	TaskArena& arena = ThreadPool::taskArena();
+	TaskArena::Marker marker = arena.mark();
+	std::vector<Real, TaskArenaAllocator<Real>> cr(count, Real(0), TaskArenaAllocator<Real>(arena));
+	std::vector<Real, TaskArenaAllocator<Real>> ci(count, Real(0), TaskArenaAllocator<Real>(arena));
+	std::vector<uint32_t, TaskArenaAllocator<uint32_t>> iterations(count, 0, TaskArenaAllocator<uint32_t>(arena));
+	for (size_t k = 0; k < count; ++k) {
+		cr[k] = region.re[pixels[k].x - region.startX];
+		ci[k] = region.im[pixels[k].y - region.startY];
+	}
+
+	FractalSkipped skipped;
+	for (size_t first = 0; first < count; first += kPixelsPerCheck) {
+		// The view has changed, these pixels are stale
+		if (region.token.isCancelled())
+			break;
+
+		size_t last = std::min(first + kPixelsPerCheck, count);
+		iteratePoints(region.view, region.reference, cr.data() + first, ci.data() + first, last - first, iterations.data() + first, skipped);
+		for (size_t k = first; k < last; ++k) {
+			uint32_t* pixelIterations = &g_fractalIterations[pixels[k].y][pixels[k].x];
+			*pixelIterations = iterations[k];
+			colorRow(region.texture, pixels[k].y, pixels[k].x, pixels[k].x + 1, pixelIterations, region.view.depth);
 		}
 	}
+	addSkipped(skipped);
+	arena.rewind(marker);
 }
 
-// Divides up the pixels of the fractal into regions, and submits them for processing on a threadpool
-void submitMandelbrot(ThreadPoolT& threadPool, GLuint texture, double zoomAmount)
+// Calculates the inside of the rectangle with corners (startX, startY) and (endX, endY),
+// whose border pixels have already been calculated. The set is connected, so a border
+// of one iteration count is taken to hold nothing but that count and the inside is filled
+// without iterating it. That misses filaments that slip between the border pixels, so the
+// result can differ from iterating every pixel. Other rectangles are split in four along a cross, and the quarters large
+// enough to be worth it are calculated as tasks of their own.
+template<typename Real>
+void subdivideRect(const FractalRegion<Real>& region, size_t startX, size_t startY, size_t endX, size_t endY)
 {
-	size_t regionHeight = g_kRegionHeight;
-	size_t regionWidth = g_kRegionWidth;
-	
-	// Submit regions to the WorkQueue
-	for (size_t i = 0; i < g_regionsVert; ++i) {
-		size_t regionStartY = i * regionHeight;
+	// Smaller rectangles are calculated pixel by pixel, or on the same task
+	const size_t kMinSubdivideSize = 16;
+	const size_t kMinTaskSize = 32;
+
+	if (region.token.isCancelled() || endX - startX < 2 || endY - startY < 2)
+		return;
+
+	uint32_t border = g_fractalIterations[startY][startX];
+	bool uniform = true;
+	for (size_t j = startX; j <= endX && uniform; ++j)
+		uniform = g_fractalIterations[startY][j] == border && g_fractalIterations[endY][j] == border;
+	for (size_t i = startY + 1; i < endY && uniform; ++i)
+		uniform = g_fractalIterations[i][startX] == border && g_fractalIterations[i][endX] == border;
+	if (uniform) {
+		for (size_t i = startY + 1; i < endY; ++i) {
+			std::fill(&g_fractalIterations[i][startX + 1], &g_fractalIterations[i][endX], border);
+			colorRow(region.texture, i, startX + 1, endX, &g_fractalIterations[i][startX + 1], region.view.depth);
+		}
+		return;
+	}
+
+	TaskArena& arena = ThreadPool::taskArena();
+	TaskArena::Marker marker = arena.mark();
+	PixelList pixels{ TaskArenaAllocator<Pixel>(arena) };
+	if (endX - startX <= kMinSubdivideSize || endY - startY <= kMinSubdivideSize) {
+		pixels.reserve((endX - startX - 1) * (endY - startY - 1));
+		for (size_t i = startY + 1; i < endY; ++i) {
+			for (size_t j = startX + 1; j < endX; ++j)
+				addPixel(region, pixels, j, i);
+		}
+		processPixels(region, pixels);
+		arena.rewind(marker);
+		return;
+	}
+
+	size_t middleX = (startX + endX) / 2;
+	size_t middleY = (startY + endY) / 2;
+	pixels.reserve((endX - startX - 1) + (endY - startY - 2));
+	for (size_t j = startX + 1; j < endX; ++j)
+		addPixel(region, pixels, j, middleY);
+	for (size_t i = startY + 1; i < endY; ++i) {
+		if (i != middleY)
+			addPixel(region, pixels, middleX, i);
+	}
+	processPixels(region, pixels);
+	arena.rewind(marker);
+
+	const size_t quarters[4][4] = {
+		{ startX, startY, middleX, middleY }, { middleX, startY, endX, middleY },
+		{ startX, middleY, middleX, endY }, { middleX, middleY, endX, endY }
+	};
+	auto subdivideQuarter = [&region, &quarters](size_t quarter) {
+		const size_t* rect = quarters[quarter];
+		subdivideRect(region, rect[0], rect[1], rect[2], rect[3]);
+	};
+	if (endX - startX < kMinTaskSize || endY - startY < kMinTaskSize) {
+		for (size_t quarter = 0; quarter < 4; ++quarter)
+			subdivideQuarter(quarter);
+		return;
+	}
+
+	// High priority so a thread waiting here finishes the quarters it has started,
+	// rather than starting other regions while it waits
+	region.threadPool.wait(region.threadPool.submitBatch(Priority::High, region.token, 4, subdivideQuarter));
+}
+
+// Calculates the pixels of a region on a grid step pixels apart from its corner, other than
+// those an earlier pass calculated. Each fills the step x step block to its lower right, so
+// a coarse pass covers the whole region. The pixels of the earlier pass are only colored, as
+// it drew into the other buffer. The last pass subdivides when that's turned on.
+template<typename Real>
+void processRegionPass(ThreadPoolT& threadPool, const FractalView& view, TextureData& texture, size_t regionStartX, size_t regionStartY, size_t width, size_t height
+                      , const ReferenceOrbit* reference, size_t step, size_t knownStep, const CancellationToken& token)
+{
+	size_t regionEndY = std::min(regionStartY + height, texture.size());
+	size_t regionEndX = std::min(regionStartX + width, texture[0].size());
+	if (regionEndX <= regionStartX || regionEndY <= regionStartY)
+		return;
+
+	FractalRegion<Real> region = makeRegion<Real>(threadPool, view, texture, regionStartX, regionStartY, regionEndX, regionEndY, reference, knownStep, token);
+	TaskArena& arena = ThreadPool::taskArena();
+	PixelList pixels{ TaskArenaAllocator<Pixel>(arena) };
+
+	if (step == 1 && g_fractalSubdivision) {
+		pixels.reserve(2 * (regionEndX - regionStartX + regionEndY - regionStartY));
+		for (size_t j = regionStartX; j < regionEndX; ++j) {
+			addPixel(region, pixels, j, regionStartY);
+			if (regionEndY - regionStartY > 1)
+				addPixel(region, pixels, j, regionEndY - 1);
+		}
+		for (size_t i = regionStartY + 1; i + 1 < regionEndY; ++i) {
+			addPixel(region, pixels, regionStartX, i);
+			if (regionEndX - regionStartX > 1)
+				addPixel(region, pixels, regionEndX - 1, i);
+		}
+		processPixels(region, pixels);
+		subdivideRect(region, regionStartX, regionStartY, regionEndX - 1, regionEndY - 1);
+		for (size_t i = regionStartY; knownStep != 0 && i < regionEndY; i += knownStep) {
+			for (size_t j = regionStartX; j < regionEndX; j += knownStep)
+				colorRow(texture, i, j, j + 1, &g_fractalIterations[i][j], view.depth);
+		}
+		return;
+	}
+
+	pixels.reserve(regionEndX - regionStartX);
+	for (size_t i = regionStartY; i < regionEndY; i += step)
+	{
+		// The view has changed, this row is stale
+		if (token.isCancelled())
+			return;
+
+		// Rows an earlier pass never touched are iterated whole
+		if (step == 1 && (knownStep == 0 || ((i - regionStartY) & (knownStep - 1)) != 0)) {
+			FractalSkipped skipped;
+			uint32_t* rowIterations = &g_fractalIterations[i][regionStartX];
+			iterateRow(view, reference, region.re.data(), region.im[i - regionStartY], regionEndX - regionStartX, rowIterations, skipped);
+			addSkipped(skipped);
+			colorRow(texture, i, regionStartX, regionEndX, rowIterations, view.depth);
+			continue;
+		}
+
+		pixels.clear();
+		for (size_t j = regionStartX; j < regionEndX; j += step)
+			addPixel(region, pixels, j, i);
+		processPixels(region, pixels);
+		if (step == 1) {
+			colorRow(texture, i, regionStartX, regionEndX, &g_fractalIterations[i][regionStartX], view.depth);
+			continue;
+		}
+
+		// Spread each pixel along its row, then copy the row down the rest of the blocks
+		for (size_t j = regionStartX; j < regionEndX; j += step) {
+			colorRow(texture, i, j, j + 1, &g_fractalIterations[i][j], view.depth);
+			std::fill(&texture[i][j], &texture[i][std::min(j + step, regionEndX)], texture[i][j]);
+		}
+		for (size_t y = i + 1; y < std::min(i + step, regionEndY); ++y)
+			std::copy(&texture[i][regionStartX], &texture[i][regionEndX], &texture[y][regionStartX]);
+	}
+}
+
+// Calculates a region in one pass, or in the given pass of a progressive view
+template<typename Real>
+void processRegionAs(ThreadPoolT& threadPool, const FractalView& view, TextureData& texture, size_t regionStartX, size_t regionStartY, size_t width, size_t height
+                    , const ReferenceOrbit* reference, size_t step, size_t knownStep, const CancellationToken& token)
+{
+	// Whole rows at a time are cheapest when every pixel is needed
+	if (step == 1 && knownStep == 0 && !g_fractalSubdivision) {
+		if (reference)
+			processRegionPerturbed(view, texture, *reference, regionStartX, regionStartY, width, height, token);
+		else
+			processRegionIn<Real>(view, texture, regionStartX, regionStartY, width, height, token);
+		return;
+	}
+	processRegionPass<Real>(threadPool, view, texture, regionStartX, regionStartY, width, height, reference, step, knownStep, token);
+}
+
+// Calculate the pixel colors for a region of the mandelbrot fractal.
+// Stops early if the token is cancelled, which is checked once per row.
+// Deep views are calculated with perturbation when given a reference orbit.
+// Only the pixels step apart that aren't knownStep apart are calculated.
+void processRegion(ThreadPoolT& threadPool, TextureData& texture, const FractalView& view, size_t regionStartX, size_t regionStartY
+                  , size_t width, size_t height, FractalPrecision precision
+                  , const ReferenceOrbit* reference, size_t step, size_t knownStep, const CancellationToken& token)
+{
+	if (reference) {
+		processRegionAs<double>(threadPool, view, texture, regionStartX, regionStartY, width, height, reference, step, knownStep, token);
+		return;
+	}
+
+	switch (precision)
+	{
+	case FractalPrecision::Float:
+		processRegionAs<float>(threadPool, view, texture, regionStartX, regionStartY, width, height, nullptr, step, knownStep, token);
+		break;
+	case FractalPrecision::Double:
+		processRegionAs<double>(threadPool, view, texture, regionStartX, regionStartY, width, height, nullptr, step, knownStep, token);
+		break;
+#if FRACTAL_HAS_QUAD
+	case FractalPrecision::Quad:
+		processRegionAs<__float128>(threadPool, view, texture, regionStartX, regionStartY, width, height, nullptr, step, knownStep, token);
+		break;
+#endif
+	default:
+		processRegionAs<DoubleDouble>(threadPool, view, texture, regionStartX, regionStartY, width, height, nullptr, step, knownStep, token);
+		break;
+	}
+}
+
+// A pass of a progressive view calculates the pixels on a grid step pixels apart
+// that the pass before didn't, so each step must divide the one before. Coarse
+// passes go ahead of any finer work still queued.
+struct FractalPass {
+	size_t step;
+	Priority priority;
+};
+
+const FractalPass g_kFractalPasses[] = { { 4, Priority::High }, { 2, Priority::Normal }, { 1, Priority::Low } };
+const size_t g_kNumFractalPasses = sizeof(g_kFractalPasses) / sizeof(g_kFractalPasses[0]);
+
+// What the passes of one view share
+struct FractalRender {
+	GLuint texture;
+	FractalView view;
+	FractalPrecision precision;
+	std::shared_ptr<const ReferenceOrbit> reference;
+	CancellationToken token;
+	std::chrono::high_resolution_clock::time_point start;
+	size_t numPasses;
+	Promise<void> done;
+};
+
+// Submits a pass over every region as a single batch. The thread that finishes it
+// shows the buffer the pass drew into and queues the next pass, or completes the view.
+void submitPass(ThreadPoolT& threadPool, std::shared_ptr<FractalRender> render, size_t pass)
+{
+	FractalPass current = render->numPasses > 1 ? g_kFractalPasses[pass] : FractalPass{ 1, Priority::Normal };
+	size_t knownStep = pass > 0 ? g_kFractalPasses[pass - 1].step : 0;
+	size_t drawTexture;
+	{
+		std::lock_guard<std::mutex> lock(g_fractalPassMutex);
+		drawTexture = render->numPasses > 1 ? 1 - g_fractalShownTexture : g_fractalShownTexture;
+	}
+	TextureData* texture = &g_textureData[drawTexture];
+	BatchFuture batch = threadPool.submitBatch(current.priority, render->token, g_regionsHoriz * g_regionsVert,
+	                                           [&threadPool, render, texture, current, knownStep](size_t workItemIdx) {
+		size_t i = workItemIdx / g_regionsHoriz;
+		size_t j = workItemIdx % g_regionsHoriz;
+		size_t regionStartY = i * g_kRegionHeight;
+		size_t regionStartX = j * g_kRegionWidth;
+		size_t regionHeight = g_kRegionHeight;
+		size_t regionWidth = g_kRegionWidth;
 
 		// Handle uneven regions by assigning more work to regions in the last row
 		if ((i == g_regionsVert - 1) && (regionStartY + regionHeight < g_kPixelsVert))
 			regionHeight = g_kPixelsVert - regionStartY;
 
-		for (size_t j = 0; j < g_regionsHoriz; ++j) {
-			size_t regionStartX = j * regionWidth;
+		// Handle uneven regions by assigning more work to regions in the last column
+		if ((j == g_regionsHoriz - 1) && (regionStartX + regionWidth < g_kPixelsHoriz))
+			regionWidth = g_kPixelsHoriz - regionStartX;
 
-			// Handle uneven regions by assigning more work to regions in the last column
-			if ((j == g_regionsHoriz - 1) && (regionStartX + regionWidth < g_kPixelsHoriz))
-				regionWidth = g_kPixelsHoriz - regionStartX;
+		ThreadPool::setTaskLabel("Region %zu,%zu step %zu", j, i, current.step);
+		processRegion(threadPool, *texture, render->view, regionStartX, regionStartY, regionWidth, regionHeight
+		             , render->precision, render->reference.get(), current.step, knownStep, render->token);
+	});
 
-			std::future<void> future = threadPool.submit(processRegion, texture, regionStartX, regionStartY, regionWidth, regionHeight);
+	threadPool.then(std::move(batch), [&threadPool, render, pass, drawTexture](BatchFuture) {
+		// The texture and the timings belong to the view that replaced this one
+		if (render->token.isCancelled()) {
+			render->done.setValue();
+			return;
+		}
 
-			size_t workItemIdx = i * g_regionsHoriz + j;
-			g_futures[workItemIdx] = std::move(future);
+		if (pass == 0) {
+			using namespace std::chrono;
+			g_fractalFirstPassTime = duration_cast<nanoseconds>(high_resolution_clock::now() - render->start).count() / 1000000000.0;
+		}
+		if (render->numPasses > 1) {
+			std::lock_guard<std::mutex> lock(g_fractalPassMutex);
+			g_fractalShownTexture = drawTexture;
+			g_fractalPassReady = true;
 		}
+		if (pass + 1 < render->numPasses)
+			submitPass(threadPool, render, pass + 1);
+		else
+			render->done.setValue();
+	});
+}
+
+// Divides up the pixels of the fractal into regions, and submits them for processing on a threadpool
+// as a batch per pass. Progressive views start with a coarse pass that is quick to show, and each
+// pass after it reuses the pixels of the one before. Returns a future that becomes ready when the
+// last pass has finished. Regions are skipped once the token is cancelled.
+Future<void> submitMandelbrot(ThreadPoolT& threadPool, GLuint texture, const FractalView& view, FractalPrecision precision
+                             , std::shared_ptr<const ReferenceOrbit> reference, CancellationToken token
+                             , std::chrono::high_resolution_clock::time_point start)
+{
+	auto render = std::make_shared<FractalRender>();
+	render->texture = texture;
+	render->view = view;
+	render->precision = precision;
+	render->reference = std::move(reference);
+	render->token = std::move(token);
+	render->start = start;
+	render->numPasses = g_fractalProgressive ? g_kNumFractalPasses : 1;
+	Future<void> result = render->done.getFuture();
+	submitPass(threadPool, render, 0);
+	return result;
+}
+
+// Formats a latency in microseconds. The histogram's buckets are up to an eighth
+// of their start wide, so latencies from 10us are shown in whole microseconds.
+std::string latencyString(uint64_t ns)
+{
+	double us = ns / 1000.0;
+	return toString(us, us < 10 ? 1 : 0) + "us";
+}
+
+// Draws a utilization bar for each thread of the pool, and the time tasks spent queued
+void drawThreadStats(NVGcontext* nvgCtx, const ThreadPoolStats& stats, float x, float y)
+{
+	const float kBarWidth = 200;
+	const float kBarHeight = 14;
+
+	WorkerStats total = stats.total();
+	std::string latency = "Queue Latency p50: " + latencyString(total.queueLatency.percentile(0.5))
+	                    + "  p99: " + latencyString(total.queueLatency.percentile(0.99));
+	nvgText(nvgCtx, x, y, latency.c_str(), nullptr);
+	y += 30;
+
+	nvgFontSize(nvgCtx, 16);
+	for (size_t i = 0; i < stats.workers.size(); ++i) {
+		float utilization = static_cast<float>(stats.workers[i].utilization());
+
+		nvgBeginPath(nvgCtx);
+		nvgRect(nvgCtx, x, y, kBarWidth, kBarHeight);
+		nvgFillColor(nvgCtx, nvgRGBA(60, 60, 60, 200));
+		nvgFill(nvgCtx);
+
+		nvgBeginPath(nvgCtx);
+		nvgRect(nvgCtx, x, y, kBarWidth * utilization, kBarHeight);
+		nvgFillColor(nvgCtx, nvgRGBA(0, 200, 200, 255));
+		nvgFill(nvgCtx);
+
+		nvgFillColor(nvgCtx, nvgRGBA(255, 255, 255, 255));
+		nvgText(nvgCtx, x + kBarWidth + 8, y, ("Thread " + toString(i + 1) + ": " + toString(utilization * 100, 0) + "%").c_str(), nullptr);
+		y += kBarHeight + 4;
+	}
+	nvgFontSize(nvgCtx, 24);
+}
+
+// Starts calculating the fractal for the current view. The calculation time is
+// recorded by the pool as soon as the last region finishes, rather than the next
+// time the render loop checks.
+Future<double> renderMandelbrot(ThreadPoolT& threadPool, GLuint texture)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	auto elapsed = [start](Future<void>) {
+		using namespace std::chrono;
+		return duration_cast<nanoseconds>(high_resolution_clock::now() - start).count() / 1000000000.0;
+	};
+
+	// Regions of an old view are dropped when threadPool.cancelAll is called
+	CancellationToken token = threadPool.getCancellationToken();
+
+	// Scrolling from here on only changes the next view
+	FractalView view;
+	view.centerRe = g_fractalCenterRe;
+	view.centerIm = g_fractalCenterIm;
+	view.range = g_kFractalDomainRange / g_fractalZoomAmount;
+	view.depth = static_cast<uint32_t>(iterationDepth(g_fractalZoomAmount));
+	g_fractalRecursionDepth = view.depth;
+
+	// The cheapest numbers that can still tell pixels apart at this zoom
+	double pixelStep = view.range / (g_kPixelsHoriz - 1);
+	double magnitude = std::max(std::abs(static_cast<double>(view.centerRe)), std::abs(static_cast<double>(view.centerIm))) + view.range / 2;
+	FractalPrecision precision = FractalKernel::choosePrecision(pixelStep, magnitude);
+	g_fractalPrecision = precision;
+	g_fractalPerturbing = g_fractalPerturbation && precision > FractalPrecision::Double;
+	g_fractalBulbIterations = 0;
+	g_fractalPeriodicIterations = 0;
+	g_fractalFirstPassTime = 0;
+	if (!g_fractalPerturbing) {
+		return threadPool.then(submitMandelbrot(threadPool, texture, view, precision, nullptr, token, start), elapsed);
 	}
+
+	// Views that need more than doubles iterate every pixel in doubles as an offset from
+	// one reference orbit at the center. It is calculated first on its own task, and the
+	// regions are queued by the thread that finishes it.
+	auto reference = threadPool.submit(Priority::High, token, [view, pixelStep]() {
+		ThreadPool::setTaskLabel("Reference orbit");
+		auto orbit = std::make_shared<const ReferenceOrbit>(view.centerRe, view.centerIm, view.depth, view.range * M_SQRT1_2, pixelStep);
+		g_fractalSeriesIterations = orbit->seriesIterations();
+		return orbit;
+	});
+
+	auto timer = std::make_shared<Promise<double>>();
+	Future<double> result = timer->getFuture();
+	threadPool.then(std::move(reference), [&threadPool, texture, view, precision, token, start, timer, elapsed](Future<std::shared_ptr<const ReferenceOrbit>> orbit) {
+		threadPool.then(submitMandelbrot(threadPool, texture, view, precision, orbit.get(), token, start), [timer, elapsed](Future<void> passes) {
+			timer->setValue(elapsed(std::move(passes)));
+		});
+	});
+	return result;
 }
 
 int main()
 {
 	// Read settings from config file
 	size_t numThreads = 0;
+	std::string scheduler;
+	std::string queueType;
+	std::string affinity;
+	bool numaAware = false;
+	bool collectStats = false;
+	IdlePolicy idlePolicy;
+	PriorityPolicy priorityPolicy;
+	size_t lowMaxWaitMs = 50;
+	size_t maxBulkPop = 1;
+	std::string kernel = "auto";
 	INIParser iniParser;
 	iniParser.LoadIniFile("Assets/Settings/config.ini");
 	iniParser.GetIntValue("Threading", "regionsHorizontal", g_regionsHoriz);
 	iniParser.GetIntValue("Threading", "regionsVertical", g_regionsVert);
 	iniParser.GetIntValue("Threading", "numThreads", numThreads);
+	iniParser.GetStringValue("Threading", "scheduler", scheduler);
+	iniParser.GetStringValue("Threading", "queue", queueType);
+	iniParser.GetIntValue("Threading", "bulkPop", maxBulkPop);
+	iniParser.GetIntValue("Threading", "spinCount", idlePolicy.spinCount);
+	iniParser.GetIntValue("Threading", "yieldCount", idlePolicy.yieldCount);
+	iniParser.GetIntValue("Threading", "highBurst", priorityPolicy.highBurst);
+	iniParser.GetIntValue("Threading", "lowMaxWait", lowMaxWaitMs);
+	iniParser.GetStringValue("Threading", "affinity", affinity);
+	iniParser.GetBoolValue("Threading", "numa", numaAware);
+	iniParser.GetBoolValue("Threading", "stats", collectStats);
+	iniParser.GetStringValue("Threading", "traceFile", g_traceFile);
 	iniParser.GetIntValue("Fractal", "initialIterationDepth", g_fractalInitialDepth);
 	iniParser.GetIntValue("Fractal", "iterationIncrement", g_fractalDepthIncrement);
 	iniParser.GetFloatValue("Fractal", "zoomSensitivity", g_fractalZoomSensitivity);
+	iniParser.GetStringValue("Fractal", "kernel", kernel);
+	iniParser.GetBoolValue("Fractal", "perturbation", g_fractalPerturbation);
+	iniParser.GetBoolValue("Fractal", "bulbCheck", g_fractalBulbCheck);
+	iniParser.GetBoolValue("Fractal", "periodicityCheck", g_fractalPeriodicityCheck);
+	iniParser.GetBoolValue("Fractal", "subdivision", g_fractalSubdivision);
+	iniParser.GetBoolValue("Fractal", "progressive", g_fractalProgressive);
+	if (!FractalKernel::parse(kernel, g_fractalKernel) || !FractalKernel::isSupported(g_fractalKernel)) {
+		std::cerr << "Fractal kernel \"" << kernel << "\" isn't available, using "
+		          << FractalKernel::name(FractalKernel::best()) << std::endl;
+		g_fractalKernel = FractalKernel::best();
+	}
 	
 	// Setup the thread pool
-	g_futures = std::vector<std::future<void>>{ g_regionsHoriz * g_regionsVert };
 	ThreadPoolT threadPool;
 	if (numThreads > 0) {
 		threadPool.setNumThreads(numThreads);
 	}
+	if (scheduler == "workStealing") {
+		threadPool.setSchedulerMode(SchedulerMode::WorkStealing);
+	}
+	if (queueType == "lockFree") {
+		threadPool.setQueueType(QueueType::LockFree);
+	}
+	threadPool.setMaxBulkPop(maxBulkPop);
+	threadPool.setIdlePolicy(idlePolicy);
+	priorityPolicy.lowMaxWait = std::chrono::milliseconds(lowMaxWaitMs);
+	threadPool.setPriorityPolicy(priorityPolicy);
+	std::vector<unsigned int> affinityCpus;
+	if (affinity == "compact") {
+		threadPool.setAffinityPolicy(AffinityPolicy::Compact);
+	}
+	else if (affinity == "scatter") {
+		threadPool.setAffinityPolicy(AffinityPolicy::Scatter);
+	}
+	else if (affinity == "physicalCores") {
+		threadPool.setAffinityPolicy(AffinityPolicy::PhysicalCores);
+	}
+	else if (CpuTopology::parseCpuList(affinity, affinityCpus)) {
+		threadPool.setAffinityCpus(affinityCpus);
+	}
+	threadPool.setNumaAware(numaAware);
+	threadPool.setCollectStats(collectStats);
+	if (!g_traceFile.empty()) {
+		threadPool.setTracing(true);
+		threadPool.setTraceFile(g_traceFile);
+	}
 
 	// Do boilerplate initialization
 	GLFWwindow* window;
@@ -391,12 +1082,15 @@ int main()
 	init(window, nvgCtx, program, VAO, texture);
 
 	// Starts the mandelbrot processing
-	static bool s_fractalTimerRunning = true;
 	using namespace std::chrono;
 	double fractalTime = -1;
+	// Set from a render request until the old view has stopped and the new one is started
+	bool renderPending = false;
+	ThreadPoolStats lastStats;
+	ThreadPoolStats threadStats;
+	auto lastStatsTime = high_resolution_clock::now();
 	threadPool.start();
-	auto start = high_resolution_clock::now();
-	submitMandelbrot(threadPool, texture, g_fractalZoomAmount);
+	g_fractalTimer = renderMandelbrot(threadPool, texture);
 
 	// Render loop
 	while (!glfwWindowShouldClose(window))
@@ -413,18 +1107,27 @@ int main()
 		// Updates the mandelbrot texture on the CPU / GPU
 		if (g_fractalRenderRequest) {
 
-			threadPool.clearWork();
-			s_fractalTimerRunning = true;
-			start = high_resolution_clock::now();
-			submitMandelbrot(threadPool, texture, g_fractalZoomAmount);
+			// Stop work on the old view. Regions that are already running stop at their next row.
+			threadPool.cancelAll();
+			renderPending = true;
 			g_fractalRenderRequest = false;
 		}
-		updateTexture(texture, 0, 0, g_kPixelsHoriz, g_kPixelsVert);
+		// The new view starts once every region of the old one has stopped, so none of them
+		// write over its pixels, including those its later passes reuse
+		if (renderPending && (!g_fractalTimer.valid() || isReady(g_fractalTimer))) {
+			g_fractalTimer = renderMandelbrot(threadPool, texture);
+			renderPending = false;
+		}
+		// Views in a single pass are uploaded every frame to show their progress, progressive
+		// views once each pass finishes. The lock keeps the next pass out of the shown buffer.
+		if (!g_fractalProgressive || g_fractalPassReady.exchange(false)) {
+			std::lock_guard<std::mutex> lock(g_fractalPassMutex);
+			updateTexture(texture, g_textureData[g_fractalShownTexture], 0, 0, g_kPixelsHoriz, g_kPixelsVert);
+		}
 
-		// Checks for mandelbrot completion and records the time taken to calculate
-		if (s_fractalTimerRunning && futuresReady(g_futures)) {
-			fractalTime = duration_cast<nanoseconds>(high_resolution_clock::now() - start).count() / 1000000000.0;
-			s_fractalTimerRunning = false;
+		// Checks for mandelbrot completion and shows the time taken to calculate
+		if (!renderPending && isReady(g_fractalTimer)) {
+			fractalTime = g_fractalTimer.get();
 		}
 
 		// Setup camera
@@ -440,18 +1143,59 @@ int main()
 		glDrawElements(GL_TRIANGLES, g_kIdxArraySize, GL_UNSIGNED_INT, BUFFER_OFFSET(0));
 		glBindVertexArray(0);
 
+		// Writes the tasks traced since the last snapshot, e.g. trace.json to trace.1.json
+		if (g_traceRequest) {
+			if (threadPool.isTracing()) {
+				std::string path = g_traceFile;
+				size_t extension = path.find_last_of('.');
+				path.insert(extension == std::string::npos ? path.size() : extension, "." + toString(++g_traceSnapshots));
+				if (!threadPool.writeTrace(path)) {
+					std::cerr << "Failed to write trace file " << path << std::endl;
+				}
+			}
+			g_traceRequest = false;
+		}
+
+		// Thread stats are shown for the last interval rather than since the start
+		if (threadPool.isCollectingStats() && high_resolution_clock::now() - lastStatsTime >= g_kStatsInterval) {
+			ThreadPoolStats stats = threadPool.snapshotStats();
+			threadStats = stats.since(lastStats);
+			lastStats = std::move(stats);
+			lastStatsTime = high_resolution_clock::now();
+		}
+
 		// Draw fractal stats
-		if (fractalTime > 0) {
+		if (fractalTime > 0 || threadPool.isCollectingStats()) {
 			nvgBeginFrame(nvgCtx, winWidth, winHeight, pxRatio);
 
 			nvgFontFace(nvgCtx, "sans");
 			nvgFontSize(nvgCtx, 24);
 			nvgFillColor(nvgCtx, nvgRGBA(255, 255, 255, 255));
 			nvgTextAlign(nvgCtx, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
-			nvgText(nvgCtx, 10, 10, ("Fractal Calc Time: " + toString(fractalTime, 9)).c_str(), nullptr);
-			nvgText(nvgCtx, 10, 40, ("Fractal Iteration Depth: " + toString(g_fractalRecursionDepth)).c_str(), nullptr);
-			double range = g_kFractalDomainRange / g_fractalZoomAmount;
-			nvgText(nvgCtx, 10, 70, ("Fractal Domain Size: " + toString(range, 20)).c_str(), nullptr);
+			if (fractalTime > 0) {
+				std::string calcTime = "Fractal Calc Time: " + toString(fractalTime, 9);
+				if (g_fractalProgressive) {
+					calcTime += ", First Pass: " + toString(g_fractalFirstPassTime.load(), 9);
+				}
+				nvgText(nvgCtx, 10, 10, calcTime.c_str(), nullptr);
+				nvgText(nvgCtx, 10, 40, ("Fractal Iteration Depth: " + toString(g_fractalRecursionDepth)).c_str(), nullptr);
+				double range = g_kFractalDomainRange / g_fractalZoomAmount;
+				nvgText(nvgCtx, 10, 70, ("Fractal Domain Size: " + toString(range, 20)).c_str(), nullptr);
+				if (g_fractalPerturbing) {
+					nvgText(nvgCtx, 10, 100, ("Fractal Kernel: Perturbation, series skips " + toString(g_fractalSeriesIterations.load())).c_str(), nullptr);
+				}
+				else {
+					// Only float and double have SIMD kernels
+					bool simd = g_fractalPrecision == FractalPrecision::Float || g_fractalPrecision == FractalPrecision::Double;
+					std::string kernelName = FractalKernel::name(simd ? g_fractalKernel : FractalKernelType::Scalar);
+					nvgText(nvgCtx, 10, 100, ("Fractal Kernel: " + kernelName + ", " + FractalKernel::name(g_fractalPrecision)).c_str(), nullptr);
+					nvgText(nvgCtx, 10, 130, ("Skipped Iterations: bulbs " + toString(g_fractalBulbIterations.load())
+					                        + ", periodic " + toString(g_fractalPeriodicIterations.load())).c_str(), nullptr);
+				}
+			}
+			if (threadPool.isCollectingStats()) {
+				drawThreadStats(nvgCtx, threadStats, 10, 160);
+			}
 
 			nvgEndFrame(nvgCtx);
 		}
@@ -460,6 +1204,8 @@ int main()
 		glfwPollEvents();
 	}
 
+	// exit doesn't run destructors, so stop the pool here to finish writing the trace
+	threadPool.stop();
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	exit(EXIT_SUCCESS);